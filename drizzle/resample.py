@@ -2,11 +2,32 @@
 The `drizzle` module defines the `Drizzle` class, for combining input
 images into a single output image using the drizzle algorithm.
 """
+import itertools
+import json
+import multiprocessing
+import os
+import shutil
+import weakref
+from collections import OrderedDict, deque
+from collections.abc import Mapping
+from concurrent.futures import ProcessPoolExecutor, ThreadPoolExecutor
+from multiprocessing import shared_memory
+
 import numpy as np
 
 from drizzle import cdrizzle
 
-__all__ = ["Drizzle", "blot_image"]
+__all__ = [
+    "CancelledError",
+    "Drizzle",
+    "OverlapMatrix",
+    "ParallelDrizzle",
+    "PreparedPixmap",
+    "TiledDrizzle",
+    "blot_image",
+    "drizzle_adjoint",
+    "schedule_tiles",
+]
 
 SUPPORTED_DRIZZLE_KERNELS = [
     "square",
@@ -19,6 +40,65 @@ SUPPORTED_DRIZZLE_KERNELS = [
 
 CTX_PLANE_BITS = 32
 
+# types of input images and weight maps read by the C extension without
+# conversion; other types are converted to the first one:
+INPUT_DTYPES = (np.float32, np.float64, np.int16, np.uint16)
+
+# types of pixel maps: single precision halves their size at the cost of
+# about 1e-3 pixel rounding error in coordinates of order 1e4:
+PIXMAP_DTYPES = (np.float64, np.float32)
+
+CHECKPOINT_VERSION = 1
+
+
+class PreparedPixmap(cdrizzle.PreparedPixmap):
+    """
+    A pixel map together with what is computed from it before drizzling:
+    the section of the input image where the map is valid, the range of
+    valid pixels of each row, and the outline of the input image clipped to
+    the output grid (for the last few output grids, kernels and input
+    sections used). Pass it instead of the pixel map to
+    :py:meth:`Drizzle.add_image` to drizzle several images (e.g., science
+    and variance arrays, or onto different outputs) with the same pixel map
+    without repeating this work.
+
+    Parameters
+    ----------
+    pixmap : 3D array
+        Pixel map, as for :py:meth:`Drizzle.add_image`. It is referenced,
+        not copied, and must not be modified afterwards.
+
+    pixmap_step : int, optional
+        Spacing of the nodes of a coarse pixel map, as for
+        :py:meth:`Drizzle.add_image`.
+
+    Attributes
+    ----------
+    pixmap : numpy.ndarray
+        The pixel map.
+
+    pixmap_step : int
+        Spacing of the nodes of the pixel map in input pixels.
+
+    affine : tuple
+        Least-squares affine fit ``((a, b, c), (d, e, f))`` of the pixel map,
+        ``x_out = a * x + b * y + c`` and ``y_out = d * x + e * y + f``.
+
+    affine_residual : float
+        Largest deviation of the pixel map from ``affine``, in output pixels.
+
+    row_spans : numpy.ndarray, None
+        First and last columns of each row with a finite pixel map (``[0,
+        -1]`` for rows without any), or `None` for coarse pixel maps.
+
+    """
+
+    def __init__(self, pixmap, pixmap_step=1):
+        super().__init__(_as_input_array(pixmap, *PIXMAP_DTYPES), pixmap_step)
+
+
+CancelledError = cdrizzle.CancelledError
+
 
 class Drizzle:
     """
@@ -167,7 +247,8 @@ class Drizzle:
 
     def __init__(self, kernel="square", fillval=None, out_shape=None,
                  out_img=None, out_wht=None, out_ctx=None, exptime=0.0,
-                 begin_ctx_id=0, max_ctx_id=None, disable_ctx=False):
+                 begin_ctx_id=0, max_ctx_id=None, disable_ctx=False,
+                 out_origin=(0, 0), mosaic_shape=None, mosaic_origin=(0, 0)):
         """
         kernel: str, optional
             The name of the kernel used to combine the input. The choice of
@@ -185,6 +266,12 @@ class Drizzle:
             of input images). This parameter is helpful when neither
             ``out_img``, ``out_wht``, nor ``out_ctx`` images are provided.
 
+            A three-element shape ``(Nlambda, Ny, Nx)`` creates spectral
+            cubes. Cubes can only be drizzled with the "square" kernel and
+            require pixel maps with a third (wavelength) component. See
+            :py:meth:`add_image`. The context array of a cube has one extra
+            leading dimension for context planes, just as for images.
+
         fillval: float, None, str, optional
             The value of output pixels that did not have contributions from
             input images' pixels. When ``fillval`` is either `None` or
@@ -239,16 +326,47 @@ class Drizzle:
             to `True`, parameters ``out_ctx``, ``begin_ctx_id``, and
             ``max_ctx_id`` will be ignored.
 
+        out_origin : tuple of int, optional
+            Coordinates ``(x0, y0)``, in the frame of the pixel maps, of the
+            first pixel of the output images. Pixel maps are interpreted as
+            coordinates in a larger mosaic of which the output images are a
+            tile starting at ``(x0, y0)``: a pixel map value ``(x, y)``
+            falls on output pixel ``(x - x0, y - y0)``. This allows the same
+            pixel maps to be used to drizzle onto any tile of a mosaic without
+            shifting (copying) them. It requires the shape of the output
+            images: when it is derived from the pixel map of the first image
+            (see :py:meth:`add_image`), the origin is set to the smallest
+            coordinates of that pixel map.
+
+        mosaic_shape : tuple, None, optional
+            Shape ``(Ny, Nx)`` of the mosaic of which the output images are
+            the tile at ``out_origin``. Input pixels are then selected as
+            when drizzling onto the whole mosaic: pixels that map just
+            outside the tile but inside the mosaic contribute to the edge
+            pixels of the tile, so that tiles add up to the mosaic. When
+            `None`, only input pixels that map inside the output images are
+            drizzled.
+
+        mosaic_origin : tuple of int, optional
+            Pixel map coordinates ``(x0, y0)`` of the first pixel of the
+            mosaic. Ignored when ``mosaic_shape`` is `None`.
+
         """
         self._disable_ctx = disable_ctx
+        self._out_origin = (int(out_origin[0]), int(out_origin[1]))
+        self._mosaic = _mosaic_extent(mosaic_shape, mosaic_origin)
+        self._engine = None
+        self._engine_outputs = ()
 
         if disable_ctx:
             self._ctx_id = None
+            self._begin_ctx_id = None
             self._max_ctx_id = None
         else:
             if begin_ctx_id < 0:
                 raise ValueError("Invalid context image ID")
             self._ctx_id = begin_ctx_id  # the ID of the *last* image to be resampled
+            self._begin_ctx_id = begin_ctx_id
             if max_ctx_id is None:
                 max_ctx_id = begin_ctx_id
             elif max_ctx_id < begin_ctx_id:
@@ -314,12 +432,32 @@ class Drizzle:
             out_wht = np.asarray(out_wht, dtype=np.float32)
             shapes.add(out_wht.shape)
 
+        # output images are either 2D images or 3D spectral cubes:
+        if out_shape is not None:
+            img_ndim = len(out_shape)
+        elif out_img is not None:
+            img_ndim = out_img.ndim
+        elif out_wht is not None:
+            img_ndim = out_wht.ndim
+        else:
+            img_ndim = 2
+
+        if img_ndim not in [2, 3]:
+            raise ValueError("Output images must be either 2D or 3D arrays.")
+
         if out_ctx is not None:
             out_ctx = np.asarray(out_ctx, dtype=np.int32)
-            if out_ctx.ndim == 2:
-                out_ctx = out_ctx[None, :, :]
-            elif out_ctx.ndim != 3:
-                raise ValueError("'out_ctx' must be either a 2D or 3D array.")
+            if out_ctx.ndim == img_ndim:
+                out_ctx = out_ctx[None, ...]
+            elif out_ctx.ndim != img_ndim + 1:
+                if img_ndim == 2:
+                    raise ValueError(
+                        "'out_ctx' must be either a 2D or 3D array."
+                    )
+                raise ValueError(
+                    "'out_ctx' must be either a 3D or 4D array for spectral "
+                    "cubes."
+                )
             shapes.add(out_ctx.shape[1:])
 
         if out_shape is not None:
@@ -355,6 +493,11 @@ class Drizzle:
         """Resampling kernel."""
         return self._kernel
 
+    @property
+    def out_origin(self):
+        """Pixel map coordinates ``(x0, y0)`` of the first output pixel."""
+        return self._out_origin
+
     @property
     def ctx_id(self):
         """Context image "ID" (0-based ) of the next image to be resampled."""
@@ -422,6 +565,48 @@ class Drizzle:
         else:
             self._out_img = out_img
 
+    def _get_engine(self):
+        """
+        Return the C drizzle engine bound to the current output arrays,
+        binding it again when the arrays have been replaced (e.g., when
+        context planes were added).
+
+        """
+        outputs = (self._out_img, self._out_wht, self._out_ctx)
+        if (self._engine is not None and
+                all(a is b for a, b in zip(outputs, self._engine_outputs))):
+            return self._engine
+
+        # the engine updates outputs in place, whatever their strides (e.g.,
+        # views of a subarray or of a plane of a cube):
+        self._out_img = np.require(self._out_img, np.float32, ["A", "W"])
+        self._out_wht = np.require(self._out_wht, np.float32, ["A", "W"])
+        if self._out_ctx is not None:
+            self._out_ctx = np.require(self._out_ctx, np.int32, ["A", "W"])
+        outputs = (self._out_img, self._out_wht, self._out_ctx)
+
+        if self._engine is None:
+            self._engine = cdrizzle.DrizzleEngine(
+                *outputs,
+                kernel=self._kernel,
+                fillstr=self._fillval,
+            )
+        else:
+            self._engine.set_outputs(*outputs)
+        self._engine_outputs = outputs
+        return self._engine
+
+    def _ensure_ctx_planes(self, last_id):
+        """
+        Add planes to the context image, when needed, so that it holds the
+        bit of context ID ``last_id``.
+        """
+        nplanes = last_id // CTX_PLANE_BITS + 1
+        depth = self._out_ctx.shape[0]
+        if nplanes > depth:
+            planes = np.zeros((nplanes - depth, ) + self._out_shape, np.int32)
+            self._out_ctx = np.append(self._out_ctx, planes, axis=0)
+
     def _increment_ctx_id(self):
         """
         Returns a pair of the *current* plane number and bit number in that
@@ -432,12 +617,8 @@ class Drizzle:
             return None, 0
 
         self._plane_no = self._ctx_id // CTX_PLANE_BITS
-        depth = self._out_ctx.shape[0]
-
-        if self._plane_no >= depth:
-            # Add a new plane to the context image if planeid overflows
-            plane = np.zeros((1, ) + self._out_shape, np.int32)
-            self._out_ctx = np.append(self._out_ctx, plane, axis=0)
+        # Add a new plane to the context image if planeid overflows
+        self._ensure_ctx_planes(self._ctx_id)
 
         plane_info = (self._plane_no, self._ctx_id % CTX_PLANE_BITS)
         # increment ID for the *next* image to be added:
@@ -447,7 +628,8 @@ class Drizzle:
 
     def add_image(self, data, exptime, pixmap, scale=1.0,
                   weight_map=None, wht_scale=1.0, pixfrac=1.0, in_units='cps',
-                  xmin=None, xmax=None, ymin=None, ymax=None):
+                  xmin=None, xmax=None, ymin=None, ymax=None, progress=None,
+                  cancel=None, pixmap_step=1, pixmap_affine=None):
         """
         Resample and add an image to the cumulative output image. Also, update
         output total weight image and context images.
@@ -456,18 +638,37 @@ class Drizzle:
         ----------
         data : 2D numpy.ndarray
             A 2D numpy array containing the input image to be drizzled.
+            Arrays of ``float32``, ``float64``, ``int16`` or ``uint16``
+            type (see ``INPUT_DTYPES``), in either byte order, are read
+            without conversion; other types are converted to ``float32``.
 
         exptime : float
             The exposure time of the input image, a positive number. The
             exposure time is used to scale the image if the units are counts.
 
-        pixmap : 3D array
+        pixmap : 3D array, PreparedPixmap
             A mapping from input image (``data``) coordinates to resampled
             (``out_img``) coordinates. ``pixmap`` must be an array of shape
             ``(Ny, Nx, 2)`` where ``(Ny, Nx)`` is the shape of the input image.
             ``pixmap[..., 0]`` forms a 2D array of X-coordinates of input
             pixels in the ouput frame and ``pixmap[..., 1]`` forms a 2D array of
             Y-coordinates of input pixels in the ouput coordinate frame.
+            Pixel maps of type ``numpy.float32`` are used as they are, which
+            halves their memory footprint; other types are converted to
+            ``numpy.float64``. Coordinates are always computed in double
+            precision from the stored values.
+
+            A `PreparedPixmap` may be passed instead of the array when the
+            same pixel map is used for several images. Its ``pixmap_step``
+            is then used by default.
+
+            When drizzling onto a spectral cube, ``pixmap`` must have shape
+            ``(Ny, Nx, 3)`` with ``pixmap[..., 2]`` holding the (fractional)
+            wavelength plane index of input pixel centers in the output
+            cube. The flux of each input pixel is split among cube planes in
+            proportion to the overlap of the pixel's wavelength extent with
+            each plane, and spatial overlaps are computed only once per
+            input pixel.
 
         scale : float, optional
             The pixel scale of the input image. Conceptually, this is the
@@ -477,7 +678,8 @@ class Drizzle:
 
         weight_map : 2D array, None, optional
             A 2D numpy array containing the pixel by pixel weighting.
-            Must have the same dimensions as ``data``.
+            Must have the same dimensions as ``data``. The same types as
+            for ``data`` are read without conversion.
 
             When ``weight_map`` is `None`, the weight of input data pixels will
             be assumed to be 1.
@@ -522,6 +724,40 @@ class Drizzle:
             maximum will be set in the y dimension,  the full x dimension
             of the output image is the bounding box.
 
+        progress : callable, None, optional
+            A function called as ``progress(done, total)`` about every 1% of
+            the rows of the input image, with the number of rows already
+            drizzled and the total number of rows. Drizzling is cancelled
+            when it returns a true value or raises an exception (which is
+            then propagated). It is called with the GIL held but possibly
+            from a thread other than the one calling ``add_image``.
+
+        cancel : numpy.ndarray, None, optional
+            A C-contiguous ``numpy.int32`` array, e.g., ``np.zeros(1,
+            dtype=np.int32)``. Setting its first element to a non-zero value,
+            for example from another thread, cancels drizzling at the start
+            of the next row of the input image. The first element is read
+            atomically, without ordering other memory accesses.
+
+        pixmap_step : int, optional
+            When larger than 1, ``pixmap`` is a coarse pixel map sampled
+            every ``pixmap_step`` input pixels along both axes (see
+            :py:func:`~drizzle.utils.calc_pixmap`): ``pixmap[j, i]`` maps
+            input pixel ``(i * pixmap_step, j * pixmap_step)`` and the map
+            must cover the whole input image. The kernels interpolate it
+            bicubically, so that a per-pixel map is never stored. This is
+            accurate for distortions that are smooth on the scale of
+            ``pixmap_step`` pixels.
+
+        pixmap_affine : array-like, None, optional
+            A 2x3 matrix ``[[a, b, c], [d, e, f]]`` of an affine correction
+            applied on the fly to the output coordinates ``(x, y)`` read
+            from ``pixmap``: ``x' = a * x + b * y + c`` and
+            ``y' = d * x + e * y + f``. This allows one pixel map (e.g., a
+            `PreparedPixmap` of the distortion of a detector) to serve all
+            exposures that differ only by a small alignment correction
+            (shift, rotation, scale).
+
         Returns
         -------
         nskip : float
@@ -534,18 +770,52 @@ class Drizzle:
             ``((xmin, xmax), (ymin, ymax))`` in the input image that were
             ignored and did not contribute to the output image.
 
+        Raises
+        ------
+        CancelledError
+            If drizzling was cancelled through ``progress`` or ``cancel``.
+            The output arrays then hold the contributions of the rows
+            drizzled before cancellation and fill values are not applied,
+            while the context ID and total exposure time already account
+            for the image. Discard this object, or restore it from a
+            checkpoint (see :py:meth:`checkpoint`), after a cancellation.
+
         """
+        if isinstance(pixmap, cdrizzle.PreparedPixmap):
+            prepared = pixmap
+            pixmap = prepared.pixmap
+            if pixmap_step == 1:
+                pixmap_step = prepared.pixmap_step
+        else:
+            pixmap = _as_input_array(pixmap, *PIXMAP_DTYPES)
+            prepared = pixmap
+        if pixmap.ndim != 3 or pixmap.shape[2] not in [2, 3]:
+            raise ValueError("'pixmap' must be an array of shape (Ny, Nx, 2) "
+                             "or (Ny, Nx, 3).")
+
+        x0, y0 = self._out_origin
+
         # this enables initializer to not need output image shape at all and
         # set output image shape based on output coordinates from the pixmap.
         #
         if self._out_shape is None:
-            pmap_xmin = int(np.floor(np.nanmin(pixmap[:, :, 0])))
-            pmap_xmax = int(np.ceil(np.nanmax(pixmap[:, :, 0])))
-            pmap_ymin = int(np.floor(np.nanmin(pixmap[:, :, 1])))
-            pmap_ymax = int(np.ceil(np.nanmax(pixmap[:, :, 1])))
-            pixmap = pixmap.copy()
-            pixmap[:, :, 0] -= pmap_xmin
-            pixmap[:, :, 1] -= pmap_ymin
+            if pixmap.shape[2] == 3:
+                raise ValueError(
+                    "Shape of the output spectral cube must be specified."
+                )
+            if self._out_origin != (0, 0):
+                raise ValueError(
+                    "'out_origin' requires the shape of the output images: "
+                    "without it the origin is derived from the pixel map."
+                )
+            x, y = _apply_pixmap_affine(pixmap, pixmap_affine)
+            pmap_xmin = int(np.floor(np.nanmin(x)))
+            pmap_xmax = int(np.ceil(np.nanmax(x)))
+            pmap_ymin = int(np.floor(np.nanmin(y)))
+            pmap_ymax = int(np.ceil(np.nanmax(y)))
+            # shift the output grid instead of copying the pixmap:
+            x0, y0 = pmap_xmin, pmap_ymin
+            self._out_origin = (x0, y0)
             self._out_shape = (
                 pmap_xmax - pmap_xmin + 1,
                 pmap_ymax - pmap_ymin + 1
@@ -573,15 +843,26 @@ class Drizzle:
 
         self._texptime += exptime
 
-        data = np.asarray(data, dtype=np.float32)
-        pixmap = np.asarray(pixmap, dtype=np.float64)
+        data = _as_input_array(data, *INPUT_DTYPES)
         in_ymax, in_xmax = data.shape
 
-        if pixmap.shape[:2] != data.shape:
+        if pixmap_step == 1 and pixmap.shape[:2] != data.shape:
             raise ValueError(
                 "'pixmap' shape is not consistent with 'data' shape."
             )
 
+        if len(self._out_shape) == 3:
+            if pixmap.shape[2] != 3:
+                raise ValueError(
+                    "Drizzling to a spectral cube requires a pixel map with "
+                    "a wavelength component."
+                )
+            if self._kernel.lower() != "square":
+                raise ValueError(
+                    "Spectral cubes can only be drizzled with the 'square' "
+                    "kernel."
+                )
+
         if xmin is None or xmin < 0:
             xmin = 0
 
@@ -595,113 +876,2355 @@ class Drizzle:
             ymax = in_ymax - 1
 
         if weight_map is not None:
-            weight_map = np.asarray(weight_map, dtype=np.float32)
-        else:  # TODO: this should not be needed after C code modifications
-            weight_map = np.ones_like(data)
-
-        pixmap = np.asarray(pixmap, dtype=np.float64)
+            weight_map = _as_input_array(weight_map, *INPUT_DTYPES)
 
         if self._disable_ctx:
-            ctx_plane = None
+            ctx_id = 0
         else:
-            if self._out_ctx.ndim == 2:
-                raise AssertionError("Context image is expected to be 3D")
-            ctx_plane = self._out_ctx[plane_no]
-
-        # TODO: probably tdriz should be modified to not return version.
-        #       we should not have git, Python, C, ... versions
-
-        # TODO: While drizzle code in cdrizzlebox.c supports weight_map=None,
-        #       cdrizzleapi.c does not. It should be modified to support this
-        #       for performance reasons.
+            if self._out_ctx.ndim == len(self._out_shape):
+                raise AssertionError(
+                    "Context image is expected to have a plane axis"
+                )
+            ctx_id = plane_no * CTX_PLANE_BITS + id_in_plane
 
-        _vers, nmiss, nskip = cdrizzle.tdriz(
+        nmiss, nskip = self._get_engine().add(
             input=data,
             weights=weight_map,
-            pixmap=pixmap,
-            output=self._out_img,
-            counts=self._out_wht,
-            context=ctx_plane,
-            uniqid=id_in_plane + 1,
+            pixmap=prepared,
+            ctx_id=ctx_id,
             xmin=xmin,
             xmax=xmax,
             ymin=ymin,
             ymax=ymax,
             scale=scale,  # scales image intensity. usually equal to pixel scale
             pixfrac=pixfrac,
-            kernel=self._kernel,
             in_units=in_units,
             expscale=expscale,
             wtscale=wht_scale,
+            out_x0=x0,
+            out_y0=y0,
+            mosaic=self._mosaic,
+            progress=progress,
+            cancel=cancel,
+            pixmap_step=pixmap_step,
+            pixmap_affine=pixmap_affine,
+        )
+
+        return nmiss, nskip
+
+    def add_image_stream(self, producers, depth=2):
+        """
+        Resample and add a stream of images, preparing upcoming images in
+        background threads while the current image is drizzled.
+
+        Each producer is a callable that prepares one input image, for
+        example by reading it, converting data quality flags to weights,
+        and computing its pixel map, and returns the arguments of
+        :py:meth:`add_image`. Up to ``depth`` producers run ahead on a
+        thread pool while images are drizzled, in the order of
+        ``producers``, so that context IDs are assigned as if
+        :py:meth:`add_image` had been called for each image in turn.
+        Producers run concurrently with drizzling as long as they spend
+        their time in I/O or in code that releases the GIL, such as most
+        `numpy` and WCS computations.
+
+        Parameters
+        ----------
+        producers : iterable of callable
+            Callables taking no arguments and returning either a mapping of
+            keyword arguments or a tuple of positional arguments of
+            :py:meth:`add_image`. The iterable may be a generator: it is
+            consumed only ``depth`` items ahead of the image being drizzled.
+
+        depth : int, optional
+            Maximum number of images prepared ahead, which is also the number
+            of threads running producers. It bounds the memory used by
+            images waiting to be drizzled.
+
+        Returns
+        -------
+        nmiss : numpy.ndarray
+            The number of pixels of each input image that were ignored and
+            did not contribute to the output image.
+
+        nskip : numpy.ndarray
+            The number of lines of each input image that were ignored and
+            did not contribute to the output image.
+
+        """
+        if depth < 1:
+            raise ValueError("'depth' must be a positive number.")
+
+        producers = iter(producers)
+        nmiss = []
+        nskip = []
+        executor = ThreadPoolExecutor(max_workers=depth)
+        try:
+            queue = deque(
+                executor.submit(producer)
+                for producer in itertools.islice(producers, depth)
+            )
+            while queue:
+                args = queue.popleft().result()
+                # start preparing the next image before drizzling this one:
+                for producer in itertools.islice(producers, 1):
+                    queue.append(executor.submit(producer))
+                if isinstance(args, Mapping):
+                    miss, skip = self.add_image(**args)
+                else:
+                    miss, skip = self.add_image(*args)
+                nmiss.append(miss)
+                nskip.append(skip)
+        finally:
+            executor.shutdown(wait=True, cancel_futures=True)
+
+        return np.array(nmiss, dtype=int), np.array(nskip, dtype=int)
+
+    def add_images(self, data, exptime, pixmap, scale=1.0, weight_map=None,
+                   wht_scale=1.0, pixfrac=1.0, in_units='cps', nthreads=None):
+        """
+        Resample and add several images to the cumulative output image in a
+        single call. Also, update output total weight image and context
+        images.
+
+        The result is the same as calling :py:meth:`add_image` once for each
+        input image (up to floating point round-off) but all images are
+        processed by the C code in one call, with the images spread over
+        ``nthreads`` threads that drizzle onto private copies of the output
+        arrays, which are merged at the end.
+
+        Parameters
+        ----------
+        data : list of 2D numpy.ndarray, 3D numpy.ndarray
+            A sequence of 2D images or a stack of images to be drizzled.
+            Images may have different shapes when provided as a list.
+
+        exptime : float, list of float
+            The exposure time of the input images, either a single value
+            for all images or one value per image.
+
+        pixmap : 3D array, list of 3D arrays
+            Pixel maps of the input images (see :py:meth:`add_image`). A
+            single ``(Ny, Nx, 2)`` array is shared by all input images, which
+            then must all have the same shape.
+
+        scale : float, optional
+            The pixel scale of the input images (see :py:meth:`add_image`).
+
+        weight_map : list of 2D array, 3D array, None, optional
+            Pixel by pixel weighting of each of the input images.
+            When ``weight_map`` is `None`, the weight of input data pixels will
+            be assumed to be 1.
+
+        wht_scale : float
+            A scaling factor applied to the pixel by pixel weighting.
+
+        pixfrac : float, optional
+            The fraction of a pixel that the pixel flux is confined to
+            (see :py:meth:`add_image`).
+
+        in_units : str
+            The units of the input images. The units can either be "counts"
+            or "cps" (counts per second.)
+
+        nthreads : int, None, optional
+            Number of threads used to drizzle the images. When `None`, the
+            number of available CPUs is used.
+
+        Returns
+        -------
+        nmiss : numpy.ndarray
+            The number of pixels of each input image that were ignored and
+            did not contribute to the output image.
+
+        nskip : numpy.ndarray
+            The number of lines of each input image that were ignored and
+            did not contribute to the output image.
+
+        """
+        if self._out_shape is None:
+            raise ValueError(
+                "Output image shape must be specified in order to add "
+                "several images at once."
+            )
+        if len(self._out_shape) != 2:
+            raise ValueError("Spectral cubes must be built with 'add_image'.")
+
+        nimages = len(data)
+        if nimages == 0:
+            return np.zeros(0, dtype=int), np.zeros(0, dtype=int)
+
+        exptime = np.broadcast_to(
+            np.asarray(exptime, dtype=np.float32), (nimages, )
+        )
+        if np.any(exptime <= 0.0):
+            raise ValueError("'exptime' *must* be a strictly positive number.")
+
+        if nthreads is None:
+            nthreads = os.cpu_count() or 1
+
+        if self._disable_ctx:
+            ctx_ids = None
+        else:
+            ctx_ids = np.arange(self._ctx_id, self._ctx_id + nimages,
+                                dtype=np.int32)
+            self._ensure_ctx_planes(self._ctx_id + nimages - 1)
+            self._ctx_id += nimages
+            self._plane_no = (self._ctx_id - 1) // CTX_PLANE_BITS
+
+        nmiss, nskip = cdrizzle.tdriz_batch(
+            inputs=data,
+            weights=weight_map,
+            pixmaps=pixmap,
+            output=self._out_img,
+            counts=self._out_wht,
+            context=self._out_ctx,
+            ctx_ids=ctx_ids,
+            exptimes=exptime,
+            scale=scale,
+            pixfrac=pixfrac,
+            kernel=self._kernel,
+            in_units=in_units,
+            wtscale=wht_scale,
             fillstr=self._fillval,
+            nthreads=nthreads,
+            out_x0=self._out_origin[0],
+            out_y0=self._out_origin[1],
+            mosaic=self._mosaic,
         )
-        self._cversion = _vers  # TODO: probably not needed
+
+        self._texptime += float(np.sum(exptime, dtype=np.float64))
 
         return nmiss, nskip
 
+    def add_frames(self, data, exptime, pixmap, scale=1.0, weight_map=None,
+                   wht_scale=1.0, pixfrac=1.0, in_units='cps', coadd=True,
+                   frames_img=None, frames_wht=None, nthreads=None):
+        """
+        Resample a series of frames (e.g., a time series) each onto its own
+        plane of an ``(nframes, Ny, Nx)`` output stack and, optionally, add
+        them to the cumulative output image, weight, and context images.
 
-def blot_image(data, pixmap, pix_ratio, exptime, output_pixel_shape,
-               interp='poly5', sinscl=1.0):
-    """
-    Resample the ``data`` input image onto an output grid defined by
-    the ``pixmap`` array. ``blot_image`` performs resampling using one of
-    the several interpolation algorithms and, unlike the "drizzle" algorithm
-    with 'square', 'turbo', and 'point' kernels, this resampling is not
-    flux-conserving.
+        Frames are drizzled in parallel, one frame per task, and the co-add
+        is computed from the resampled frames in frame order so that the
+        result does not depend on the number of threads. Context bits of the
+        co-add are set for the output pixels that received positive weight
+        from a frame.
 
-    This method works best for with well sampled images and thus it is
-    typically used to resample the output of :py:class:`Drizzle` back to the
-    coordinate grids of input images of :py:meth:`Drizzle.add_image`.
-    The output of :py:class:`Drizzle` are usually well sampled images especially
-    if it was created from a set of dithered images.
+        Parameters
+        ----------
+        data : list of 2D numpy.ndarray, 3D numpy.ndarray
+            A sequence of 2D frames or a stack of frames to be drizzled.
 
-    Parameters
-    ----------
-    data : 2D array
-        Input numpy array of the source image in units of 'cps'.
+        exptime : float, list of float
+            The exposure time of the frames, either a single value for all
+            frames or one value per frame.
 
-    pixmap : 3D array
-        A mapping from input image (``data``) coordinates to resampled
-        (``out_img``) coordinates. ``pixmap`` must be an array of shape
-        ``(Ny, Nx, 2)`` where ``(Ny, Nx)`` is the shape of the input image.
-        ``pixmap[..., 0]`` forms a 2D array of X-coordinates of input
-        pixels in the ouput frame and ``pixmap[..., 1]`` forms a 2D array of
-        Y-coordinates of input pixels in the ouput coordinate frame.
+        pixmap : 3D array, list of 3D arrays
+            Pixel maps of the frames (see :py:meth:`add_image`). A single
+            ``(Ny, Nx, 2)`` array is shared by all frames.
 
-    output_pixel_shape : tuple of int
-        A tuple of two integer numbers indicating the dimensions of the output
-        image ``(Nx, Ny)``.
+        scale : float, optional
+            The pixel scale of the input frames (see :py:meth:`add_image`).
 
-    pix_ratio : float
-        Ratio of the input image pixel scale to the ouput image pixel scale.
+        weight_map : list of 2D array, 3D array, None, optional
+            Pixel by pixel weighting of each of the frames.
+            When ``weight_map`` is `None`, the weight of input data pixels will
+            be assumed to be 1.
 
-    exptime : float
-        The exposure time of the input image.
+        wht_scale : float
+            A scaling factor applied to the pixel by pixel weighting.
 
-    interp : str, optional
-        The type of interpolation used in the resampling. The
-        possible values are:
+        pixfrac : float, optional
+            The fraction of a pixel that the pixel flux is confined to
+            (see :py:meth:`add_image`).
 
-            - "nearest" (nearest neighbor interpolation);
-            - "linear" (bilinear interpolation);
-            - "poly3" (cubic polynomial interpolation);
-            - "poly5" (quintic polynomial interpolation);
-            - "sinc" (sinc interpolation);
-            - "lan3" (3rd order Lanczos interpolation); and
-            - "lan5" (5th order Lanczos interpolation).
+        in_units : str
+            The units of the input frames. The units can either be "counts"
+            or "cps" (counts per second.)
 
-    sincscl : float, optional
-        The scaling factor for "sinc" interpolation.
+        coadd : bool, optional
+            When `True`, the frames are also added to the output image,
+            weight, and context of this `Drizzle` object.
 
-    Returns
-    -------
-    out_img : 2D numpy.ndarray
-        A 2D numpy array containing the resampled image data.
+        frames_img : 3D numpy.ndarray, None, optional
+            A ``float32`` array of shape ``(nframes, Ny, Nx)`` to hold the
+            resampled frames. A new array is allocated when `None`.
 
-    """
-    out_img = np.zeros(output_pixel_shape[::-1], dtype=np.float32)
+        frames_wht : 3D numpy.ndarray, None, optional
+            A ``float32`` array of shape ``(nframes, Ny, Nx)`` to hold the
+            weights of the resampled frames. A new array is allocated when
+            `None`. Any values already present in ``frames_img`` and
+            ``frames_wht`` are discarded.
 
-    cdrizzle.tblot(data, pixmap, out_img, scale=pix_ratio, kscale=1.0,
-                   interp=interp, exptime=exptime, misval=0.0, sinscl=sinscl)
+        nthreads : int, None, optional
+            Number of threads used to drizzle the frames. When `None`, the
+            number of available CPUs is used.
 
-    return out_img
+        Returns
+        -------
+        frames_img : numpy.ndarray
+            Resampled frames.
+
+        frames_wht : numpy.ndarray
+            Weights of the resampled frames.
+
+        nmiss : numpy.ndarray
+            The number of pixels of each frame that were ignored and did not
+            contribute to the output image.
+
+        nskip : numpy.ndarray
+            The number of lines of each frame that were ignored and did not
+            contribute to the output image.
+
+        """
+        if self._out_shape is None:
+            raise ValueError(
+                "Output image shape must be specified in order to drizzle "
+                "frames."
+            )
+        if len(self._out_shape) != 2:
+            raise ValueError("Spectral cubes must be built with 'add_image'.")
+
+        nframes = len(data)
+        stack_shape = (nframes, ) + tuple(self._out_shape)
+
+        exptime = np.broadcast_to(
+            np.asarray(exptime, dtype=np.float32), (nframes, )
+        )
+        if np.any(exptime <= 0.0):
+            raise ValueError("'exptime' *must* be a strictly positive number.")
+
+        if nthreads is None:
+            nthreads = os.cpu_count() or 1
+
+        if frames_wht is None:
+            frames_wht = np.zeros(stack_shape, dtype=np.float32)
+        elif frames_wht.shape != stack_shape:
+            raise ValueError("'frames_wht' must have shape (nframes, Ny, Nx).")
+        else:
+            frames_wht[...] = 0.0
+
+        if frames_img is None:
+            frames_img = np.zeros(stack_shape, dtype=np.float32)
+        elif frames_img.shape != stack_shape:
+            raise ValueError("'frames_img' must have shape (nframes, Ny, Nx).")
+
+        if nframes == 0:
+            return frames_img, frames_wht, np.zeros(0, int), np.zeros(0, int)
+
+        ctx_ids = None
+        if coadd and not self._disable_ctx:
+            ctx_ids = np.arange(self._ctx_id, self._ctx_id + nframes,
+                                dtype=np.int32)
+            self._ensure_ctx_planes(self._ctx_id + nframes - 1)
+            self._ctx_id += nframes
+            self._plane_no = (self._ctx_id - 1) // CTX_PLANE_BITS
+
+        nmiss, nskip = cdrizzle.tdriz_stack(
+            inputs=data,
+            weights=weight_map,
+            pixmaps=pixmap,
+            output=frames_img,
+            counts=frames_wht,
+            exptimes=exptime,
+            scale=scale,
+            pixfrac=pixfrac,
+            kernel=self._kernel,
+            in_units=in_units,
+            wtscale=wht_scale,
+            fillstr=self._fillval,
+            nthreads=nthreads,
+            coadd=self._out_img if coadd else None,
+            coadd_counts=self._out_wht if coadd else None,
+            coadd_context=None if ctx_ids is None else self._out_ctx,
+            ctx_ids=ctx_ids,
+            out_x0=self._out_origin[0],
+            out_y0=self._out_origin[1],
+            mosaic=self._mosaic,
+        )
+
+        if coadd:
+            self._texptime += float(np.sum(exptime, dtype=np.float64))
+
+        return frames_img, frames_wht, nmiss, nskip
+
+    def merge(self, other, ctx_offset=None, nthreads=None):
+        """
+        Add the output of another :py:class:`Drizzle` object to this one,
+        in place, as if the images drizzled by ``other`` had been drizzled
+        onto this object.
+
+        This makes it possible to split a set of exposures among processes
+        or nodes, drizzle each subset onto its own :py:class:`Drizzle`
+        object, and combine the results. Output images are combined with
+        the weighted mean used when drizzling, weights and total exposure
+        times are summed, and context images are OR-ed after renumbering
+        the context IDs of ``other``.
+
+        Parameters
+        ----------
+        other : Drizzle
+            The :py:class:`Drizzle` object to merge. It must have the same
+            output shape and origin and it is not modified.
+
+        ctx_offset : int, None, optional
+            Non-negative number added to the context IDs of images drizzled
+            onto ``other``. When `None`, context IDs of ``other`` are shifted
+            to follow the IDs used by this object, unless ``other`` was
+            created with a ``begin_ctx_id`` that already does not overlap
+            them, in which case they are kept. Explicit offsets are not
+            checked for collisions.
+
+        nthreads : int, None, optional
+            Number of threads. When `None`, the number of CPUs is used.
+
+        """
+        if not isinstance(other, Drizzle):
+            raise TypeError("'other' must be a Drizzle object.")
+
+        if self._disable_ctx != other._disable_ctx:
+            raise ValueError(
+                "Context images must be either enabled or disabled in both "
+                "Drizzle objects."
+            )
+
+        if other._out_shape is None:
+            # nothing was drizzled onto 'other'
+            return
+
+        if self._out_shape is None and self._out_origin == (0, 0):
+            # like the origin of a grid derived from a pixel map:
+            self._out_origin = other._out_origin
+
+        if self._out_origin != other._out_origin:
+            raise ValueError(
+                "Output images of merged Drizzle objects must have equal "
+                "origins."
+            )
+
+        if self._out_shape is None:
+            self._out_shape = other._out_shape
+            self._alloc_output_arrays(
+                out_shape=self._out_shape,
+                max_ctx_id=self._max_ctx_id,
+                out_img=None,
+                out_wht=None,
+                out_ctx=None,
+            )
+        elif tuple(self._out_shape) != tuple(other._out_shape):
+            raise ValueError(
+                "Output images of merged Drizzle objects must have equal "
+                "shapes."
+            )
+
+        if nthreads is None:
+            nthreads = os.cpu_count() or 1
+
+        if self._disable_ctx:
+            ctx_offset = 0
+        else:
+            if ctx_offset is None:
+                ctx_offset = max(self._ctx_id - other._begin_ctx_id, 0)
+            elif ctx_offset < 0:
+                raise ValueError("'ctx_offset' must be non-negative.")
+
+            self._ctx_id = max(self._ctx_id, other._ctx_id + ctx_offset)
+            self._ensure_ctx_planes(max(self._ctx_id - 1, 0))
+
+        cdrizzle.merge(
+            output=self._out_img,
+            counts=self._out_wht,
+            context=self._out_ctx,
+            other_output=other._out_img,
+            other_counts=other._out_wht,
+            other_context=other._out_ctx,
+            ctx_offset=ctx_offset,
+            nthreads=nthreads,
+        )
+
+        self._texptime += other._texptime
+
+    def checkpoint(self, path, inputs=None):
+        """
+        Save the accumulation state of this object so that drizzling can
+        be resumed with :py:meth:`resume`, for example after a job has been
+        preempted.
+
+        The checkpoint is a directory holding the output arrays as raw
+        ``.npy`` files, which :py:meth:`resume` memory-maps instead of
+        reading, and a ``state.json`` file with the remaining state. A new
+        checkpoint is written next to ``path`` and then moved in place of
+        an existing one so that an interrupted call leaves the previous
+        checkpoint usable.
+
+        Parameters
+        ----------
+        path : str, os.PathLike
+            Checkpoint directory.
+
+        inputs : list, None, optional
+            Identifiers (for example, file names) of the input images
+            drizzled so far. They must be JSON-serializable and are returned
+            by :py:meth:`resume` so that they can be skipped when the job is
+            restarted.
+
+        """
+        path = os.fspath(path)
+        tmp_path = path + ".tmp"
+        old_path = path + ".old"
+
+        state = {
+            "version": CHECKPOINT_VERSION,
+            "kernel": self._kernel,
+            "fillval": self._fillval,
+            "out_origin": list(self._out_origin),
+            "mosaic": None if self._mosaic is None else list(self._mosaic),
+            "out_shape": (
+                None if self._out_shape is None else list(self._out_shape)
+            ),
+            "disable_ctx": self._disable_ctx,
+            "ctx_id": self._ctx_id,
+            "begin_ctx_id": self._begin_ctx_id,
+            "max_ctx_id": self._max_ctx_id,
+            "exptime": self._texptime,
+            "inputs": [] if inputs is None else list(inputs),
+        }
+
+        shutil.rmtree(tmp_path, ignore_errors=True)
+        os.makedirs(tmp_path)
+
+        arrays = {"out_img": self._out_img, "out_wht": self._out_wht}
+        if not self._disable_ctx:
+            arrays["out_ctx"] = self._out_ctx
+        for name, arr in arrays.items():
+            if arr is None:
+                continue
+            with open(os.path.join(tmp_path, name + ".npy"), "wb") as f:
+                np.save(f, arr)
+                f.flush()
+                os.fsync(f.fileno())
+
+        # state is written last: a checkpoint directory without it is
+        # incomplete
+        with open(os.path.join(tmp_path, "state.json"), "w") as f:
+            json.dump(state, f)
+            f.flush()
+            os.fsync(f.fileno())
+
+        if os.path.exists(path):
+            shutil.rmtree(old_path, ignore_errors=True)
+            os.replace(path, old_path)
+        os.replace(tmp_path, path)
+        shutil.rmtree(old_path, ignore_errors=True)
+
+    @classmethod
+    def resume(cls, path, mmap_mode="c"):
+        """
+        Create a :py:class:`Drizzle` object from a checkpoint saved with
+        :py:meth:`checkpoint`.
+
+        Parameters
+        ----------
+        path : str, os.PathLike
+            Checkpoint directory.
+
+        mmap_mode : {"c", "r+", None}, optional
+            How output arrays are loaded. The default, ``"c"``, memory-maps
+            them copy-on-write: resuming does not read the arrays and
+            drizzling onto the resumed object does not modify the
+            checkpoint. With ``"r+"`` drizzled images are written through
+            to the checkpoint files, which then no longer match the saved
+            state until the next :py:meth:`checkpoint`. `None` reads the
+            arrays into memory.
+
+        Returns
+        -------
+        driz : Drizzle
+            The :py:class:`Drizzle` object.
+
+        inputs : list
+            Identifiers of the inputs passed to :py:meth:`checkpoint`.
+
+        """
+        if mmap_mode not in ["c", "r+", None]:
+            raise ValueError("'mmap_mode' must be one of 'c', 'r+', or None.")
+
+        path = os.fspath(path)
+        if (not os.path.isfile(os.path.join(path, "state.json")) and
+                os.path.isfile(os.path.join(path + ".old", "state.json"))):
+            # checkpoint() was interrupted while replacing the checkpoint
+            path = path + ".old"
+
+        with open(os.path.join(path, "state.json")) as f:
+            state = json.load(f)
+
+        if state.get("version") != CHECKPOINT_VERSION:
+            raise ValueError(
+                f"Unsupported checkpoint version: {state.get('version')}."
+            )
+
+        disable_ctx = state["disable_ctx"]
+        driz = cls(
+            kernel=state["kernel"],
+            disable_ctx=disable_ctx,
+            begin_ctx_id=0 if disable_ctx else state["begin_ctx_id"],
+            out_origin=state["out_origin"],
+        )
+        if state.get("mosaic") is not None:
+            driz._mosaic = tuple(state["mosaic"])
+        driz._fillval = state["fillval"]
+        driz._texptime = state["exptime"]
+        if not disable_ctx:
+            driz._ctx_id = state["ctx_id"]
+            driz._max_ctx_id = state["max_ctx_id"]
+
+        if state["out_shape"] is not None:
+            # arrays are attached directly: they were validated when they
+            # were drizzled onto
+            def load(name):
+                return np.load(os.path.join(path, name + ".npy"),
+                               mmap_mode=mmap_mode)
+
+            driz._out_shape = tuple(state["out_shape"])
+            driz._out_img = load("out_img")
+            driz._out_wht = load("out_wht")
+            if not disable_ctx:
+                driz._out_ctx = load("out_ctx")
+
+        return driz, state["inputs"]
+
+    def add_image_overlaps(self, data, exptime, overlaps, weight_map=None,
+                           wht_scale=1.0, in_units='cps'):
+        """
+        Resample and add an image to the cumulative output image using a
+        precomputed :py:class:`OverlapMatrix`. Also, update output total weight
+        image and context images.
+
+        This is equivalent to :py:meth:`add_image` called with the pixel map,
+        kernel, ``scale``, ``pixfrac``, and bounding box used to build
+        ``overlaps``, but it skips all geometric computations and is,
+        therefore, considerably faster when the same geometry is used
+        to resample many images (e.g., repeated drizzles inside an iterative
+        reconstruction or a cube of images sharing one WCS).
+
+        Parameters
+        ----------
+        data : 2D numpy.ndarray
+            A 2D numpy array containing the input image to be drizzled.
+            Its shape must match ``overlaps.in_shape``.
+
+        exptime : float
+            The exposure time of the input image, a positive number. The
+            exposure time is used to scale the image if the units are counts.
+
+        overlaps : OverlapMatrix
+            Sparse matrix of overlaps between input and output pixels
+            computed with :py:meth:`OverlapMatrix.from_pixmap`. Its kernel
+            must match the kernel of this `Drizzle` object and its
+            ``out_shape`` must match the shape of the output images.
+
+        weight_map : 2D array, None, optional
+            A 2D numpy array containing the pixel by pixel weighting.
+            Must have the same dimensions as ``data``.
+
+            When ``weight_map`` is `None`, the weight of input data pixels will
+            be assumed to be 1.
+
+        wht_scale : float
+            A scaling factor applied to the pixel by pixel weighting.
+
+        in_units : str
+            The units of the input image. The units can either be "counts"
+            or "cps" (counts per second.)
+
+        Returns
+        -------
+        nskip : float
+            The number of lines of the input image that were ignored when
+            ``overlaps`` was computed.
+
+        nmiss : float
+            The number of pixels of the input image that were ignored when
+            ``overlaps`` was computed.
+
+        """
+        if not isinstance(overlaps, OverlapMatrix):
+            raise TypeError("'overlaps' must be an 'OverlapMatrix' object.")
+
+        if overlaps.kernel.lower() != self._kernel.lower():
+            raise ValueError(
+                f"Overlap matrix was computed for the '{overlaps.kernel}' "
+                f"kernel but this Drizzle object uses '{self._kernel}' kernel."
+            )
+
+        if self._out_shape is None and self._out_origin == (0, 0):
+            self._out_origin = overlaps.out_origin
+
+        # output indices of the matrix are relative to its own grid:
+        if (self._out_origin != overlaps.out_origin or
+                self._mosaic != overlaps.mosaic):
+            raise ValueError(
+                "Overlap matrix output origin or mosaic is not consistent "
+                "with those of the output images."
+            )
+
+        if self._out_shape is None:
+            self._out_shape = overlaps.out_shape
+            self._alloc_output_arrays(
+                out_shape=self._out_shape,
+                max_ctx_id=self._max_ctx_id,
+                out_img=None,
+                out_wht=None,
+                out_ctx=None,
+            )
+        elif tuple(self._out_shape) != overlaps.out_shape:
+            raise ValueError(
+                "Overlap matrix output shape is not consistent with the shape "
+                "of the output images."
+            )
+
+        data = np.asarray(data, dtype=np.float32)
+        if data.shape != overlaps.in_shape:
+            raise ValueError(
+                "'data' shape is not consistent with the overlap matrix."
+            )
+
+        if exptime <= 0.0:
+            raise ValueError("'exptime' *must* be a strictly positive number.")
+
+        plane_no, id_in_plane = self._increment_ctx_id()
+
+        if in_units == 'cps':
+            expscale = 1.0
+        else:
+            expscale = exptime
+
+        self._texptime += exptime
+
+        if weight_map is not None:
+            weight_map = np.asarray(weight_map, dtype=np.float32)
+
+        if self._disable_ctx:
+            ctx_plane = None
+        else:
+            ctx_plane = self._out_ctx[plane_no]
+
+        cdrizzle.tdriz_overlaps(
+            input=data,
+            weights=weight_map,
+            indptr=overlaps.indptr,
+            indices=overlaps.indices,
+            overlaps=overlaps.weights,
+            output=self._out_img,
+            counts=self._out_wht,
+            context=ctx_plane,
+            uniqid=id_in_plane + 1,
+            scale=overlaps.scale,
+            in_units=in_units,
+            expscale=expscale,
+            wtscale=wht_scale,
+            fillstr=self._fillval,
+        )
+
+        return overlaps.nmiss, overlaps.nskip
+
+
+class OverlapMatrix:
+    """
+    Sparse matrix of the overlaps between the pixels of an input image and
+    the pixels of the output (resampled) image for a fixed geometry and
+    drizzle kernel.
+
+    Computing pixel overlaps (polygon clipping for the "square" kernel,
+    kernel evaluation for the others) is usually the most expensive part of
+    drizzling. When the same pixel map is used to resample many images
+    (iterative reconstructions, data cubes, repeated drizzles of simulated
+    data), the overlaps can be computed once with :py:meth:`from_pixmap`,
+    optionally saved to disk, and re-applied to new data and weights with
+    :py:meth:`Drizzle.add_image_overlaps`, which reduces drizzling to a single
+    memory-bound pass over the matrix.
+
+    The matrix is stored in compressed sparse row (CSR) format: row ``k``
+    corresponds to the input pixel with flat index ``k = y * Nx + x`` and
+    entries ``indptr[k]:indptr[k + 1]`` of ``indices`` and ``weights`` hold the
+    flat indices of the output pixels this input pixel contributes to and
+    the kernel weights of those contributions. Entries are kept in the order
+    in which drizzle kernels visit output pixels so that applying the matrix
+    reproduces :py:meth:`Drizzle.add_image` up to floating point rounding
+    of the stored (single precision) weights.
+
+    """
+    def __init__(self, indptr, indices, weights, in_shape, out_shape,
+                 kernel="square", pixfrac=1.0, scale=1.0, nmiss=0, nskip=0,
+                 out_origin=(0, 0), mosaic=None):
+        """
+        indptr : 1D array of int
+            Row offsets of the CSR matrix, of length ``Ny * Nx + 1`` where
+            ``(Ny, Nx)`` is ``in_shape``.
+
+        indices : 1D array of int
+            Flat indices of the output pixels.
+
+        weights : 1D array of float32
+            Kernel weights of each overlap.
+
+        in_shape : tuple of int
+            Shape (`numpy` order ``(Ny, Nx)``) of input images.
+
+        out_shape : tuple of int
+            Shape (`numpy` order ``(Ny, Nx)``) of output images.
+
+        kernel : str, optional
+            The name of the kernel used to compute the overlaps.
+
+        pixfrac : float, optional
+            The ``pixfrac`` used to compute the overlaps.
+
+        scale : float, optional
+            The pixel scale used to compute the overlaps. The same scale is
+            used to scale the input image when the matrix is applied.
+
+        nmiss : int, optional
+            The number of input pixels that did not contribute to the output.
+
+        nskip : int, optional
+            The number of input lines that did not contribute to the output.
+
+        out_origin : tuple of int, optional
+            Pixel map coordinates ``(x0, y0)`` of the first output pixel.
+
+        mosaic : tuple of int, None, optional
+            Extent ``(x0, y0, Nx, Ny)``, in pixel map coordinates, of the
+            mosaic of which the output grid is a tile, or `None` when the
+            output grid is not a tile.
+
+        """
+        self.indptr = np.ascontiguousarray(indptr, dtype=np.intp)
+        self.indices = np.ascontiguousarray(indices, dtype=np.intp)
+        self.weights = np.ascontiguousarray(weights, dtype=np.float32)
+        self.in_shape = tuple(int(n) for n in in_shape)
+        self.out_shape = tuple(int(n) for n in out_shape)
+        self.kernel = str(kernel)
+        self.pixfrac = float(pixfrac)
+        self.scale = float(scale)
+        self.nmiss = int(nmiss)
+        self.nskip = int(nskip)
+        self.out_origin = (int(out_origin[0]), int(out_origin[1]))
+        self.mosaic = None if mosaic is None else tuple(int(n) for n in mosaic)
+
+        if (self.indptr.ndim != 1 or
+                self.indptr.size != self.in_shape[0] * self.in_shape[1] + 1):
+            raise ValueError(
+                "'indptr' must have one element per input pixel plus one."
+            )
+        if self.indices.shape != self.weights.shape:
+            raise ValueError("'indices' and 'weights' must have equal shapes.")
+        if (self.indices.ndim != 1 or self.indptr[0] != 0 or
+                self.indptr[-1] != self.indices.size or
+                np.any(np.diff(self.indptr) < 0)):
+            raise ValueError(
+                "'indptr' must be non-decreasing from 0 to the number of "
+                "overlaps."
+            )
+
+    @classmethod
+    def from_pixmap(cls, pixmap, out_shape, kernel="square", pixfrac=1.0,
+                    scale=1.0, xmin=None, xmax=None, ymin=None, ymax=None,
+                    out_origin=(0, 0), mosaic_shape=None,
+                    mosaic_origin=(0, 0)):
+        """
+        Compute the overlap matrix for a pixel map.
+
+        Parameters
+        ----------
+        pixmap : 3D array
+            A mapping from input image coordinates to resampled coordinates
+            of shape ``(Ny, Nx, 2)``. See :py:meth:`Drizzle.add_image`.
+
+        out_shape : tuple of int
+            Shape (`numpy` order ``(Ny, Nx)``) of output images.
+
+        kernel : str, optional
+            The name of the kernel. See :py:class:`Drizzle`.
+
+        pixfrac : float, optional
+            The fraction of a pixel that the pixel flux is confined to.
+
+        scale : float, optional
+            The pixel scale of the input image.
+
+        xmin, xmax, ymin, ymax : int, None, optional
+            Bounding rectangle on the input image. See
+            :py:meth:`Drizzle.add_image`.
+
+        out_origin : tuple of int, optional
+            Pixel map coordinates ``(x0, y0)`` of the first output pixel.
+            See :py:class:`Drizzle`.
+
+        mosaic_shape : tuple, None, optional
+            Shape ``(Ny, Nx)`` of the mosaic of which the output grid is a
+            tile. See :py:class:`Drizzle`.
+
+        mosaic_origin : tuple of int, optional
+            Pixel map coordinates ``(x0, y0)`` of the first pixel of the
+            mosaic.
+
+        Returns
+        -------
+        overlaps : OverlapMatrix
+            The overlap matrix.
+
+        """
+        if kernel.lower() not in SUPPORTED_DRIZZLE_KERNELS:
+            raise ValueError(f"Kernel '{kernel}' is not supported.")
+
+        pixmap = _as_input_array(pixmap, *PIXMAP_DTYPES)
+        in_ymax, in_xmax = pixmap.shape[:2]
+
+        if xmin is None or xmin < 0:
+            xmin = 0
+
+        if ymin is None or ymin < 0:
+            ymin = 0
+
+        if xmax is None or xmax > in_xmax - 1:
+            xmax = in_xmax - 1
+
+        if ymax is None or ymax > in_ymax - 1:
+            ymax = in_ymax - 1
+
+        mosaic = _mosaic_extent(mosaic_shape, mosaic_origin)
+
+        indptr, indices, weights, nmiss, nskip = cdrizzle.overlap_matrix(
+            pixmap=pixmap,
+            shape=tuple(out_shape),
+            xmin=xmin,
+            xmax=xmax,
+            ymin=ymin,
+            ymax=ymax,
+            scale=scale,
+            pixfrac=pixfrac,
+            kernel=kernel,
+            out_x0=int(out_origin[0]),
+            out_y0=int(out_origin[1]),
+            mosaic=mosaic,
+        )
+
+        return cls(indptr, indices, weights, in_shape=pixmap.shape[:2],
+                   out_shape=out_shape, kernel=kernel, pixfrac=pixfrac,
+                   scale=scale, nmiss=nmiss, nskip=nskip,
+                   out_origin=out_origin, mosaic=mosaic)
+
+    @property
+    def nnz(self):
+        """Number of stored overlaps."""
+        return self.weights.size
+
+    def save(self, file):
+        """
+        Save the overlap matrix to an uncompressed ``.npz`` file.
+
+        Parameters
+        ----------
+        file : str, file-like
+            File name or file object.
+
+        """
+        np.savez(
+            file,
+            indptr=self.indptr,
+            indices=self.indices,
+            weights=self.weights,
+            in_shape=np.array(self.in_shape),
+            out_shape=np.array(self.out_shape),
+            kernel=np.array(self.kernel),
+            pixfrac=np.array(self.pixfrac),
+            scale=np.array(self.scale),
+            nmiss=np.array(self.nmiss),
+            nskip=np.array(self.nskip),
+            out_origin=np.array(self.out_origin),
+            mosaic=np.array([] if self.mosaic is None else self.mosaic,
+                            dtype=np.intp),
+        )
+
+    @classmethod
+    def load(cls, file):
+        """
+        Load an overlap matrix saved with :py:meth:`save`.
+
+        Parameters
+        ----------
+        file : str, file-like
+            File name or file object.
+
+        Returns
+        -------
+        overlaps : OverlapMatrix
+            The overlap matrix.
+
+        """
+        with np.load(file) as f:
+            # files saved before the origin was stored have none:
+            out_origin = f["out_origin"] if "out_origin" in f else (0, 0)
+            mosaic = f["mosaic"] if "mosaic" in f else []
+            return cls(
+                f["indptr"],
+                f["indices"],
+                f["weights"],
+                in_shape=f["in_shape"],
+                out_shape=f["out_shape"],
+                kernel=str(f["kernel"]),
+                pixfrac=float(f["pixfrac"]),
+                scale=float(f["scale"]),
+                nmiss=int(f["nmiss"]),
+                nskip=int(f["nskip"]),
+                out_origin=out_origin,
+                mosaic=mosaic if len(mosaic) else None,
+            )
+
+
+class TiledDrizzle:
+    """
+    Drizzle onto a large output grid stored as fixed-size tiles that are
+    allocated only when an input image contributes to them.
+
+    Wide-area mosaics are often mostly empty: the combined footprint of the
+    input images covers a small fraction of the bounding box of the output
+    grid. :py:class:`Drizzle` allocates dense output, weight, and context
+    arrays for the whole bounding box while this class keeps one
+    :py:class:`Drizzle` object per touched tile, each drizzling directly onto
+    its tile through the ``out_origin`` offset, so that memory use scales
+    with the area covered by the input images. Tiles that end up receiving
+    no flux are released. Dense output arrays can be assembled at the end
+    with :py:meth:`to_dense`.
+
+    Drizzling an image onto tiles produces the same output as drizzling it
+    onto a dense output image of shape ``out_shape``.
+
+    When ``tile_dir`` is given, tiles are kept out of core: at most
+    ``max_resident`` tiles are held in memory and the least recently used
+    tiles are written to ``tile_dir``, one file per tile, and read back when
+    an input image maps onto them again. Each tile is read and written
+    sequentially as a whole, unlike output arrays memory-mapped in image
+    (row-major) order, whose pages drizzle kernels touch in a scattered
+    pattern. Processing input images in the order returned by
+    :py:meth:`order_inputs`, and announcing upcoming tiles with
+    :py:meth:`prefetch`, keeps the number of tile reads low and overlaps
+    them with drizzling.
+
+    """
+
+    def __init__(self, out_shape, tile_shape=(1024, 1024), kernel="square",
+                 fillval=None, begin_ctx_id=0, disable_ctx=False,
+                 tile_dir=None, max_resident=None):
+        """
+        out_shape : tuple of int
+            Shape (`numpy` order ``(Ny, Nx)``) of the full output grid.
+
+        tile_shape : tuple of int, optional
+            Shape (`numpy` order ``(Ny, Nx)``) of output tiles. Tiles on the
+            top and right edges of the grid may be smaller.
+
+        kernel: str, optional
+            The name of the kernel used to combine the input. See
+            :py:class:`Drizzle`.
+
+        fillval: float, None, str, optional
+            The value of output pixels that did not have contributions from
+            input images' pixels, including pixels of tiles that were never
+            allocated. See :py:class:`Drizzle`.
+
+        begin_ctx_id : int, optional
+            The context ID number (0-based) of the first image that will be
+            resampled.
+
+        disable_ctx : bool, optional
+            Indicates to not create a context image.
+
+        tile_dir : str, None, optional
+            Directory in which tiles evicted from memory are stored. When
+            `None`, all tiles are kept in memory.
+
+        max_resident : int, None, optional
+            Maximum number of tiles held in memory when ``tile_dir`` is
+            given. When `None`, tiles are written to ``tile_dir`` only by
+            :py:meth:`flush`.
+
+        """
+        if len(out_shape) != 2 or len(tile_shape) != 2:
+            raise ValueError(
+                "'out_shape' and 'tile_shape' must be two-element shapes."
+            )
+        if min(out_shape) < 1 or min(tile_shape) < 1:
+            raise ValueError("Output and tile shapes must be positive.")
+        if begin_ctx_id < 0:
+            raise ValueError("Invalid context image ID")
+        if max_resident is not None:
+            if tile_dir is None:
+                raise ValueError("'max_resident' requires 'tile_dir'.")
+            if max_resident < 1:
+                raise ValueError("'max_resident' must be a positive integer.")
+
+        if kernel.lower() not in SUPPORTED_DRIZZLE_KERNELS:
+            raise ValueError(f"Kernel '{kernel}' is not supported.")
+
+        self._out_shape = tuple(int(n) for n in out_shape)
+        self._tile_shape = tuple(int(n) for n in tile_shape)
+        self._ntiles = tuple(
+            -(-n // t) for n, t in zip(self._out_shape, self._tile_shape)
+        )
+        self._kernel = kernel
+        self._disable_ctx = disable_ctx
+        self._ctx_id = begin_ctx_id
+        self._texptime = 0.0
+
+        # resident tiles in least to most recently used order:
+        self._tiles = OrderedDict()
+        # tiles stored in tile_dir, possibly also resident:
+        self._stored = set()
+        # resident tiles modified since they were last stored:
+        self._dirty = set()
+        self._prefetched = {}
+        self._executor = None
+
+        self._tile_dir = tile_dir
+        self._max_resident = max_resident
+        if tile_dir is not None:
+            os.makedirs(tile_dir, exist_ok=True)
+
+        # normalize fill value the same way Drizzle does:
+        self._fillval = Drizzle(kernel=kernel, fillval=fillval).fillval
+
+    @property
+    def out_shape(self):
+        """Shape of the full output grid."""
+        return self._out_shape
+
+    @property
+    def tile_shape(self):
+        """Shape of output tiles."""
+        return self._tile_shape
+
+    @property
+    def kernel(self):
+        """Resampling kernel."""
+        return self._kernel
+
+    @property
+    def fillval(self):
+        """Fill value for output pixels without contributions from input images."""
+        return self._fillval
+
+    @property
+    def ctx_id(self):
+        """Context image "ID" (0-based ) of the next image to be resampled."""
+        return self._ctx_id
+
+    @property
+    def total_exptime(self):
+        """Total exposure time of all resampled images."""
+        return self._texptime
+
+    @property
+    def tiles(self):
+        """
+        A dictionary of allocated tiles held in memory: keys are tile indices
+        ``(iy, ix)`` along each axis of the output grid and values are the
+        :py:class:`Drizzle` objects holding the tiles. Tile ``(iy, ix)``
+        starts at output pixel ``(iy * tile_shape[0], ix * tile_shape[1])``.
+
+        """
+        return dict(self._tiles)
+
+    @property
+    def tile_indices(self):
+        """Sorted indices ``(iy, ix)`` of all allocated tiles."""
+        return sorted(self._stored.union(self._tiles))
+
+    @property
+    def nbytes(self):
+        """Total memory used by the output arrays of resident tiles."""
+        n = 0
+        for tile in self._tiles.values():
+            n += tile.out_img.nbytes + tile.out_wht.nbytes
+            if tile.out_ctx is not None:
+                n += tile.out_ctx.nbytes
+        return n
+
+    def _tile_slice(self, iy, ix):
+        ty, tx = self._tile_shape
+        return np.s_[iy * ty:(iy + 1) * ty, ix * tx:(ix + 1) * tx]
+
+    def _tile_file(self, key):
+        return os.path.join(self._tile_dir, f"tile_{key[0]}_{key[1]}.npz")
+
+    def _read_tile(self, key):
+        with np.load(self._tile_file(key)) as f:
+            return (
+                f["out_img"],
+                f["out_wht"],
+                None if self._disable_ctx else f["out_ctx"],
+            )
+
+    def _write_tile(self, key):
+        tile = self._tiles[key]
+        arrays = {"out_img": tile.out_img, "out_wht": tile.out_wht}
+        if not self._disable_ctx:
+            arrays["out_ctx"] = tile.out_ctx
+        np.savez(self._tile_file(key), **arrays)
+        self._stored.add(key)
+        self._dirty.discard(key)
+
+    def _tile_arrays(self, key):
+        """Output arrays of a tile without making it resident."""
+        if key in self._tiles:
+            tile = self._tiles[key]
+            return tile.out_img, tile.out_wht, tile.out_ctx
+        future = self._prefetched.get(key)
+        if future is not None:
+            return future.result()
+        return self._read_tile(key)
+
+    def _evict(self, keep):
+        if self._max_resident is None:
+            return
+        for key in list(self._tiles):
+            if len(self._tiles) <= self._max_resident:
+                break
+            if key == keep:
+                continue
+            if key in self._dirty or key not in self._stored:
+                self._write_tile(key)
+            del self._tiles[key]
+
+    def _resident_tile(self, key):
+        """
+        Return the resident tile ``key``, reading it from ``tile_dir`` if
+        needed, or `None` if the tile has not been allocated.
+
+        """
+        tile = self._tiles.get(key)
+        if tile is not None:
+            self._tiles.move_to_end(key)
+            return tile
+
+        if key not in self._stored:
+            return None
+
+        future = self._prefetched.pop(key, None)
+        if future is None:
+            out_img, out_wht, out_ctx = self._read_tile(key)
+        else:
+            out_img, out_wht, out_ctx = future.result()
+
+        # attach stored arrays directly: they are known to be consistent
+        # and Drizzle's checks would cost a pass over the context planes
+        sl = self._tile_slice(*key)
+        tile = Drizzle(
+            kernel=self._kernel,
+            fillval=self._fillval,
+            disable_ctx=self._disable_ctx,
+            out_origin=(sl[1].start, sl[0].start),
+            mosaic_shape=self._out_shape,
+        )
+        tile._out_shape = out_img.shape
+        tile._out_img = out_img
+        tile._out_wht = out_wht
+        tile._out_ctx = out_ctx
+        tile._texptime = self._texptime
+        self._tiles[key] = tile
+        self._evict(keep=key)
+        return tile
+
+    def prefetch(self, tiles):
+        """
+        Start reading stored tiles in a background thread so that they are
+        in memory when the next input images are drizzled onto them.
+
+        Parameters
+        ----------
+        tiles : list of tuple
+            Indices ``(iy, ix)`` of tiles to read. Tiles that are resident,
+            already being read, or have not been allocated are ignored.
+
+        """
+        if self._tile_dir is None:
+            return
+        if self._executor is None:
+            self._executor = ThreadPoolExecutor(max_workers=1)
+        for key in tiles:
+            key = (int(key[0]), int(key[1]))
+            if (key in self._stored and key not in self._tiles and
+                    key not in self._prefetched):
+                self._prefetched[key] = self._executor.submit(
+                    self._read_tile, key
+                )
+
+    def flush(self):
+        """
+        Write all resident tiles modified since they were last stored to
+        ``tile_dir``. Tiles remain in memory.
+
+        """
+        if self._tile_dir is None:
+            raise ValueError("Tiles can be flushed only when 'tile_dir' "
+                             "is set.")
+        for key in list(self._dirty):
+            self._write_tile(key)
+
+    def close(self):
+        """Flush modified tiles, when stored, and stop prefetching."""
+        if self._executor is not None:
+            self._executor.shutdown(wait=True)
+            self._executor = None
+        self._prefetched.clear()
+        if self._tile_dir is not None:
+            self.flush()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def order_inputs(self, pixmaps):
+        """
+        Order input images so that images mapping onto the same output tiles
+        are drizzled one after another.
+
+        Images are sorted by the tile, in tile-major order, that holds the
+        center of their footprint on the output grid. With out-of-core tiles
+        this keeps the tiles needed by consecutive images resident. Note that
+        context IDs are assigned in the order images are added.
+
+        Parameters
+        ----------
+        pixmaps : list of 3D arrays
+            Pixel maps of input images. See :py:meth:`add_image`.
+
+        Returns
+        -------
+        order : list of int
+            Indices of ``pixmaps`` in the order they should be drizzled.
+
+        """
+        keys = []
+        for pixmap in pixmaps:
+            pixmap = np.asarray(pixmap)
+            with np.errstate(all="ignore"):
+                x = np.nanmedian(pixmap[..., 0])
+                y = np.nanmedian(pixmap[..., 1])
+            if np.isfinite(x) and np.isfinite(y):
+                iy = int(np.clip((y + 0.5) // self._tile_shape[0], 0,
+                                 self._ntiles[0] - 1))
+                ix = int(np.clip((x + 0.5) // self._tile_shape[1], 0,
+                                 self._ntiles[1] - 1))
+                keys.append(iy * self._ntiles[1] + ix)
+            else:
+                keys.append(self._ntiles[0] * self._ntiles[1])
+        return sorted(range(len(keys)), key=keys.__getitem__)
+
+    def schedule(self, footprints):
+        """
+        Find the input images that overlap each tile of the output grid.
+
+        Same as :py:func:`schedule_tiles` for the grid and tiles of this
+        object.
+
+        """
+        return schedule_tiles(footprints, self._out_shape, self._tile_shape)
+
+    def _touched_tiles(self, pixmap, scale, pixfrac):
+        """
+        Indices of the tiles that may receive flux from input pixels mapped
+        by ``pixmap``. The estimate is conservative: pixel centers are padded
+        by the extent of the largest kernel and of one input pixel.
+
+        """
+        x = pixmap[..., 0]
+        y = pixmap[..., 1]
+        valid = np.isfinite(x) & np.isfinite(y)
+        if not np.any(valid):
+            return []
+
+        r = _kernel_reach(pixmap, scale, pixfrac)
+        x = x[valid]
+        y = y[valid]
+        ranges = []
+        for c, t, n in zip((y, x), self._tile_shape, self._ntiles):
+            lo = np.floor((c - r + 0.5) / t).astype(np.intp)
+            hi = np.floor((c + r + 0.5) / t).astype(np.intp)
+            ranges.append((lo, hi, n))
+
+        inside = np.ones(x.shape, dtype=bool)
+        for lo, hi, n in ranges:
+            inside &= (hi >= 0) & (lo < n)
+        if not np.any(inside):
+            return []
+
+        ranges = [
+            (np.clip(lo[inside], 0, n - 1), np.clip(hi[inside], 0, n - 1))
+            for lo, hi, n in ranges
+        ]
+        (ylo, yhi), (xlo, xhi) = ranges
+
+        keys = []
+        for ky in range(int(np.max(yhi - ylo)) + 1):
+            iy = np.minimum(ylo + ky, yhi)
+            for kx in range(int(np.max(xhi - xlo)) + 1):
+                ix = np.minimum(xlo + kx, xhi)
+                keys.append(np.unique(iy * self._ntiles[1] + ix))
+
+        keys = np.unique(np.concatenate(keys))
+        return [divmod(int(k), self._ntiles[1]) for k in keys]
+
+    def add_image(self, data, exptime, pixmap, scale=1.0,
+                  weight_map=None, wht_scale=1.0, pixfrac=1.0, in_units='cps',
+                  xmin=None, xmax=None, ymin=None, ymax=None):
+        """
+        Resample and add an image to the tiles of the output grid,
+        allocating tiles that receive flux for the first time.
+
+        Parameters are the same as for :py:meth:`Drizzle.add_image`.
+        ``pixmap`` maps input pixels to the full output grid and must have
+        shape ``(Ny, Nx, 2)``.
+
+        Returns
+        -------
+        ntiles : int
+            The number of tiles that received flux from this image.
+
+        """
+        if exptime <= 0.0:
+            raise ValueError("'exptime' *must* be a strictly positive number.")
+
+        pixmap = _as_input_array(pixmap, *PIXMAP_DTYPES)
+        if pixmap.ndim != 3 or pixmap.shape[2] != 2:
+            raise ValueError("'pixmap' must be an array of shape (Ny, Nx, 2).")
+
+        data = _as_input_array(data, *INPUT_DTYPES)
+        if weight_map is not None:
+            weight_map = _as_input_array(weight_map, *INPUT_DTYPES)
+
+        in_ymax, in_xmax = pixmap.shape[:2]
+        section = np.s_[
+            0 if ymin is None else max(ymin, 0):
+            in_ymax if ymax is None else ymax + 1,
+            0 if xmin is None else max(xmin, 0):
+            in_xmax if xmax is None else xmax + 1,
+        ]
+        npix = int(np.prod(pixmap[section].shape[:2]))
+
+        ctx_id = self._ctx_id
+        ntiles = 0
+        self._texptime += exptime
+
+        for iy, ix in self._touched_tiles(pixmap[section], scale, pixfrac):
+            tile = self._resident_tile((iy, ix))
+            new = tile is None
+            if new:
+                sl = self._tile_slice(iy, ix)
+                shape = (
+                    min(sl[0].stop, self._out_shape[0]) - sl[0].start,
+                    min(sl[1].stop, self._out_shape[1]) - sl[1].start,
+                )
+                tile = Drizzle(
+                    kernel=self._kernel,
+                    fillval=self._fillval,
+                    out_shape=shape,
+                    begin_ctx_id=ctx_id,
+                    disable_ctx=self._disable_ctx,
+                    out_origin=(sl[1].start, sl[0].start),
+                    mosaic_shape=self._out_shape,
+                )
+
+            # context IDs are global: tiles skipped by earlier images must
+            # use the same ID as the other tiles
+            tile._ctx_id = ctx_id
+
+            nmiss, _ = tile.add_image(
+                data,
+                exptime=exptime,
+                pixmap=pixmap,
+                scale=scale,
+                weight_map=weight_map,
+                wht_scale=wht_scale,
+                pixfrac=pixfrac,
+                in_units=in_units,
+                xmin=xmin,
+                xmax=xmax,
+                ymin=ymin,
+                ymax=ymax,
+            )
+
+            # the kernels may undercount missed input pixels but never
+            # overcount them: a tile that received flux is always kept
+            if nmiss >= npix:
+                continue
+            if new:
+                self._tiles[(iy, ix)] = tile
+                self._evict(keep=(iy, ix))
+            self._dirty.add((iy, ix))
+            ntiles += 1
+
+        self._ctx_id = ctx_id + 1
+
+        return ntiles
+
+    def to_dense(self, out_img=None, out_wht=None, out_ctx=None):
+        """
+        Assemble dense output arrays for the full output grid.
+
+        Parameters
+        ----------
+        out_img, out_wht, out_ctx : numpy.ndarray, None, optional
+            Arrays, for example memory-mapped files, to fill instead of
+            allocating new arrays. Tiles are copied one at a time and stored
+            tiles are not made resident. ``out_ctx`` must have at least
+            ``(ctx_id - 1) // 32 + 1`` planes.
+
+        Returns
+        -------
+        out_img : 2D numpy.ndarray
+            Output resampled image. Pixels of tiles that were never
+            allocated are set to the fill value.
+
+        out_wht : 2D numpy.ndarray
+            Output weight image.
+
+        out_ctx : 3D numpy.ndarray, None
+            Output context image or `None` if context was disabled.
+
+        """
+        if self._fillval.upper() in ["INDEF", "NAN"]:
+            fillval = np.nan
+        else:
+            fillval = float(self._fillval)
+
+        if out_img is None:
+            out_img = np.full(self._out_shape, fillval, dtype=np.float32)
+        else:
+            out_img[...] = fillval
+
+        if out_wht is None:
+            out_wht = np.zeros(self._out_shape, dtype=np.float32)
+        else:
+            out_wht[...] = 0
+
+        if self._disable_ctx:
+            out_ctx = None
+        elif out_ctx is None:
+            nplanes = max(self._ctx_id - 1, 0) // CTX_PLANE_BITS + 1
+            out_ctx = np.zeros((nplanes, ) + self._out_shape, dtype=np.int32)
+        else:
+            out_ctx[...] = 0
+
+        for key in self.tile_indices:
+            img, wht, ctx = self._tile_arrays(key)
+            sl = self._tile_slice(*key)
+            out_img[sl] = img
+            out_wht[sl] = wht
+            if out_ctx is not None:
+                out_ctx[(np.s_[:ctx.shape[0]], ) + sl] = ctx
+
+        return out_img, out_wht, out_ctx
+
+
+class ParallelDrizzle:
+    """
+    Drizzle input images in several worker processes onto output arrays held
+    in shared memory.
+
+    The constructor, properties, and :py:meth:`add_image` are those of
+    :py:class:`Drizzle`. :py:meth:`submit` hands images over to a pool of
+    worker processes and returns a future immediately, so that preparing
+    the next input image in the calling process overlaps with drizzling,
+    and images are drizzled concurrently; :py:meth:`add_image` submits an
+    image and waits for it. Output, weight, and context arrays are allocated
+    in shared memory (`multiprocessing.shared_memory`) and split into bands of
+    rows, each protected by a lock: a worker drizzles an image onto one band
+    at a time, through the ``out_origin`` offset of :py:class:`Drizzle`, so
+    that several images are drizzled onto different bands at once.
+
+    Context IDs are assigned in the order images are added, as with
+    :py:class:`Drizzle`. The order in which images are combined into the
+    output image may differ, so output images agree with those produced by
+    :py:class:`Drizzle` to within rounding errors. Input arrays are copied
+    to the worker processes.
+
+    Unlike with :py:class:`Drizzle`, the shape of the output images must be
+    given, spectral cubes are not supported, ``progress`` and ``cancel``
+    cannot be passed to :py:meth:`add_image`, and there are no counterparts
+    of :py:meth:`Drizzle.add_images`, :py:meth:`Drizzle.add_frames`,
+    :py:meth:`Drizzle.add_image_stream`, :py:meth:`Drizzle.merge`, or
+    :py:meth:`Drizzle.checkpoint`.
+
+    Output arrays in shared memory are released by :py:meth:`close`, which
+    copies them to the calling process first.
+
+    """
+
+    def __init__(self, kernel="square", fillval=None, out_shape=None,
+                 out_img=None, out_wht=None, out_ctx=None, exptime=0.0,
+                 begin_ctx_id=0, max_ctx_id=None, disable_ctx=False,
+                 out_origin=(0, 0), nworkers=None, nbands=None,
+                 mp_context=None):
+        """
+        Parameters ``kernel`` to ``out_origin`` are the same as for
+        :py:class:`Drizzle`. The shape of the output images must be known,
+        from ``out_shape`` or from the supplied output arrays, and spectral
+        cubes are not supported.
+
+        nworkers : int, None, optional
+            Number of worker processes. When `None`, the number of CPUs is
+            used.
+
+        nbands : int, None, optional
+            Number of bands of rows the output arrays are split into. When
+            `None`, four bands per worker are used.
+
+        mp_context : multiprocessing context, None, optional
+            Context used to start worker processes. When `None`, the default
+            context is used.
+
+        """
+        driz = Drizzle(
+            kernel=kernel,
+            fillval=fillval,
+            out_shape=out_shape,
+            out_img=out_img,
+            out_wht=out_wht,
+            out_ctx=out_ctx,
+            exptime=exptime,
+            begin_ctx_id=begin_ctx_id,
+            max_ctx_id=max_ctx_id,
+            disable_ctx=disable_ctx,
+            out_origin=out_origin,
+        )
+        if driz._out_shape is None:
+            raise ValueError(
+                "Shape of the output images must be specified with "
+                "'out_shape' or with output arrays."
+            )
+        if len(driz._out_shape) != 2:
+            raise ValueError("Spectral cubes are not supported.")
+
+        if nworkers is None:
+            nworkers = os.cpu_count() or 1
+        if nworkers < 1:
+            raise ValueError("'nworkers' must be a positive number.")
+        ny = driz._out_shape[0]
+        if nbands is None:
+            nbands = 4 * nworkers
+        nbands = max(1, min(int(nbands), ny))
+
+        self._kernel = driz._kernel
+        self._fillval = driz._fillval
+        self._out_origin = driz._out_origin
+        self._out_shape = driz._out_shape
+        self._disable_ctx = disable_ctx
+        self._ctx_id = driz._ctx_id
+        self._texptime = driz._texptime
+        self._bands = np.linspace(0, ny, nbands + 1).astype(np.intp)
+        self._pending = []
+        self._max_pending = 2 * nworkers
+
+        self._shm = {}
+        self._arrays = {}
+        self._finalizer = weakref.finalize(self, _release_shared_memory,
+                                           self._shm)
+        self._share("out_img", driz._out_img)
+        self._share("out_wht", driz._out_wht)
+        if not disable_ctx:
+            self._share("out_ctx", driz._out_ctx)
+        del driz
+
+        if mp_context is None:
+            mp_context = multiprocessing.get_context()
+        locks = [mp_context.Lock() for _ in range(nbands)]
+        self._executor = ProcessPoolExecutor(
+            max_workers=nworkers,
+            mp_context=mp_context,
+            initializer=_parallel_drizzle_init,
+            initargs=(locks, ),
+        )
+
+    def _share(self, name, arr):
+        """Copy an array to a new shared memory block."""
+        shm = shared_memory.SharedMemory(create=True,
+                                         size=max(arr.nbytes, 1))
+        shared = np.ndarray(arr.shape, dtype=arr.dtype, buffer=shm.buf)
+        shared[...] = arr
+        old = self._shm.pop(name, None)
+        self._shm[name] = shm
+        self._arrays[name] = shared
+        if old is not None:
+            _release_shared_memory({name: old})
+
+    def _spec(self):
+        """Description of the shared arrays passed to the workers."""
+        return {
+            name: (shm.name, self._arrays[name].shape,
+                   self._arrays[name].dtype.str)
+            for name, shm in self._shm.items()
+        }
+
+    @property
+    def fillval(self):
+        """Fill value for output pixels without contributions from input images."""
+        return self._fillval
+
+    @property
+    def kernel(self):
+        """Resampling kernel."""
+        return self._kernel
+
+    @property
+    def out_origin(self):
+        """Pixel map coordinates ``(x0, y0)`` of the first output pixel."""
+        return self._out_origin
+
+    @property
+    def ctx_id(self):
+        """Context image "ID" (0-based ) of the next image to be resampled."""
+        return self._ctx_id
+
+    @property
+    def out_img(self):
+        """Output resampled image. Waits for pending images."""
+        self.wait()
+        return self._arrays.get("out_img")
+
+    @property
+    def out_wht(self):
+        """Output weight image. Waits for pending images."""
+        self.wait()
+        return self._arrays.get("out_wht")
+
+    @property
+    def out_ctx(self):
+        """Output "context" image. Waits for pending images."""
+        self.wait()
+        return self._arrays.get("out_ctx")
+
+    @property
+    def total_exptime(self):
+        """Total exposure time of all resampled images."""
+        return self._texptime
+
+    def add_image(self, data, exptime, pixmap, scale=1.0,
+                  weight_map=None, wht_scale=1.0, pixfrac=1.0, in_units='cps',
+                  xmin=None, xmax=None, ymin=None, ymax=None, pixmap_step=1,
+                  pixmap_affine=None):
+        """
+        Resample and add an image to the output images, waiting until it
+        has been drizzled. Images submitted earlier may still be pending.
+
+        Parameters are the same as for :py:meth:`Drizzle.add_image`, except
+        ``progress`` and ``cancel``, which are not supported.
+
+        Returns
+        -------
+        nskip : int
+            The number of lines of the input image none of whose pixels
+            map onto the output images.
+
+        nmiss : int
+            The number of pixels of the input image that did not
+            contribute to the output images. Pixels whose kernel straddles
+            two bands of rows count as contributing to both, so this may be
+            lower than the number returned by :py:meth:`Drizzle.add_image`.
+
+        """
+        return self.submit(
+            data,
+            exptime,
+            pixmap,
+            scale=scale,
+            weight_map=weight_map,
+            wht_scale=wht_scale,
+            pixfrac=pixfrac,
+            in_units=in_units,
+            xmin=xmin,
+            xmax=xmax,
+            ymin=ymin,
+            ymax=ymax,
+            pixmap_step=pixmap_step,
+            pixmap_affine=pixmap_affine,
+        ).result()
+
+    def submit(self, data, exptime, pixmap, scale=1.0,
+               weight_map=None, wht_scale=1.0, pixfrac=1.0, in_units='cps',
+               xmin=None, xmax=None, ymin=None, ymax=None, pixmap_step=1,
+               pixmap_affine=None):
+        """
+        Submit an image to be resampled and added to the output images and
+        return without waiting for it.
+
+        Parameters are the same as for :py:meth:`add_image`. A
+        `PreparedPixmap` is sent to the workers as its pixel map.
+
+        Returns
+        -------
+        future : concurrent.futures.Future
+            A future that completes when the image has been drizzled. Its
+            ``result()`` method returns ``nmiss, nskip`` as
+            :py:meth:`add_image` does. Exceptions raised by workers are
+            re-raised by ``result()`` and by :py:meth:`wait`.
+
+        """
+        if self._executor is None:
+            raise ValueError("Images cannot be added after 'close()'.")
+
+        if isinstance(pixmap, cdrizzle.PreparedPixmap):
+            if pixmap_step == 1:
+                pixmap_step = pixmap.pixmap_step
+            pixmap = pixmap.pixmap
+        pixmap = _as_input_array(pixmap, *PIXMAP_DTYPES)
+        if pixmap.ndim != 3 or pixmap.shape[2] != 2:
+            raise ValueError("'pixmap' must be an array of shape (Ny, Nx, 2).")
+        if exptime <= 0.0:
+            raise ValueError("'exptime' *must* be a strictly positive number.")
+
+        ctx_id = self._ctx_id
+        if not self._disable_ctx:
+            depth = self._arrays["out_ctx"].shape[0]
+            if ctx_id // CTX_PLANE_BITS >= depth:
+                # grow the context image: workers must not be writing to it
+                self.wait()
+                ctx = np.zeros((2 * depth, ) + self._out_shape, dtype=np.int32)
+                ctx[:depth] = self._arrays["out_ctx"]
+                self._share("out_ctx", ctx)
+            self._ctx_id += 1
+
+        # bound the number of images held by the executor:
+        while len(self._pending) >= self._max_pending:
+            self._pending.pop(0).result()
+
+        future = self._executor.submit(
+            _parallel_drizzle_task,
+            self._spec(),
+            self._bands,
+            dict(
+                kernel=self._kernel,
+                fillval=self._fillval,
+                disable_ctx=self._disable_ctx,
+                out_origin=self._out_origin,
+            ),
+            ctx_id,
+            dict(
+                data=data,
+                exptime=exptime,
+                pixmap=pixmap,
+                scale=scale,
+                weight_map=weight_map,
+                wht_scale=wht_scale,
+                pixfrac=pixfrac,
+                in_units=in_units,
+                xmin=xmin,
+                xmax=xmax,
+                ymin=ymin,
+                ymax=ymax,
+                pixmap_step=pixmap_step,
+                pixmap_affine=pixmap_affine,
+            ),
+        )
+        self._pending.append(future)
+        self._texptime += exptime
+        return future
+
+    def wait(self):
+        """Wait until all submitted images have been drizzled."""
+        pending, self._pending = self._pending, []
+        for future in pending:
+            future.result()
+
+    def close(self):
+        """
+        Wait for pending images, stop the worker processes, and move the
+        output arrays from shared memory to the calling process.
+
+        """
+        if self._executor is None:
+            return
+        try:
+            self.wait()
+        finally:
+            self._executor.shutdown(wait=True)
+            self._executor = None
+            for name in self._shm:
+                self._arrays[name] = np.array(self._arrays[name])
+            self._finalizer()
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+
+def _release_shared_memory(shms):
+    for shm in shms.values():
+        try:
+            shm.unlink()
+        except FileNotFoundError:
+            pass
+        try:
+            shm.close()
+        except BufferError:
+            # arrays obtained by the user still map the block; it is
+            # unmapped when they are garbage collected
+            pass
+    shms.clear()
+
+
+# state of ParallelDrizzle worker processes:
+_worker_locks = None
+_worker_shm = {}
+
+
+def _parallel_drizzle_init(locks):
+    global _worker_locks
+    _worker_locks = locks
+
+
+def _parallel_drizzle_task(spec, bands, config, ctx_id, args):
+    """
+    Drizzle an image onto the output bands it touches, one at a time, and
+    return ``nmiss, nskip`` for the whole output grid.
+
+    """
+    arrays = {}
+    for name, (shm_name, shape, dtype) in spec.items():
+        shm = _worker_shm.get(name)
+        if shm is None or shm.name != shm_name:
+            # the context image was grown
+            if shm is not None:
+                shm.close()
+            shm = shared_memory.SharedMemory(name=shm_name)
+            _worker_shm[name] = shm
+        arrays[name] = np.ndarray(shape, dtype=dtype, buffer=shm.buf)
+
+    pixmap = args["pixmap"]
+    x, y = _apply_pixmap_affine(pixmap, args["pixmap_affine"])
+    valid = np.isfinite(x) & np.isfinite(y)
+    if not np.any(valid):
+        # as Drizzle.add_image reports images that miss the output
+        return 0, 0
+
+    x0, y0 = config["out_origin"]
+    ny, nx = arrays["out_img"].shape
+    if args["pixmap_affine"] is not None:
+        pixmap = np.dstack([x, y])
+    r = _kernel_reach(pixmap, args["scale"], args["pixfrac"])
+    lo = int(np.floor(np.min(y[valid]) - y0 - r + 0.5))
+    hi = int(np.floor(np.max(y[valid]) - y0 + r + 0.5))
+    if hi < 0 or lo > ny - 1:
+        return 0, 0
+    b1 = np.searchsorted(bands, max(lo, 0), side="right") - 1
+    b2 = np.searchsorted(bands, min(hi, ny - 1), side="right") - 1
+
+    # bounding box of input pixels, as in Drizzle.add_image:
+    in_ymax, in_xmax = np.shape(args["data"])
+    xmin = max(args["xmin"] or 0, 0)
+    ymin = max(args["ymin"] or 0, 0)
+    xmax = in_xmax - 1 if args["xmax"] is None else min(args["xmax"],
+                                                        in_xmax - 1)
+    ymax = in_ymax - 1 if args["ymax"] is None else min(args["ymax"],
+                                                        in_ymax - 1)
+
+    # a line is skipped when none of its pixels lands on the output grid,
+    # whichever band it would be drizzled onto:
+    step = args["pixmap_step"]
+    on = (
+        valid
+        & (x >= x0 - 0.5) & (x < x0 + nx - 0.5)
+        & (y >= y0 - 0.5) & (y < y0 + ny - 0.5)
+    )
+    on = np.any(on[:, xmin // step:xmax // step + 1], axis=1)
+    lines = np.minimum((np.arange(ymin, ymax + 1) + step // 2) // step,
+                       on.size - 1)
+    nskip = int(np.count_nonzero(~on[lines]))
+
+    # the kernels count a box that misses a band as this many pixels,
+    # or report no misses at all when it does not overlap the band:
+    nall = (ymax - ymin + 1) * (xmax - xmin)
+    nhit = 0
+    overlap = False
+
+    # convert inputs once rather than for every band:
+    args["data"] = _as_input_array(args["data"], *INPUT_DTYPES)
+    if args["weight_map"] is not None:
+        args["weight_map"] = _as_input_array(args["weight_map"],
+                                             *INPUT_DTYPES)
+
+    for b in range(b1, b2 + 1):
+        r0, r1 = int(bands[b]), int(bands[b + 1])
+        driz = Drizzle(
+            kernel=config["kernel"],
+            fillval=config["fillval"],
+            disable_ctx=config["disable_ctx"],
+            out_origin=(x0, y0 + r0),
+            mosaic_shape=(ny, nx),
+            mosaic_origin=(x0, y0),
+        )
+        driz._out_shape = (r1 - r0, nx)
+        driz._out_img = arrays["out_img"][r0:r1]
+        driz._out_wht = arrays["out_wht"][r0:r1]
+        if not config["disable_ctx"]:
+            # only the plane of this image, so that the band is contiguous:
+            plane = ctx_id // CTX_PLANE_BITS
+            driz._out_ctx = arrays["out_ctx"][plane:plane + 1, r0:r1]
+            driz._ctx_id = ctx_id % CTX_PLANE_BITS
+        with _worker_locks[b]:
+            miss, skip = driz.add_image(**args)
+        if miss or skip:
+            nhit += nall - miss
+            overlap = True
+
+    if not overlap:
+        return 0, 0
+    return nall - nhit, nskip
+
+
+def _as_input_array(arr, dtype, *dtypes):
+    """
+    Convert an input of the C extension to ``dtype`` unless it already has
+    that type, or one of ``dtypes``, in any byte order: the kernels read such
+    arrays, e.g., memory-mapped big-endian FITS data, without a copy.
+
+    """
+    arr = np.asanyarray(arr)
+    if arr.dtype.newbyteorder("=") in [np.dtype(t) for t in (dtype, ) + dtypes]:
+        return arr
+    return np.asarray(arr, dtype=dtype)
+
+
+def _mosaic_extent(mosaic_shape, mosaic_origin):
+    """
+    Extent ``(x0, y0, nx, ny)`` of a mosaic passed to the C extension, or
+    `None` when the output is not a tile of a mosaic.
+
+    """
+    if mosaic_shape is None:
+        return None
+    ny, nx = (int(n) for n in mosaic_shape[-2:])
+    if nx < 1 or ny < 1:
+        raise ValueError("'mosaic_shape' must be positive.")
+    return (int(mosaic_origin[0]), int(mosaic_origin[1]), nx, ny)
+
+
+def _apply_pixmap_affine(pixmap, affine):
+    """
+    Output coordinates ``x, y`` of a pixel map with its affine correction
+    (see :py:meth:`Drizzle.add_image`) applied.
+
+    """
+    x = pixmap[..., 0]
+    y = pixmap[..., 1]
+    if affine is None:
+        return x, y
+    (a, b, c), (d, e, f) = np.asarray(affine, dtype=np.float64)
+    return a * x + b * y + c, d * x + e * y + f
+
+
+def _kernel_reach(pixmap, scale, pixfrac):
+    """
+    Conservative distance, in output pixels, from the center of an input
+    pixel to the farthest output pixel that may receive its flux: the extent
+    of the largest kernel and of one input pixel.
+
+    """
+    # largest distance between neighboring pixel centers:
+    jac = 1.0
+    for axis in (0, 1):
+        if pixmap.shape[axis] > 1:
+            step = np.abs(np.diff(pixmap[..., :2], axis=axis))
+            if np.any(np.isfinite(step)):
+                jac = max(jac, float(np.nanmax(step)))
+    return 1.0 + jac * (1.0 + pixfrac) + 3.0 * max(pixfrac, 1.2) / scale
+
+
+def schedule_tiles(footprints, out_shape, tile_shape=(1024, 1024)):
+    """
+    Find the input images that overlap each tile of an output grid and
+    estimate the number of output pixels they cover.
+
+    Footprints are indexed over a uniform grid formed by the tiles and
+    clipped to the tiles covered by their bounding boxes, so that the cost
+    scales with the number of overlaps rather than with the number of
+    images times the number of tiles.
+
+    Parameters
+    ----------
+    footprints : array-like
+        An array of shape ``(N, M, 2)`` with the coordinates ``(x, y)``, in
+        the output frame, of the ``M`` (3 or 4) vertices of the convex
+        footprint of each of the ``N`` input images. For example, the
+        output frame coordinates of the corners of the footprint returned
+        by ``calc_footprint(center=False)`` of the WCS of an input image.
+        Footprints with non-finite coordinates are ignored.
+
+    out_shape : tuple
+        Shape (`numpy` order ``(Ny, Nx)``) of the output grid.
+
+    tile_shape : tuple, optional
+        Shape (`numpy` order ``(Ty, Tx)``) of the tiles. Tiles along the
+        top and right edges of the output grid may be smaller.
+
+    Returns
+    -------
+    schedule : dict
+        A dictionary mapping indices ``(iy, ix)`` of tiles overlapped by
+        at least one footprint to pairs ``(images, npix)`` of arrays
+        holding the indices of overlapping footprints, in increasing
+        order, and the areas of the overlaps in output pixels. Tiles are
+        ordered by decreasing total area, an estimate of the cost of
+        drizzling onto them, so that handing tiles out to workers in this
+        order balances the load.
+
+    """
+    out_shape = tuple(int(n) for n in out_shape)
+    tile_shape = tuple(int(n) for n in tile_shape)
+    footprints = np.asarray(footprints, dtype=np.float64)
+    if footprints.ndim == 2:
+        footprints = footprints[None, ...]
+
+    indptr, images, npix = cdrizzle.footprint_index(
+        footprints,
+        shape=out_shape,
+        tile_shape=tile_shape,
+    )
+
+    ntx = -(-out_shape[1] // tile_shape[1])
+    tiles = np.flatnonzero(np.diff(indptr))
+    load = [np.sum(npix[indptr[t]:indptr[t + 1]]) for t in tiles]
+    return {
+        divmod(int(t), ntx): (
+            images[indptr[t]:indptr[t + 1]],
+            npix[indptr[t]:indptr[t + 1]],
+        )
+        for t in tiles[np.argsort(np.negative(load), kind="stable")]
+    }
+
+
+def blot_image(data, pixmap, pix_ratio, exptime, output_pixel_shape,
+               interp='poly5', sinscl=1.0, progress=None, cancel=None,
+               pixmap_step=1, pixmap_affine=None):
+    """
+    Resample the ``data`` input image onto an output grid defined by
+    the ``pixmap`` array. ``blot_image`` performs resampling using one of
+    the several interpolation algorithms and, unlike the "drizzle" algorithm
+    with 'square', 'turbo', and 'point' kernels, this resampling is not
+    flux-conserving.
+
+    This method works best for with well sampled images and thus it is
+    typically used to resample the output of :py:class:`Drizzle` back to the
+    coordinate grids of input images of :py:meth:`Drizzle.add_image`.
+    The output of :py:class:`Drizzle` are usually well sampled images especially
+    if it was created from a set of dithered images.
+
+    Parameters
+    ----------
+    data : 2D array
+        Input numpy array of the source image in units of 'cps'.
+
+    pixmap : 3D array
+        A mapping from input image (``data``) coordinates to resampled
+        (``out_img``) coordinates. ``pixmap`` must be an array of shape
+        ``(Ny, Nx, 2)`` where ``(Ny, Nx)`` is the shape of the input image.
+        ``pixmap[..., 0]`` forms a 2D array of X-coordinates of input
+        pixels in the ouput frame and ``pixmap[..., 1]`` forms a 2D array of
+        Y-coordinates of input pixels in the ouput coordinate frame.
+        Like in :py:meth:`Drizzle.add_image`, ``pixmap`` may be of type
+        ``numpy.float32``.
+
+    output_pixel_shape : tuple of int
+        A tuple of two integer numbers indicating the dimensions of the output
+        image ``(Nx, Ny)``.
+
+    pix_ratio : float
+        Ratio of the input image pixel scale to the ouput image pixel scale.
+
+    exptime : float
+        The exposure time of the input image.
+
+    interp : str, optional
+        The type of interpolation used in the resampling. The
+        possible values are:
+
+            - "nearest" (nearest neighbor interpolation);
+            - "linear" (bilinear interpolation);
+            - "poly3" (cubic polynomial interpolation);
+            - "poly5" (quintic polynomial interpolation);
+            - "sinc" (sinc interpolation);
+            - "lan3" (3rd order Lanczos interpolation); and
+            - "lan5" (5th order Lanczos interpolation).
+
+    sincscl : float, optional
+        The scaling factor for "sinc" interpolation.
+
+    progress : callable, None, optional
+        A function called as ``progress(done, total)`` about every 1% of
+        the rows of the output image. Blotting is cancelled when it returns
+        a true value or raises an exception (which is then propagated).
+
+    cancel : numpy.ndarray, None, optional
+        A C-contiguous ``numpy.int32`` array whose first element, when set
+        to a non-zero value, e.g., from another thread, cancels blotting at
+        the start of the next row of the output image. The first element is
+        read atomically, without ordering other memory accesses.
+
+    pixmap_step : int, optional
+        When larger than 1, ``pixmap`` is a coarse pixel map sampled every
+        ``pixmap_step`` pixels of the output image along both axes, see
+        :py:meth:`Drizzle.add_image`.
+
+    pixmap_affine : array-like, None, optional
+        A 2x3 affine correction applied on the fly to the coordinates read
+        from ``pixmap``, see :py:meth:`Drizzle.add_image`.
+
+    Returns
+    -------
+    out_img : 2D numpy.ndarray
+        A 2D numpy array containing the resampled image data.
+
+    Raises
+    ------
+    CancelledError
+        If blotting was cancelled through ``progress`` or ``cancel``.
+
+    """
+    out_img = np.zeros(output_pixel_shape[::-1], dtype=np.float32)
+
+    cdrizzle.tblot(data, pixmap, out_img, scale=pix_ratio, kscale=1.0,
+                   interp=interp, exptime=exptime, misval=0.0, sinscl=sinscl,
+                   progress=progress, cancel=cancel, pixmap_step=pixmap_step,
+                   pixmap_affine=pixmap_affine)
+
+    return out_img
+
+
+def drizzle_adjoint(image, pixmap, kernel="square", weight_map=None,
+                    wht_scale=1.0, scale=1.0, pixfrac=1.0, in_units="cps",
+                    exptime=1.0, xmin=None, xmax=None, ymin=None, ymax=None,
+                    out_origin=(0, 0), mosaic_shape=None,
+                    mosaic_origin=(0, 0)):
+    """
+    Apply the transpose (adjoint) of the drizzle operator to an output-grid
+    image, gathering it back onto the input image grid with the same
+    kernel weights that :py:meth:`Drizzle.add_image` uses to distribute
+    input flux.
+
+    Drizzling an input image ``x`` onto an empty output grid produces
+    ``out_img * out_wht = A @ x`` where ``A`` is a sparse linear operator
+    whose coefficients are the kernel overlaps multiplied by input pixel
+    weights (and by ``scale**2``). This function computes ``A.T @ image``.
+    Unlike :py:func:`blot_image`, which is an interpolator, the result
+    satisfies ``<A x, y> = <x, A.T y>`` and can therefore be used to compute
+    gradients in forward-modelling and iterative reconstruction. The adjoint
+    of the normalized operator ``x -> out_img`` (for fixed weights) is
+    obtained by passing ``image / out_wht``.
+
+    Parameters
+    ----------
+    image : 2D array
+        Output-grid image to which the adjoint is applied.
+
+    pixmap : 3D array
+        A mapping from input image coordinates to ``image`` coordinates of
+        shape ``(Ny, Nx, 2)``. See :py:meth:`Drizzle.add_image`.
+
+    kernel : str, optional
+        The name of the kernel. See :py:class:`Drizzle`.
+
+    weight_map : 2D array, None, optional
+        Input pixel weights of shape ``(Ny, Nx)``. When `None`, weights are
+        assumed to be 1.
+
+    wht_scale : float, optional
+        A scaling factor applied to the pixel by pixel weighting.
+
+    scale : float, optional
+        The pixel scale of the input image. See :py:meth:`Drizzle.add_image`.
+
+    pixfrac : float, optional
+        The fraction of a pixel that the pixel flux is confined to.
+
+    in_units : str, optional
+        The units of the input image, either "counts" or "cps".
+
+    exptime : float, optional
+        The exposure time of the input image. Used only when ``in_units``
+        is "counts".
+
+    xmin, xmax, ymin, ymax : int, None, optional
+        Bounding rectangle on the input image. See
+        :py:meth:`Drizzle.add_image`.
+
+    out_origin : tuple of int, optional
+        Pixel map coordinates ``(x0, y0)`` of the first pixel of ``image``.
+        See :py:class:`Drizzle`.
+
+    mosaic_shape : tuple, None, optional
+        Shape ``(Ny, Nx)`` of the mosaic of which ``image`` is a tile. See
+        :py:class:`Drizzle`.
+
+    mosaic_origin : tuple of int, optional
+        Pixel map coordinates ``(x0, y0)`` of the first pixel of the mosaic.
+
+    Returns
+    -------
+    adj_img : 2D numpy.ndarray
+        A ``float32`` array of shape ``(Ny, Nx)`` on the input image grid.
+        Input pixels that do not overlap the output grid are set to 0.
+
+    """
+    if kernel.lower() not in SUPPORTED_DRIZZLE_KERNELS:
+        raise ValueError(f"Kernel '{kernel}' is not supported.")
+
+    if exptime <= 0.0:
+        raise ValueError("'exptime' *must* be a strictly positive number.")
+
+    pixmap = _as_input_array(pixmap, *PIXMAP_DTYPES)
+    image = np.asarray(image, dtype=np.float32)
+    in_ymax, in_xmax = pixmap.shape[:2]
+    adj_img = np.zeros((in_ymax, in_xmax), dtype=np.float32)
+
+    if xmin is None or xmin < 0:
+        xmin = 0
+
+    if ymin is None or ymin < 0:
+        ymin = 0
+
+    if xmax is None or xmax > in_xmax - 1:
+        xmax = in_xmax - 1
+
+    if ymax is None or ymax > in_ymax - 1:
+        ymax = in_ymax - 1
+
+    if weight_map is not None:
+        weight_map = np.asarray(weight_map, dtype=np.float32)
+
+    cdrizzle.tdriz_adjoint(
+        input=adj_img,
+        weights=weight_map,
+        pixmap=pixmap,
+        output=image,
+        xmin=xmin,
+        xmax=xmax,
+        ymin=ymin,
+        ymax=ymax,
+        scale=scale,
+        pixfrac=pixfrac,
+        kernel=kernel,
+        in_units=in_units,
+        expscale=exptime,
+        wtscale=wht_scale,
+        out_x0=int(out_origin[0]),
+        out_y0=int(out_origin[1]),
+        mosaic=_mosaic_extent(mosaic_shape, mosaic_origin),
+    )
+
+    return adj_img
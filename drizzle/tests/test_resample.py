@@ -1223,3 +1223,1276 @@ def test_nan_fillval(fillval):
     )
 
     assert np.all(np.isnan(driz.out_img))
+
+
+@pytest.mark.filterwarnings("ignore:Kernel .* is not a flux-conserving kernel")
+@pytest.mark.parametrize(
+    'kernel', ['square', 'point', 'turbo', 'gaussian', 'lanczos3'],
+)
+def test_overlap_matrix_matches_add_image(kernel):
+    in_shape = (60, 50)
+    out_shape = (70, 65)
+    rng = np.random.default_rng(1)
+
+    # rotated, scaled and mildly distorted pixel map:
+    y, x = np.indices(in_shape, dtype=np.float64)
+    c, s = np.cos(0.3), np.sin(0.3)
+    xp = 1.1 * (c * x - s * y) + 25.0 + 1.0e-3 * x * y
+    yp = 1.1 * (s * x + c * y) + 5.0
+    pixmap = np.dstack([xp, yp])
+
+    overlaps = resample.OverlapMatrix.from_pixmap(
+        pixmap, out_shape, kernel=kernel, pixfrac=0.8, scale=0.9
+    )
+    assert overlaps.nnz > 0
+
+    driz = resample.Drizzle(kernel=kernel, out_shape=out_shape)
+    driz_ovr = resample.Drizzle(kernel=kernel, out_shape=out_shape)
+
+    for in_units in ['cps', 'counts']:
+        data = rng.normal(10.0, 1.0, in_shape).astype(np.float32)
+        wht = rng.uniform(0.5, 1.5, in_shape).astype(np.float32)
+
+        nmiss, nskip = driz.add_image(
+            data.copy(), exptime=2.0, pixmap=pixmap, weight_map=wht,
+            pixfrac=0.8, scale=0.9, in_units=in_units,
+        )
+        assert (nmiss, nskip) == driz_ovr.add_image_overlaps(
+            data, exptime=2.0, overlaps=overlaps, weight_map=wht,
+            in_units=in_units,
+        )
+
+    assert np.array_equal(driz.out_ctx, driz_ovr.out_ctx)
+    assert np.allclose(driz.out_wht, driz_ovr.out_wht, rtol=1e-6, atol=0)
+    assert np.allclose(driz.out_img, driz_ovr.out_img, rtol=1e-5, atol=0,
+                       equal_nan=True)
+    assert driz.total_exptime == driz_ovr.total_exptime
+
+
+def test_overlap_matrix_save_load(tmp_path):
+    in_shape = (20, 25)
+    y, x = np.indices(in_shape, dtype=np.float64)
+    pixmap = np.dstack([x + 0.3, y - 0.4])
+
+    overlaps = resample.OverlapMatrix.from_pixmap(pixmap, in_shape)
+    fname = str(tmp_path / "overlaps.npz")
+    overlaps.save(fname)
+    loaded = resample.OverlapMatrix.load(fname)
+
+    assert loaded.in_shape == overlaps.in_shape
+    assert loaded.out_shape == overlaps.out_shape
+    assert loaded.kernel == overlaps.kernel
+    assert loaded.scale == overlaps.scale
+    assert np.array_equal(loaded.indptr, overlaps.indptr)
+    assert np.array_equal(loaded.indices, overlaps.indices)
+    assert np.array_equal(loaded.weights, overlaps.weights)
+
+    # a Drizzle object without output shape takes it from the matrix:
+    driz = resample.Drizzle()
+    driz.add_image_overlaps(np.ones(in_shape), exptime=1.0, overlaps=loaded)
+    assert driz.out_img.shape == in_shape
+    assert np.allclose(driz.out_img[1:-1, 1:-1], 1.0, rtol=1e-6, atol=0)
+
+    with pytest.raises(ValueError):
+        resample.Drizzle(kernel="point").add_image_overlaps(
+            np.ones(in_shape), exptime=1.0, overlaps=loaded
+        )
+
+    # the output origin and mosaic are part of the matrix:
+    overlaps = resample.OverlapMatrix.from_pixmap(
+        pixmap + 10, in_shape, out_origin=(10, 10), mosaic_shape=(30, 40),
+        mosaic_origin=(5, 5),
+    )
+    overlaps.save(fname)
+    loaded = resample.OverlapMatrix.load(fname)
+    assert loaded.out_origin == (10, 10)
+    assert loaded.mosaic == (5, 5, 40, 30)
+
+    driz = resample.Drizzle(out_shape=in_shape, out_origin=(10, 10),
+                            mosaic_shape=(30, 40), mosaic_origin=(5, 5))
+    driz.add_image_overlaps(np.ones(in_shape), exptime=1.0, overlaps=loaded)
+    ref = resample.Drizzle(out_shape=in_shape, out_origin=(10, 10),
+                           mosaic_shape=(30, 40), mosaic_origin=(5, 5))
+    ref.add_image(np.ones(in_shape), exptime=1.0, pixmap=pixmap + 10)
+    assert np.allclose(driz.out_wht, ref.out_wht, rtol=1e-6, atol=0)
+
+    for kwargs in [{}, {"out_origin": (10, 10)}]:
+        driz = resample.Drizzle(out_shape=in_shape, **kwargs)
+        with pytest.raises(ValueError):
+            driz.add_image_overlaps(np.ones(in_shape), exptime=1.0,
+                                    overlaps=loaded)
+
+    # row pointers of a corrupted matrix must not index past its overlaps:
+    indptr = overlaps.indptr.copy()
+    indptr[5] = indptr[-1] + 100
+    with pytest.raises(ValueError):
+        resample.OverlapMatrix(indptr, overlaps.indices, overlaps.weights,
+                               in_shape, in_shape)
+    with pytest.raises(ValueError):
+        cdrizzle.tdriz_overlaps(
+            np.ones(in_shape, dtype=np.float32), None, indptr,
+            overlaps.indices, overlaps.weights,
+            np.zeros(in_shape, dtype=np.float32),
+            np.zeros(in_shape, dtype=np.float32), None,
+        )
+
+    # the context image must have the shape of the output image:
+    with pytest.raises(ValueError):
+        cdrizzle.tdriz_overlaps(
+            np.ones(in_shape, dtype=np.float32), None, overlaps.indptr,
+            overlaps.indices, overlaps.weights,
+            np.zeros(in_shape, dtype=np.float32),
+            np.zeros(in_shape, dtype=np.float32),
+            np.zeros((2, 2), dtype=np.int32),
+        )
+
+
+@pytest.mark.filterwarnings("ignore:Kernel .* is not a flux-conserving kernel")
+@pytest.mark.parametrize(
+    'kernel', ['square', 'point', 'turbo', 'gaussian', 'lanczos2'],
+)
+@pytest.mark.parametrize('in_units', ['cps', 'counts'])
+def test_drizzle_adjoint_dot_product(kernel, in_units):
+    in_shape = (40, 45)
+    out_shape = (52, 50)
+    rng = np.random.default_rng(7)
+
+    y, x = np.indices(in_shape, dtype=np.float64)
+    c, s = np.cos(0.2), np.sin(0.2)
+    xp = 1.05 * (c * x - s * y) + 10.0 + 2.0e-3 * x * y
+    yp = 1.05 * (s * x + c * y) + 2.0
+    pixmap = np.dstack([xp, yp])
+
+    x_in = rng.normal(size=in_shape).astype(np.float32)
+    wht = rng.uniform(0.5, 2.0, in_shape).astype(np.float32)
+    y_out = rng.normal(size=out_shape).astype(np.float32)
+
+    # forward operator: numerator of the weighted mean drizzled onto an
+    # empty output grid
+    driz = resample.Drizzle(kernel=kernel, out_shape=out_shape, fillval=0)
+    driz.add_image(x_in.copy(), exptime=2.5, pixmap=pixmap, weight_map=wht,
+                   scale=0.8, pixfrac=0.7, in_units=in_units)
+    ax = driz.out_img.astype(np.float64) * driz.out_wht
+
+    aty = resample.drizzle_adjoint(
+        y_out, pixmap, kernel=kernel, weight_map=wht, scale=0.8, pixfrac=0.7,
+        in_units=in_units, exptime=2.5,
+    )
+    assert aty.shape == in_shape
+
+    lhs = np.sum(ax * y_out)
+    rhs = np.sum(x_in.astype(np.float64) * aty)
+    assert np.isclose(lhs, rhs, rtol=1e-4, atol=1e-4 * np.abs(ax).max())
+
+
+def test_drizzle_cube_single_plane_matches_image():
+    in_shape = (30, 40)
+    out_shape = (36, 44)
+    rng = np.random.default_rng(3)
+    data = rng.uniform(1.0, 2.0, in_shape).astype(np.float32)
+
+    y, x = np.indices(in_shape, dtype=np.float64)
+    xp = 1.02 * x + 1.3 + 0.01 * y
+    yp = 0.98 * y + 2.1
+    pixmap = np.dstack([xp, yp])
+    # all input pixels fall into wavelength plane 2 of the cube:
+    pixmap3 = np.dstack([xp, yp, np.full(in_shape, 2.0)])
+
+    driz = resample.Drizzle(out_shape=out_shape)
+    driz.add_image(data, exptime=1.0, pixmap=pixmap, pixfrac=0.9)
+
+    cube = resample.Drizzle(out_shape=(4, ) + out_shape)
+    cube.add_image(data, exptime=1.0, pixmap=pixmap3, pixfrac=0.9)
+
+    assert cube.out_img.shape == (4, ) + out_shape
+    assert cube.out_ctx.shape == (1, 4) + out_shape
+    assert np.allclose(cube.out_img[2], driz.out_img, equal_nan=True)
+    assert np.array_equal(cube.out_wht[2], driz.out_wht)
+    assert np.array_equal(cube.out_ctx[0, 2], driz.out_ctx[0])
+    assert np.all(np.isnan(cube.out_img[[0, 1, 3]]))
+    assert not np.any(cube.out_wht[[0, 1, 3]])
+
+
+def test_drizzle_cube_flux_conservation():
+    in_shape = (25, 60)
+    out_shape = (24, 30, 30)
+    rng = np.random.default_rng(5)
+    data = rng.uniform(0.5, 1.5, in_shape).astype(np.float32)
+
+    # dispersion along x: 3 input pixels per wavelength plane plus a tilt
+    y, x = np.indices(in_shape, dtype=np.float64)
+    pixmap = np.dstack([0.4 * x + 3.0, y + 2.0, x / 3.0 + 0.05 * y])
+
+    cube = resample.Drizzle(out_shape=out_shape, fillval=0)
+    cube.add_image(data, exptime=1.0, pixmap=pixmap)
+
+    assert np.isclose(
+        np.sum(cube.out_img.astype(np.float64) * cube.out_wht),
+        np.sum(data, dtype=np.float64),
+        rtol=1e-5,
+    )
+    # flux is split among several planes:
+    assert np.count_nonzero(cube.out_wht.sum(axis=(1, 2))) > 10
+
+    with pytest.raises(ValueError):
+        resample.Drizzle(kernel="point", out_shape=out_shape).add_image(
+            data, exptime=1.0, pixmap=pixmap
+        )
+    with pytest.raises(ValueError):
+        resample.Drizzle(out_shape=out_shape).add_image(
+            data, exptime=1.0, pixmap=pixmap[..., :2]
+        )
+
+
+@pytest.mark.parametrize("kernel", ["square", "turbo", "point"])
+@pytest.mark.parametrize("nthreads", [1, 4])
+def test_add_images_matches_add_image(kernel, nthreads):
+    in_shape = (20, 25)
+    out_shape = (40, 45)
+    nimages = 40
+    rng = np.random.default_rng(7)
+
+    data = rng.normal(10.0, 1.0, (nimages, ) + in_shape).astype(np.float32)
+    data_orig = data.copy()
+    wht = rng.uniform(0.5, 1.5, (nimages, ) + in_shape).astype(np.float32)
+    exptime = rng.uniform(1.0, 3.0, nimages)
+    y, x = np.indices(in_shape, dtype=np.float64)
+    pixmaps = [
+        np.dstack([x + dx, 1.05 * y + dy])
+        for dx, dy in rng.uniform(0.0, 18.0, (nimages, 2))
+    ]
+
+    driz = resample.Drizzle(kernel=kernel, out_shape=out_shape)
+    for k in range(nimages):
+        driz.add_image(data[k], exptime=exptime[k], pixmap=pixmaps[k],
+                       weight_map=wht[k], pixfrac=0.7, in_units="counts")
+
+    batch = resample.Drizzle(kernel=kernel, out_shape=out_shape)
+    nmiss, nskip = batch.add_images(
+        data, exptime=exptime, pixmap=pixmaps, weight_map=wht, pixfrac=0.7,
+        in_units="counts", nthreads=nthreads,
+    )
+    assert nmiss.shape == nskip.shape == (nimages, )
+
+    assert batch.ctx_id == driz.ctx_id == nimages
+    assert batch.out_ctx.shape == (2, ) + out_shape
+    assert np.array_equal(batch.out_ctx, driz.out_ctx)
+    assert np.allclose(batch.out_wht, driz.out_wht, rtol=1e-5, atol=0)
+    assert np.allclose(batch.out_img, driz.out_img, rtol=1e-5, atol=0,
+                       equal_nan=True)
+    assert np.isclose(batch.total_exptime, driz.total_exptime)
+    # input images must not be modified when drizzling counts:
+    assert np.array_equal(data, data_orig)
+
+
+@pytest.mark.parametrize("nthreads", [1, 3])
+def test_add_frames_stack_and_coadd(nthreads):
+    in_shape = (20, 25)
+    out_shape = (40, 45)
+    nframes = 35
+    rng = np.random.default_rng(11)
+
+    data = rng.normal(10.0, 1.0, (nframes, ) + in_shape).astype(np.float32)
+    wht = rng.uniform(0.5, 1.5, (nframes, ) + in_shape).astype(np.float32)
+    y, x = np.indices(in_shape, dtype=np.float64)
+    pixmaps = [
+        np.dstack([x + dx, 0.95 * y + dy])
+        for dx, dy in rng.uniform(0.0, 18.0, (nframes, 2))
+    ]
+
+    driz = resample.Drizzle(out_shape=out_shape)
+    stack = resample.Drizzle(out_shape=out_shape)
+    frames_img, frames_wht, nmiss, nskip = stack.add_frames(
+        data, exptime=2.0, pixmap=pixmaps, weight_map=wht, pixfrac=0.8,
+        in_units="counts", nthreads=nthreads,
+    )
+    assert frames_img.shape == frames_wht.shape == (nframes, ) + out_shape
+
+    for k in range(nframes):
+        frame = resample.Drizzle(out_shape=out_shape, disable_ctx=True)
+        frame.add_image(data[k], exptime=2.0, pixmap=pixmaps[k],
+                        weight_map=wht[k], pixfrac=0.8, in_units="counts")
+        assert np.array_equal(frames_wht[k], frame.out_wht)
+        assert np.allclose(frames_img[k], frame.out_img, equal_nan=True)
+
+        assert (nmiss[k], nskip[k]) == driz.add_image(
+            data[k], exptime=2.0, pixmap=pixmaps[k], weight_map=wht[k],
+            pixfrac=0.8, in_units="counts",
+        )
+
+    assert np.array_equal(stack.out_ctx, driz.out_ctx)
+    assert np.allclose(stack.out_wht, driz.out_wht, rtol=1e-5, atol=0)
+    assert np.allclose(stack.out_img, driz.out_img, rtol=1e-5, atol=0,
+                       equal_nan=True)
+    assert stack.total_exptime == driz.total_exptime
+
+    # frames only, without touching the co-add:
+    frames_img2 = stack.add_frames(
+        data[:3], exptime=2.0, pixmap=pixmaps[:3], weight_map=wht[:3],
+        pixfrac=0.8, in_units="counts", coadd=False,
+    )[0]
+    assert np.allclose(frames_img2, frames_img[:3], equal_nan=True)
+    assert stack.ctx_id == nframes
+
+
+@pytest.mark.parametrize("kernel", ["square", "turbo", "gaussian"])
+def test_drizzle_tiles_match_mosaic(kernel):
+    in_shape = (30, 35)
+    out_shape = (48, 50)
+    rng = np.random.default_rng(5)
+
+    data = rng.normal(10.0, 1.0, in_shape).astype(np.float32)
+    wht = rng.uniform(0.5, 1.5, in_shape).astype(np.float32)
+    y, x = np.indices(in_shape, dtype=np.float64)
+    # exactly representable coefficients so that subtracting the origin
+    # does not round output coordinates:
+    pixmap = np.dstack([
+        1.125 * x + 0.25 * y + 3.25,
+        1.25 * y - 0.125 * x + 6.5,
+    ])
+    pixmap_orig = pixmap.copy()
+
+    mosaic = resample.Drizzle(kernel=kernel, out_shape=out_shape)
+    mosaic.add_image(data, exptime=1.0, pixmap=pixmap, weight_map=wht,
+                     pixfrac=0.75)
+
+    tile_shape = (20, 19)
+    for y0 in range(0, out_shape[0], tile_shape[0]):
+        for x0 in range(0, out_shape[1], tile_shape[1]):
+            cut = np.s_[y0:y0 + tile_shape[0], x0:x0 + tile_shape[1]]
+            shape = mosaic.out_wht[cut].shape
+            tile = resample.Drizzle(kernel=kernel, out_shape=shape,
+                                    out_origin=(x0, y0),
+                                    mosaic_shape=out_shape)
+            assert tile.out_origin == (x0, y0)
+            tile.add_image(data, exptime=1.0, pixmap=pixmap, weight_map=wht,
+                           pixfrac=0.75)
+            assert np.array_equal(tile.out_ctx[0], mosaic.out_ctx[0][cut])
+            assert np.allclose(tile.out_wht, mosaic.out_wht[cut],
+                               rtol=1e-5, atol=1e-6)
+            assert np.allclose(tile.out_img, mosaic.out_img[cut],
+                               rtol=1e-5, atol=1e-5, equal_nan=True)
+
+            if kernel == "square":
+                overlaps = resample.OverlapMatrix.from_pixmap(
+                    pixmap, shape, pixfrac=0.75, out_origin=(x0, y0),
+                    mosaic_shape=out_shape
+                )
+                replay = resample.Drizzle(out_shape=shape,
+                                          out_origin=(x0, y0),
+                                          mosaic_shape=out_shape)
+                replay.add_image_overlaps(data, 1.0, overlaps,
+                                          weight_map=wht)
+                assert np.allclose(replay.out_wht, tile.out_wht, rtol=1e-5,
+                                   atol=1e-6)
+
+    assert np.array_equal(pixmap, pixmap_orig)
+
+
+def test_drizzle_derived_out_origin():
+    in_shape = (20, 20)
+    y, x = np.indices(in_shape, dtype=np.float64)
+    pixmap = np.dstack([x + 5.5, y - 3.25])
+    data = np.ones(in_shape, dtype=np.float32)
+
+    # the output grid derived from the first pixel map keeps its origin for
+    # the following images:
+    driz = resample.Drizzle()
+    driz.add_image(data, exptime=1.0, pixmap=pixmap)
+    assert driz.out_origin == (5, -4)
+    wht = driz.out_wht.copy()
+    driz.add_image(data, exptime=1.0, pixmap=pixmap)
+    assert np.allclose(driz.out_wht, 2 * wht, rtol=1e-6, atol=0)
+
+    with pytest.raises(ValueError):
+        resample.Drizzle(out_origin=(3, 4)).add_image(
+            data, exptime=1.0, pixmap=pixmap
+        )
+
+
+@pytest.mark.parametrize(
+    "kernel, coeffs, expected",
+    [
+        ("square", [1.0, 0.0, 10.3, 0.0, 1.0, -5.6],
+         (840, 5, 1120, 66.125, 1746.2078)),
+        ("point", [0.9, 0.2, 3.7, -0.2, 0.9, 1.2],
+         (589, 0, 1113, 60.0, 2174.93)),
+        ("turbo", [1.0, 0.0, -7.4, 0.0, 1.0, 12.45],
+         (574, 7, 1386, 94.539062, 2158.5612)),
+        ("gaussian", [1.1, -0.1, -4.2, 0.1, 1.1, 8.8],
+         (810, 8, 1480, 67.307002, 1750.3244)),
+    ]
+)
+def test_drizzle_output_edges_unchanged(kernel, coeffs, expected):
+    # input pixels are selected with the exact output window when the output
+    # is not a tile of a mosaic: values are those of drizzle 2.0
+    in_shape = (40, 50)
+    y, x = np.indices(in_shape, dtype=np.float64)
+    data = (1.0 + 0.01 * x + 0.02 * y).astype(np.float32)
+    a, b, c, d, e, f = coeffs
+    pixmap = np.dstack([a * x + b * y + c, d * x + e * y + f])
+
+    driz = resample.Drizzle(kernel=kernel, out_shape=(45, 42))
+    nmiss, nskip = driz.add_image(data, exptime=1.0, pixmap=pixmap,
+                                  pixfrac=0.8)
+
+    wht = driz.out_wht.astype(np.float64)
+    edges = wht[0].sum() + wht[-1].sum() + wht[:, 0].sum() + wht[:, -1].sum()
+    flux = np.sum(np.nan_to_num(driz.out_img) * wht)
+    assert (nmiss, nskip, np.count_nonzero(wht)) == expected[:3]
+    assert np.allclose([edges, flux], expected[3:], rtol=1e-6, atol=0)
+
+
+@pytest.mark.parametrize("kernel", ["square", "lanczos3"])
+def test_tiled_drizzle_matches_dense(kernel):
+    out_shape = (300, 420)
+    in_shape = (40, 45)
+    rng = np.random.default_rng(3)
+    y, x = np.indices(in_shape, dtype=np.float64)
+
+    # a few sparse pointings, one of them partially off the output grid:
+    offsets = [(10.2, 5.7), (13.1, 9.9), (250.4, 120.3), (390.6, 270.1)]
+    tiled = resample.TiledDrizzle(out_shape, tile_shape=(64, 64),
+                                  kernel=kernel)
+    dense = resample.Drizzle(kernel=kernel, out_shape=out_shape)
+
+    for k, (dx, dy) in enumerate(offsets):
+        data = rng.normal(10.0, 1.0, in_shape).astype(np.float32)
+        pixmap = np.dstack([1.1 * x + 0.1 * y + dx, 1.1 * y - 0.1 * x + dy])
+        ntiles = tiled.add_image(data, exptime=1.5, pixmap=pixmap,
+                                 pixfrac=0.7)
+        assert ntiles > 0
+        dense.add_image(data, exptime=1.5, pixmap=pixmap, pixfrac=0.7)
+
+    assert tiled.ctx_id == dense.ctx_id == len(offsets)
+    assert tiled.total_exptime == dense.total_exptime
+    assert len(tiled.tiles) < 0.25 * 5 * 7
+    assert tiled.nbytes < 0.25 * (dense.out_img.nbytes +
+                                  dense.out_wht.nbytes + dense.out_ctx.nbytes)
+
+    out_img, out_wht, out_ctx = tiled.to_dense()
+    assert np.array_equal(out_ctx, dense.out_ctx)
+    assert np.allclose(out_wht, dense.out_wht, rtol=1e-5, atol=1e-6)
+    assert np.allclose(out_img, dense.out_img, rtol=1e-5, atol=1e-5,
+                       equal_nan=True)
+
+
+def test_tiled_drizzle_out_of_core(tmp_path):
+    out_shape = (200, 260)
+    in_shape = (40, 45)
+    rng = np.random.default_rng(9)
+    y, x = np.indices(in_shape, dtype=np.float64)
+
+    offsets = rng.uniform(0.0, 210.0, (12, 2))
+    images = rng.normal(10.0, 1.0, (len(offsets), ) + in_shape)
+    pixmaps = [
+        np.dstack([1.05 * x + 0.1 * y + dx, 1.05 * y - 0.1 * x + dy])
+        for dx, dy in offsets
+    ]
+
+    memory = resample.TiledDrizzle(out_shape, tile_shape=(50, 50))
+    order = memory.order_inputs(pixmaps)
+    assert sorted(order) == list(range(len(pixmaps)))
+    for k in order:
+        memory.add_image(images[k], exptime=1.0, pixmap=pixmaps[k])
+
+    with resample.TiledDrizzle(out_shape, tile_shape=(50, 50),
+                               tile_dir=tmp_path, max_resident=2) as ooc:
+        for n, k in enumerate(order):
+            ooc.add_image(images[k], exptime=1.0, pixmap=pixmaps[k])
+            assert len(ooc.tiles) <= 2
+            if n + 1 < len(order):
+                ooc.prefetch(ooc.tile_indices)
+
+        assert ooc.tile_indices == sorted(memory.tiles)
+        assert ooc.ctx_id == memory.ctx_id
+
+        out_img = np.lib.format.open_memmap(
+            tmp_path / "img.npy", mode="w+", dtype=np.float32,
+            shape=out_shape,
+        )
+        out_wht = np.lib.format.open_memmap(
+            tmp_path / "wht.npy", mode="w+", dtype=np.float32,
+            shape=out_shape,
+        )
+        out_ctx = np.zeros((1, ) + out_shape, dtype=np.int32)
+        ooc.to_dense(out_img=out_img, out_wht=out_wht, out_ctx=out_ctx)
+        assert len(ooc.tiles) <= 2
+
+    assert len(list(tmp_path.glob("tile_*.npz"))) == len(memory.tiles)
+
+    ref_img, ref_wht, ref_ctx = memory.to_dense()
+    assert np.array_equal(out_ctx, ref_ctx)
+    assert np.array_equal(out_wht, ref_wht)
+    assert np.array_equal(out_img, ref_img, equal_nan=True)
+
+
+@pytest.mark.parametrize("nthreads", [1, 3])
+def test_drizzle_merge(nthreads):
+    in_shape = (20, 25)
+    out_shape = (40, 45)
+    nimages = 40
+    rng = np.random.default_rng(13)
+
+    data = rng.normal(10.0, 1.0, (nimages, ) + in_shape).astype(np.float32)
+    y, x = np.indices(in_shape, dtype=np.float64)
+    pixmaps = [
+        np.dstack([x + dx, 1.05 * y + dy])
+        for dx, dy in rng.uniform(0.0, 18.0, (nimages, 2))
+    ]
+
+    driz = resample.Drizzle(out_shape=out_shape)
+    for k in range(nimages):
+        driz.add_image(data[k], exptime=1.5, pixmap=pixmaps[k])
+
+    # split inputs in subsets whose sizes are not multiples of 32 so that
+    # renumbered context IDs straddle context planes:
+    subsets = np.array_split(np.arange(nimages), 3)
+    parts = []
+    for subset in subsets:
+        part = resample.Drizzle(out_shape=out_shape)
+        for k in subset:
+            part.add_image(data[k], exptime=1.5, pixmap=pixmaps[k])
+        parts.append(part)
+
+    merged = parts[0]
+    for part in parts[1:]:
+        merged.merge(part, nthreads=nthreads)
+
+    assert merged.ctx_id == nimages
+    assert merged.total_exptime == driz.total_exptime
+    assert np.array_equal(merged.out_ctx, driz.out_ctx)
+    assert np.allclose(merged.out_wht, driz.out_wht, rtol=1e-5, atol=0)
+    assert np.allclose(merged.out_img, driz.out_img, rtol=1e-5, atol=0,
+                       equal_nan=True)
+
+    # pre-assigned context ID ranges, merged in any order:
+    empty = resample.Drizzle(out_shape=out_shape)
+    for subset in subsets[::-1]:
+        part = resample.Drizzle(out_shape=out_shape,
+                                begin_ctx_id=int(subset[0]))
+        for k in subset:
+            part.add_image(data[k], exptime=1.5, pixmap=pixmaps[k])
+        empty.merge(part, ctx_offset=0, nthreads=nthreads)
+    assert empty.ctx_id == nimages
+    assert np.array_equal(empty.out_ctx, driz.out_ctx)
+    assert np.allclose(empty.out_wht, driz.out_wht, rtol=1e-5, atol=0)
+
+    with pytest.raises(ValueError):
+        driz.merge(resample.Drizzle(out_shape=(40, 40), disable_ctx=True))
+    with pytest.raises(ValueError):
+        driz.merge(resample.Drizzle(out_shape=(40, 40)))
+    with pytest.raises(ValueError):
+        driz.merge(resample.Drizzle(out_shape=out_shape, out_origin=(1, 0)))
+
+    # context IDs must fit in the planes of the output context:
+    shape = (4, 5)
+    arrays = [np.zeros(shape, dtype=np.float32) for _ in range(4)]
+    out_ctx = np.zeros((1, ) + shape, dtype=np.int32)
+    other_ctx = np.zeros((1, ) + shape, dtype=np.int32)
+    other_ctx[0, 1, 2] = 1 << 30
+    cdrizzle.merge(arrays[0], arrays[1], out_ctx, arrays[2], arrays[3],
+                   other_ctx, ctx_offset=1)
+    assert out_ctx.view(np.uint32)[0, 1, 2] == 1 << 31
+    with pytest.raises(ValueError):
+        cdrizzle.merge(arrays[0], arrays[1], out_ctx, arrays[2], arrays[3],
+                       other_ctx, ctx_offset=2)
+
+    # an empty object adopts the origin of the merged one:
+    shifted = resample.Drizzle(out_shape=out_shape, out_origin=(-3, 2))
+    shifted.add_image(data[0], exptime=1.5, pixmap=pixmaps[0])
+    empty = resample.Drizzle()
+    empty.merge(shifted)
+    assert empty.out_origin == (-3, 2)
+    assert np.array_equal(empty.out_wht, shifted.out_wht)
+
+
+def test_drizzle_checkpoint_resume(tmp_path):
+    in_shape = (20, 25)
+    out_shape = (40, 45)
+    nimages = 40
+    rng = np.random.default_rng(17)
+
+    data = rng.normal(10.0, 1.0, (nimages, ) + in_shape).astype(np.float32)
+    y, x = np.indices(in_shape, dtype=np.float64)
+    pixmaps = [
+        np.dstack([x + dx, 1.05 * y + dy])
+        for dx, dy in rng.uniform(0.0, 18.0, (nimages, 2))
+    ]
+    names = [f"image_{k}.fits" for k in range(nimages)]
+
+    driz = resample.Drizzle(out_shape=out_shape, fillval=0)
+    for k in range(nimages):
+        driz.add_image(data[k], exptime=1.5, pixmap=pixmaps[k])
+
+    path = tmp_path / "checkpoint"
+    part = resample.Drizzle(out_shape=out_shape, fillval=0)
+    for k in range(nimages):
+        if k == 25:
+            part.checkpoint(path, inputs=names[:k])
+        part.add_image(data[k], exptime=1.5, pixmap=pixmaps[k])
+        if k == 30:
+            # preempted: restart from the last checkpoint
+            break
+
+    resumed, done = resample.Drizzle.resume(path)
+    assert done == names[:25]
+    assert resumed.ctx_id == 25
+    assert resumed.fillval == driz.fillval
+    assert resumed.total_exptime == 25 * 1.5
+    for k in range(nimages):
+        if names[k] not in done:
+            resumed.add_image(data[k], exptime=1.5, pixmap=pixmaps[k])
+
+    assert resumed.ctx_id == nimages
+    assert resumed.total_exptime == driz.total_exptime
+    assert np.array_equal(resumed.out_ctx, driz.out_ctx)
+    assert np.array_equal(resumed.out_wht, driz.out_wht)
+    assert np.array_equal(resumed.out_img, driz.out_img)
+
+    # copy-on-write maps leave the checkpoint unchanged:
+    again, done = resample.Drizzle.resume(path, mmap_mode=None)
+    assert again.ctx_id == 25
+    assert again.out_ctx.shape[0] == 1
+
+    # an interrupted replacement falls back to the previous checkpoint:
+    os.replace(path, str(path) + ".old")
+    again, done = resample.Drizzle.resume(path)
+    assert done == names[:25]
+
+    # state of an empty object:
+    resample.Drizzle(disable_ctx=True).checkpoint(path)
+    empty, done = resample.Drizzle.resume(path)
+    assert done == []
+    assert empty.out_img is None
+    assert empty.ctx_id is None
+
+
+def test_schedule_tiles():
+    out_shape = (230, 310)
+    tile_shape = (50, 64)
+    rng = np.random.default_rng(23)
+
+    # rotated and sheared rectangles, some partially or fully off the grid:
+    footprints = []
+    for x0, y0, w, h, a in zip(rng.uniform(-60, 330, 60),
+                               rng.uniform(-60, 250, 60),
+                               rng.uniform(5, 120, 60),
+                               rng.uniform(5, 90, 60),
+                               rng.uniform(0, np.pi, 60)):
+        c, s = np.cos(a), np.sin(a)
+        corners = np.array([[0, 0], [w, 0], [w, h], [0, h]])
+        footprints.append(corners @ np.array([[c, s], [-s, c]]) + [x0, y0])
+    footprints.append(np.full((4, 2), np.nan))
+    footprints = np.array(footprints)
+
+    schedule = resample.schedule_tiles(footprints, out_shape, tile_shape)
+
+    def poly_area(p):
+        p = np.asarray(p)
+        if len(p) < 3:
+            return 0.0
+        x, y = p[:, 0], p[:, 1]
+        return 0.5 * abs(np.dot(x, np.roll(y, -1)) - np.dot(y, np.roll(x, -1)))
+
+    # brute force over all tiles and footprints:
+    expected = {}
+    for iy in range(-(-out_shape[0] // tile_shape[0])):
+        for ix in range(-(-out_shape[1] // tile_shape[1])):
+            x1, y1 = ix * tile_shape[1] - 0.5, iy * tile_shape[0] - 0.5
+            x2 = min((ix + 1) * tile_shape[1], out_shape[1]) - 0.5
+            y2 = min((iy + 1) * tile_shape[0], out_shape[0]) - 0.5
+            window = [(x1, y1), (x2, y1), (x2, y2), (x1, y2)]
+            for k, fp in enumerate(footprints[:-1]):
+                a = poly_area(cdrizzle.clip_polygon(fp, window))
+                if a > 0:
+                    expected.setdefault((iy, ix), []).append((k, a))
+
+    assert set(schedule) == set(expected)
+    for tile, (images, npix) in schedule.items():
+        k, a = zip(*expected[tile])
+        assert np.array_equal(images, k)
+        assert np.allclose(npix, a, rtol=1e-12, atol=1e-9)
+
+    # tiles are ordered by decreasing load:
+    load = [np.sum(npix) for images, npix in schedule.values()]
+    assert np.all(np.diff(load) <= 0)
+
+    tdriz = resample.TiledDrizzle(out_shape, tile_shape=tile_shape)
+    assert list(tdriz.schedule(footprints)) == list(schedule)
+
+    with pytest.raises(ValueError):
+        resample.schedule_tiles(footprints[:, :2], out_shape, tile_shape)
+
+
+def test_parallel_drizzle():
+    in_shape = (20, 25)
+    out_shape = (40, 45)
+    nimages = 40
+    rng = np.random.default_rng(29)
+
+    data = rng.normal(10.0, 1.0, (nimages, ) + in_shape).astype(np.float32)
+    y, x = np.indices(in_shape, dtype=np.float64)
+    pixmaps = [
+        np.dstack([x + dx, 1.05 * y + dy])
+        for dx, dy in rng.uniform(0.0, 18.0, (nimages, 2))
+    ]
+
+    driz = resample.Drizzle(out_shape=out_shape, fillval=0)
+    ref = [
+        driz.add_image(data[k], exptime=1.5, pixmap=pixmaps[k])
+        for k in range(nimages)
+    ]
+
+    # more than 32 images grow the context image in shared memory:
+    with resample.ParallelDrizzle(out_shape=out_shape, fillval=0,
+                                  nworkers=2, nbands=5) as pdriz:
+        futures = [
+            pdriz.submit(data[k], exptime=1.5, pixmap=pixmaps[k])
+            for k in range(nimages)
+        ]
+        for future, (nmiss, nskip) in zip(futures, ref):
+            # pixels straddling two bands count as hits in both:
+            assert future.result()[0] <= nmiss
+            assert future.result()[1] == nskip
+        assert pdriz.ctx_id == nimages
+        assert pdriz.total_exptime == driz.total_exptime
+        assert np.array_equal(pdriz.out_ctx[:2], driz.out_ctx)
+        assert not np.any(pdriz.out_ctx[2:])
+
+    # images are combined in a different order:
+    assert np.allclose(pdriz.out_wht, driz.out_wht, rtol=1e-5, atol=0)
+    assert np.allclose(pdriz.out_img, driz.out_img, rtol=1e-5, atol=0)
+
+    with pytest.raises(ValueError):
+        pdriz.add_image(data[0], exptime=1.5, pixmap=pixmaps[0])
+    with pytest.raises(ValueError):
+        resample.ParallelDrizzle()
+
+    # lines that miss the output are skipped, whatever the correction:
+    affine = [[1.0, 0.0, 2.0], [0.0, 1.0, 30.0]]
+    driz = resample.Drizzle(out_shape=out_shape, kernel="point")
+    nmiss, nskip = driz.add_image(data[0], exptime=1.5, pixmap=pixmaps[0],
+                                  pixmap_affine=affine)
+    assert nskip > 0
+    with resample.ParallelDrizzle(out_shape=out_shape, kernel="point",
+                                  nworkers=1, nbands=3) as pdriz:
+        assert pdriz.add_image(data[0], exptime=1.5, pixmap=pixmaps[0],
+                               pixmap_affine=affine) == (nmiss, nskip)
+    assert np.array_equal(pdriz.out_wht, driz.out_wht)
+    assert np.array_equal(pdriz.out_img, driz.out_img, equal_nan=True)
+
+
+def test_drizzle_add_image_stream():
+    in_shape = (20, 25)
+    out_shape = (40, 45)
+    nimages = 12
+    rng = np.random.default_rng(31)
+
+    data = rng.normal(10.0, 1.0, (nimages, ) + in_shape).astype(np.float32)
+    y, x = np.indices(in_shape, dtype=np.float64)
+    offsets = rng.uniform(0.0, 18.0, (nimages, 2))
+
+    def pixmap(k):
+        return np.dstack([x + offsets[k, 0], 1.05 * y + offsets[k, 1]])
+
+    driz = resample.Drizzle(out_shape=out_shape)
+    for k in range(nimages):
+        driz.add_image(data[k], exptime=1.5, pixmap=pixmap(k))
+
+    def producers():
+        for k in range(nimages):
+            def produce(k=k):
+                if k % 2:
+                    return data[k], 1.5, pixmap(k)
+                return {"data": data[k], "exptime": 1.5, "pixmap": pixmap(k)}
+            # producers are requested at most 'depth' images ahead:
+            assert k <= stream.ctx_id + 3
+            yield produce
+
+    stream = resample.Drizzle(out_shape=out_shape)
+    nmiss, nskip = stream.add_image_stream(producers(), depth=3)
+    assert nmiss.shape == nskip.shape == (nimages, )
+    assert stream.ctx_id == nimages
+    assert np.array_equal(stream.out_ctx, driz.out_ctx)
+    assert np.array_equal(stream.out_wht, driz.out_wht)
+    assert np.array_equal(stream.out_img, driz.out_img, equal_nan=True)
+
+    def failing():
+        raise OSError("cannot read image")
+
+    with pytest.raises(OSError):
+        stream.add_image_stream([failing])
+    with pytest.raises(ValueError):
+        stream.add_image_stream([], depth=0)
+
+
+@pytest.mark.filterwarnings("ignore:Kernel .* is not a flux-conserving kernel")
+@pytest.mark.parametrize("kernel", resample.SUPPORTED_DRIZZLE_KERNELS)
+def test_drizzle_engine_matches_tdriz(kernel):
+    in_shape = (30, 35)
+    out_shape = (50, 55)
+    rng = np.random.default_rng(37)
+    y, x = np.indices(in_shape, dtype=np.float64)
+
+    out_img = np.zeros(out_shape, dtype=np.float32)
+    out_wht = np.zeros(out_shape, dtype=np.float32)
+    out_ctx = np.zeros((2, ) + out_shape, dtype=np.int32)
+    engine = cdrizzle.DrizzleEngine(out_img, out_wht, out_ctx, kernel=kernel,
+                                    fillstr="0")
+
+    ref_img = np.zeros(out_shape, dtype=np.float32)
+    ref_wht = np.zeros(out_shape, dtype=np.float32)
+    ref_ctx = np.zeros((2, ) + out_shape, dtype=np.int32)
+
+    for ctx_id in [0, 5, 33]:
+        data = rng.normal(10.0, 1.0, in_shape).astype(np.float32)
+        dx, dy = rng.uniform(0.0, 15.0, 2)
+        pixmap = np.dstack([1.1 * x + 0.1 * y + dx, 1.05 * y + dy])
+
+        nmiss, nskip = engine.add(data, pixmap, ctx_id=ctx_id, scale=0.9,
+                                  pixfrac=0.8, in_units="counts",
+                                  expscale=2.0)
+        _, ref_nmiss, ref_nskip = cdrizzle.tdriz(
+            data, np.ones_like(data), pixmap, ref_img, ref_wht,
+            ref_ctx[ctx_id // 32], uniqid=ctx_id % 32 + 1, scale=0.9,
+            pixfrac=0.8, kernel=kernel, in_units="counts", expscale=2.0,
+            fillstr="0",
+        )
+        assert (nmiss, nskip) == (ref_nmiss, ref_nskip)
+
+    assert np.array_equal(out_ctx, ref_ctx)
+    assert np.array_equal(out_wht, ref_wht)
+    assert np.array_equal(out_img, ref_img)
+
+    # the engine updates its outputs in place and does not copy them:
+    with pytest.raises(ValueError):
+        engine.set_outputs(out_img.astype(">f4"), out_wht)
+    with pytest.raises(ValueError):
+        engine.set_outputs(out_img.astype(np.float64), out_wht)
+    with pytest.raises(ValueError):
+        engine.add(data, pixmap, ctx_id=64)
+
+    # an engine that was not initialized has no outputs:
+    engine = cdrizzle.DrizzleEngine.__new__(cdrizzle.DrizzleEngine)
+    with pytest.raises(ValueError, match="engine not initialized"):
+        engine.add(data, pixmap)
+    with pytest.raises(ValueError, match="engine not initialized"):
+        engine.set_outputs(out_img, out_wht)
+
+
+@pytest.mark.parametrize("kernel", ["square", "lanczos3"])
+def test_drizzle_progress_cancel(kernel):
+    in_shape = (40, 30)
+    y, x = np.indices(in_shape, dtype=np.float64)
+    pixmap = np.dstack([x + 2.3, y + 1.7])
+    data = np.ones(in_shape, dtype=np.float32)
+
+    # progress is reported about every 1% of the rows, ending before the
+    # last row:
+    calls = []
+    driz = resample.Drizzle(kernel=kernel, out_shape=(45, 35))
+    driz.add_image(data, exptime=1.0, pixmap=pixmap,
+                   progress=lambda done, total: calls.append((done, total)))
+    assert calls == [(k, 40) for k in range(40)]
+    ref_img = driz.out_img.copy()
+
+    # a true return value cancels the call, leaving a partial contribution:
+    driz = resample.Drizzle(kernel=kernel, out_shape=(45, 35))
+    with pytest.raises(resample.CancelledError):
+        driz.add_image(data, exptime=1.0, pixmap=pixmap,
+                       progress=lambda done, total: done >= 10)
+    assert 0 < np.count_nonzero(driz.out_wht) < np.count_nonzero(ref_img)
+    assert driz.ctx_id == 1
+
+    # exceptions raised by the callback are propagated:
+    def failing(done, total):
+        raise KeyError("stop")
+
+    driz = resample.Drizzle(kernel=kernel, out_shape=(45, 35))
+    with pytest.raises(KeyError):
+        driz.add_image(data, exptime=1.0, pixmap=pixmap, progress=failing)
+    assert not np.any(driz.out_wht)
+
+    # the cancellation flag:
+    cancel = np.ones(1, dtype=np.int32)
+    driz = resample.Drizzle(kernel=kernel, out_shape=(45, 35))
+    with pytest.raises(resample.CancelledError):
+        driz.add_image(data, exptime=1.0, pixmap=pixmap, cancel=cancel)
+    assert not np.any(driz.out_wht)
+
+    cancel[0] = 0
+    driz.add_image(data, exptime=1.0, pixmap=pixmap, cancel=cancel)
+
+    with pytest.raises(ValueError):
+        driz.add_image(data, exptime=1.0, pixmap=pixmap,
+                       cancel=np.zeros(1, dtype=np.int64))
+
+    # blotting:
+    blotted = resample.blot_image(ref_img, pixmap, 1.0, 1.0, in_shape[::-1],
+                                  interp="linear", cancel=cancel)
+    with pytest.raises(resample.CancelledError):
+        resample.blot_image(ref_img, pixmap, 1.0, 1.0, in_shape[::-1],
+                            interp="linear", progress=lambda d, t: d == 5)
+    assert np.any(blotted)
+
+
+@pytest.mark.parametrize("kernel", ["square", "turbo", "lanczos3"])
+def test_drizzle_big_endian_inputs(kernel):
+    in_shape = (40, 30)
+    rng = np.random.default_rng(42)
+    y, x = np.indices(in_shape, dtype=np.float64)
+    pixmap = np.dstack([1.1 * x + 0.2 * y + 2.3, 0.9 * y + 1.7])
+    data = rng.normal(10.0, 1.0, in_shape).astype(np.float32)
+    weights = rng.uniform(0.5, 1.0, in_shape).astype(np.float32)
+
+    swapped = [a.astype(a.dtype.newbyteorder()) for a in
+               (data, weights, pixmap)]
+    assert all(not a.dtype.isnative for a in swapped)
+
+    ref = resample.Drizzle(kernel=kernel, out_shape=(45, 40))
+    ref.add_image(data, exptime=1.0, pixmap=pixmap, weight_map=weights)
+    driz = resample.Drizzle(kernel=kernel, out_shape=(45, 40))
+    driz.add_image(swapped[0], exptime=1.0, pixmap=swapped[2],
+                   weight_map=swapped[1])
+
+    assert np.array_equal(driz.out_img, ref.out_img, equal_nan=True)
+    assert np.array_equal(driz.out_wht, ref.out_wht)
+    assert np.array_equal(driz.out_ctx, ref.out_ctx)
+
+    for interp in ["nearest", "linear", "poly3", "poly5", "lan3", "lan5"]:
+        blotted = resample.blot_image(
+            ref.out_img.astype(">f4"), swapped[2], 1.0, 1.0, in_shape[::-1],
+            interp=interp,
+        )
+        assert np.array_equal(
+            blotted,
+            resample.blot_image(ref.out_img, pixmap, 1.0, 1.0,
+                                in_shape[::-1], interp=interp),
+            equal_nan=True,
+        )
+
+
+@pytest.mark.parametrize("dtype", ["float64", ">f8", "int16", ">i2", "uint16"])
+def test_drizzle_generic_input_dtypes(dtype):
+    in_shape = (40, 30)
+    rng = np.random.default_rng(43)
+    y, x = np.indices(in_shape, dtype=np.float64)
+    pixmap = np.dstack([1.1 * x + 0.2 * y + 2.3, 0.9 * y + 1.7])
+    data = rng.uniform(0.0, 1000.0, in_shape).astype(dtype)
+    weights = rng.integers(1, 100, in_shape).astype(dtype)
+
+    driz = resample.Drizzle(out_shape=(45, 40))
+    driz.add_image(data, exptime=1.0, pixmap=pixmap, weight_map=weights)
+    ref = resample.Drizzle(out_shape=(45, 40))
+    ref.add_image(data.astype(np.float32), exptime=1.0, pixmap=pixmap,
+                  weight_map=weights.astype(np.float32))
+
+    assert np.array_equal(driz.out_img, ref.out_img, equal_nan=True)
+    assert np.array_equal(driz.out_wht, ref.out_wht)
+
+    for interp in ["nearest", "poly5", "lan3"]:
+        assert np.array_equal(
+            resample.blot_image(data, pixmap, 1.0, 1.0, in_shape[::-1],
+                                interp=interp),
+            resample.blot_image(data.astype(np.float32), pixmap, 1.0, 1.0,
+                                in_shape[::-1], interp=interp),
+        )
+
+
+def test_drizzle_strided_views():
+    in_shape = (40, 30)
+    out_shape = (45, 40)
+    rng = np.random.default_rng(44)
+    y, x = np.indices(in_shape, dtype=np.float64)
+    pixmap = np.dstack([1.1 * x + 0.2 * y + 2.3, 0.9 * y + 1.7])
+    data = rng.normal(10.0, 1.0, in_shape).astype(np.float32)
+
+    # inputs: a channel of a cube, every other column of a wider image and
+    # a pixel map with its components in separate planes:
+    data_cube = np.zeros((3, ) + in_shape, dtype=np.float32)
+    data_cube[1] = data
+    wide = np.zeros((in_shape[0], 2 * in_shape[1]), dtype=np.float32)
+    wide[:, ::2] = data
+    pixmap_t = np.ascontiguousarray(np.moveaxis(pixmap, -1, 0))
+    pixmap_view = np.moveaxis(pixmap_t, 0, -1)
+    assert not pixmap_view.flags.c_contiguous
+
+    ref = resample.Drizzle(out_shape=out_shape, fillval=0)
+    ref.add_image(data, exptime=1.0, pixmap=pixmap)
+
+    # outputs: subarrays of larger arrays, updated in place:
+    big_img = np.zeros((2, 60, 50), dtype=np.float32)
+    big_wht = np.zeros((2, 60, 50), dtype=np.float32)
+    big_ctx = np.zeros((1, 60, 50), dtype=np.int32)
+    sub = np.s_[5:5 + out_shape[0], 3:3 + out_shape[1]]
+    for inp in [data_cube[1], wide[:, ::2]]:
+        big_img[:] = 0
+        big_wht[:] = 0
+        big_ctx[:] = 0
+        out_img = big_img[1][sub]
+        driz = resample.Drizzle(out_img=out_img, out_wht=big_wht[1][sub],
+                                out_ctx=big_ctx[(slice(None), ) + sub],
+                                fillval=0)
+        driz.add_image(inp, exptime=1.0, pixmap=pixmap_view)
+        assert driz.out_img is out_img
+        assert np.array_equal(big_img[1][sub], ref.out_img)
+        assert np.array_equal(big_wht[1][sub], ref.out_wht)
+        assert np.array_equal(big_ctx[0][sub], ref.out_ctx[0])
+        assert not np.any(big_wht[0])
+
+    # direct calls write into views:
+    out_img = np.zeros((2, ) + out_shape, dtype=np.float32)
+    out_wht = np.zeros((2, ) + out_shape, dtype=np.float32)
+    out_ctx = np.zeros((2, ) + out_shape, dtype=np.int32)
+    cdrizzle.tdriz(wide[:, ::2], np.ones_like(data), pixmap_view,
+                   out_img[1], out_wht[1], out_ctx[1])
+    assert np.array_equal(out_wht[1], ref.out_wht)
+
+    for interp in ["poly5", "lan5"]:
+        blotted = np.zeros((2, ) + in_shape, dtype=np.float32)
+        cdrizzle.tblot(ref.out_wht[:, ::-1], pixmap, blotted[1],
+                       interp=interp)
+        assert np.array_equal(
+            blotted[1],
+            resample.blot_image(ref.out_wht[:, ::-1].copy(), pixmap, 1.0,
+                                1.0, in_shape[::-1], interp=interp),
+        )
+
+
+@pytest.mark.filterwarnings("ignore:Kernel .* is not a flux-conserving kernel")
+@pytest.mark.parametrize("kernel", ["square", "turbo", "point", "lanczos3"])
+def test_drizzle_float32_pixmap(kernel):
+    in_shape = (40, 30)
+    out_shape = (45, 40)
+    rng = np.random.default_rng(45)
+    y, x = np.indices(in_shape, dtype=np.float64)
+    # coordinates exactly representable in single precision:
+    pixmap = np.dstack([1.125 * x + 0.25 * y + 2.5, 0.875 * y + 1.75])
+    pixmap32 = pixmap.astype(np.float32)
+    data = rng.normal(10.0, 1.0, in_shape).astype(np.float32)
+
+    results = []
+    for p in [pixmap, pixmap32, pixmap32.astype(">f4")]:
+        driz = resample.Drizzle(kernel=kernel, out_shape=out_shape, fillval=0)
+        driz.add_image(data, exptime=1.0, pixmap=p)
+        results.append(driz)
+    for driz in results[1:]:
+        assert np.array_equal(driz.out_img, results[0].out_img)
+        assert np.array_equal(driz.out_wht, results[0].out_wht)
+        assert np.array_equal(driz.out_ctx, results[0].out_ctx)
+
+    for interp in ["nearest", "linear", "poly5", "lan5"]:
+        blotted = [
+            resample.blot_image(results[0].out_img, p, 1.0, 1.0,
+                                in_shape[::-1], interp=interp)
+            for p in [pixmap, pixmap32]
+        ]
+        assert np.array_equal(blotted[0], blotted[1])
+
+    bbox = [[-0.5, in_shape[1] - 0.5], [-0.5, in_shape[0] - 0.5]]
+    assert np.allclose(
+        cdrizzle.invert_pixmap(pixmap32, [20.0, 15.0], bbox),
+        cdrizzle.invert_pixmap(pixmap, [20.0, 15.0], bbox),
+        rtol=0, atol=1e-6,
+    )
+
+    # single precision storage from calc_pixmap:
+    inwcs = wcs.WCS(naxis=2)
+    inwcs.pixel_shape = in_shape[::-1]
+    pmap = utils.calc_pixmap(inwcs, inwcs, dtype=np.float32)
+    assert pmap.dtype == np.float32
+    assert np.array_equal(pmap, np.dstack([x, y]))
+
+
+@pytest.mark.filterwarnings("ignore:Kernel .* is not a flux-conserving kernel")
+@pytest.mark.parametrize("kernel", ["square", "turbo", "point", "lanczos3"])
+@pytest.mark.parametrize("step", [4, 7])
+def test_drizzle_coarse_pixmap(kernel, step):
+    in_shape = (40, 30)
+    out_shape = (50, 45)
+    rng = np.random.default_rng(46)
+    data = rng.normal(10.0, 1.0, in_shape).astype(np.float32)
+
+    def affine(x, y):
+        return np.dstack([1.1234 * x + 0.2071 * y + 2.3183,
+                          -0.1017 * x + 0.9137 * y + 5.7291])
+
+    y, x = np.indices(in_shape, dtype=np.float64)
+    pixmap = affine(x, y)
+    # nodes covering the image, the last ones beyond its edges:
+    yc, xc = step * np.indices(
+        ((in_shape[0] - 2) // step + 2, (in_shape[1] - 2) // step + 2),
+        dtype=np.float64
+    )
+    coarse = affine(xc, yc)
+
+    # bicubic interpolation of the nodes reproduces an affine map:
+    ref = resample.Drizzle(kernel=kernel, out_shape=out_shape, fillval=0)
+    ref.add_image(data, exptime=1.0, pixmap=pixmap)
+    driz = resample.Drizzle(kernel=kernel, out_shape=out_shape, fillval=0)
+    driz.add_image(data, exptime=1.0, pixmap=coarse, pixmap_step=step)
+    assert np.allclose(driz.out_img, ref.out_img, rtol=0, atol=1e-4)
+    assert np.allclose(driz.out_wht, ref.out_wht, rtol=0, atol=1e-5)
+    assert np.array_equal(driz.out_ctx, ref.out_ctx)
+
+    for interp in ["nearest", "linear", "poly5"]:
+        blotted = resample.blot_image(ref.out_img, coarse, 1.0, 1.0,
+                                      in_shape[::-1], interp=interp,
+                                      pixmap_step=step)
+        assert np.allclose(
+            blotted,
+            resample.blot_image(ref.out_img, pixmap, 1.0, 1.0,
+                                in_shape[::-1], interp=interp),
+            rtol=0, atol=1e-4,
+        )
+
+    # the nodes must cover the input image:
+    with pytest.raises(ValueError, match="does not cover"):
+        driz.add_image(data, exptime=1.0, pixmap=coarse[:-1],
+                       pixmap_step=step)
+    with pytest.raises(ValueError, match="pixmap_step"):
+        driz.add_image(data, exptime=1.0, pixmap=coarse, pixmap_step=0)
+
+    inwcs = wcs.WCS(naxis=2)
+    inwcs.pixel_shape = in_shape[::-1]
+    pmap = utils.calc_pixmap(inwcs, inwcs, pixmap_step=step)
+    assert np.array_equal(pmap, np.dstack([xc, yc]))
+
+
+@pytest.mark.filterwarnings("ignore:Kernel .* is not a flux-conserving kernel")
+@pytest.mark.parametrize(
+    "kernel", ["square", "turbo", "point", "gaussian", "lanczos3"]
+)
+def test_drizzle_prepared_pixmap(kernel):
+    in_shape = (60, 50)
+    rng = np.random.default_rng(49)
+    data = rng.normal(10.0, 1.0, in_shape).astype(np.float32)
+    var = rng.uniform(1.0, 2.0, in_shape).astype(np.float32)
+
+    y, x = np.indices(in_shape, dtype=np.float64)
+    pixmap = np.dstack([1.1234 * x + 0.2071 * y + 2.3183,
+                        -0.1017 * x + 0.9137 * y + 5.7291])
+    # invalid pixel map at the ends of rows, a full row and inside a row:
+    pixmap[5:20, :7] = np.nan
+    pixmap[30:40, 44:] = np.nan
+    pixmap[45] = np.nan
+    pixmap[50, 20:25] = np.nan
+
+    prepared = resample.PreparedPixmap(pixmap)
+    assert prepared.pixmap_step == 1
+    assert np.array_equal(prepared.row_spans[4], [0, 49])
+    assert np.array_equal(prepared.row_spans[5], [7, 49])
+    assert np.array_equal(prepared.row_spans[30], [0, 43])
+    assert np.array_equal(prepared.row_spans[45], [0, -1])
+    assert np.array_equal(prepared.row_spans[50], [0, 49])
+    assert np.allclose(prepared.affine,
+                       [[1.1234, 0.2071, 2.3183], [-0.1017, 0.9137, 5.7291]],
+                       rtol=0, atol=1e-12)
+    assert prepared.affine_residual < 1e-12
+
+    # the same pixel map for different images, outputs and input sections:
+    for out_shape, section in [((70, 65), {}), ((70, 65), {}),
+                               ((40, 35), {}), ((70, 65), {"ymin": 8}),
+                               ((70, 65), {})]:
+        for image in [data, var]:
+            ref = resample.Drizzle(kernel=kernel, out_shape=out_shape)
+            ref_miss = ref.add_image(image, exptime=1.0, pixmap=pixmap,
+                                     **section)
+            driz = resample.Drizzle(kernel=kernel, out_shape=out_shape)
+            miss = driz.add_image(image, exptime=1.0, pixmap=prepared,
+                                  **section)
+            assert miss == ref_miss
+            assert np.array_equal(driz.out_img, ref.out_img, equal_nan=True)
+            assert np.array_equal(driz.out_wht, ref.out_wht)
+            assert np.array_equal(driz.out_ctx, ref.out_ctx)
+
+    # cdrizzle.tdriz accepts it as well:
+    outputs = [np.zeros((70, 65), dtype=np.float32) for _ in range(4)]
+    for pmap, (out, wht) in [(pixmap, outputs[:2]), (prepared, outputs[2:])]:
+        cdrizzle.tdriz(data, var, pmap, out, wht, None, kernel=kernel)
+    assert np.array_equal(outputs[0], outputs[2], equal_nan=True)
+    assert np.array_equal(outputs[1], outputs[3])
+
+    # a prepared pixel map that was not initialized has no pixel map:
+    empty = resample.PreparedPixmap.__new__(resample.PreparedPixmap)
+    with pytest.raises(ValueError, match="not initialized"):
+        cdrizzle.tdriz(data, var, empty, *outputs[:2], None, kernel=kernel)
+
+    # coarse pixel maps carry their step:
+    coarse = resample.PreparedPixmap(pixmap[::4, ::4], pixmap_step=4)
+    assert coarse.pixmap_step == 4
+    assert coarse.row_spans is None
+    with pytest.raises(ValueError, match="pixmap_step"):
+        resample.Drizzle(kernel=kernel).add_image(
+            data[:57, :49], exptime=1.0, pixmap=coarse, pixmap_step=2
+        )
+
+
+@pytest.mark.filterwarnings("ignore:Kernel .* is not a flux-conserving kernel")
+@pytest.mark.parametrize(
+    "kernel", ["square", "turbo", "point", "gaussian", "lanczos3"]
+)
+def test_drizzle_pixmap_affine(kernel):
+    in_shape = (40, 30)
+    out_shape = (55, 50)
+    rng = np.random.default_rng(50)
+    data = rng.normal(10.0, 1.0, in_shape).astype(np.float32)
+
+    # a distorted base pixel map and a small alignment correction:
+    y, x = np.indices(in_shape, dtype=np.float64)
+    base = np.dstack([x + 2e-3 * x * y + 4.1371, y - 1e-3 * x * x + 6.2913])
+    affine = np.array([[0.9991, -0.0213, 1.7031],
+                       [0.0213, 0.9991, -0.8179]])
+
+    def corrected(pmap):
+        return np.dstack(resample._apply_pixmap_affine(pmap, affine))
+
+    ref = resample.Drizzle(kernel=kernel, out_shape=out_shape)
+    ref.add_image(data, exptime=1.0, pixmap=corrected(base))
+
+    prepared = resample.PreparedPixmap(base)
+    for pmap in [base, prepared]:
+        driz = resample.Drizzle(kernel=kernel, out_shape=out_shape)
+        driz.add_image(data, exptime=1.0, pixmap=pmap, pixmap_affine=affine)
+        assert np.allclose(driz.out_img, ref.out_img, rtol=0, atol=1e-5,
+                           equal_nan=True)
+        assert np.allclose(driz.out_wht, ref.out_wht, rtol=0, atol=1e-5)
+        assert np.array_equal(driz.out_ctx, ref.out_ctx)
+
+    # the prepared pixel map must not reuse the clipped outline of the
+    # input image computed with another correction:
+    ref = resample.Drizzle(kernel=kernel, out_shape=out_shape)
+    ref.add_image(data, exptime=1.0, pixmap=base)
+    driz = resample.Drizzle(kernel=kernel, out_shape=out_shape)
+    driz.add_image(data, exptime=1.0, pixmap=prepared)
+    assert np.array_equal(driz.out_img, ref.out_img, equal_nan=True)
+    assert np.array_equal(driz.out_wht, ref.out_wht)
+
+    # coarse pixel maps:
+    step = 4
+    coarse = base[::step, ::step]
+    ref = resample.Drizzle(kernel=kernel, out_shape=out_shape)
+    ref.add_image(data[:37, :29], exptime=1.0, pixmap=corrected(coarse),
+                  pixmap_step=step)
+    driz = resample.Drizzle(kernel=kernel, out_shape=out_shape)
+    driz.add_image(data[:37, :29], exptime=1.0, pixmap=coarse,
+                   pixmap_step=step, pixmap_affine=affine)
+    assert np.allclose(driz.out_img, ref.out_img, rtol=0, atol=1e-4,
+                       equal_nan=True)
+    assert np.allclose(driz.out_wht, ref.out_wht, rtol=0, atol=1e-5)
+
+    for interp in ["nearest", "linear", "poly5"]:
+        blotted = resample.blot_image(ref.out_img, base, 1.0, 1.0,
+                                      in_shape[::-1], interp=interp,
+                                      pixmap_affine=affine)
+        assert np.allclose(
+            blotted,
+            resample.blot_image(ref.out_img, corrected(base), 1.0, 1.0,
+                                in_shape[::-1], interp=interp),
+            rtol=0, atol=1e-5, equal_nan=True,
+        )
+
+    with pytest.raises(ValueError, match="2x3"):
+        driz.add_image(data, exptime=1.0, pixmap=base,
+                       pixmap_affine=np.eye(2))
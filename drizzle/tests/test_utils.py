@@ -235,3 +235,81 @@ def test_decode_context():
     # coordinate lists must be 1D:
     with pytest.raises(ValueError):
         decode_context(ctx, [[3, 2]], [[1, 4]])
+
+
+@pytest.mark.parametrize("dtype", [np.float64, np.float32])
+@pytest.mark.parametrize("pixmap_step", [1, 16])
+def test_calc_pixmap_tan_sip(dtype, pixmap_step):
+    """
+    Compare native TAN-SIP pixel maps with those computed by astropy in
+    both directions: to a TAN WCS and to a TAN-SIP WCS.
+    """
+    sip_wcs = wcs_from_file("nrcb5_sip_wcs.hdr")
+    tan_wcs = wcs_from_file("nrcb5_output_wcs_psr_1p2.hdr")
+    shape = sip_wcs.array_shape
+
+    for wcs_from, wcs_to in [(sip_wcs, tan_wcs), (tan_wcs, sip_wcs)]:
+        pixmap = calc_pixmap(
+            wcs_from,
+            wcs_to,
+            shape=shape,
+            dtype=dtype,
+            pixmap_step=pixmap_step,
+            nthreads=2,
+        )
+        assert pixmap.dtype == dtype
+
+        y, x = pixmap_step * np.indices(pixmap.shape[:2], dtype=np.float64)
+        ra, dec = wcs_from.all_pix2world(x, y, 0)
+        xref, yref = wcs_to.all_world2pix(
+            ra, dec, 0, tolerance=1e-12, maxiter=100, quiet=True
+        )
+        atol = 1e-7 if dtype == np.float64 else 1e-3
+        assert np.allclose(pixmap[..., 0], xref, rtol=0, atol=atol)
+        assert np.allclose(pixmap[..., 1], yref, rtol=0, atol=atol)
+
+
+def test_calc_pixmap_chunks():
+    """
+    Pixel maps computed by WCS evaluation in chunks of rows, in parallel
+    or into a preallocated array must not depend on the chunking.
+    """
+    class QuadraticWCS:
+        # a thread-safe, non-linear WCS evaluated with numpy
+        array_shape = None
+
+        def pixel_to_world_values(self, x, y):
+            return (x + 1e-4 * x * y + 0.3, 0.9 * y - 2e-4 * x * x)
+
+        def world_to_pixel_values(self, u, v):
+            return (1.1 * u - 3e-5 * v * v, v + 1e-4 * u * v - 5.0)
+
+    wcs_from = QuadraticWCS()
+    wcs_to = QuadraticWCS()
+    shape = (301, 203)
+
+    y, x = np.indices(shape, dtype=np.float64)
+    ref = np.dstack(
+        wcs_to.world_to_pixel_values(*wcs_from.pixel_to_world_values(x, y))
+    )
+
+    for chunk_rows, nthreads in [(None, 1), (1, 1), (37, 1), (37, 3)]:
+        pixmap = calc_pixmap(wcs_from, wcs_to, shape=shape,
+                             chunk_rows=chunk_rows, nthreads=nthreads)
+        assert_equal(pixmap, ref)
+
+    out = np.full(shape + (2, ), np.nan, dtype=np.float32)
+    pixmap = calc_pixmap(wcs_from, wcs_to, shape=shape, out=out,
+                         chunk_rows=50, nthreads=2)
+    assert pixmap is out
+    assert_equal(out, ref.astype(np.float32))
+
+    coarse = calc_pixmap(wcs_from, wcs_to, shape=shape, pixmap_step=8,
+                         chunk_rows=5)
+    assert coarse.shape == (39, 27, 2)
+    assert_equal(coarse[:-1, :-1], ref[::8, ::8])
+
+    with pytest.raises(ValueError):
+        calc_pixmap(wcs_from, wcs_to, shape=shape, out=out[1:])
+    with pytest.raises(ValueError):
+        calc_pixmap(wcs_from, wcs_to, shape=shape, chunk_rows=0)
@@ -1,13 +1,21 @@
 import math
+from concurrent.futures import ThreadPoolExecutor
 
 import numpy as np
 
+from drizzle import cdrizzle
+
 __all__ = ["calc_pixmap", "decode_context", "estimate_pixel_scale_ratio"]
 
 _DEG2RAD = math.pi / 180.0
 
+# number of pixels per chunk of pixel maps computed by WCS evaluation:
+_PIXMAP_CHUNK_SIZE = 2**18
+
 
-def calc_pixmap(wcs_from, wcs_to, shape=None, disable_bbox="to"):
+def calc_pixmap(wcs_from, wcs_to, shape=None, disable_bbox="to",
+                dtype=np.float64, pixmap_step=1, out=None, chunk_rows=None,
+                nthreads=1):
     """
     Calculate a discretized on a grid mapping between the pixels of two images
     using provided WCS of the original ("from") image and the destination ("to")
@@ -43,6 +51,41 @@ def calc_pixmap(wcs_from, wcs_to, shape=None, disable_bbox="to"):
         world coordinates to NaN when input pixel coordinates are outside of
         the bounding box.
 
+    dtype : numpy.dtype, optional
+        Type of the returned pixel map: ``numpy.float64`` or
+        ``numpy.float32``. Coordinates are always computed in double
+        precision; single precision storage halves the size of the pixel map
+        at the cost of a rounding error of about ``1e-3`` pixels for
+        coordinates of order ``1e4``.
+
+    pixmap_step : int, optional
+        Spacing, in pixels of the "from" image, of the pixels at which the
+        mapping is computed. When larger than 1, a coarse pixel map is
+        returned whose element ``[j, i]`` maps pixel
+        ``(i * pixmap_step, j * pixmap_step)``, with enough nodes to cover
+        the whole image. Pass the same ``pixmap_step`` to
+        :py:meth:`~drizzle.resample.Drizzle.add_image` or
+        :py:func:`~drizzle.resample.blot_image`, which interpolate the map
+        bicubically.
+
+    out : numpy.ndarray, None, optional
+        Preallocated ``numpy.float64`` or ``numpy.float32`` array of shape
+        ``(ny, nx, 2)`` in which to store the pixel map. When provided,
+        ``dtype`` is ignored and ``out`` is returned.
+
+    chunk_rows : int, None, optional
+        Number of rows of the pixel map computed at once. Memory used by
+        intermediate arrays is proportional to ``chunk_rows`` (times
+        ``nthreads``) instead of to the size of the pixel map. When `None`,
+        chunks of about 250,000 pixels are used.
+
+    nthreads : int, optional
+        Number of threads computing chunks of the pixel map. Values larger
+        than 1 require the ``pixel_to_world_values`` and
+        ``world_to_pixel_values`` methods of both WCS to be thread-safe,
+        which is not the case of `astropy.wcs.WCS` (except for the native
+        path described in the Notes).
+
     Returns
     -------
     pixmap : numpy.ndarray
@@ -64,6 +107,13 @@ def calc_pixmap(wcs_from, wcs_to, shape=None, disable_bbox="to"):
     shape from the ``bounding_box`` property of the input ``wcs_from`` object.
     If ``bounding_box`` is not available, a `ValueError` will be raised.
 
+    When both ``wcs_from`` and ``wcs_to`` are celestial FITS WCS
+    (`astropy.wcs.WCS`) using the ``TAN`` projection with, optionally,
+    SIP distortions and no other distortion corrections, the pixel map is
+    computed by a native, multithreaded implementation that writes directly
+    into the returned array. The inverse SIP polynomials of ``wcs_to`` are
+    then solved to ``1e-11`` pixels.
+
     """
     if (bbox_from := getattr(wcs_from, "bounding_box", None)) is not None:
         try:
@@ -104,7 +154,55 @@ def calc_pixmap(wcs_from, wcs_to, shape=None, disable_bbox="to"):
             'The "from" WCS must have pixel_shape property set.'
         )
 
-    y, x = np.indices(shape, dtype=np.float64)
+    if pixmap_step == 1:
+        node_shape = tuple(shape)
+    elif pixmap_step > 1:
+        # at least two nodes along each axis, the last one at or beyond the
+        # edge of the image:
+        node_shape = tuple(
+            max(-(-(n - 1) // pixmap_step), 1) + 1 for n in shape
+        )
+    else:
+        raise ValueError("'pixmap_step' must be a positive integer.")
+
+    if out is None:
+        pixmap = np.empty(node_shape + (2, ), dtype=dtype)
+    else:
+        pixmap = out
+        if pixmap.shape != node_shape + (2, ):
+            raise ValueError(
+                f"'out' must have shape {node_shape + (2, )}, "
+                f"got {pixmap.shape}."
+            )
+
+    if ((sip_from := _tan_sip_params(wcs_from)) is not None and
+            (sip_to := _tan_sip_params(wcs_to)) is not None):
+        cdrizzle.sip_pixmap(
+            pixmap,
+            sip_from,
+            sip_to,
+            pixmap_step=pixmap_step,
+            nthreads=nthreads,
+        )
+        return pixmap
+
+    ny, nx = node_shape
+    if chunk_rows is None:
+        chunk_rows = max(_PIXMAP_CHUNK_SIZE // max(nx, 1), 1)
+    elif chunk_rows < 1:
+        raise ValueError("'chunk_rows' must be a positive integer.")
+    chunks = [(r, min(r + chunk_rows, ny)) for r in range(0, ny, chunk_rows)]
+
+    def map_rows(rows):
+        y, x = pixmap_step * np.indices(
+            (rows[1] - rows[0], nx), dtype=np.float64
+        )
+        y += pixmap_step * rows[0]
+        x, y = wcs_to.world_to_pixel_values(
+            *wcs_from.pixel_to_world_values(x, y)
+        )
+        pixmap[rows[0]:rows[1], :, 0] = x
+        pixmap[rows[0]:rows[1], :, 1] = y
 
     # temporarily disable the bounding box for the "from" WCS:
     if disable_bbox in ["from", "both"] and bbox_from is not None:
@@ -112,19 +210,68 @@ def calc_pixmap(wcs_from, wcs_to, shape=None, disable_bbox="to"):
     if disable_bbox in ["to", "both"] and bbox_to is not None:
         wcs_to.bounding_box = None
     try:
-        x, y = wcs_to.world_to_pixel_values(
-            *wcs_from.pixel_to_world_values(x, y)
-        )
+        if nthreads > 1 and len(chunks) > 1:
+            with ThreadPoolExecutor(max_workers=nthreads) as executor:
+                for _ in executor.map(map_rows, chunks):
+                    pass
+        else:
+            for rows in chunks:
+                map_rows(rows)
     finally:
         if bbox_from is not None:
             wcs_from.bounding_box = bbox_from
         if bbox_to is not None:
             wcs_to.bounding_box = bbox_to
 
-    pixmap = np.dstack([x, y])
     return pixmap
 
 
+def _tan_sip_params(wcs):
+    """
+    Describe a celestial FITS WCS using the TAN projection with optional SIP
+    distortions as a ``(crpix, cd, crval, lonpole, a, b, ap, bp)`` tuple for
+    `drizzle.cdrizzle.sip_pixmap`. Return `None` for any other WCS.
+    """
+    w = getattr(wcs, "wcs", None)
+    if (getattr(wcs, "naxis", None) != 2 or
+            not hasattr(w, "lonpole") or
+            not hasattr(wcs, "sip") or
+            any(getattr(wcs, k, None) is not None
+                for k in ("cpdis1", "cpdis2", "det2im1", "det2im2"))):
+        return None
+
+    try:
+        w.set()
+    except Exception:
+        return None
+
+    if (w.lng != 0 or w.lat != 1 or w.get_pv() or
+            any(not c.endswith(("-TAN", "-TAN-SIP")) for c in w.ctype) or
+            any(str(u) != "deg" for u in w.cunit)):
+        return None
+
+    cd = np.asarray(wcs.pixel_scale_matrix, dtype=np.float64)
+    if (sip := wcs.sip) is None:
+        a = b = ap = bp = None
+    else:
+        if not np.array_equal(sip.crpix, w.crpix):
+            return None
+        a, b, ap, bp = sip.a, sip.b, sip.ap, sip.bp
+        if ap is None or bp is None:
+            ap = bp = None
+
+    return (
+        tuple(map(float, w.crpix)),
+        tuple(map(tuple, cd.tolist())),
+        tuple(map(float, w.crval)),
+        float(w.lonpole),
+        a,
+        b,
+        ap,
+        bp,
+    )
+
+
 def estimate_pixel_scale_ratio(wcs_from, wcs_to, refpix_from=None, refpix_to=None):
     """
     Compute the ratio of the pixel scale of the "to" WCS at the ``refpix_to``
@@ -15,6 +15,7 @@ def get_extensions():
                      'cdrizzlebox.c',
                      'cdrizzlemap.c',
                      'cdrizzleutil.c',
+                     'cdrizzlewcs.c',
                      os.path.join('tests', 'utest_cdrizzle.c')]
     sources = [os.path.join(srcdir, x) for x in cdriz_sources]
 
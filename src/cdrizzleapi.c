@@ -1,4 +1,5 @@
 #include <Python.h>
+#include <structmember.h>
 
 #define _USE_MATH_DEFINES /* MS Windows needs to define M_PI */
 #include <math.h>
@@ -18,32 +19,672 @@
 #include "cdrizzlebox.h"
 #include "cdrizzlemap.h"
 #include "cdrizzleutil.h"
+#include "cdrizzlewcs.h"
 #include "tests/drizzletest.h"
 
 static PyObject *gl_Error;
+static PyObject *gl_CancelledError;
 FILE *driz_log_handle = NULL;
 
 /** ---------------------------------------------------------------------------
- * Multiply each pixel in an image by a scale factor
+ * Convert the fill value string to a number. "INDEF" (or an empty string)
+ * means output pixels without contributions are left untouched.
  */
 
+static int
+fill_str2value(char *fillstr, bool_t *do_fill, float *fill_value,
+               struct driz_error_t *error) {
+    char *fillstr_end;
+
+    if (fillstr == NULL || *fillstr == 0 || strncmp(fillstr, "INDEF", 6) == 0 ||
+        strncmp(fillstr, "indef", 6) == 0) {
+        *do_fill = 0;
+        *fill_value = 0.0;
+
+    } else if (strncmp(fillstr, "NaN", 4) == 0 ||
+               strncmp(fillstr, "nan", 4) == 0) {
+        *do_fill = 1;
+        *fill_value = NPY_NANF;
+
+    } else {
+        *do_fill = 1;
+#ifdef _WIN32
+        *fill_value = atof(fillstr);
+#else
+        *fill_value = strtof(fillstr, &fillstr_end);
+        if (fillstr == fillstr_end || *fillstr_end != '\0') {
+            driz_error_set_message(error, "Illegal fill value");
+            return 1;
+        }
+#endif
+    }
+
+    return 0;
+}
+
+/* Outputs are updated in place when they are aligned, writeable arrays of
+   the requested type in native byte order, whatever their strides, e.g.,
+   views of a subarray or of a plane of a cube: the array accessors honour
+   strides. Other outputs are updated through a temporary copy that is
+   written back on exit. */
+#define OUTPUT_ARRAY_FLAGS \
+    (NPY_ARRAY_ALIGNED | NPY_ARRAY_WRITEABLE | NPY_ARRAY_WRITEBACKIFCOPY)
+
+/** ---------------------------------------------------------------------------
+ * Get an input array of the given type and number of dimensions. Aligned
+ * arrays of that type are used as they are, whatever their strides and in
+ * either byte order, so that, e.g., subarray views or memory-mapped
+ * big-endian FITS data are not copied: the array accessors honour strides
+ * and swap values when they are fetched. Images
+ * (NPY_FLOAT) may also be of any of the other input types, which are
+ * converted to float when they are fetched, and pixel maps (NPY_DOUBLE) may
+ * be stored in single precision. Anything else is converted to a contiguous
+ * array of the given type in native byte order.
+ */
+
+static PyArrayObject *
+input_array_from_any(PyObject *obj, int type, int ndim) {
+    PyArrayObject *arr = (PyArrayObject *)obj;
+
+    if (PyArray_Check(obj) &&
+        (PyArray_TYPE(arr) == type ||
+         (type == NPY_FLOAT && is_input_type(PyArray_TYPE(arr))) ||
+         (type == NPY_DOUBLE && PyArray_TYPE(arr) == NPY_FLOAT)) &&
+        PyArray_NDIM(arr) == ndim && PyArray_ISALIGNED(arr)) {
+        Py_INCREF(arr);
+        return arr;
+    }
+
+    return (PyArrayObject *)PyArray_ContiguousFromAny(obj, type, ndim, ndim);
+}
+
+/** ---------------------------------------------------------------------------
+ * Check the spacing of the nodes of a pixel map: a coarse pixel map
+ * (pixmap_step > 1) must cover an image of the given size (x, y).
+ */
+
+static int
+check_pixmap_step(PyArrayObject *map, integer_t step, const integer_t size[2],
+                  struct driz_error_t *error) {
+    if (driz_error_check(error, "pixmap_step must be >= 1", step >= 1)) {
+        return 1;
+    }
+    if (step > 1 && !coarse_pixmap_covers(map, step, size)) {
+        driz_error_format_message(
+            error,
+            "Coarse pixel map with %" NPY_INTP_FMT " x %" NPY_INTP_FMT
+            " nodes spaced by %" NPY_INTP_FMT " pixels does not cover an "
+            "image of %" NPY_INTP_FMT " x %" NPY_INTP_FMT " pixels.",
+            PyArray_DIM(map, 1), PyArray_DIM(map, 0), step, size[0],
+            size[1]);
+        return 1;
+    }
+    return 0;
+}
+
+/** ---------------------------------------------------------------------------
+ * Read the affine correction applied to the output coordinates of a pixel
+ * map: a 2x3 matrix [[a, b, c], [d, e, f]], x' = a x + b y + c and
+ * y' = d x + e y + f, or None. Returns 1 if a matrix was read, 0 for None
+ * and -1 on error.
+ */
+
+static int
+pixmap_affine_from_any(PyObject *obj, double affine[2][3],
+                       struct driz_error_t *error) {
+    PyArrayObject *arr;
+    int k;
+
+    if (obj == NULL || obj == Py_None) return 0;
+
+    arr = (PyArrayObject *)PyArray_ContiguousFromAny(obj, NPY_DOUBLE, 2, 2);
+    if (!arr || PyArray_DIM(arr, 0) != 2 || PyArray_DIM(arr, 1) != 3) {
+        Py_XDECREF(arr);
+        PyErr_Clear();
+        driz_error_set_message(error,
+                               "pixmap_affine must be a 2x3 matrix or None");
+        return -1;
+    }
+    for (k = 0; k < 6; ++k) {
+        affine[k / 3][k % 3] = ((double *)PyArray_DATA(arr))[k];
+    }
+    Py_DECREF(arr);
+    return 1;
+}
+
+/** ---------------------------------------------------------------------------
+ * Read the extent (x0, y0, nx, ny) of the mosaic of which the output is a
+ * tile, or None (all zeros) when the output is not a tile. Returns non-zero
+ * on error.
+ */
+
+static int
+mosaic_from_any(PyObject *obj, integer_t mosaic[4],
+                struct driz_error_t *error) {
+    PyArrayObject *arr;
+    int k;
+
+    memset(mosaic, 0, 4 * sizeof(integer_t));
+    if (obj == NULL || obj == Py_None) return 0;
+
+    arr = (PyArrayObject *)PyArray_ContiguousFromAny(obj, NPY_INTP, 1, 1);
+    if (!arr || PyArray_DIM(arr, 0) != 4 ||
+        ((npy_intp *)PyArray_DATA(arr))[2] < 1 ||
+        ((npy_intp *)PyArray_DATA(arr))[3] < 1) {
+        Py_XDECREF(arr);
+        PyErr_Clear();
+        driz_error_set_message(error,
+                               "mosaic must be (x0, y0, nx, ny) or None");
+        return 1;
+    }
+    for (k = 0; k < 4; ++k) {
+        mosaic[k] = ((npy_intp *)PyArray_DATA(arr))[k];
+    }
+    Py_DECREF(arr);
+    return 0;
+}
+
+/** ---------------------------------------------------------------------------
+ * Progress reporting and cancellation. The kernels run with the GIL
+ * released: the Python progress callback is called through a trampoline
+ * that acquires the GIL, and cancellation is requested by setting the first
+ * element of an int32 array (e.g., from another thread).
+ */
+
+static int
+progress_trampoline(void *arg, integer_t done, integer_t total) {
+    PyGILState_STATE gstate;
+    PyObject *result;
+    int stop;
+
+    gstate = PyGILState_Ensure();
+    result = PyObject_CallFunction((PyObject *)arg, "nn", done, total);
+    if (result == NULL) {
+        /* Stop and leave the exception raised by the callback pending */
+        stop = 1;
+    } else {
+        stop = PyObject_IsTrue(result);
+        Py_DECREF(result);
+        if (stop < 0) stop = 1;
+    }
+    PyGILState_Release(gstate);
+
+    return stop;
+}
+
+static int
+progress_init(struct driz_progress_t *progress, PyObject *callback,
+              PyObject *cancel, integer_t every, struct driz_error_t *error) {
+    progress->cancel = NULL;
+    progress->callback = NULL;
+    progress->arg = NULL;
+    progress->every = every;
+    progress->next = 0;
+    progress->cancelled = 0;
+
+    if (callback != NULL && callback != Py_None) {
+        if (!PyCallable_Check(callback)) {
+            driz_error_set_message(error, "progress must be callable");
+            return 1;
+        }
+        progress->callback = progress_trampoline;
+        progress->arg = callback;
+    }
+
+    if (cancel != NULL && cancel != Py_None) {
+        if (!PyArray_Check(cancel) ||
+            PyArray_TYPE((PyArrayObject *)cancel) != NPY_INT32 ||
+            !PyArray_ISCARRAY_RO((PyArrayObject *)cancel) ||
+            PyArray_SIZE((PyArrayObject *)cancel) < 1) {
+            driz_error_set_message(
+                error, "cancel must be a non-empty, C-contiguous int32 array");
+            return 1;
+        }
+        progress->cancel =
+            (const npy_int32 *)PyArray_DATA((PyArrayObject *)cancel);
+    }
+
+    return 0;
+}
+
+/* Raise CancelledError for a cancelled call, unless the progress callback
+   raised an exception that is already pending. Returns 1 if the call was
+   cancelled. */
+static int
+progress_exit(struct driz_progress_t *progress) {
+    if (!progress->cancelled) return 0;
+    if (!PyErr_Occurred()) {
+        PyErr_SetString(gl_CancelledError, "Drizzle operation cancelled");
+    }
+    return 1;
+}
+
+/** ---------------------------------------------------------------------------
+ * PreparedPixmap: a Python type holding a pixel map together with what is
+ * computed from it before drizzling, so that drizzling several images with
+ * the same pixel map does not scan it for invalid values, or map, clip and
+ * invert the outline of the input image, again.
+ */
+
+#define PREPARED_SCANNERS 4
+
+/* Size of the grid of pixel map nodes sampled by the affine fit */
+#define PREPARED_FIT_NODES 512
+
+struct prepared_scanner_t {
+    npy_intp osize[2];    /* last two dimensions of the output */
+    integer_t out_x0, out_y0;
+    integer_t mosaic[4];  /* extent of the mosaic of a tile */
+    integer_t section[4]; /* xmin, xmax, ymin, ymax */
+    enum e_kernel_t kernel;
+    double pixel_fraction;
+    double scale;
+    int has_affine;
+    double affine[2][3];  /* affine correction of the pixel map */
+    struct image_scanner_t scanner;
+};
+
+typedef struct {
+    PyObject_HEAD
+    PyArrayObject *pixmap;
+    integer_t step;
+    integer_t (*row_spans)[2]; /* NULL for coarse pixel maps */
+    int has_section;
+    integer_t request[4];      /* input section requested last... */
+    integer_t section[4];      /* ...and its part with a valid pixel map */
+    double affine[2][3];
+    double affine_residual;
+    int nscanners;
+    int next_scanner;
+    struct prepared_scanner_t scanners[PREPARED_SCANNERS];
+} prepared_pixmap_t;
+
+static PyTypeObject prepared_pixmap_type;
+
+/* First and last columns of each row of the pixel map where it is valid;
+   [0, -1] for rows without valid values. */
+static void
+prepared_pixmap_row_spans(prepared_pixmap_t *self) {
+    integer_t i, j, nx, ny, (*spans)[2];
+    PyArrayObject *map = self->pixmap;
+
+    nx = PyArray_DIM(map, 1);
+    ny = PyArray_DIM(map, 0);
+    spans = self->row_spans;
+
+    for (j = 0; j < ny; ++j) {
+        for (i = 0; i < nx; ++i) {
+            if (!npy_isnan(get_pixmap_value(map, i, j, 0)) &&
+                !npy_isnan(get_pixmap_value(map, i, j, 1))) {
+                break;
+            }
+        }
+        spans[j][0] = i;
+        if (i == nx) {
+            spans[j][0] = 0;
+            spans[j][1] = -1;
+            continue;
+        }
+        for (i = nx - 1; i > spans[j][0]; --i) {
+            if (!npy_isnan(get_pixmap_value(map, i, j, 0)) &&
+                !npy_isnan(get_pixmap_value(map, i, j, 1))) {
+                break;
+            }
+        }
+        spans[j][1] = i;
+    }
+}
+
+/* Least-squares fit of x_out = a[0] x + a[1] y + a[2] (and similarly for
+   y_out) to the valid nodes of a grid of at most PREPARED_FIT_NODES x
+   PREPARED_FIT_NODES nodes of the pixel map, and the largest residual of the
+   fit over these nodes. The coefficients are NaN if the fit fails. */
+static void
+prepared_pixmap_affine(prepared_pixmap_t *self) {
+    PyArrayObject *map = self->pixmap;
+    integer_t i, j, nx, ny, di, dj;
+    double n = 0.0, su = 0.0, sv = 0.0, suu = 0.0, suv = 0.0, svv = 0.0;
+    double sx[3] = {0.0, 0.0, 0.0}, sy[3] = {0.0, 0.0, 0.0};
+    double u0, v0, u, v, x, y, det, r, rmax = 0.0;
+    int k;
+
+    nx = PyArray_DIM(map, 1);
+    ny = PyArray_DIM(map, 0);
+    di = MAX(1, (nx + PREPARED_FIT_NODES - 1) / PREPARED_FIT_NODES);
+    dj = MAX(1, (ny + PREPARED_FIT_NODES - 1) / PREPARED_FIT_NODES);
+
+    for (k = 0; k < 6; ++k) self->affine[k / 3][k % 3] = NPY_NAN;
+    self->affine_residual = NPY_NAN;
+
+    /* coordinates are centered on the grid for numerical accuracy */
+    u0 = 0.5 * (double)((nx - 1) * self->step);
+    v0 = 0.5 * (double)((ny - 1) * self->step);
+
+    for (j = 0; j < ny; j += dj) {
+        v = (double)(j * self->step) - v0;
+        for (i = 0; i < nx; i += di) {
+            x = get_pixmap_value(map, i, j, 0);
+            y = get_pixmap_value(map, i, j, 1);
+            if (npy_isnan(x) || npy_isnan(y)) continue;
+            u = (double)(i * self->step) - u0;
+            n += 1.0;
+            su += u;
+            sv += v;
+            suu += u * u;
+            suv += u * v;
+            svv += v * v;
+            sx[0] += u * x;
+            sx[1] += v * x;
+            sx[2] += x;
+            sy[0] += u * y;
+            sy[1] += v * y;
+            sy[2] += y;
+        }
+    }
+    if (n < 3.0) return;
+
+    /* normal equations with the means removed */
+    suu -= su * su / n;
+    suv -= su * sv / n;
+    svv -= sv * sv / n;
+    for (k = 0; k < 2; ++k) {
+        sx[k] -= (k ? sv : su) * sx[2] / n;
+        sy[k] -= (k ? sv : su) * sy[2] / n;
+    }
+    det = suu * svv - suv * suv;
+    if (!(det > 0.0)) return;
+
+    self->affine[0][0] = (svv * sx[0] - suv * sx[1]) / det;
+    self->affine[0][1] = (suu * sx[1] - suv * sx[0]) / det;
+    self->affine[1][0] = (svv * sy[0] - suv * sy[1]) / det;
+    self->affine[1][1] = (suu * sy[1] - suv * sy[0]) / det;
+    for (k = 0; k < 2; ++k) {
+        self->affine[k][2] = ((k ? sy[2] : sx[2]) -
+                              self->affine[k][0] * su -
+                              self->affine[k][1] * sv) / n -
+                             self->affine[k][0] * u0 -
+                             self->affine[k][1] * v0;
+    }
+
+    for (j = 0; j < ny; j += dj) {
+        v = (double)(j * self->step);
+        for (i = 0; i < nx; i += di) {
+            u = (double)(i * self->step);
+            for (k = 0; k < 2; ++k) {
+                r = fabs(get_pixmap_value(map, i, j, k) -
+                         (self->affine[k][0] * u + self->affine[k][1] * v +
+                          self->affine[k][2]));
+                if (r > rmax) rmax = r;
+            }
+        }
+    }
+    self->affine_residual = rmax;
+}
+
+static int
+prepared_pixmap_init(prepared_pixmap_t *self, PyObject *args,
+                     PyObject *keywords) {
+    const char *kwlist[] = {"pixmap", "pixmap_step", NULL};
+
+    PyObject *opixmap;
+    integer_t step = 1;
+    PyArrayObject *map;
+    integer_t (*spans)[2] = NULL;
+
+    if (!PyArg_ParseTupleAndKeywords(args, keywords, "O|n:PreparedPixmap",
+                                     (char **)kwlist, &opixmap, &step)) {
+        return -1;
+    }
+
+    map = input_array_from_any(opixmap, NPY_DOUBLE, 3);
+    if (!map || PyArray_DIM(map, 2) < 2 || PyArray_DIM(map, 0) < 1 ||
+        PyArray_DIM(map, 1) < 1) {
+        Py_XDECREF(map);
+        PyErr_SetString(PyExc_ValueError, "Invalid pixmap array");
+        return -1;
+    }
+    if (step < 1) {
+        Py_DECREF(map);
+        PyErr_SetString(PyExc_ValueError, "pixmap_step must be >= 1");
+        return -1;
+    }
+    if (step == 1) {
+        spans = malloc(PyArray_DIM(map, 0) * sizeof(*spans));
+        if (!spans) {
+            Py_DECREF(map);
+            PyErr_NoMemory();
+            return -1;
+        }
+    }
+
+    Py_XSETREF(self->pixmap, map);
+    free(self->row_spans);
+    self->row_spans = spans;
+    self->step = step;
+    self->has_section = 0;
+    self->nscanners = 0;
+    self->next_scanner = 0;
+
+    Py_BEGIN_ALLOW_THREADS;
+    if (spans) prepared_pixmap_row_spans(self);
+    prepared_pixmap_affine(self);
+    Py_END_ALLOW_THREADS;
+
+    return 0;
+}
+
+static void
+prepared_pixmap_dealloc(prepared_pixmap_t *self) {
+    Py_XDECREF(self->pixmap);
+    free(self->row_spans);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *
+prepared_pixmap_get_affine(prepared_pixmap_t *self,
+                           void *closure UNUSED_PARAM) {
+    return Py_BuildValue("(ddd)(ddd)", self->affine[0][0], self->affine[0][1],
+                         self->affine[0][2], self->affine[1][0],
+                         self->affine[1][1], self->affine[1][2]);
+}
+
+static PyObject *
+prepared_pixmap_get_row_spans(prepared_pixmap_t *self,
+                              void *closure UNUSED_PARAM) {
+    npy_intp dims[2];
+    PyArrayObject *spans;
+
+    if (!self->row_spans) Py_RETURN_NONE;
+
+    dims[0] = PyArray_DIM(self->pixmap, 0);
+    dims[1] = 2;
+    spans = (PyArrayObject *)PyArray_SimpleNew(2, dims, NPY_INTP);
+    if (!spans) return NULL;
+    memcpy(PyArray_DATA(spans), self->row_spans,
+           dims[0] * sizeof(*self->row_spans));
+    return (PyObject *)spans;
+}
+
+/* Pixel map array of a pixmap argument, which may be a PreparedPixmap
+   (then returned in prepared, and NULL otherwise). */
+static PyArrayObject *
+pixmap_from_any(PyObject *pixmap, prepared_pixmap_t **prepared,
+                integer_t *step, struct driz_error_t *error) {
+    prepared_pixmap_t *self;
+
+    if (!PyObject_TypeCheck(pixmap, &prepared_pixmap_type)) {
+        *prepared = NULL;
+        return input_array_from_any(pixmap, NPY_DOUBLE, 3);
+    }
+
+    self = (prepared_pixmap_t *)pixmap;
+    if (self->pixmap == NULL) {
+        /* created with __new__() only, without __init__() */
+        driz_error_set_message(error, "prepared pixel map not initialized");
+        return NULL;
+    }
+    if (*step != 1 && *step != self->step) {
+        driz_error_set_message(error,
+                               "pixmap_step differs from that of the "
+                               "prepared pixel map");
+        return NULL;
+    }
+    *prepared = self;
+    *step = self->step;
+    Py_INCREF(self->pixmap);
+    return self->pixmap;
+}
+
+/* shrink_pixmap_section, using the result for the section requested last
+   if it is requested again. */
+static int
+prepared_pixmap_section(prepared_pixmap_t *self, PyArrayObject *map,
+                        integer_t step, integer_t *xmin, integer_t *xmax,
+                        integer_t *ymin, integer_t *ymax) {
+    integer_t request[4];
+
+    if (!self) return shrink_pixmap_section(map, step, xmin, xmax, ymin, ymax);
+
+    request[0] = *xmin;
+    request[1] = *xmax;
+    request[2] = *ymin;
+    request[3] = *ymax;
+    if (!self->has_section || memcmp(request, self->request, sizeof(request))) {
+        self->has_section = 0;
+        if (shrink_pixmap_section(map, step, xmin, xmax, ymin, ymax)) {
+            return 1;
+        }
+        memcpy(self->request, request, sizeof(request));
+        self->section[0] = *xmin;
+        self->section[1] = *xmax;
+        self->section[2] = *ymin;
+        self->section[3] = *ymax;
+        self->has_section = 1;
+    }
+
+    *xmin = self->section[0];
+    *xmax = self->section[1];
+    *ymin = self->section[2];
+    *ymax = self->section[3];
+    return 0;
+}
+
+/* Set up the row spans and the image scanner of drizzling parameters p
+   from those saved for the same input section, output grid (and mosaic),
+   kernel and affine correction of the pixel map, or
+   compute and save the scanner. The scanner is copied into the caller's
+   scanner so that the kernels may run while other calls use the cache. */
 static void
-scale_image(PyArrayObject *image, double scale_factor) {
-    long i, size;
-    float *imptr;
+prepared_pixmap_scanner(prepared_pixmap_t *self, struct driz_param_t *p,
+                        struct image_scanner_t *scanner) {
+    struct prepared_scanner_t key, *entry = NULL;
+    npy_intp *odims;
+    int k;
 
-    assert(image);
-    imptr = (float *)PyArray_DATA(image);
+    if (!self) return;
+
+    p->row_spans = (const integer_t(*)[2])self->row_spans;
+
+    odims = PyArray_DIMS(p->output_data) + PyArray_NDIM(p->output_data) - 2;
+    key.osize[0] = odims[0];
+    key.osize[1] = odims[1];
+    key.out_x0 = p->out_x0;
+    key.out_y0 = p->out_y0;
+    memcpy(key.mosaic, p->mosaic, sizeof(key.mosaic));
+    key.section[0] = p->xmin;
+    key.section[1] = p->xmax;
+    key.section[2] = p->ymin;
+    key.section[3] = p->ymax;
+    key.kernel = p->kernel;
+    key.pixel_fraction = p->pixel_fraction;
+    key.scale = p->scale;
+    key.has_affine = p->pixmap_affine != NULL;
+    if (key.has_affine) {
+        memcpy(key.affine, p->pixmap_affine, sizeof(key.affine));
+    }
 
-    size = PyArray_DIMS(image)[0] * PyArray_DIMS(image)[1];
+    for (k = 0; k < self->nscanners; ++k) {
+        entry = self->scanners + k;
+        if (entry->osize[0] == key.osize[0] &&
+            entry->osize[1] == key.osize[1] &&
+            entry->out_x0 == key.out_x0 && entry->out_y0 == key.out_y0 &&
+            !memcmp(entry->mosaic, key.mosaic, sizeof(key.mosaic)) &&
+            !memcmp(entry->section, key.section, sizeof(key.section)) &&
+            entry->kernel == key.kernel &&
+            entry->pixel_fraction == key.pixel_fraction &&
+            entry->scale == key.scale && entry->has_affine == key.has_affine &&
+            (!key.has_affine ||
+             !memcmp(entry->affine, key.affine, sizeof(key.affine)))) {
+            break;
+        }
+        entry = NULL;
+    }
 
-    for (i = size; i > 0; --i) {
-        *imptr++ *= scale_factor;
+    if (!entry) {
+        entry = self->scanners + self->next_scanner;
+        self->next_scanner = (self->next_scanner + 1) % PREPARED_SCANNERS;
+        self->nscanners = MIN(self->nscanners + 1, PREPARED_SCANNERS);
+        *entry = key;
+        p->image_scanner = NULL;
+        entry->scanner.status = init_image_scanner(
+            p, &entry->scanner.s, &entry->scanner.ymin, &entry->scanner.ymax);
     }
 
-    return;
+    *scanner = entry->scanner;
+    p->image_scanner = scanner;
 }
 
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmissing-field-initializers"
+#pragma GCC diagnostic ignored "-Wcast-function-type"
+#elif defined(__clang__)
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wcast-function-type-mismatch"
+#endif
+static PyMemberDef prepared_pixmap_members[] = {
+    {"pixmap", T_OBJECT, offsetof(prepared_pixmap_t, pixmap), READONLY,
+     "Pixel map."},
+    {"pixmap_step", T_PYSSIZET, offsetof(prepared_pixmap_t, step), READONLY,
+     "Spacing of the nodes of the pixel map in input pixels."},
+    {"affine_residual", T_DOUBLE,
+     offsetof(prepared_pixmap_t, affine_residual), READONLY,
+     "Largest deviation, in output pixels, of the pixel map from its affine "
+     "fit."},
+    {NULL} /* sentinel */
+};
+
+static PyGetSetDef prepared_pixmap_getset[] = {
+    {"affine", (getter)prepared_pixmap_get_affine, NULL,
+     "Least-squares affine fit ((a, b, c), (d, e, f)) of the pixel map: "
+     "x_out = a x + b y + c, y_out = d x + e y + f.",
+     NULL},
+    {"row_spans", (getter)prepared_pixmap_get_row_spans, NULL,
+     "First and last columns of each row with a valid pixel map (or None "
+     "for coarse pixel maps).",
+     NULL},
+    {NULL} /* sentinel */
+};
+
+static PyTypeObject prepared_pixmap_type = {
+    PyVarObject_HEAD_INIT(NULL, 0).tp_name =
+        "drizzle.cdrizzle.PreparedPixmap",
+    .tp_doc = "PreparedPixmap(pixmap, pixmap_step)",
+    .tp_basicsize = sizeof(prepared_pixmap_t),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,
+    .tp_new = PyType_GenericNew,
+    .tp_init = (initproc)prepared_pixmap_init,
+    .tp_dealloc = (destructor)prepared_pixmap_dealloc,
+    .tp_members = prepared_pixmap_members,
+    .tp_getset = prepared_pixmap_getset,
+};
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#elif defined(__clang__)
+#pragma clang diagnostic pop
+#endif
+
 /** ---------------------------------------------------------------------------
  * Top level function for drizzling, interfaces with python code
  */
@@ -54,7 +695,9 @@ tdriz(PyObject *obj UNUSED_PARAM, PyObject *args, PyObject *keywords) {
                             "counts",  "context", "uniqid",   "xmin",
                             "xmax",    "ymin",    "ymax",     "scale",
                             "pixfrac", "kernel",  "in_units", "expscale",
-                            "wtscale", "fillstr", NULL};
+                            "wtscale", "fillstr", "out_x0",   "out_y0",
+                            "progress", "cancel", "progress_rows",
+                            "pixmap_step", "pixmap_affine", "mosaic", NULL};
 
     /* Arguments in the order they appear */
     PyObject *oimg, *owei, *pixmap, *oout, *owht, *ocon;
@@ -70,6 +713,13 @@ tdriz(PyObject *obj UNUSED_PARAM, PyObject *args, PyObject *keywords) {
     float expin = 1.0;
     float wtscl = 1.0;
     char *fillstr = "INDEF";
+    integer_t out_x0 = 0;
+    integer_t out_y0 = 0;
+    PyObject *oprogress = Py_None, *ocancel = Py_None;
+    integer_t progress_rows = 0;
+    integer_t pixmap_step = 1;
+    PyObject *oaffine = Py_None;
+    PyObject *omosaic = Py_None;
 
     /* Derived values */
 
@@ -77,12 +727,16 @@ tdriz(PyObject *obj UNUSED_PARAM, PyObject *args, PyObject *keywords) {
                   *con = NULL, *map = NULL;
     enum e_kernel_t kernel;
     enum e_unit_t inun;
-    char *fillstr_end;
     bool_t do_fill;
     float fill_value;
-    float inv_exposure_time;
     struct driz_error_t error;
     struct driz_param_t p;
+    struct driz_progress_t progress;
+    struct coarse_pixmap_t *coarse = NULL;
+    double affine[2][3];
+    int has_affine;
+    prepared_pixmap_t *prepared = NULL;
+    struct image_scanner_t scanner;
     integer_t isize[2], psize[2], wsize[2];
     char warn_msg[128];
 
@@ -91,42 +745,54 @@ tdriz(PyObject *obj UNUSED_PARAM, PyObject *args, PyObject *keywords) {
     driz_error_init(&error);
 
     if (!PyArg_ParseTupleAndKeywords(
-            args, keywords, "OOOOOO|iiiiiddssffs:tdriz", (char **)kwlist, &oimg,
-            &owei, &pixmap, &oout, &owht, &ocon,     /* OOOOOO */
-            &uniqid, &xmin, &xmax, &ymin, &ymax,     /* iiiii */
+            args, keywords, "OOOOOO|nnnnnddssffsnnOOnnOO:tdriz",
+            (char **)kwlist, &oimg, &owei, &pixmap, &oout, &owht,
+            &ocon,                                   /* OOOOOO */
+            &uniqid, &xmin, &xmax, &ymin, &ymax,     /* nnnnn */
             &scale, &pfract, &kernel_str, &inun_str, /* ddss */
-            &expin, &wtscl, &fillstr)                /* ffs */
+            &expin, &wtscl, &fillstr,                /* ffs */
+            &out_x0, &out_y0,                        /* nn */
+            &oprogress, &ocancel, &progress_rows,    /* OOn */
+            &pixmap_step, &oaffine, &omosaic)        /* nOO */
     ) {
         return NULL;
     }
 
+    if (progress_init(&progress, oprogress, ocancel, progress_rows, &error)) {
+        goto _exit;
+    }
+
     /* Get raw C-array data */
-    img = (PyArrayObject *)PyArray_ContiguousFromAny(oimg, NPY_FLOAT, 2, 2);
+    img = input_array_from_any(oimg, NPY_FLOAT, 2);
     if (!img) {
         driz_error_set_message(&error, "Invalid input array");
         goto _exit;
     }
 
-    wei = (PyArrayObject *)PyArray_ContiguousFromAny(owei, NPY_FLOAT, 2, 2);
+    wei = input_array_from_any(owei, NPY_FLOAT, 2);
     if (!wei) {
         driz_error_set_message(&error, "Invalid weights array");
         goto _exit;
     }
 
-    map = (PyArrayObject *)PyArray_ContiguousFromAny(pixmap, NPY_DOUBLE, 3, 3);
+    map = pixmap_from_any(pixmap, &prepared, &pixmap_step, &error);
     if (!map) {
-        driz_error_set_message(&error, "Invalid pixmap array");
+        if (!driz_error_is_set(&error)) {
+            driz_error_set_message(&error, "Invalid pixmap array");
+        }
         goto _exit;
     }
 
-    out = (PyArrayObject *)PyArray_ContiguousFromAny(oout, NPY_FLOAT, 2, 2);
-    if (!out) {
+    out = (PyArrayObject *)PyArray_FROM_OTF(oout, NPY_FLOAT,
+                                            OUTPUT_ARRAY_FLAGS);
+    if (!out || PyArray_NDIM(out) < 2 || PyArray_NDIM(out) > 3) {
         driz_error_set_message(&error, "Invalid output array");
         goto _exit;
     }
 
-    wht = (PyArrayObject *)PyArray_ContiguousFromAny(owht, NPY_FLOAT, 2, 2);
-    if (!wht) {
+    wht = (PyArrayObject *)PyArray_FROM_OTF(owht, NPY_FLOAT,
+                                            OUTPUT_ARRAY_FLAGS);
+    if (!wht || PyArray_NDIM(wht) < 2 || PyArray_NDIM(wht) > 3) {
         driz_error_set_message(&error, "Invalid counts array");
         goto _exit;
     }
@@ -134,36 +800,17 @@ tdriz(PyObject *obj UNUSED_PARAM, PyObject *args, PyObject *keywords) {
     if (ocon == Py_None) {
         con = NULL;
     } else {
-        con = (PyArrayObject *)PyArray_ContiguousFromAny(ocon, NPY_INT32, 2, 2);
-        if (!con) {
+        con = (PyArrayObject *)PyArray_FROM_OTF(ocon, NPY_INT32,
+                                                OUTPUT_ARRAY_FLAGS);
+        if (!con || PyArray_NDIM(con) < 2 || PyArray_NDIM(con) > 3) {
             driz_error_set_message(&error, "Invalid context array");
             goto _exit;
         }
     }
 
     /* Convert the fill value string */
-
-    if (fillstr == NULL || *fillstr == 0 || strncmp(fillstr, "INDEF", 6) == 0 ||
-        strncmp(fillstr, "indef", 6) == 0) {
-        do_fill = 0;
-        fill_value = 0.0;
-
-    } else if (strncmp(fillstr, "NaN", 4) == 0 ||
-               strncmp(fillstr, "nan", 4) == 0) {
-        do_fill = 1;
-        fill_value = NPY_NANF;
-
-    } else {
-        do_fill = 1;
-#ifdef _WIN32
-        fill_value = atof(fillstr);
-#else
-        fill_value = strtof(fillstr, &fillstr_end);
-        if (fillstr == fillstr_end || *fillstr_end != '\0') {
-            driz_error_set_message(&error, "Illegal fill value");
-            goto _exit;
-        }
-#endif
+    if (fill_str2value(fillstr, &do_fill, &fill_value, &error)) {
+        goto _exit;
     }
 
     /* Set the area to be processed */
@@ -172,7 +819,10 @@ tdriz(PyObject *obj UNUSED_PARAM, PyObject *args, PyObject *keywords) {
     if (xmax == 0 || xmax >= isize[0]) xmax = isize[0] - 1;
     if (ymax == 0 || ymax >= isize[1]) ymax = isize[1] - 1;
 
-    if (shrink_image_section(map, &xmin, &xmax, &ymin, &ymax)) {
+    if (check_pixmap_step(map, pixmap_step, isize, &error)) goto _exit;
+
+    if (prepared_pixmap_section(prepared, map, pixmap_step, &xmin, &xmax,
+                                &ymin, &ymax)) {
         driz_error_set_message(&error,
                                "No or too few valid pixels in the pixel map.");
         goto _exit;
@@ -201,13 +851,10 @@ tdriz(PyObject *obj UNUSED_PARAM, PyObject *args, PyObject *keywords) {
         kernel_str2enum("point", &kernel, &error);
     }
 
-    /* If the input image is not in CPS we need to divide by the exposure */
-    if (inun != unit_cps) {
-        inv_exposure_time = 1.0f / expin;
-        scale_image(img, inv_exposure_time);
-    }
-
     /* Setup reasonable defaults for drizzling */
+    has_affine = pixmap_affine_from_any(oaffine, affine, &error);
+    if (has_affine < 0) goto _exit;
+
     driz_param_init(&p);
 
     p.data = img;
@@ -221,6 +868,8 @@ tdriz(PyObject *obj UNUSED_PARAM, PyObject *args, PyObject *keywords) {
     p.ymin = ymin;
     p.xmax = xmax;
     p.ymax = ymax;
+    p.out_x0 = out_x0;
+    p.out_y0 = out_y0;
     p.scale = scale;
     p.pixel_fraction = pfract;
     p.kernel = kernel;
@@ -229,6 +878,9 @@ tdriz(PyObject *obj UNUSED_PARAM, PyObject *args, PyObject *keywords) {
     p.weight_scale = wtscl;
     p.fill_value = fill_value;
     p.error = &error;
+    p.progress = &progress;
+    if (has_affine) p.pixmap_affine = (const double(*)[3])affine;
+    if (mosaic_from_any(omosaic, p.mosaic, &error)) goto _exit;
 
     if (driz_error_check(&error, "xmin must be >= 0", p.xmin >= 0)) goto _exit;
     if (driz_error_check(&error, "ymin must be >= 0", p.ymin >= 0)) goto _exit;
@@ -245,10 +897,12 @@ tdriz(PyObject *obj UNUSED_PARAM, PyObject *args, PyObject *keywords) {
         goto _exit;
 
     get_dimensions(p.pixmap, psize);
-    if (psize[0] != isize[0] || psize[1] != isize[1]) {
+    if (pixmap_step == 1 && (psize[0] != isize[0] || psize[1] != isize[1])) {
         if (snprintf(
                 warn_msg, 128,
-                "Pixel map dimensions (%d, %d) != input dimensions (%d, %d).",
+                "Pixel map dimensions (%" NPY_INTP_FMT ", %" NPY_INTP_FMT
+                ") != input dimensions (%" NPY_INTP_FMT ", %" NPY_INTP_FMT
+                ").",
                 psize[0], psize[1], isize[0], isize[1]) < 1) {
             strcpy(warn_msg, "Pixel map dimensions != input dimensions.");
         }
@@ -256,12 +910,34 @@ tdriz(PyObject *obj UNUSED_PARAM, PyObject *args, PyObject *keywords) {
         goto _exit;
     }
 
+    /* Spectral cubes need a (x, y, lambda) pixel map and output, counts,
+       and context arrays of the same shape */
+    if (PyArray_NDIM(out) == 3 || PyArray_NDIM(wht) == 3 ||
+        (con && PyArray_NDIM(con) == 3)) {
+        if (driz_error_check(&error,
+                             "Output, counts, and context cubes must have the "
+                             "same shape.",
+                             PyArray_SAMESHAPE(out, wht) &&
+                                 (!con || PyArray_SAMESHAPE(out, con))))
+            goto _exit;
+        if (driz_error_check(&error,
+                             "Drizzling to a spectral cube requires a pixel "
+                             "map with three components (x, y, lambda).",
+                             PyArray_DIM(map, 2) >= 3))
+            goto _exit;
+    } else if (driz_error_check(&error,
+                                "Pixel map must have at least two components.",
+                                PyArray_DIM(map, 2) >= 2)) {
+        goto _exit;
+    }
+
     if (p.weights) {
         get_dimensions(p.weights, wsize);
         if (wsize[0] != isize[0] || wsize[1] != isize[1]) {
             if (snprintf(warn_msg, 128,
-                         "Weights array dimensions (%d, %d) != input "
-                         "dimensions (%d, %d).",
+                         "Weights array dimensions (%" NPY_INTP_FMT
+                         ", %" NPY_INTP_FMT ") != input dimensions (%"
+                         NPY_INTP_FMT ", %" NPY_INTP_FMT ").",
                          wsize[0], wsize[1], isize[0], isize[1]) < 1) {
                 strcpy(warn_msg,
                        "Weights array dimensions != input dimensions.");
@@ -271,87 +947,124 @@ tdriz(PyObject *obj UNUSED_PARAM, PyObject *args, PyObject *keywords) {
         }
     }
 
-    if (dobox(&p)) {
-        goto _exit;
+    if (pixmap_step > 1) {
+        coarse = coarse_pixmap_new(map, pixmap_step, &error);
+        if (!coarse) goto _exit;
+        p.coarse_pixmap = coarse;
     }
 
-    /* Put in the fill values (if defined) */
-    if (do_fill) {
+    prepared_pixmap_scanner(prepared, &p, &scanner);
+
+    /* The kernels do not use the Python API: let other threads, e.g.,
+       threads preparing the next input image, run meanwhile. */
+    Py_BEGIN_ALLOW_THREADS;
+
+    if (!dobox(&p) && do_fill) {
+        /* Put in the fill values (if defined) */
         put_fill(&p, fill_value);
     }
 
+    Py_END_ALLOW_THREADS;
+
 _exit:
     driz_log_message("ending tdriz");
     driz_log_close(driz_log_handle);
+    if (out) PyArray_ResolveWritebackIfCopy(out);
+    if (wht) PyArray_ResolveWritebackIfCopy(wht);
+    if (con) PyArray_ResolveWritebackIfCopy(con);
     Py_XDECREF(con);
     Py_XDECREF(img);
     Py_XDECREF(wei);
     Py_XDECREF(out);
     Py_XDECREF(wht);
     Py_XDECREF(map);
+    coarse_pixmap_free(coarse);
 
-    if (driz_error_is_set(&error)) {
+    if (progress_exit(&progress)) {
+        return NULL;
+    } else if (driz_error_is_set(&error)) {
         PyErr_SetString(PyExc_ValueError, driz_error_get_message(&error));
         return NULL;
     } else {
         return Py_BuildValue(
-            "sii", "Callable C-based DRIZZLE Version 1.12 (28th June 2018)",
+            "snn", "Callable C-based DRIZZLE Version 1.12 (28th June 2018)",
             p.nmiss, p.nskip);
     }
 }
 
 /** ---------------------------------------------------------------------------
- * Top level function for blotting, interfaces with python code
+ * Top level function for the adjoint (transpose) of drizzling: gathers an
+ * output-grid image back onto the input grid using the kernel weights,
+ * interfaces with python code
  */
 
 static PyObject *
-tblot(PyObject *obj, PyObject *args, PyObject *keywords) {
-    const char *kwlist[] = {"source",  "pixmap", "output", "xmin",   "xmax",
-                            "ymin",    "ymax",   "scale",  "kscale", "interp",
-                            "exptime", "misval", "sinscl", NULL};
+tdriz_adjoint(PyObject *obj UNUSED_PARAM, PyObject *args, PyObject *keywords) {
+    const char *kwlist[] = {"input",   "weights", "pixmap",   "output",
+                            "xmin",    "xmax",    "ymin",     "ymax",
+                            "scale",   "pixfrac", "kernel",   "in_units",
+                            "expscale", "wtscale", "out_x0",  "out_y0",
+                            "mosaic",  NULL};
 
     /* Arguments in the order they appear */
-    PyObject *oimg, *pixmap, *oout;
-    long xmin = 0;
-    long xmax = 0;
-    long ymin = 0;
-    long ymax = 0;
+    PyObject *oimg, *owei, *pixmap, *oout;
+    integer_t xmin = 0;
+    integer_t xmax = 0;
+    integer_t ymin = 0;
+    integer_t ymax = 0;
     double scale = 1.0;
-    float kscale = 1.0;
-    char *interp_str = "poly5";
-    float ef = 1.0;
-    float misval = 0.0;
-    float sinscl = 1.0;
+    double pfract = 1.0;
+    char *kernel_str = "square";
+    char *inun_str = "cps";
+    float expin = 1.0;
+    float wtscl = 1.0;
+    integer_t out_x0 = 0;
+    integer_t out_y0 = 0;
+    PyObject *omosaic = Py_None;
 
-    PyArrayObject *img = NULL, *out = NULL, *map = NULL;
-    enum e_interp_t interp;
-    int istat = 0;
+    /* Derived values */
+    PyArrayObject *img = NULL, *wei = NULL, *out = NULL, *map = NULL,
+                  *wht = NULL;
+    enum e_kernel_t kernel;
+    enum e_unit_t inun;
     struct driz_error_t error;
     struct driz_param_t p;
-    integer_t psize[2], osize[2];
-    char warn_msg[128];
+    integer_t isize[2], psize[2], wsize[2];
 
     driz_log_handle = driz_log_init(driz_log_handle);
-    driz_log_message("starting tblot");
+    driz_log_message("starting tdriz_adjoint");
     driz_error_init(&error);
+    driz_param_init(&p);
 
     if (!PyArg_ParseTupleAndKeywords(
-            args, keywords, "OOO|lllldfsfff:tblot", (char **)kwlist, &oimg,
-            &pixmap, &oout,                    /* OOO */
-            &xmin, &xmax, &ymin, &ymax,        /* llll */
-            &scale, &kscale, &interp_str, &ef, /* dfsf */
-            &misval, &sinscl)                  /* ff */
+            args, keywords, "OOOO|nnnnddssffnnO:tdriz_adjoint",
+            (char **)kwlist, &oimg, &owei, &pixmap, &oout, /* OOOO */
+            &xmin, &xmax, &ymin, &ymax,                    /* nnnn */
+            &scale, &pfract, &kernel_str, &inun_str,       /* ddss */
+            &expin, &wtscl, &out_x0, &out_y0, &omosaic)    /* ffnnO */
     ) {
         return NULL;
     }
 
-    img = (PyArrayObject *)PyArray_ContiguousFromAny(oimg, NPY_FLOAT, 2, 2);
-    if (!img) {
+    /* The input array receives the result, so it is updated in place */
+    img = (PyArrayObject *)PyArray_FROM_OTF(oimg, NPY_FLOAT,
+                                            OUTPUT_ARRAY_FLAGS);
+    if (!img || PyArray_NDIM(img) != 2) {
         driz_error_set_message(&error, "Invalid input array");
         goto _exit;
     }
 
-    map = (PyArrayObject *)PyArray_ContiguousFromAny(pixmap, NPY_DOUBLE, 3, 3);
+    if (owei == Py_None) {
+        wei = NULL;
+    } else {
+        wei = input_array_from_any(owei, NPY_FLOAT, 2);
+        if (!wei) {
+            driz_error_set_message(&error, "Invalid weights array");
+            goto _exit;
+        }
+    }
+
+    map = input_array_from_any(pixmap, NPY_DOUBLE, 3);
     if (!map) {
         driz_error_set_message(&error, "Invalid pixmap array");
         goto _exit;
@@ -363,6 +1076,1857 @@ tblot(PyObject *obj, PyObject *args, PyObject *keywords) {
         goto _exit;
     }
 
+    /* Output counts are read (but not used) by the kernels */
+    wht = (PyArrayObject *)PyArray_ZEROS(2, PyArray_DIMS(out), NPY_FLOAT, 0);
+    if (!wht) {
+        driz_error_set_message(&error, "Out of memory");
+        goto _exit;
+    }
+
+    /* Set the area to be processed */
+    get_dimensions(img, isize);
+    if (xmax == 0 || xmax >= isize[0]) xmax = isize[0] - 1;
+    if (ymax == 0 || ymax >= isize[1]) ymax = isize[1] - 1;
+
+    get_dimensions(map, psize);
+    if (driz_error_check(&error, "Pixel map dimensions != input dimensions.",
+                         psize[0] == isize[0] && psize[1] == isize[1]))
+        goto _exit;
+
+    if (wei) {
+        get_dimensions(wei, wsize);
+        if (driz_error_check(&error,
+                             "Weights array dimensions != input dimensions.",
+                             wsize[0] == isize[0] && wsize[1] == isize[1]))
+            goto _exit;
+    }
+
+    if (shrink_image_section(map, &xmin, &xmax, &ymin, &ymax)) {
+        driz_error_set_message(&error,
+                               "No or too few valid pixels in the pixel map.");
+        goto _exit;
+    }
+
+    if (kernel_str2enum(kernel_str, &kernel, &error) ||
+        unit_str2enum(inun_str, &inun, &error)) {
+        goto _exit;
+    }
+
+    if (pfract <= 0.001) {
+        kernel_str2enum("point", &kernel, &error);
+    }
+
+    p.data = img;
+    p.weights = wei;
+    p.pixmap = map;
+    p.output_data = out;
+    p.output_counts = wht;
+    p.xmin = xmin;
+    p.ymin = ymin;
+    p.xmax = xmax;
+    p.ymax = ymax;
+    p.out_x0 = out_x0;
+    p.out_y0 = out_y0;
+    p.scale = scale;
+    p.pixel_fraction = pfract;
+    p.kernel = kernel;
+    p.in_units = inun;
+    p.exposure_time = expin;
+    p.weight_scale = wtscl;
+    p.adjoint = 1;
+    p.error = &error;
+    if (mosaic_from_any(omosaic, p.mosaic, &error)) goto _exit;
+
+    if (driz_error_check(&error, "xmin must be >= 0", p.xmin >= 0)) goto _exit;
+    if (driz_error_check(&error, "ymin must be >= 0", p.ymin >= 0)) goto _exit;
+    if (driz_error_check(&error, "xmax must be > xmin", p.xmax > p.xmin))
+        goto _exit;
+    if (driz_error_check(&error, "ymax must be > ymin", p.ymax > p.ymin))
+        goto _exit;
+    if (driz_error_check(&error, "scale must be > 0", p.scale > 0.0))
+        goto _exit;
+    if (driz_error_check(&error, "exposure time must be > 0",
+                         p.exposure_time > 0.0))
+        goto _exit;
+    if (driz_error_check(&error, "weight scale must be > 0",
+                         p.weight_scale > 0.0))
+        goto _exit;
+
+    dobox(&p);
+
+_exit:
+    driz_log_message("ending tdriz_adjoint");
+    driz_log_close(driz_log_handle);
+    if (img) {
+        if (driz_error_is_set(&error)) {
+            PyArray_DiscardWritebackIfCopy(img);
+        } else {
+            PyArray_ResolveWritebackIfCopy(img);
+        }
+    }
+    Py_XDECREF(img);
+    Py_XDECREF(wei);
+    Py_XDECREF(out);
+    Py_XDECREF(wht);
+    Py_XDECREF(map);
+
+    if (driz_error_is_set(&error)) {
+        PyErr_SetString(PyExc_ValueError, driz_error_get_message(&error));
+        return NULL;
+    } else {
+        return Py_BuildValue("nn", p.nmiss, p.nskip);
+    }
+}
+
+/** ---------------------------------------------------------------------------
+ * Compute the sparse matrix of overlaps between input and output pixels for
+ * a given pixel map and kernel, interfaces with python code
+ */
+
+static PyObject *
+overlap_matrix(PyObject *obj UNUSED_PARAM, PyObject *args, PyObject *keywords) {
+    const char *kwlist[] = {"pixmap", "shape",  "xmin",    "xmax",   "ymin",
+                            "ymax",   "scale",  "pixfrac", "kernel", "out_x0",
+                            "out_y0", "mosaic", NULL};
+
+    /* Arguments in the order they appear */
+    PyObject *pixmap;
+    integer_t ny = 0;
+    integer_t nx = 0;
+    integer_t xmin = 0;
+    integer_t xmax = 0;
+    integer_t ymin = 0;
+    integer_t ymax = 0;
+    double scale = 1.0;
+    double pfract = 1.0;
+    char *kernel_str = "square";
+    integer_t out_x0 = 0;
+    integer_t out_y0 = 0;
+    PyObject *omosaic = Py_None;
+
+    /* Derived values */
+    PyArrayObject *img = NULL, *out = NULL, *map = NULL;
+    PyArrayObject *indptr = NULL, *indices = NULL, *weights = NULL;
+    enum e_kernel_t kernel;
+    struct overlap_matrix_t m = {0};
+    struct driz_error_t error;
+    struct driz_param_t p;
+    integer_t psize[2];
+    npy_intp dims[2], nnz;
+    char warn_msg[128];
+
+    driz_log_handle = driz_log_init(driz_log_handle);
+    driz_log_message("starting overlap_matrix");
+    driz_error_init(&error);
+
+    if (!PyArg_ParseTupleAndKeywords(
+            args, keywords, "O(nn)|nnnnddsnnO:overlap_matrix", (char **)kwlist,
+            &pixmap, &ny, &nx,               /* O(nn) */
+            &xmin, &xmax, &ymin, &ymax,      /* nnnn */
+            &scale, &pfract, &kernel_str,    /* dds */
+            &out_x0, &out_y0, &omosaic)      /* nnO */
+    ) {
+        return NULL;
+    }
+
+    map = input_array_from_any(pixmap, NPY_DOUBLE, 3);
+    if (!map) {
+        driz_error_set_message(&error, "Invalid pixmap array");
+        goto _exit;
+    }
+
+    if (driz_error_check(&error, "output shape must be positive",
+                         nx > 0 && ny > 0))
+        goto _exit;
+
+    /* The kernels never touch the data and output pixels when recording
+       overlaps, so zero-filled arrays only provide the image geometry. */
+    get_dimensions(map, psize);
+    dims[0] = psize[1];
+    dims[1] = psize[0];
+    img = (PyArrayObject *)PyArray_ZEROS(2, dims, NPY_FLOAT, 0);
+    dims[0] = ny;
+    dims[1] = nx;
+    out = (PyArrayObject *)PyArray_ZEROS(2, dims, NPY_FLOAT, 0);
+    if (!img || !out) {
+        driz_error_set_message(&error, "Out of memory");
+        goto _exit;
+    }
+
+    /* Set the area to be processed */
+    if (xmax == 0 || xmax >= psize[0]) xmax = psize[0] - 1;
+    if (ymax == 0 || ymax >= psize[1]) ymax = psize[1] - 1;
+
+    if (shrink_image_section(map, &xmin, &xmax, &ymin, &ymax)) {
+        driz_error_set_message(&error,
+                               "No or too few valid pixels in the pixel map.");
+        goto _exit;
+    }
+
+    if (kernel_str2enum(kernel_str, &kernel, &error)) {
+        goto _exit;
+    }
+
+    if (kernel == kernel_gaussian || kernel == kernel_lanczos2 ||
+        kernel == kernel_lanczos3) {
+        if (snprintf(warn_msg, 128,
+                     "Kernel '%s' is not a flux-conserving kernel.",
+                     kernel_str) < 1) {
+            strcpy(warn_msg,
+                   "Selected kernel is not a flux-conserving kernel.");
+        }
+        PyErr_WarnEx(PyExc_Warning, warn_msg, 1);
+    }
+
+    if (pfract <= 0.001) {
+        kernel_str2enum("point", &kernel, &error);
+    }
+
+    driz_param_init(&p);
+
+    p.data = img;
+    p.pixmap = map;
+    p.output_data = out;
+    p.output_counts = out;
+    p.xmin = xmin;
+    p.ymin = ymin;
+    p.xmax = xmax;
+    p.ymax = ymax;
+    p.out_x0 = out_x0;
+    p.out_y0 = out_y0;
+    p.scale = scale;
+    p.pixel_fraction = pfract;
+    p.kernel = kernel;
+    p.overlaps = &m;
+    p.error = &error;
+    if (mosaic_from_any(omosaic, p.mosaic, &error)) goto _exit;
+
+    if (driz_error_check(&error, "xmin must be >= 0", p.xmin >= 0)) goto _exit;
+    if (driz_error_check(&error, "ymin must be >= 0", p.ymin >= 0)) goto _exit;
+    if (driz_error_check(&error, "xmax must be > xmin", p.xmax > p.xmin))
+        goto _exit;
+    if (driz_error_check(&error, "ymax must be > ymin", p.ymax > p.ymin))
+        goto _exit;
+    if (driz_error_check(&error, "scale must be > 0", p.scale > 0.0))
+        goto _exit;
+
+    if (overlap_matrix_init(&m, (npy_intp)psize[0] * psize[1], &error)) {
+        goto _exit;
+    }
+
+    if (dobox(&p)) {
+        goto _exit;
+    }
+
+    /* Hand the buffers over to numpy arrays */
+    nnz = m.nnz;
+    dims[0] = m.nrows + 1;
+    indptr = (PyArrayObject *)PyArray_SimpleNewFromData(1, dims, NPY_INTP,
+                                                        m.indptr);
+    if (!indptr) goto _exit;
+    PyArray_ENABLEFLAGS(indptr, NPY_ARRAY_OWNDATA);
+    m.indptr = NULL;
+
+    dims[0] = nnz;
+    if (nnz > 0 && nnz < m.capacity) {
+        /* Trim the unused capacity; keep the old buffers should that fail */
+        npy_intp *ind_trim;
+        float *wht_trim;
+        if ((ind_trim = realloc(m.indices, nnz * sizeof(npy_intp))) != NULL) {
+            m.indices = ind_trim;
+        }
+        if ((wht_trim = realloc(m.weights, nnz * sizeof(float))) != NULL) {
+            m.weights = wht_trim;
+        }
+    }
+    indices = (PyArrayObject *)PyArray_SimpleNewFromData(1, dims, NPY_INTP,
+                                                         m.indices);
+    if (!indices) goto _exit;
+    PyArray_ENABLEFLAGS(indices, NPY_ARRAY_OWNDATA);
+    m.indices = NULL;
+
+    weights = (PyArrayObject *)PyArray_SimpleNewFromData(1, dims, NPY_FLOAT,
+                                                         m.weights);
+    if (!weights) goto _exit;
+    PyArray_ENABLEFLAGS(weights, NPY_ARRAY_OWNDATA);
+    m.weights = NULL;
+
+_exit:
+    driz_log_message("ending overlap_matrix");
+    driz_log_close(driz_log_handle);
+    overlap_matrix_free(&m);
+    Py_XDECREF(img);
+    Py_XDECREF(out);
+    Py_XDECREF(map);
+
+    if (driz_error_is_set(&error) || !weights) {
+        Py_XDECREF(indptr);
+        Py_XDECREF(indices);
+        Py_XDECREF(weights);
+        if (driz_error_is_set(&error)) {
+            PyErr_SetString(PyExc_ValueError, driz_error_get_message(&error));
+        }
+        return NULL;
+    } else {
+        return Py_BuildValue("NNNnn", indptr, indices, weights, p.nmiss,
+                             p.nskip);
+    }
+}
+
+/** ---------------------------------------------------------------------------
+ * Drizzle an image using a precomputed overlap matrix, interfaces with python
+ * code. Unlike tdriz, this returns None: the numbers of missed pixels and
+ * skipped lines depend on the pixel map, which the matrix does not keep, and
+ * were returned by overlap_matrix when the matrix was computed.
+ */
+
+static PyObject *
+tdriz_overlaps(PyObject *obj UNUSED_PARAM, PyObject *args,
+               PyObject *keywords) {
+    const char *kwlist[] = {"input",    "weights", "indptr",   "indices",
+                            "overlaps", "output",  "counts",   "context",
+                            "uniqid",   "scale",   "in_units", "expscale",
+                            "wtscale",  "fillstr", NULL};
+
+    /* Arguments in the order they appear */
+    PyObject *oimg, *owei, *oindptr, *oindices, *ooverlaps, *oout, *owht, *ocon;
+    integer_t uniqid = 1;
+    double scale = 1.0;
+    char *inun_str = "cps";
+    float expin = 1.0;
+    float wtscl = 1.0;
+    char *fillstr = "INDEF";
+
+    /* Derived values */
+    PyArrayObject *img = NULL, *wei = NULL, *out = NULL, *wht = NULL,
+                  *con = NULL, *ind = NULL, *col = NULL, *ovr = NULL;
+    enum e_unit_t inun;
+    bool_t do_fill;
+    float fill_value;
+    struct overlap_matrix_t m;
+    struct driz_error_t error;
+    struct driz_param_t p;
+    integer_t isize[2], osize[2], wsize[2];
+    npy_intp k;
+
+    driz_log_handle = driz_log_init(driz_log_handle);
+    driz_log_message("starting tdriz_overlaps");
+    driz_error_init(&error);
+
+    if (!PyArg_ParseTupleAndKeywords(
+            args, keywords, "OOOOOOOO|ndsffs:tdriz_overlaps", (char **)kwlist,
+            &oimg, &owei, &oindptr, &oindices, &ooverlaps, /* OOOOO */
+            &oout, &owht, &ocon,                         /* OOO */
+            &uniqid, &scale, &inun_str,                  /* nds */
+            &expin, &wtscl, &fillstr)                    /* ffs */
+    ) {
+        return NULL;
+    }
+
+    img = input_array_from_any(oimg, NPY_FLOAT, 2);
+    if (!img) {
+        driz_error_set_message(&error, "Invalid input array");
+        goto _exit;
+    }
+
+    if (owei == Py_None) {
+        wei = NULL;
+    } else {
+        wei = input_array_from_any(owei, NPY_FLOAT, 2);
+        if (!wei) {
+            driz_error_set_message(&error, "Invalid weights array");
+            goto _exit;
+        }
+    }
+
+    ind = (PyArrayObject *)PyArray_ContiguousFromAny(oindptr, NPY_INTP, 1, 1);
+    col = (PyArrayObject *)PyArray_ContiguousFromAny(oindices, NPY_INTP, 1, 1);
+    ovr = (PyArrayObject *)PyArray_ContiguousFromAny(ooverlaps, NPY_FLOAT, 1,
+                                                     1);
+    if (!ind || !col || !ovr) {
+        driz_error_set_message(&error, "Invalid overlap matrix");
+        goto _exit;
+    }
+
+    out = (PyArrayObject *)PyArray_FROM_OTF(oout, NPY_FLOAT,
+                                            OUTPUT_ARRAY_FLAGS);
+    if (!out || PyArray_NDIM(out) != 2) {
+        driz_error_set_message(&error, "Invalid output array");
+        goto _exit;
+    }
+
+    wht = (PyArrayObject *)PyArray_FROM_OTF(owht, NPY_FLOAT,
+                                            OUTPUT_ARRAY_FLAGS);
+    if (!wht || PyArray_NDIM(wht) != 2) {
+        driz_error_set_message(&error, "Invalid counts array");
+        goto _exit;
+    }
+
+    if (ocon == Py_None) {
+        con = NULL;
+    } else {
+        con = (PyArrayObject *)PyArray_FROM_OTF(ocon, NPY_INT32,
+                                                OUTPUT_ARRAY_FLAGS);
+        if (!con || PyArray_NDIM(con) != 2) {
+            driz_error_set_message(&error, "Invalid context array");
+            goto _exit;
+        }
+    }
+
+    if (fill_str2value(fillstr, &do_fill, &fill_value, &error) ||
+        unit_str2enum(inun_str, &inun, &error)) {
+        goto _exit;
+    }
+
+    m.nrows = PyArray_DIM(ind, 0) - 1;
+    m.nnz = PyArray_DIM(col, 0);
+    m.capacity = m.nnz;
+    m.row = m.nrows;
+    m.indptr = (npy_intp *)PyArray_DATA(ind);
+    m.indices = (npy_intp *)PyArray_DATA(col);
+    m.weights = (float *)PyArray_DATA(ovr);
+
+    if (driz_error_check(&error, "Inconsistent overlap matrix arrays",
+                         m.nrows >= 0 && PyArray_DIM(ovr, 0) == m.nnz &&
+                             m.indptr[0] == 0 && m.indptr[m.nrows] == m.nnz))
+        goto _exit;
+
+    /* Rows must lie within indices and overlaps: the kernel trusts indptr */
+    for (k = 0; k < m.nrows; ++k) {
+        if (m.indptr[k] > m.indptr[k + 1]) break;
+    }
+    if (driz_error_check(&error, "Overlap matrix row pointers must be "
+                                 "non-decreasing", k == m.nrows))
+        goto _exit;
+
+    get_dimensions(img, isize);
+    get_dimensions(out, osize);
+    get_dimensions(wht, wsize);
+    if (driz_error_check(&error, "Output and counts arrays differ in shape",
+                         osize[0] == wsize[0] && osize[1] == wsize[1]))
+        goto _exit;
+
+    if (con) {
+        get_dimensions(con, wsize);
+        if (driz_error_check(&error,
+                             "Output and context arrays differ in shape",
+                             osize[0] == wsize[0] && osize[1] == wsize[1]))
+            goto _exit;
+    }
+
+    if (wei) {
+        get_dimensions(wei, wsize);
+        if (driz_error_check(&error,
+                             "Weights array dimensions != input dimensions.",
+                             wsize[0] == isize[0] && wsize[1] == isize[1]))
+            goto _exit;
+    }
+
+    driz_param_init(&p);
+
+    p.data = img;
+    p.weights = wei;
+    p.output_data = out;
+    p.output_counts = wht;
+    p.output_context = con;
+    p.uuid = uniqid;
+    p.scale = scale;
+    p.in_units = inun;
+    p.exposure_time = expin;
+    p.weight_scale = wtscl;
+    p.fill_value = fill_value;
+    p.overlaps = &m;
+    p.error = &error;
+
+    if (driz_error_check(&error, "scale must be > 0", p.scale > 0.0))
+        goto _exit;
+    if (driz_error_check(&error, "exposure time must be > 0",
+                         p.exposure_time > 0.0))
+        goto _exit;
+    if (driz_error_check(&error, "weight scale must be > 0",
+                         p.weight_scale > 0.0))
+        goto _exit;
+
+    if (dobox_overlaps(&p)) {
+        goto _exit;
+    }
+
+    /* Put in the fill values (if defined) */
+    if (do_fill) {
+        put_fill(&p, fill_value);
+    }
+
+_exit:
+    driz_log_message("ending tdriz_overlaps");
+    driz_log_close(driz_log_handle);
+    if (out) PyArray_ResolveWritebackIfCopy(out);
+    if (wht) PyArray_ResolveWritebackIfCopy(wht);
+    if (con) PyArray_ResolveWritebackIfCopy(con);
+    Py_XDECREF(con);
+    Py_XDECREF(img);
+    Py_XDECREF(wei);
+    Py_XDECREF(out);
+    Py_XDECREF(wht);
+    Py_XDECREF(ind);
+    Py_XDECREF(col);
+    Py_XDECREF(ovr);
+
+    if (driz_error_is_set(&error)) {
+        PyErr_SetString(PyExc_ValueError, driz_error_get_message(&error));
+        return NULL;
+    } else {
+        return Py_BuildValue("");
+    }
+}
+
+/** ---------------------------------------------------------------------------
+ * State shared by the worker threads of tdriz_batch. Images are split into
+ * ntasks contiguous chunks; chunk k is drizzled onto out_data[k],
+ * out_counts[k] and out_context[k], where chunk 0 uses the caller's output
+ * arrays and the other chunks private ones merged at the end.
+ * tdriz_stack uses one chunk per image, out_data[k] and out_counts[k] being
+ * the planes of the frame stacks.
+ */
+
+struct batch_t {
+    struct driz_param_t base; /* options common to all images */
+    int nimages;
+    int ntasks;
+    int nrow_tasks;
+    int nplanes;
+    PyArrayObject **images;
+    PyArrayObject **weights;
+    PyArrayObject **pixmaps;
+    PyArrayObject *shared_map; /* set when all images share one pixel map */
+    float *exptimes;
+    npy_int32 *ctx_ids;
+    integer_t *nmiss;
+    integer_t *nskip;
+    PyArrayObject **out_data;
+    PyArrayObject **out_counts;
+    PyArrayObject **out_context; /* whole context arrays, ntasks */
+    PyArrayObject **ctx_planes;  /* 2D views, ntasks * nplanes */
+    struct driz_error_t *errors; /* one per task */
+    PyArrayObject *coadd_data;   /* co-add of the frames of tdriz_stack */
+    PyArrayObject *coadd_counts;
+    PyArrayObject **coadd_planes; /* 2D views of the co-add context */
+};
+
+static void
+batch_drizzle_task(void *arg, int k) {
+    struct batch_t *b = (struct batch_t *)arg;
+    struct driz_param_t p;
+    integer_t isize[2];
+    int n, first, last;
+
+    first = (int)((npy_intp)k * b->nimages / b->ntasks);
+    last = (int)((npy_intp)(k + 1) * b->nimages / b->ntasks);
+
+    for (n = first; n < last; ++n) {
+        p = b->base;
+        p.data = b->images[n];
+        p.weights = b->weights ? b->weights[n] : NULL;
+        p.pixmap = b->pixmaps[n];
+        p.output_data = b->out_data[k];
+        p.output_counts = b->out_counts[k];
+        if (b->ctx_planes) {
+            p.output_context =
+                b->ctx_planes[k * b->nplanes + b->ctx_ids[n] / 32];
+            p.uuid = b->ctx_ids[n] % 32 + 1;
+        }
+        p.exposure_time = b->exptimes[n];
+        p.error = b->errors + k;
+
+        get_dimensions(p.data, isize);
+        p.xmin = 0;
+        p.xmax = isize[0] - 1;
+        p.ymin = 0;
+        p.ymax = isize[1] - 1;
+
+        if (shrink_image_section(p.pixmap, &p.xmin, &p.xmax, &p.ymin,
+                                 &p.ymax)) {
+            driz_error_format_message(
+                p.error, "No or too few valid pixels in the pixel map of "
+                         "image %d.", n);
+            return;
+        }
+
+        if (dobox(&p)) return;
+
+        b->nmiss[n] = p.nmiss;
+        b->nskip[n] = p.nskip;
+    }
+}
+
+static void
+batch_merge_task(void *arg, int k) {
+    struct batch_t *b = (struct batch_t *)arg;
+    integer_t ny, row_start, row_end;
+    int t;
+
+    ny = PyArray_DIM(b->out_data[0], 0);
+    row_start = (integer_t)((npy_intp)k * ny / b->nrow_tasks);
+    row_end = (integer_t)((npy_intp)(k + 1) * ny / b->nrow_tasks);
+
+    /* Merge in task order so that results do not depend on timing */
+    for (t = 1; t < b->ntasks; ++t) {
+        merge_output_rows(b->out_data[0], b->out_counts[0],
+                          b->out_context ? b->out_context[0] : NULL,
+                          b->out_data[t], b->out_counts[t],
+                          b->out_context ? b->out_context[t] : NULL, 0,
+                          row_start, row_end);
+    }
+}
+
+/** ---------------------------------------------------------------------------
+ * Convert the images, weights, pixel maps, and exposure times passed to the
+ * batch functions to arrays. Images and weights may be sequences of 2D
+ * arrays or 3D stacks; pixel maps may be a sequence of 3D arrays, a 4D stack,
+ * or a single 3D array shared by all images.
+ */
+
+static int
+batch_load_inputs(struct batch_t *b, PyObject *oimgs, PyObject *oweis,
+                  PyObject *omaps, PyObject *oexptimes,
+                  struct driz_error_t *error) {
+    PyObject *seq = NULL;
+    PyArrayObject *exps = NULL;
+    integer_t isize[2], wsize[2];
+    npy_intp n, nimg;
+    int status = 1;
+
+    seq = PySequence_Fast(oimgs, "inputs must be a sequence of images");
+    if (!seq) goto _exit;
+    nimg = PySequence_Fast_GET_SIZE(seq);
+    if (driz_error_check(error, "No input images", nimg > 0)) goto _exit;
+    if (driz_error_check(error, "Too many input images", nimg < INT_MAX))
+        goto _exit;
+    b->nimages = (int)nimg;
+
+    b->images = (PyArrayObject **)calloc(nimg, sizeof(PyArrayObject *));
+    b->pixmaps = (PyArrayObject **)calloc(nimg, sizeof(PyArrayObject *));
+    b->exptimes = (float *)malloc(nimg * sizeof(float));
+    b->nmiss = (integer_t *)calloc(nimg, sizeof(integer_t));
+    b->nskip = (integer_t *)calloc(nimg, sizeof(integer_t));
+    if (!b->images || !b->pixmaps || !b->exptimes || !b->nmiss ||
+        !b->nskip) {
+        driz_error_set_message(error, "Out of memory");
+        goto _exit;
+    }
+
+    for (n = 0; n < nimg; ++n) {
+        b->images[n] = input_array_from_any(
+            PySequence_Fast_GET_ITEM(seq, n), NPY_FLOAT, 2);
+        if (!b->images[n]) {
+            driz_error_format_message(error, "Invalid input array %d", (int)n);
+            goto _exit;
+        }
+    }
+    Py_CLEAR(seq);
+
+    if (oweis != Py_None) {
+        seq = PySequence_Fast(oweis, "weights must be a sequence of images");
+        if (!seq) goto _exit;
+        if (driz_error_check(error, "Number of weight maps != number of inputs",
+                             PySequence_Fast_GET_SIZE(seq) == nimg))
+            goto _exit;
+        b->weights = (PyArrayObject **)calloc(nimg, sizeof(PyArrayObject *));
+        if (!b->weights) {
+            driz_error_set_message(error, "Out of memory");
+            goto _exit;
+        }
+        for (n = 0; n < nimg; ++n) {
+            b->weights[n] = input_array_from_any(
+                PySequence_Fast_GET_ITEM(seq, n), NPY_FLOAT, 2);
+            if (!b->weights[n]) {
+                driz_error_format_message(error, "Invalid weights array %d",
+                                          (int)n);
+                goto _exit;
+            }
+            get_dimensions(b->weights[n], wsize);
+            get_dimensions(b->images[n], isize);
+            if (wsize[0] != isize[0] || wsize[1] != isize[1]) {
+                driz_error_format_message(
+                    error,
+                    "Weights array dimensions != input dimensions for "
+                    "image %d.",
+                    (int)n);
+                goto _exit;
+            }
+        }
+        Py_CLEAR(seq);
+    }
+
+    /* A single (ny, nx, 2) pixel map is shared by all images */
+    if (PyArray_Check(omaps) && PyArray_NDIM((PyArrayObject *)omaps) == 3) {
+        b->shared_map = input_array_from_any(omaps, NPY_DOUBLE, 3);
+        if (!b->shared_map) {
+            driz_error_set_message(error, "Invalid pixmap array");
+            goto _exit;
+        }
+        for (n = 0; n < nimg; ++n) {
+            b->pixmaps[n] = b->shared_map;
+        }
+    } else {
+        seq = PySequence_Fast(omaps, "pixmaps must be a sequence of arrays");
+        if (!seq) goto _exit;
+        if (driz_error_check(error, "Number of pixmaps != number of inputs",
+                             PySequence_Fast_GET_SIZE(seq) == nimg))
+            goto _exit;
+        for (n = 0; n < nimg; ++n) {
+            b->pixmaps[n] = input_array_from_any(
+                PySequence_Fast_GET_ITEM(seq, n), NPY_DOUBLE, 3);
+            if (!b->pixmaps[n]) {
+                driz_error_format_message(error, "Invalid pixmap array %d",
+                                          (int)n);
+                goto _exit;
+            }
+        }
+        Py_CLEAR(seq);
+    }
+
+    for (n = 0; n < nimg; ++n) {
+        get_dimensions(b->images[n], isize);
+        get_dimensions(b->pixmaps[n], wsize);
+        if (wsize[0] != isize[0] || wsize[1] != isize[1] ||
+            PyArray_DIM(b->pixmaps[n], 2) < 2) {
+            driz_error_format_message(
+                error, "Pixel map dimensions != input dimensions for image %d.",
+                (int)n);
+            goto _exit;
+        }
+    }
+
+    /* Per-image exposure times */
+    if (oexptimes == Py_None) {
+        for (n = 0; n < nimg; ++n) b->exptimes[n] = 1.0f;
+    } else {
+        exps = (PyArrayObject *)PyArray_ContiguousFromAny(oexptimes, NPY_FLOAT,
+                                                          1, 1);
+        if (!exps || PyArray_SIZE(exps) != nimg) {
+            driz_error_set_message(
+                error, "Number of exposure times != number of inputs");
+            goto _exit;
+        }
+        memcpy(b->exptimes, PyArray_DATA(exps), nimg * sizeof(float));
+    }
+    for (n = 0; n < nimg; ++n) {
+        if (!(b->exptimes[n] > 0.0f)) {
+            driz_error_set_message(error, "exposure time must be > 0");
+            goto _exit;
+        }
+    }
+
+    status = 0;
+
+_exit:
+    Py_XDECREF(seq);
+    Py_XDECREF(exps);
+    return status;
+}
+
+/** ---------------------------------------------------------------------------
+ * Release the input arrays of the batch functions
+ */
+
+static void
+batch_free_inputs(struct batch_t *b) {
+    int n;
+
+    for (n = 0; n < b->nimages; ++n) {
+        if (b->images) Py_XDECREF(b->images[n]);
+        if (b->weights) Py_XDECREF(b->weights[n]);
+        if (b->pixmaps && !b->shared_map) Py_XDECREF(b->pixmaps[n]);
+    }
+    Py_XDECREF(b->shared_map);
+    free(b->images);
+    free(b->weights);
+    free(b->pixmaps);
+    free(b->exptimes);
+    free(b->nmiss);
+    free(b->nskip);
+}
+
+/** ---------------------------------------------------------------------------
+ * Set up the drizzle options common to all images of a batch
+ */
+
+static int
+batch_init_params(struct driz_param_t *p, const char *kernel_str,
+                  const char *inun_str, double scale, double pfract,
+                  float wtscl, struct driz_error_t *error) {
+    enum e_kernel_t kernel;
+    enum e_unit_t inun;
+    char warn_msg[128];
+
+    if (kernel_str2enum(kernel_str, &kernel, error) ||
+        unit_str2enum(inun_str, &inun, error)) {
+        return 1;
+    }
+
+    if (kernel == kernel_gaussian || kernel == kernel_lanczos2 ||
+        kernel == kernel_lanczos3) {
+        if (snprintf(warn_msg, 128,
+                     "Kernel '%s' is not a flux-conserving kernel.",
+                     kernel_str) < 1) {
+            strcpy(warn_msg,
+                   "Selected kernel is not a flux-conserving kernel.");
+        }
+        PyErr_WarnEx(PyExc_Warning, warn_msg, 1);
+    }
+
+    if (pfract <= 0.001) {
+        kernel_str2enum("point", &kernel, error);
+    }
+
+    if (driz_error_check(error, "scale must be > 0", scale > 0.0)) return 1;
+    if (driz_error_check(error, "weight scale must be > 0", wtscl > 0.0))
+        return 1;
+
+    driz_param_init(p);
+    p->kernel = kernel;
+    p->pixel_fraction = pfract;
+    p->scale = scale;
+    p->in_units = inun;
+    p->weight_scale = wtscl;
+
+    return 0;
+}
+
+/** ---------------------------------------------------------------------------
+ * Drizzle many input images onto the same output in a single call, spreading
+ * the images over several threads, interfaces with python code
+ */
+
+static PyObject *
+tdriz_batch(PyObject *obj UNUSED_PARAM, PyObject *args, PyObject *keywords) {
+    const char *kwlist[] = {"inputs",   "weights",  "pixmaps", "output",
+                            "counts",   "context",  "ctx_ids", "exptimes",
+                            "scale",    "pixfrac",  "kernel",  "in_units",
+                            "wtscale",  "fillstr",  "nthreads", "out_x0",
+                            "out_y0",   "mosaic",   NULL};
+
+    /* Arguments in the order they appear */
+    PyObject *oimgs, *oweis, *omaps, *oout, *owht, *ocon;
+    PyObject *octx_ids = Py_None;
+    PyObject *oexptimes = Py_None;
+    double scale = 1.0;
+    double pfract = 1.0;
+    char *kernel_str = "square";
+    char *inun_str = "cps";
+    float wtscl = 1.0;
+    char *fillstr = "INDEF";
+    int nthreads = 1;
+    integer_t out_x0 = 0;
+    integer_t out_y0 = 0;
+    PyObject *omosaic = Py_None;
+
+    /* Derived values */
+    PyArrayObject *out = NULL, *wht = NULL, *con = NULL, *ids = NULL;
+    PyArrayObject *onmiss = NULL, *onskip = NULL;
+    struct batch_t b;
+    bool_t do_fill;
+    float fill_value;
+    struct driz_error_t error;
+    struct driz_param_t p;
+    integer_t osize[2];
+    npy_intp n, k, nimg, dims[3];
+
+    driz_log_handle = driz_log_init(driz_log_handle);
+    driz_log_message("starting tdriz_batch");
+    driz_error_init(&error);
+    memset(&b, 0, sizeof(b));
+
+    if (!PyArg_ParseTupleAndKeywords(
+            args, keywords, "OOOOOO|OOddssfsinnO:tdriz_batch", (char **)kwlist,
+            &oimgs, &oweis, &omaps, &oout, &owht, &ocon, /* OOOOOO */
+            &octx_ids, &oexptimes,                      /* OO */
+            &scale, &pfract, &kernel_str, &inun_str,    /* ddss */
+            &wtscl, &fillstr, &nthreads,                /* fsi */
+            &out_x0, &out_y0, &omosaic)                 /* nnO */
+    ) {
+        return NULL;
+    }
+
+    /* Outputs are updated in place (through a temporary copy if needed) */
+    out = (PyArrayObject *)PyArray_FROM_OTF(oout, NPY_FLOAT,
+                                            OUTPUT_ARRAY_FLAGS);
+    wht = (PyArrayObject *)PyArray_FROM_OTF(owht, NPY_FLOAT,
+                                            OUTPUT_ARRAY_FLAGS);
+    if (!out || !wht || PyArray_NDIM(out) != 2 ||
+        !PyArray_SAMESHAPE(out, wht)) {
+        driz_error_set_message(&error, "Invalid output or counts array");
+        goto _exit;
+    }
+    get_dimensions(out, osize);
+
+    if (ocon != Py_None) {
+        con = (PyArrayObject *)PyArray_FROM_OTF(ocon, NPY_INT32,
+                                                OUTPUT_ARRAY_FLAGS);
+        if (!con || PyArray_NDIM(con) < 2 || PyArray_NDIM(con) > 3 ||
+            PyArray_DIM(con, PyArray_NDIM(con) - 1) != osize[0] ||
+            PyArray_DIM(con, PyArray_NDIM(con) - 2) != osize[1]) {
+            driz_error_set_message(&error, "Invalid context array");
+            goto _exit;
+        }
+        b.nplanes = PyArray_NDIM(con) == 3 ? (int)PyArray_DIM(con, 0) : 1;
+    }
+
+    if (batch_load_inputs(&b, oimgs, oweis, omaps, oexptimes, &error)) {
+        goto _exit;
+    }
+    nimg = b.nimages;
+
+    if (con) {
+        if (driz_error_check(&error, "Context IDs are required with context",
+                             octx_ids != Py_None))
+            goto _exit;
+        ids = (PyArrayObject *)PyArray_ContiguousFromAny(octx_ids, NPY_INT32,
+                                                         1, 1);
+        if (!ids || PyArray_SIZE(ids) != nimg) {
+            driz_error_set_message(&error,
+                                   "Number of context IDs != number of inputs");
+            goto _exit;
+        }
+        b.ctx_ids = (npy_int32 *)PyArray_DATA(ids);
+        for (n = 0; n < nimg; ++n) {
+            if (b.ctx_ids[n] < 0 || b.ctx_ids[n] / 32 >= b.nplanes) {
+                driz_error_set_message(
+                    &error, "Context ID is outside of the context array");
+                goto _exit;
+            }
+        }
+    }
+
+    if (fill_str2value(fillstr, &do_fill, &fill_value, &error) ||
+        batch_init_params(&b.base, kernel_str, inun_str, scale, pfract, wtscl,
+                          &error)) {
+        goto _exit;
+    }
+    b.base.out_x0 = out_x0;
+    b.base.out_y0 = out_y0;
+    if (mosaic_from_any(omosaic, b.base.mosaic, &error)) goto _exit;
+
+    /* Set up the (private) outputs of each task */
+    b.ntasks = (int)MIN(MAX(nthreads, 1), nimg);
+    b.out_data = (PyArrayObject **)calloc(b.ntasks, sizeof(PyArrayObject *));
+    b.out_counts = (PyArrayObject **)calloc(b.ntasks, sizeof(PyArrayObject *));
+    b.errors =
+        (struct driz_error_t *)calloc(b.ntasks, sizeof(struct driz_error_t));
+    if (con) {
+        b.out_context =
+            (PyArrayObject **)calloc(b.ntasks, sizeof(PyArrayObject *));
+        b.ctx_planes = (PyArrayObject **)calloc(b.ntasks * b.nplanes,
+                                                sizeof(PyArrayObject *));
+    }
+    if (!b.out_data || !b.out_counts || !b.errors ||
+        (con && (!b.out_context || !b.ctx_planes))) {
+        driz_error_set_message(&error, "Out of memory");
+        goto _exit;
+    }
+
+    for (k = 0; k < b.ntasks; ++k) {
+        driz_error_init(b.errors + k);
+        if (k == 0) {
+            Py_INCREF(out);
+            Py_INCREF(wht);
+            Py_XINCREF(con);
+            b.out_data[0] = out;
+            b.out_counts[0] = wht;
+            if (con) b.out_context[0] = con;
+        } else {
+            dims[0] = osize[1];
+            dims[1] = osize[0];
+            b.out_data[k] =
+                (PyArrayObject *)PyArray_ZEROS(2, dims, NPY_FLOAT, 0);
+            b.out_counts[k] =
+                (PyArrayObject *)PyArray_ZEROS(2, dims, NPY_FLOAT, 0);
+            if (!b.out_data[k] || !b.out_counts[k]) goto _exit;
+            if (con) {
+                b.out_context[k] = (PyArrayObject *)PyArray_ZEROS(
+                    PyArray_NDIM(con), PyArray_DIMS(con), NPY_INT32, 0);
+                if (!b.out_context[k]) goto _exit;
+            }
+        }
+
+        for (n = 0; con && n < b.nplanes; ++n) {
+            if (PyArray_NDIM(con) == 2) {
+                Py_INCREF(b.out_context[k]);
+                b.ctx_planes[k * b.nplanes] = b.out_context[k];
+            } else {
+                b.ctx_planes[k * b.nplanes + n] = (PyArrayObject *)
+                    PySequence_GetItem((PyObject *)b.out_context[k], n);
+                if (!b.ctx_planes[k * b.nplanes + n]) goto _exit;
+            }
+        }
+    }
+
+    b.nrow_tasks = (int)MIN(osize[1], 4 * b.ntasks);
+
+    Py_BEGIN_ALLOW_THREADS;
+
+    driz_parallel(b.ntasks, b.ntasks, batch_drizzle_task, &b);
+
+    for (k = 0; k < b.ntasks; ++k) {
+        if (driz_error_is_set(b.errors + k)) {
+            driz_error_set_message(&error,
+                                   driz_error_get_message(b.errors + k));
+            break;
+        }
+    }
+
+    if (!driz_error_is_set(&error) && b.ntasks > 1) {
+        driz_parallel(b.ntasks, b.nrow_tasks, batch_merge_task, &b);
+    }
+
+    /* Put in the fill values (if defined) */
+    if (!driz_error_is_set(&error) && do_fill) {
+        p = b.base;
+        p.output_data = out;
+        p.output_counts = wht;
+        p.error = &error;
+        put_fill(&p, fill_value);
+    }
+
+    Py_END_ALLOW_THREADS;
+
+    if (!driz_error_is_set(&error)) {
+        onmiss = (PyArrayObject *)PyArray_SimpleNew(1, &nimg, NPY_INTP);
+        onskip = (PyArrayObject *)PyArray_SimpleNew(1, &nimg, NPY_INTP);
+        if (onmiss && onskip) {
+            memcpy(PyArray_DATA(onmiss), b.nmiss, nimg * sizeof(integer_t));
+            memcpy(PyArray_DATA(onskip), b.nskip, nimg * sizeof(integer_t));
+        }
+    }
+
+_exit:
+    driz_log_message("ending tdriz_batch");
+    driz_log_close(driz_log_handle);
+
+    for (k = 0; k < b.ntasks; ++k) {
+        if (b.out_data) Py_XDECREF(b.out_data[k]);
+        if (b.out_counts) Py_XDECREF(b.out_counts[k]);
+        if (b.out_context) Py_XDECREF(b.out_context[k]);
+        for (n = 0; b.ctx_planes && n < b.nplanes; ++n) {
+            Py_XDECREF(b.ctx_planes[k * b.nplanes + n]);
+        }
+    }
+    batch_free_inputs(&b);
+    free(b.out_data);
+    free(b.out_counts);
+    free(b.out_context);
+    free(b.ctx_planes);
+    free(b.errors);
+    Py_XDECREF(ids);
+
+    if (driz_error_is_set(&error) || PyErr_Occurred() || !onmiss || !onskip) {
+        if (out) PyArray_DiscardWritebackIfCopy(out);
+        if (wht) PyArray_DiscardWritebackIfCopy(wht);
+        if (con) PyArray_DiscardWritebackIfCopy(con);
+    } else {
+        PyArray_ResolveWritebackIfCopy(out);
+        PyArray_ResolveWritebackIfCopy(wht);
+        if (con) PyArray_ResolveWritebackIfCopy(con);
+    }
+    Py_XDECREF(out);
+    Py_XDECREF(wht);
+    Py_XDECREF(con);
+
+    if (driz_error_is_set(&error)) {
+        Py_XDECREF(onmiss);
+        Py_XDECREF(onskip);
+        PyErr_SetString(PyExc_ValueError, driz_error_get_message(&error));
+        return NULL;
+    } else if (PyErr_Occurred() || !onmiss || !onskip) {
+        Py_XDECREF(onmiss);
+        Py_XDECREF(onskip);
+        return NULL;
+    } else {
+        return Py_BuildValue("NN", onmiss, onskip);
+    }
+}
+
+static void
+stack_coadd_task(void *arg, int k) {
+    struct batch_t *b = (struct batch_t *)arg;
+    PyArrayObject *ctx;
+    integer_t i, j, nx, ny, row_start, row_end, bv;
+    int n;
+
+    ny = PyArray_DIM(b->coadd_data, 0);
+    nx = PyArray_DIM(b->coadd_data, 1);
+    row_start = (integer_t)((npy_intp)k * ny / b->nrow_tasks);
+    row_end = (integer_t)((npy_intp)(k + 1) * ny / b->nrow_tasks);
+
+    /* Add frames in order so that results do not depend on timing */
+    for (n = 0; n < b->nimages; ++n) {
+        merge_output_rows(b->coadd_data, b->coadd_counts, NULL,
+                          b->out_data[n], b->out_counts[n], NULL, 0,
+                          row_start, row_end);
+
+        if (!b->coadd_planes) continue;
+
+        ctx = b->coadd_planes[b->ctx_ids[n] / 32];
+        bv = compute_bit_value(b->ctx_ids[n] % 32 + 1);
+        for (j = row_start; j < row_end; ++j) {
+            for (i = 0; i < nx; ++i) {
+                if (get_pixel(b->out_counts[n], i, j) > 0.0f) {
+                    set_bit(ctx, i, j, bv);
+                }
+            }
+        }
+    }
+}
+
+/** ---------------------------------------------------------------------------
+ * Drizzle a series of frames, each onto its own plane of an output stack,
+ * and optionally add them to a co-added output, interfaces with python code
+ */
+
+static PyObject *
+tdriz_stack(PyObject *obj UNUSED_PARAM, PyObject *args, PyObject *keywords) {
+    const char *kwlist[] = {"inputs",  "weights",  "pixmaps",  "output",
+                            "counts",  "exptimes", "scale",    "pixfrac",
+                            "kernel",  "in_units", "wtscale",  "fillstr",
+                            "nthreads", "coadd",   "coadd_counts",
+                            "coadd_context", "ctx_ids", "out_x0", "out_y0",
+                            "mosaic", NULL};
+
+    /* Arguments in the order they appear */
+    PyObject *oimgs, *oweis, *omaps, *oout, *owht;
+    PyObject *oexptimes = Py_None;
+    double scale = 1.0;
+    double pfract = 1.0;
+    char *kernel_str = "square";
+    char *inun_str = "cps";
+    float wtscl = 1.0;
+    char *fillstr = "INDEF";
+    int nthreads = 1;
+    PyObject *ocoadd = Py_None;
+    PyObject *ocoadd_wht = Py_None;
+    PyObject *ocoadd_con = Py_None;
+    PyObject *octx_ids = Py_None;
+    integer_t out_x0 = 0;
+    integer_t out_y0 = 0;
+    PyObject *omosaic = Py_None;
+
+    /* Derived values */
+    PyArrayObject *out = NULL, *wht = NULL, *cout = NULL, *cwht = NULL,
+                  *ccon = NULL, *ids = NULL;
+    PyArrayObject *outputs[5];
+    PyArrayObject *onmiss = NULL, *onskip = NULL;
+    struct batch_t b;
+    bool_t do_fill;
+    float fill_value;
+    struct driz_error_t error;
+    struct driz_param_t p;
+    npy_intp n, nimg;
+    int ok;
+
+    driz_log_handle = driz_log_init(driz_log_handle);
+    driz_log_message("starting tdriz_stack");
+    driz_error_init(&error);
+    memset(&b, 0, sizeof(b));
+
+    if (!PyArg_ParseTupleAndKeywords(
+            args, keywords, "OOOOO|OddssfsiOOOOnnO:tdriz_stack",
+            (char **)kwlist, &oimgs, &oweis, &omaps, &oout, &owht, /* OOOOO */
+            &oexptimes, &scale, &pfract, &kernel_str,              /* Odds */
+            &inun_str, &wtscl, &fillstr, &nthreads,                /* sfsi */
+            &ocoadd, &ocoadd_wht, &ocoadd_con, &octx_ids,          /* OOOO */
+            &out_x0, &out_y0, &omosaic)                            /* nnO */
+    ) {
+        return NULL;
+    }
+
+    if (batch_load_inputs(&b, oimgs, oweis, omaps, oexptimes, &error)) {
+        goto _exit;
+    }
+    nimg = b.nimages;
+
+    /* Frame stacks are updated in place (through a temporary copy if needed) */
+    out = (PyArrayObject *)PyArray_FROM_OTF(oout, NPY_FLOAT,
+                                            OUTPUT_ARRAY_FLAGS);
+    wht = (PyArrayObject *)PyArray_FROM_OTF(owht, NPY_FLOAT,
+                                            OUTPUT_ARRAY_FLAGS);
+    if (!out || !wht || PyArray_NDIM(out) != 3 ||
+        !PyArray_SAMESHAPE(out, wht) || PyArray_DIM(out, 0) != nimg) {
+        driz_error_set_message(
+            &error, "Output and counts must be (nframes, ny, nx) stacks");
+        goto _exit;
+    }
+
+    if (ocoadd != Py_None) {
+        cout = (PyArrayObject *)PyArray_FROM_OTF(ocoadd, NPY_FLOAT,
+                                                 OUTPUT_ARRAY_FLAGS);
+        cwht = (PyArrayObject *)PyArray_FROM_OTF(ocoadd_wht, NPY_FLOAT,
+                                                 OUTPUT_ARRAY_FLAGS);
+        if (!cout || !cwht || PyArray_NDIM(cout) != 2 ||
+            !PyArray_SAMESHAPE(cout, cwht) ||
+            PyArray_DIM(cout, 0) != PyArray_DIM(out, 1) ||
+            PyArray_DIM(cout, 1) != PyArray_DIM(out, 2)) {
+            driz_error_set_message(&error, "Invalid co-add arrays");
+            goto _exit;
+        }
+        b.coadd_data = cout;
+        b.coadd_counts = cwht;
+
+        if (ocoadd_con != Py_None) {
+            ccon = (PyArrayObject *)PyArray_FROM_OTF(ocoadd_con, NPY_INT32,
+                                                     OUTPUT_ARRAY_FLAGS);
+            if (!ccon || PyArray_NDIM(ccon) < 2 || PyArray_NDIM(ccon) > 3 ||
+                PyArray_DIM(ccon, PyArray_NDIM(ccon) - 1) !=
+                    PyArray_DIM(cout, 1) ||
+                PyArray_DIM(ccon, PyArray_NDIM(ccon) - 2) !=
+                    PyArray_DIM(cout, 0)) {
+                driz_error_set_message(&error, "Invalid co-add context array");
+                goto _exit;
+            }
+            b.nplanes =
+                PyArray_NDIM(ccon) == 3 ? (int)PyArray_DIM(ccon, 0) : 1;
+
+            ids = (PyArrayObject *)PyArray_ContiguousFromAny(
+                octx_ids, NPY_INT32, 1, 1);
+            if (!ids || PyArray_SIZE(ids) != nimg) {
+                driz_error_set_message(
+                    &error, "Number of context IDs != number of inputs");
+                goto _exit;
+            }
+            b.ctx_ids = (npy_int32 *)PyArray_DATA(ids);
+            for (n = 0; n < nimg; ++n) {
+                if (b.ctx_ids[n] < 0 || b.ctx_ids[n] / 32 >= b.nplanes) {
+                    driz_error_set_message(
+                        &error, "Context ID is outside of the context array");
+                    goto _exit;
+                }
+            }
+        }
+    }
+
+    if (fill_str2value(fillstr, &do_fill, &fill_value, &error) ||
+        batch_init_params(&b.base, kernel_str, inun_str, scale, pfract, wtscl,
+                          &error)) {
+        goto _exit;
+    }
+    b.base.out_x0 = out_x0;
+    b.base.out_y0 = out_y0;
+    if (mosaic_from_any(omosaic, b.base.mosaic, &error)) goto _exit;
+
+    /* Each frame is a task of its own, drizzled onto its plane of the stack */
+    b.ntasks = b.nimages;
+    b.out_data = (PyArrayObject **)calloc(nimg, sizeof(PyArrayObject *));
+    b.out_counts = (PyArrayObject **)calloc(nimg, sizeof(PyArrayObject *));
+    b.errors = (struct driz_error_t *)calloc(nimg, sizeof(struct driz_error_t));
+    if (ccon) {
+        b.coadd_planes =
+            (PyArrayObject **)calloc(b.nplanes, sizeof(PyArrayObject *));
+    }
+    if (!b.out_data || !b.out_counts || !b.errors ||
+        (ccon && !b.coadd_planes)) {
+        driz_error_set_message(&error, "Out of memory");
+        goto _exit;
+    }
+
+    for (n = 0; n < nimg; ++n) {
+        driz_error_init(b.errors + n);
+        b.out_data[n] =
+            (PyArrayObject *)PySequence_GetItem((PyObject *)out, n);
+        b.out_counts[n] =
+            (PyArrayObject *)PySequence_GetItem((PyObject *)wht, n);
+        if (!b.out_data[n] || !b.out_counts[n]) goto _exit;
+    }
+
+    for (n = 0; ccon && n < b.nplanes; ++n) {
+        if (PyArray_NDIM(ccon) == 2) {
+            Py_INCREF(ccon);
+            b.coadd_planes[0] = ccon;
+        } else {
+            b.coadd_planes[n] =
+                (PyArrayObject *)PySequence_GetItem((PyObject *)ccon, n);
+            if (!b.coadd_planes[n]) goto _exit;
+        }
+    }
+
+    if (cout) {
+        b.nrow_tasks = (int)MIN(PyArray_DIM(cout, 0), 4 * MAX(nthreads, 1));
+    }
+
+    Py_BEGIN_ALLOW_THREADS;
+
+    driz_parallel(nthreads, b.ntasks, batch_drizzle_task, &b);
+
+    for (n = 0; n < nimg; ++n) {
+        if (driz_error_is_set(b.errors + n)) {
+            driz_error_set_message(&error,
+                                   driz_error_get_message(b.errors + n));
+            break;
+        }
+    }
+
+    if (!driz_error_is_set(&error) && cout && b.nrow_tasks > 0) {
+        driz_parallel(nthreads, b.nrow_tasks, stack_coadd_task, &b);
+    }
+
+    /* Put in the fill values (if defined) */
+    if (!driz_error_is_set(&error) && do_fill) {
+        p = b.base;
+        p.error = &error;
+        p.output_data = out;
+        p.output_counts = wht;
+        put_fill(&p, fill_value);
+        if (cout) {
+            p.output_data = cout;
+            p.output_counts = cwht;
+            put_fill(&p, fill_value);
+        }
+    }
+
+    Py_END_ALLOW_THREADS;
+
+    if (!driz_error_is_set(&error)) {
+        onmiss = (PyArrayObject *)PyArray_SimpleNew(1, &nimg, NPY_INTP);
+        onskip = (PyArrayObject *)PyArray_SimpleNew(1, &nimg, NPY_INTP);
+        if (onmiss && onskip) {
+            memcpy(PyArray_DATA(onmiss), b.nmiss, nimg * sizeof(integer_t));
+            memcpy(PyArray_DATA(onskip), b.nskip, nimg * sizeof(integer_t));
+        }
+    }
+
+_exit:
+    driz_log_message("ending tdriz_stack");
+    driz_log_close(driz_log_handle);
+
+    for (n = 0; n < b.nimages; ++n) {
+        if (b.out_data) Py_XDECREF(b.out_data[n]);
+        if (b.out_counts) Py_XDECREF(b.out_counts[n]);
+    }
+    for (n = 0; b.coadd_planes && n < b.nplanes; ++n) {
+        Py_XDECREF(b.coadd_planes[n]);
+    }
+    batch_free_inputs(&b);
+    free(b.out_data);
+    free(b.out_counts);
+    free(b.coadd_planes);
+    free(b.errors);
+    Py_XDECREF(ids);
+
+    ok = !driz_error_is_set(&error) && !PyErr_Occurred() && onmiss && onskip;
+    outputs[0] = out;
+    outputs[1] = wht;
+    outputs[2] = cout;
+    outputs[3] = cwht;
+    outputs[4] = ccon;
+    for (n = 0; n < 5; ++n) {
+        if (!outputs[n]) continue;
+        if (ok) {
+            PyArray_ResolveWritebackIfCopy(outputs[n]);
+        } else {
+            PyArray_DiscardWritebackIfCopy(outputs[n]);
+        }
+    }
+    Py_XDECREF(out);
+    Py_XDECREF(wht);
+    Py_XDECREF(cout);
+    Py_XDECREF(cwht);
+    Py_XDECREF(ccon);
+
+    if (driz_error_is_set(&error)) {
+        Py_XDECREF(onmiss);
+        Py_XDECREF(onskip);
+        PyErr_SetString(PyExc_ValueError, driz_error_get_message(&error));
+        return NULL;
+    } else if (!ok) {
+        Py_XDECREF(onmiss);
+        Py_XDECREF(onskip);
+        return NULL;
+    } else {
+        return Py_BuildValue("NN", onmiss, onskip);
+    }
+}
+
+/** ---------------------------------------------------------------------------
+ * Merge the outputs of a separate drizzle product into output images in
+ * place, interfaces with python code
+ */
+
+struct merge_t {
+    PyArrayObject *out_data, *out_counts, *out_context;
+    PyArrayObject *data, *counts, *context;
+    integer_t ctx_offset;
+    int ntasks;
+};
+
+static void
+merge_task(void *arg, int k) {
+    struct merge_t *m = (struct merge_t *)arg;
+    integer_t ny, row_start, row_end;
+
+    ny = PyArray_DIM(m->out_data, 0);
+    row_start = (integer_t)((npy_intp)k * ny / m->ntasks);
+    row_end = (integer_t)((npy_intp)(k + 1) * ny / m->ntasks);
+    merge_output_rows(m->out_data, m->out_counts, m->out_context, m->data,
+                      m->counts, m->context, m->ctx_offset, row_start,
+                      row_end);
+}
+
+/* View an image or a spectral cube, or their context, as rows of pixels:
+   (nl, ny, nx) cubes become (nl * ny, nx) images and context planes keep
+   their leading dimension. */
+static PyArrayObject *
+merge_rows_view(PyArrayObject *arr, int image_ndim) {
+    npy_intp dims[3];
+    PyArray_Dims shape;
+    int ndim = PyArray_NDIM(arr);
+    npy_intp nx, nplanes;
+
+    nx = PyArray_DIM(arr, ndim - 1);
+    nplanes = (ndim > image_ndim) ? PyArray_DIM(arr, 0) : 1;
+    shape.ptr = dims;
+    shape.len = 0;
+    if (ndim > image_ndim) dims[shape.len++] = nplanes;
+    dims[shape.len++] = (nx && nplanes) ? PyArray_SIZE(arr) / nx / nplanes : 0;
+    dims[shape.len++] = nx;
+
+    return (PyArrayObject *)PyArray_Newshape(arr, &shape, NPY_CORDER);
+}
+
+static int
+merge_check_context(PyArrayObject *con, PyArrayObject *out) {
+    int k, ndim, image_ndim = PyArray_NDIM(out);
+
+    ndim = PyArray_NDIM(con);
+    if (ndim != image_ndim && ndim != image_ndim + 1) return 1;
+    for (k = 1; k <= image_ndim; ++k) {
+        if (PyArray_DIM(con, ndim - k) != PyArray_DIM(out, image_ndim - k)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Highest context ID set in a (contiguous) context image, or -1 when none
+   is set. */
+static npy_intp
+merge_max_ctx_id(PyArrayObject *ctx, int image_ndim) {
+    const npy_uint32 *v = (const npy_uint32 *)PyArray_DATA(ctx);
+    npy_intp k, i, nplanes, size;
+    npy_uint32 bits;
+    int b;
+
+    nplanes = (PyArray_NDIM(ctx) > image_ndim) ? PyArray_DIM(ctx, 0) : 1;
+    size = nplanes ? PyArray_SIZE(ctx) / nplanes : 0;
+    for (k = nplanes - 1; k >= 0; --k) {
+        bits = 0;
+        for (i = 0; i < size; ++i) bits |= v[k * size + i];
+        if (bits) {
+            for (b = 31; !(bits >> b); --b) continue;
+            return k * 32 + b;
+        }
+    }
+    return -1;
+}
+
+static PyObject *
+merge(PyObject *obj UNUSED_PARAM, PyObject *args, PyObject *keywords) {
+    const char *kwlist[] = {"output",       "counts",       "context",
+                            "other_output", "other_counts", "other_context",
+                            "ctx_offset",   "nthreads",     NULL};
+
+    /* Arguments in the order they appear */
+    PyObject *oout, *owht, *ocon, *odata, *ocounts, *octx;
+    integer_t ctx_offset = 0;
+    int nthreads = 1;
+
+    /* Derived values */
+    PyArrayObject *out = NULL, *wht = NULL, *con = NULL, *data = NULL,
+                  *counts = NULL, *ctx = NULL;
+    PyArrayObject *views[6] = {NULL, NULL, NULL, NULL, NULL, NULL};
+    struct merge_t m;
+    struct driz_error_t error;
+    npy_intp max_id, out_nplanes;
+    int k, image_ndim, ok;
+
+    driz_log_handle = driz_log_init(driz_log_handle);
+    driz_log_message("starting merge");
+    driz_error_init(&error);
+
+    if (!PyArg_ParseTupleAndKeywords(
+            args, keywords, "OOOOOO|ni:merge", (char **)kwlist, &oout,
+            &owht, &ocon, &odata, &ocounts, &octx, /* OOOOOO */
+            &ctx_offset, &nthreads)                /* ni */
+    ) {
+        return NULL;
+    }
+
+    /* Outputs are updated in place (through a temporary copy if needed) */
+    out = (PyArrayObject *)PyArray_FROM_OTF(oout, NPY_FLOAT,
+                                            NPY_ARRAY_INOUT_ARRAY2);
+    wht = (PyArrayObject *)PyArray_FROM_OTF(owht, NPY_FLOAT,
+                                            NPY_ARRAY_INOUT_ARRAY2);
+    if (!out || !wht || PyArray_NDIM(out) < 2 || PyArray_NDIM(out) > 3 ||
+        !PyArray_SAMESHAPE(out, wht)) {
+        driz_error_set_message(&error, "Invalid output or counts array");
+        goto _exit;
+    }
+    image_ndim = PyArray_NDIM(out);
+
+    data = (PyArrayObject *)PyArray_ContiguousFromAny(odata, NPY_FLOAT, 2, 3);
+    counts =
+        (PyArrayObject *)PyArray_ContiguousFromAny(ocounts, NPY_FLOAT, 2, 3);
+    if (!data || !counts || !PyArray_SAMESHAPE(out, data) ||
+        !PyArray_SAMESHAPE(out, counts)) {
+        driz_error_set_message(
+            &error, "Merged output and counts must match output arrays");
+        goto _exit;
+    }
+
+    if ((ocon == Py_None) != (octx == Py_None)) {
+        driz_error_set_message(&error,
+                               "Either both or none of the context arrays "
+                               "must be provided");
+        goto _exit;
+    }
+
+    if (ocon != Py_None) {
+        con = (PyArrayObject *)PyArray_FROM_OTF(ocon, NPY_INT32,
+                                                NPY_ARRAY_INOUT_ARRAY2);
+        ctx = (PyArrayObject *)PyArray_ContiguousFromAny(octx, NPY_INT32, 2,
+                                                         4);
+        if (!con || !ctx || merge_check_context(con, out) ||
+            merge_check_context(ctx, out)) {
+            driz_error_set_message(&error, "Invalid context array");
+            goto _exit;
+        }
+    }
+
+    if (ctx_offset < 0) {
+        driz_error_set_message(&error, "Context ID offset must be >= 0");
+        goto _exit;
+    }
+
+    /* merge_output_rows drops the bits of IDs past the last output plane */
+    if (con) {
+        max_id = merge_max_ctx_id(ctx, image_ndim);
+        out_nplanes =
+            (PyArray_NDIM(con) > image_ndim) ? PyArray_DIM(con, 0) : 1;
+        if (max_id >= 0 && (ctx_offset + max_id) / 32 >= out_nplanes) {
+            driz_error_set_message(&error,
+                                   "Output context array has too few planes "
+                                   "for the merged context IDs");
+            goto _exit;
+        }
+    }
+
+    views[0] = merge_rows_view(out, image_ndim);
+    views[1] = merge_rows_view(wht, image_ndim);
+    views[3] = merge_rows_view(data, image_ndim);
+    views[4] = merge_rows_view(counts, image_ndim);
+    if (con) {
+        views[2] = merge_rows_view(con, image_ndim);
+        views[5] = merge_rows_view(ctx, image_ndim);
+    }
+    if (!views[0] || !views[1] || !views[3] || !views[4] ||
+        (con && (!views[2] || !views[5]))) {
+        goto _exit;
+    }
+
+    m.out_data = views[0];
+    m.out_counts = views[1];
+    m.out_context = views[2];
+    m.data = views[3];
+    m.counts = views[4];
+    m.context = views[5];
+    m.ctx_offset = ctx_offset;
+    m.ntasks = (int)MIN(PyArray_DIM(views[0], 0), 4 * MAX(nthreads, 1));
+
+    if (m.ntasks > 0) {
+        Py_BEGIN_ALLOW_THREADS;
+        driz_parallel(nthreads, m.ntasks, merge_task, &m);
+        Py_END_ALLOW_THREADS;
+    }
+
+_exit:
+    driz_log_message("ending merge");
+    driz_log_close(driz_log_handle);
+
+    for (k = 0; k < 6; ++k) {
+        Py_XDECREF(views[k]);
+    }
+
+    ok = !driz_error_is_set(&error) && !PyErr_Occurred();
+    views[0] = out;
+    views[1] = wht;
+    views[2] = con;
+    for (k = 0; k < 3; ++k) {
+        if (!views[k]) continue;
+        if (ok) {
+            PyArray_ResolveWritebackIfCopy(views[k]);
+        } else {
+            PyArray_DiscardWritebackIfCopy(views[k]);
+        }
+    }
+    Py_XDECREF(out);
+    Py_XDECREF(wht);
+    Py_XDECREF(con);
+    Py_XDECREF(data);
+    Py_XDECREF(counts);
+    Py_XDECREF(ctx);
+
+    if (driz_error_is_set(&error)) {
+        PyErr_SetString(PyExc_ValueError, driz_error_get_message(&error));
+        return NULL;
+    } else if (!ok) {
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+/** ---------------------------------------------------------------------------
+ * Native pixel maps between two TAN(-SIP) WCS, interfaces with python code
+ */
+
+/* Copy SIP coefficients, given as a square (order + 1, order + 1) array or
+   None, into coef. */
+static int
+sip_coefficients(PyObject *obj,
+                 double coef[SIP_MAX_ORDER + 1][SIP_MAX_ORDER + 1],
+                 int *order, struct driz_error_t *error) {
+    PyArrayObject *arr;
+    npy_intp n, p, q;
+
+    *order = 0;
+    if (obj == Py_None) return 0;
+
+    arr = (PyArrayObject *)PyArray_ContiguousFromAny(obj, NPY_DOUBLE, 2, 2);
+    if (!arr) return 1;
+
+    n = PyArray_DIM(arr, 0);
+    if (n != PyArray_DIM(arr, 1) || n < 1 || n > SIP_MAX_ORDER + 1) {
+        driz_error_set_message(error, "Invalid SIP coefficients");
+        Py_DECREF(arr);
+        return 1;
+    }
+    for (p = 0; p < n; ++p) {
+        for (q = 0; q < n; ++q) {
+            coef[p][q] = *(double *)PyArray_GETPTR2(arr, p, q);
+        }
+    }
+    *order = (int)n - 1;
+    Py_DECREF(arr);
+    return 0;
+}
+
+/* Parse a (crpix, cd, crval, lonpole, a, b, ap, bp) WCS description. */
+static int
+sip_wcs_from_tuple(PyObject *obj, struct sip_wcs_t *wcs,
+                   struct driz_error_t *error) {
+    PyObject *oa, *ob, *oap, *obp;
+    double crval[2], lonpole;
+    int b_order, bp_order;
+
+    memset(wcs, 0, sizeof(*wcs));
+    if (!PyArg_ParseTuple(obj, "(dd)((dd)(dd))(dd)dOOOO;invalid WCS",
+                          &wcs->crpix[0], &wcs->crpix[1], &wcs->cd[0][0],
+                          &wcs->cd[0][1], &wcs->cd[1][0], &wcs->cd[1][1],
+                          &crval[0], &crval[1], &lonpole, &oa, &ob, &oap,
+                          &obp)) {
+        return 1;
+    }
+
+    if (sip_coefficients(oa, wcs->a, &wcs->a_order, error) ||
+        sip_coefficients(ob, wcs->b, &b_order, error) ||
+        sip_coefficients(oap, wcs->ap, &wcs->ap_order, error) ||
+        sip_coefficients(obp, wcs->bp, &bp_order, error)) {
+        return 1;
+    }
+    if (wcs->a_order != b_order || wcs->ap_order != bp_order) {
+        driz_error_set_message(error,
+                               "SIP polynomials must come in pairs of the "
+                               "same order");
+        return 1;
+    }
+
+    return sip_wcs_init(wcs, crval[0], crval[1], lonpole, error);
+}
+
+struct sip_pixmap_t {
+    struct sip_wcs_t wcs_from, wcs_to;
+    PyArrayObject *pixmap;
+    integer_t step, row0;
+    int ntasks;
+};
+
+static void
+sip_pixmap_task(void *arg, int k) {
+    struct sip_pixmap_t *s = (struct sip_pixmap_t *)arg;
+    integer_t ny;
+
+    ny = PyArray_DIM(s->pixmap, 0);
+    sip_pixmap_rows(&s->wcs_from, &s->wcs_to, s->pixmap, s->step, s->row0,
+                    (integer_t)((npy_intp)k * ny / s->ntasks),
+                    (integer_t)((npy_intp)(k + 1) * ny / s->ntasks));
+}
+
+static PyObject *
+sip_pixmap(PyObject *obj UNUSED_PARAM, PyObject *args, PyObject *keywords) {
+    const char *kwlist[] = {"pixmap",      "wcs_from", "wcs_to",
+                            "pixmap_step", "row0",     "nthreads", NULL};
+
+    /* Arguments in the order they appear */
+    PyObject *opixmap, *owcs_from, *owcs_to;
+    integer_t step = 1, row0 = 0;
+    int nthreads = 1;
+
+    /* Derived values */
+    PyArrayObject *pixmap;
+    struct sip_pixmap_t *s = NULL;
+    struct driz_error_t error;
+
+    driz_error_init(&error);
+
+    if (!PyArg_ParseTupleAndKeywords(args, keywords, "O!OO|nni:sip_pixmap",
+                                     (char **)kwlist, &PyArray_Type,
+                                     &opixmap, &owcs_from, &owcs_to, &step,
+                                     &row0, &nthreads)) {
+        return NULL;
+    }
+    pixmap = (PyArrayObject *)opixmap;
+
+    /* The pixel map is written directly, so it must be a native float64
+       or float32 (ny, nx, 2) array. */
+    if (PyArray_NDIM(pixmap) != 3 || PyArray_DIM(pixmap, 2) != 2 ||
+        (PyArray_TYPE(pixmap) != NPY_DOUBLE &&
+         PyArray_TYPE(pixmap) != NPY_FLOAT) ||
+        !PyArray_ISWRITEABLE(pixmap) || !PyArray_ISNOTSWAPPED(pixmap) ||
+        !PyArray_ISALIGNED(pixmap)) {
+        driz_error_set_message(&error,
+                               "Pixel map must be a writeable, aligned, "
+                               "native float64 or float32 array of shape "
+                               "(ny, nx, 2)");
+        goto _exit;
+    }
+    if (step < 1 || row0 < 0) {
+        driz_error_set_message(&error,
+                               "Pixel map step must be >= 1 and first row "
+                               ">= 0");
+        goto _exit;
+    }
+
+    s = (struct sip_pixmap_t *)malloc(sizeof(struct sip_pixmap_t));
+    if (!s) {
+        PyErr_NoMemory();
+        goto _exit;
+    }
+    if (sip_wcs_from_tuple(owcs_from, &s->wcs_from, &error) ||
+        sip_wcs_from_tuple(owcs_to, &s->wcs_to, &error)) {
+        goto _exit;
+    }
+
+    s->pixmap = pixmap;
+    s->step = step;
+    s->row0 = row0;
+    s->ntasks = (int)MIN(PyArray_DIM(pixmap, 0), 4 * MAX(nthreads, 1));
+
+    if (s->ntasks > 0 && PyArray_DIM(pixmap, 1) > 0) {
+        Py_BEGIN_ALLOW_THREADS;
+        driz_parallel(nthreads, s->ntasks, sip_pixmap_task, s);
+        Py_END_ALLOW_THREADS;
+    }
+
+_exit:
+    free(s);
+
+    if (driz_error_is_set(&error)) {
+        PyErr_SetString(PyExc_ValueError, driz_error_get_message(&error));
+        return NULL;
+    } else if (PyErr_Occurred()) {
+        return NULL;
+    }
+
+    Py_RETURN_NONE;
+}
+
+/** ---------------------------------------------------------------------------
+ * Top level function for blotting, interfaces with python code
+ */
+
+static PyObject *
+tblot(PyObject *obj, PyObject *args, PyObject *keywords) {
+    const char *kwlist[] = {"source",  "pixmap", "output", "xmin",   "xmax",
+                            "ymin",    "ymax",   "scale",  "kscale", "interp",
+                            "exptime", "misval", "sinscl", "progress",
+                            "cancel",  "progress_rows", "pixmap_step",
+                            "pixmap_affine", NULL};
+
+    /* Arguments in the order they appear */
+    PyObject *oimg, *pixmap, *oout;
+    integer_t xmin = 0;
+    integer_t xmax = 0;
+    integer_t ymin = 0;
+    integer_t ymax = 0;
+    double scale = 1.0;
+    float kscale = 1.0;
+    char *interp_str = "poly5";
+    float ef = 1.0;
+    float misval = 0.0;
+    float sinscl = 1.0;
+    PyObject *oprogress = Py_None, *ocancel = Py_None;
+    integer_t progress_rows = 0;
+    integer_t pixmap_step = 1;
+    PyObject *oaffine = Py_None;
+
+    PyArrayObject *img = NULL, *out = NULL, *map = NULL;
+    enum e_interp_t interp;
+    int istat = 0;
+    struct driz_error_t error;
+    struct driz_param_t p;
+    struct driz_progress_t progress;
+    struct coarse_pixmap_t *coarse = NULL;
+    double affine[2][3];
+    int has_affine;
+    integer_t psize[2], osize[2];
+    char warn_msg[128];
+
+    driz_log_handle = driz_log_init(driz_log_handle);
+    driz_log_message("starting tblot");
+    driz_error_init(&error);
+
+    if (!PyArg_ParseTupleAndKeywords(
+            args, keywords, "OOO|nnnndfsfffOOnnO:tblot", (char **)kwlist,
+            &oimg, &pixmap, &oout,                /* OOO */
+            &xmin, &xmax, &ymin, &ymax,           /* nnnn */
+            &scale, &kscale, &interp_str, &ef,    /* dfsf */
+            &misval, &sinscl,                     /* ff */
+            &oprogress, &ocancel, &progress_rows, /* OOn */
+            &pixmap_step, &oaffine)               /* nO */
+    ) {
+        return NULL;
+    }
+
+    if (progress_init(&progress, oprogress, ocancel, progress_rows, &error)) {
+        goto _exit;
+    }
+
+    img = input_array_from_any(oimg, NPY_FLOAT, 2);
+    if (!img) {
+        driz_error_set_message(&error, "Invalid input array");
+        goto _exit;
+    }
+
+    map = input_array_from_any(pixmap, NPY_DOUBLE, 3);
+    if (!map) {
+        driz_error_set_message(&error, "Invalid pixmap array");
+        goto _exit;
+    }
+
+    out = (PyArrayObject *)PyArray_FROM_OTF(oout, NPY_FLOAT,
+                                            OUTPUT_ARRAY_FLAGS);
+    if (!out || PyArray_NDIM(out) != 2) {
+        driz_error_set_message(&error, "Invalid output array");
+        goto _exit;
+    }
+
     if (interp_str2enum(interp_str, &interp, &error)) {
         goto _exit;
     }
@@ -370,10 +2934,14 @@ tblot(PyObject *obj, PyObject *args, PyObject *keywords) {
     get_dimensions(map, psize);
     get_dimensions(out, osize);
 
-    if (psize[0] != osize[0] || psize[1] != osize[1]) {
+    if (check_pixmap_step(map, pixmap_step, osize, &error)) goto _exit;
+
+    if (pixmap_step == 1 && (psize[0] != osize[0] || psize[1] != osize[1])) {
         if (snprintf(
                 warn_msg, 128,
-                "Pixel map dimensions (%d, %d) != output dimensions (%d, %d).",
+                "Pixel map dimensions (%" NPY_INTP_FMT ", %" NPY_INTP_FMT
+                ") != output dimensions (%" NPY_INTP_FMT ", %" NPY_INTP_FMT
+                ").",
                 psize[0], psize[1], osize[0], osize[1]) < 1) {
             strcpy(warn_msg, "Pixel map dimensions != output dimensions.");
         }
@@ -384,6 +2952,9 @@ tblot(PyObject *obj, PyObject *args, PyObject *keywords) {
     if (xmax == 0) xmax = osize[0];
     if (ymax == 0) ymax = osize[1];
 
+    has_affine = pixmap_affine_from_any(oaffine, affine, &error);
+    if (has_affine < 0) goto _exit;
+
     driz_param_init(&p);
 
     p.data = img;
@@ -401,6 +2972,8 @@ tblot(PyObject *obj, PyObject *args, PyObject *keywords) {
     p.sinscl = sinscl;
     p.pixmap = map;
     p.error = &error;
+    p.progress = &progress;
+    if (has_affine) p.pixmap_affine = (const double(*)[3])affine;
 
     if (driz_error_check(&error, "xmin must be >= 0", p.xmin >= 0)) goto _exit;
     if (driz_error_check(&error, "ymin must be >= 0", p.ymin >= 0)) goto _exit;
@@ -415,16 +2988,30 @@ tblot(PyObject *obj, PyObject *args, PyObject *keywords) {
     if (driz_error_check(&error, "exposure time must be > 0", p.ef > 0.0))
         goto _exit;
 
-    if (doblot(&p)) goto _exit;
+    if (pixmap_step > 1) {
+        coarse = coarse_pixmap_new(map, pixmap_step, &error);
+        if (!coarse) goto _exit;
+        p.coarse_pixmap = coarse;
+    }
+
+    /* doblot does not use the Python API: progress callbacks acquire the
+       GIL and the cancellation flag may be set from another thread. */
+    Py_BEGIN_ALLOW_THREADS;
+    doblot(&p);
+    Py_END_ALLOW_THREADS;
 
 _exit:
     driz_log_message("ending tblot");
     driz_log_close(driz_log_handle);
-    Py_DECREF(img);
-    Py_DECREF(out);
-    Py_DECREF(map);
+    if (out) PyArray_ResolveWritebackIfCopy(out);
+    Py_XDECREF(img);
+    Py_XDECREF(out);
+    Py_XDECREF(map);
+    coarse_pixmap_free(coarse);
 
-    if (driz_error_is_set(&error)) {
+    if (progress_exit(&progress)) {
+        return NULL;
+    } else if (driz_error_is_set(&error)) {
         if (strcmp(driz_error_get_message(&error), "<PYTHON>") != 0)
             PyErr_SetString(PyExc_Exception, driz_error_get_message(&error));
         return NULL;
@@ -512,13 +3099,17 @@ invert_pixmap_wrap(PyObject *self, PyObject *args) {
         return PyErr_Format(gl_Error, "Invalid xyout array.");
     }
 
-    pixmap_arr =
-        (PyArrayObject *)PyArray_ContiguousFromAny(pixmap, NPY_DOUBLE, 3, 3);
+    pixmap_arr = input_array_from_any(pixmap, NPY_DOUBLE, 3);
     if (!pixmap_arr) {
         return PyErr_Format(gl_Error, "Invalid pixmap.");
     }
 
     par.pixmap = pixmap_arr;
+    par.coarse_pixmap = NULL;
+    par.pixmap_affine = NULL;
+    par.out_x0 = 0;
+    par.out_y0 = 0;
+    memset(par.mosaic, 0, sizeof(par.mosaic));
     ndim = PyArray_DIMS(pixmap_arr);
 
     if (bbox == Py_None) {
@@ -604,6 +3195,542 @@ clip_polygon_wrap(PyObject *self, PyObject *args) {
     return Py_BuildValue("N", list);
 }
 
+/** ---------------------------------------------------------------------------
+ * Index footprints of input images over the tiles of an output grid,
+ * interfaces with python code
+ */
+
+static PyObject *
+footprint_index(PyObject *obj UNUSED_PARAM, PyObject *args,
+                PyObject *keywords) {
+    const char *kwlist[] = {"footprints", "shape", "tile_shape", NULL};
+
+    /* Arguments in the order they appear */
+    PyObject *ofootprints;
+    integer_t ny = 0;
+    integer_t nx = 0;
+    integer_t ty = 0;
+    integer_t tx = 0;
+
+    /* Derived values */
+    PyArrayObject *fps = NULL;
+    PyArrayObject *indptr = NULL, *footprints = NULL, *areas = NULL;
+    struct footprint_index_t idx = {0};
+    struct driz_error_t error;
+    npy_intp dims[1];
+
+    driz_error_init(&error);
+
+    if (!PyArg_ParseTupleAndKeywords(
+            args, keywords, "O(nn)(nn):footprint_index", (char **)kwlist,
+            &ofootprints, &ny, &nx,     /* O(nn) */
+            &ty, &tx)                   /* (nn) */
+    ) {
+        return NULL;
+    }
+
+    fps = (PyArrayObject *)PyArray_ContiguousFromAny(ofootprints, NPY_DOUBLE,
+                                                     3, 3);
+    if (!fps) {
+        driz_error_set_message(&error, "Invalid footprints array");
+        goto _exit;
+    }
+    if (driz_error_check(&error, "footprints must have shape (N, M, 2)",
+                         PyArray_DIM(fps, 2) == 2))
+        goto _exit;
+
+    if (footprint_index_init(&idx, (double *)PyArray_DATA(fps),
+                             PyArray_DIM(fps, 0), (int)PyArray_DIM(fps, 1),
+                             nx, ny, tx, ty, &error)) {
+        goto _exit;
+    }
+
+    /* Hand the buffers over to numpy arrays */
+    dims[0] = idx.ntx * idx.nty + 1;
+    indptr = (PyArrayObject *)PyArray_SimpleNewFromData(1, dims, NPY_INTP,
+                                                        idx.indptr);
+    if (!indptr) goto _exit;
+    PyArray_ENABLEFLAGS(indptr, NPY_ARRAY_OWNDATA);
+    idx.indptr = NULL;
+
+    dims[0] = idx.nnz;
+    footprints = (PyArrayObject *)PyArray_SimpleNewFromData(
+        1, dims, NPY_INTP, idx.footprints);
+    if (!footprints) goto _exit;
+    PyArray_ENABLEFLAGS(footprints, NPY_ARRAY_OWNDATA);
+    idx.footprints = NULL;
+
+    areas = (PyArrayObject *)PyArray_SimpleNewFromData(1, dims, NPY_DOUBLE,
+                                                       idx.areas);
+    if (!areas) goto _exit;
+    PyArray_ENABLEFLAGS(areas, NPY_ARRAY_OWNDATA);
+    idx.areas = NULL;
+
+_exit:
+    footprint_index_free(&idx);
+    Py_XDECREF(fps);
+
+    if (driz_error_is_set(&error) || !areas) {
+        Py_XDECREF(indptr);
+        Py_XDECREF(footprints);
+        Py_XDECREF(areas);
+        if (driz_error_is_set(&error)) {
+            PyErr_SetString(PyExc_ValueError, driz_error_get_message(&error));
+        }
+        return NULL;
+    } else {
+        return Py_BuildValue("NNN", indptr, footprints, areas);
+    }
+}
+
+/** ---------------------------------------------------------------------------
+ * DrizzleEngine: a Python type holding the drizzling configuration and the
+ * output arrays across calls, so that drizzling an image does not need to
+ * parse the configuration, convert strings to enumerations, validate the
+ * output arrays, or compute kernel look-up tables again.
+ */
+
+typedef struct {
+    PyObject_HEAD
+    enum e_kernel_t kernel;
+    char kernel_name[32];
+    bool_t do_fill;
+    float fill_value;
+    PyArrayObject *output;  /* float32, (ny, nx) or (nl, ny, nx) */
+    PyArrayObject *counts;  /* float32, same shape as output */
+    PyArrayObject *context; /* int32, (nplanes, ) + output shape, or NULL */
+    float *lanczos_lut;     /* NULL for kernels other than lanczos */
+} engine_t;
+
+/* Check that an output array can be updated in place by the kernels: any
+   strides are accepted, e.g., views of a subarray or of a plane of a cube. */
+static int
+engine_check_output(PyObject *o, const char *name, int type, int ndim1,
+                    int ndim2) {
+    PyArrayObject *arr = (PyArrayObject *)o;
+
+    if (!PyArray_Check(o) || PyArray_TYPE(arr) != type ||
+        PyArray_NDIM(arr) < ndim1 || PyArray_NDIM(arr) > ndim2 ||
+        !PyArray_ISALIGNED(arr) || !PyArray_ISWRITEABLE(arr) ||
+        !PyArray_ISNOTSWAPPED(arr)) {
+        PyErr_Format(PyExc_ValueError,
+                     "'%s' must be a writeable, aligned %s array in native "
+                     "byte order with %d or %d dimensions.",
+                     name, type == NPY_FLOAT ? "float32" : "int32", ndim1,
+                     ndim2);
+        return 1;
+    }
+    return 0;
+}
+
+static int
+engine_set_outputs(engine_t *self, PyObject *oout, PyObject *owht,
+                   PyObject *ocon) {
+    PyArrayObject *out, *wht, *con = NULL;
+
+    if (engine_check_output(oout, "output", NPY_FLOAT, 2, 3) ||
+        engine_check_output(owht, "counts", NPY_FLOAT, 2, 3)) {
+        return 1;
+    }
+    out = (PyArrayObject *)oout;
+    wht = (PyArrayObject *)owht;
+    if (!PyArray_SAMESHAPE(out, wht)) {
+        PyErr_SetString(PyExc_ValueError,
+                        "Output and counts arrays must have the same shape.");
+        return 1;
+    }
+
+    if (ocon != Py_None) {
+        if (engine_check_output(ocon, "context", NPY_INT32, 3, 4)) return 1;
+        con = (PyArrayObject *)ocon;
+        if (PyArray_NDIM(con) != PyArray_NDIM(out) + 1 ||
+            memcmp(PyArray_DIMS(con) + 1, PyArray_DIMS(out),
+                   PyArray_NDIM(out) * sizeof(npy_intp))) {
+            PyErr_SetString(PyExc_ValueError,
+                            "Context array must have the shape of the output "
+                            "array with an extra leading axis of planes.");
+            return 1;
+        }
+    }
+
+    Py_INCREF(out);
+    Py_XSETREF(self->output, out);
+    Py_INCREF(wht);
+    Py_XSETREF(self->counts, wht);
+    Py_XINCREF(con);
+    Py_XSETREF(self->context, con);
+    return 0;
+}
+
+static int
+engine_init(engine_t *self, PyObject *args, PyObject *keywords) {
+    const char *kwlist[] = {"output", "counts", "context", "kernel",
+                            "fillstr", NULL};
+
+    PyObject *oout, *owht, *ocon = Py_None;
+    char *kernel_str = "square";
+    char *fillstr = "INDEF";
+    struct driz_error_t error;
+    float *lut;
+    int order;
+
+    driz_error_init(&error);
+
+    if (!PyArg_ParseTupleAndKeywords(
+            args, keywords, "OO|Oss:DrizzleEngine", (char **)kwlist,
+            &oout, &owht, &ocon,  /* OO|O */
+            &kernel_str, &fillstr) /* ss */
+    ) {
+        return -1;
+    }
+
+    if (kernel_str2enum(kernel_str, &self->kernel, &error) ||
+        fill_str2value(fillstr, &self->do_fill, &self->fill_value, &error)) {
+        PyErr_SetString(PyExc_ValueError, driz_error_get_message(&error));
+        return -1;
+    }
+    strncpy(self->kernel_name, kernel_str, sizeof(self->kernel_name) - 1);
+    self->kernel_name[sizeof(self->kernel_name) - 1] = '\0';
+
+    if (engine_set_outputs(self, oout, owht, ocon)) return -1;
+
+    if (self->kernel == kernel_lanczos2 || self->kernel == kernel_lanczos3) {
+        if ((lut = malloc(LANCZOS_LUT_SIZE * sizeof(float))) == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        order = (self->kernel == kernel_lanczos2) ? 2 : 3;
+        create_lanczos_lut(order, LANCZOS_LUT_SIZE, LANCZOS_LUT_STEP, lut);
+        free(self->lanczos_lut);
+        self->lanczos_lut = lut;
+    }
+
+    return 0;
+}
+
+static void
+engine_dealloc(engine_t *self) {
+    Py_XDECREF(self->output);
+    Py_XDECREF(self->counts);
+    Py_XDECREF(self->context);
+    free(self->lanczos_lut);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+/* Engines created with __new__() only, without __init__(), have no outputs
+   and no kernel. */
+static int
+engine_check_init(engine_t *self) {
+    if (self->output == NULL || self->counts == NULL) {
+        PyErr_SetString(PyExc_ValueError, "engine not initialized");
+        return 1;
+    }
+    return 0;
+}
+
+static PyObject *
+engine_set_outputs_method(engine_t *self, PyObject *args,
+                          PyObject *keywords) {
+    const char *kwlist[] = {"output", "counts", "context", NULL};
+    PyObject *oout, *owht, *ocon = Py_None;
+
+    if (engine_check_init(self)) return NULL;
+    if (!PyArg_ParseTupleAndKeywords(args, keywords, "OO|O:set_outputs",
+                                     (char **)kwlist, &oout, &owht, &ocon)) {
+        return NULL;
+    }
+    if (engine_set_outputs(self, oout, owht, ocon)) return NULL;
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+engine_add(engine_t *self, PyObject *args, PyObject *keywords) {
+    const char *kwlist[] = {"input",  "pixmap", "weights",  "ctx_id",
+                            "xmin",   "xmax",   "ymin",     "ymax",
+                            "scale",  "pixfrac", "in_units", "expscale",
+                            "wtscale", "out_x0", "out_y0",  "progress",
+                            "cancel", "progress_rows", "pixmap_step",
+                            "pixmap_affine", "mosaic", NULL};
+
+    /* Arguments in the order they appear */
+    PyObject *oimg, *pixmap, *owei = Py_None;
+    integer_t ctx_id = 0;
+    integer_t xmin = 0;
+    integer_t xmax = 0;
+    integer_t ymin = 0;
+    integer_t ymax = 0;
+    double scale = 1.0;
+    double pfract = 1.0;
+    char *inun_str = "cps";
+    float expin = 1.0;
+    float wtscl = 1.0;
+    integer_t out_x0 = 0;
+    integer_t out_y0 = 0;
+    PyObject *oprogress = Py_None, *ocancel = Py_None;
+    integer_t progress_rows = 0;
+    integer_t pixmap_step = 1;
+    PyObject *oaffine = Py_None;
+    PyObject *omosaic = Py_None;
+
+    /* Derived values */
+    PyArrayObject *img = NULL, *wei = NULL, *map = NULL, *con = NULL;
+    enum e_kernel_t kernel = self->kernel;
+    enum e_unit_t inun;
+    struct driz_error_t error;
+    struct driz_param_t p;
+    struct driz_progress_t progress;
+    struct coarse_pixmap_t *coarse = NULL;
+    double affine[2][3];
+    int has_affine;
+    prepared_pixmap_t *prepared = NULL;
+    struct image_scanner_t scanner;
+    integer_t isize[2], psize[2], wsize[2];
+    npy_intp plane;
+    int cube;
+    char warn_msg[128];
+
+    driz_error_init(&error);
+
+    if (engine_check_init(self)) return NULL;
+    cube = PyArray_NDIM(self->output) == 3;
+
+    if (!PyArg_ParseTupleAndKeywords(
+            args, keywords, "OO|OnnnnnddsffnnOOnnOO:add", (char **)kwlist,
+            &oimg, &pixmap, &owei,                /* OO|O */
+            &ctx_id, &xmin, &xmax, &ymin, &ymax,  /* nnnnn */
+            &scale, &pfract, &inun_str,           /* dds */
+            &expin, &wtscl,                       /* ff */
+            &out_x0, &out_y0,                     /* nn */
+            &oprogress, &ocancel, &progress_rows, /* OOn */
+            &pixmap_step, &oaffine, &omosaic)     /* nOO */
+    ) {
+        return NULL;
+    }
+
+    if (progress_init(&progress, oprogress, ocancel, progress_rows, &error)) {
+        goto _exit;
+    }
+
+    img = input_array_from_any(oimg, NPY_FLOAT, 2);
+    if (!img) {
+        driz_error_set_message(&error, "Invalid input array");
+        goto _exit;
+    }
+
+    if (owei != Py_None) {
+        wei = input_array_from_any(owei, NPY_FLOAT, 2);
+        if (!wei) {
+            driz_error_set_message(&error, "Invalid weights array");
+            goto _exit;
+        }
+    }
+
+    map = pixmap_from_any(pixmap, &prepared, &pixmap_step, &error);
+    if (!map) {
+        if (!driz_error_is_set(&error)) {
+            driz_error_set_message(&error, "Invalid pixmap array");
+        }
+        goto _exit;
+    }
+
+    if (self->context) {
+        /* view of the plane holding the bit of this context ID */
+        plane = ctx_id / 32;
+        if (driz_error_check(&error, "context ID is out of range",
+                             ctx_id >= 0 &&
+                                 plane < PyArray_DIM(self->context, 0)))
+            goto _exit;
+        Py_INCREF(PyArray_DESCR(self->context));
+        con = (PyArrayObject *)PyArray_NewFromDescr(
+            &PyArray_Type, PyArray_DESCR(self->context),
+            PyArray_NDIM(self->context) - 1, PyArray_DIMS(self->context) + 1,
+            PyArray_STRIDES(self->context) + 1,
+            PyArray_BYTES(self->context) +
+                plane * PyArray_STRIDE(self->context, 0),
+            NPY_ARRAY_ALIGNED | NPY_ARRAY_WRITEABLE, NULL);
+        if (!con) goto _exit;
+        Py_INCREF(self->context);
+        if (PyArray_SetBaseObject(con, (PyObject *)self->context)) goto _exit;
+    }
+
+    if (unit_str2enum(inun_str, &inun, &error)) goto _exit;
+
+    /* Set the area to be processed */
+    get_dimensions(img, isize);
+    if (xmax == 0 || xmax >= isize[0]) xmax = isize[0] - 1;
+    if (ymax == 0 || ymax >= isize[1]) ymax = isize[1] - 1;
+
+    get_dimensions(map, psize);
+    if (check_pixmap_step(map, pixmap_step, isize, &error)) goto _exit;
+    if (driz_error_check(&error, "Pixel map dimensions != input dimensions.",
+                         pixmap_step > 1 ||
+                             (psize[0] == isize[0] && psize[1] == isize[1])))
+        goto _exit;
+    if (wei) {
+        get_dimensions(wei, wsize);
+        if (driz_error_check(&error,
+                             "Weights array dimensions != input dimensions.",
+                             wsize[0] == isize[0] && wsize[1] == isize[1]))
+            goto _exit;
+    }
+    if (driz_error_check(&error,
+                         cube ? "Drizzling to a spectral cube requires a "
+                                "pixel map with three components (x, y, "
+                                "lambda)."
+                              : "Pixel map must have at least two "
+                                "components.",
+                         PyArray_DIM(map, 2) >= (cube ? 3 : 2)))
+        goto _exit;
+
+    if (prepared_pixmap_section(prepared, map, pixmap_step, &xmin, &xmax,
+                                &ymin, &ymax)) {
+        driz_error_set_message(&error,
+                               "No or too few valid pixels in the pixel map.");
+        goto _exit;
+    }
+
+    if (kernel == kernel_gaussian || kernel == kernel_lanczos2 ||
+        kernel == kernel_lanczos3) {
+        if (snprintf(warn_msg, 128,
+                     "Kernel '%s' is not a flux-conserving kernel.",
+                     self->kernel_name) < 1) {
+            strcpy(warn_msg,
+                   "Selected kernel is not a flux-conserving kernel.");
+        }
+        if (PyErr_WarnEx(PyExc_Warning, warn_msg, 1)) goto _exit;
+    }
+
+    if (pfract <= 0.001) {
+        driz_log_message(
+            "kernel reset to POINT due to pfract being set to 0.0...");
+        kernel = kernel_point;
+    }
+
+    has_affine = pixmap_affine_from_any(oaffine, affine, &error);
+    if (has_affine < 0) goto _exit;
+
+    driz_param_init(&p);
+
+    p.data = img;
+    p.weights = wei;
+    p.pixmap = map;
+    p.output_data = self->output;
+    p.output_counts = self->counts;
+    p.output_context = con;
+    p.uuid = ctx_id % 32 + 1;
+    p.xmin = xmin;
+    p.ymin = ymin;
+    p.xmax = xmax;
+    p.ymax = ymax;
+    p.out_x0 = out_x0;
+    p.out_y0 = out_y0;
+    p.scale = scale;
+    p.pixel_fraction = pfract;
+    p.kernel = kernel;
+    p.in_units = inun;
+    p.exposure_time = expin;
+    p.weight_scale = wtscl;
+    p.fill_value = self->fill_value;
+    p.lanczos_lut = self->lanczos_lut;
+    p.error = &error;
+    p.progress = &progress;
+    if (has_affine) p.pixmap_affine = (const double(*)[3])affine;
+    if (mosaic_from_any(omosaic, p.mosaic, &error)) goto _exit;
+
+    if (driz_error_check(&error, "xmin must be >= 0", p.xmin >= 0)) goto _exit;
+    if (driz_error_check(&error, "ymin must be >= 0", p.ymin >= 0)) goto _exit;
+    if (driz_error_check(&error, "xmax must be > xmin", p.xmax > p.xmin))
+        goto _exit;
+    if (driz_error_check(&error, "ymax must be > ymin", p.ymax > p.ymin))
+        goto _exit;
+    if (driz_error_check(&error, "scale must be > 0", p.scale > 0.0))
+        goto _exit;
+    if (driz_error_check(&error, "exposure time must be > 0", p.exposure_time))
+        goto _exit;
+    if (driz_error_check(&error, "weight scale must be > 0",
+                         p.weight_scale > 0.0))
+        goto _exit;
+
+    if (pixmap_step > 1) {
+        coarse = coarse_pixmap_new(map, pixmap_step, &error);
+        if (!coarse) goto _exit;
+        p.coarse_pixmap = coarse;
+    }
+
+    prepared_pixmap_scanner(prepared, &p, &scanner);
+
+    Py_BEGIN_ALLOW_THREADS;
+
+    if (!dobox(&p) && self->do_fill) {
+        put_fill(&p, self->fill_value);
+    }
+
+    Py_END_ALLOW_THREADS;
+
+_exit:
+    Py_XDECREF(img);
+    Py_XDECREF(wei);
+    Py_XDECREF(map);
+    coarse_pixmap_free(coarse);
+    Py_XDECREF(con);
+
+    if (progress_exit(&progress)) {
+        return NULL;
+    } else if (driz_error_is_set(&error)) {
+        PyErr_SetString(PyExc_ValueError, driz_error_get_message(&error));
+        return NULL;
+    } else if (PyErr_Occurred()) {
+        return NULL;
+    }
+    return Py_BuildValue("nn", p.nmiss, p.nskip);
+}
+
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmissing-field-initializers"
+#pragma GCC diagnostic ignored "-Wcast-function-type"
+#elif defined(__clang__)
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wcast-function-type-mismatch"
+#endif
+static PyMemberDef engine_members[] = {
+    {"output", T_OBJECT, offsetof(engine_t, output), READONLY,
+     "Output image."},
+    {"counts", T_OBJECT, offsetof(engine_t, counts), READONLY,
+     "Output weight image."},
+    {"context", T_OBJECT, offsetof(engine_t, context), READONLY,
+     "Output context planes or None."},
+    {NULL} /* sentinel */
+};
+
+static PyMethodDef engine_methods[] = {
+    {"add", (PyCFunction)engine_add, METH_VARARGS | METH_KEYWORDS,
+     "add(input, pixmap, weights, ctx_id, xmin, xmax, ymin, ymax, scale, "
+     "pixfrac, in_units, expscale, wtscale, out_x0, out_y0, progress, "
+     "cancel, progress_rows, pixmap_step, pixmap_affine, mosaic)"},
+    {"set_outputs", (PyCFunction)engine_set_outputs_method,
+     METH_VARARGS | METH_KEYWORDS, "set_outputs(output, counts, context)"},
+    {NULL} /* sentinel */
+};
+
+static PyTypeObject engine_type = {
+    PyVarObject_HEAD_INIT(NULL, 0).tp_name = "drizzle.cdrizzle.DrizzleEngine",
+    .tp_doc = "DrizzleEngine(output, counts, context, kernel, fillstr)",
+    .tp_basicsize = sizeof(engine_t),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = PyType_GenericNew,
+    .tp_init = (initproc)engine_init,
+    .tp_dealloc = (destructor)engine_dealloc,
+    .tp_members = engine_members,
+    .tp_methods = engine_methods,
+};
+#if defined(__GNUC__)
+#pragma GCC diagnostic pop
+#elif defined(__clang__)
+#pragma clang diagnostic pop
+#endif
+
 /** ---------------------------------------------------------------------------
  * Table of functions callable from python
  */
@@ -618,15 +3745,45 @@ static struct PyMethodDef cdrizzle_methods[] = {
     {"tdriz", (PyCFunction)tdriz, METH_VARARGS | METH_KEYWORDS,
      "tdriz(image, weights, pixmap, output, counts, context, uniqid, xmin, "
      "xmax, ymin, ymax, scale, pixfrac, kernel, in_units, expscale, wtscale, "
-     "fillstr)"},
+     "fillstr, out_x0, out_y0, progress, cancel, progress_rows, "
+     "pixmap_step, pixmap_affine, mosaic)"},
+    {"tdriz_adjoint", (PyCFunction)tdriz_adjoint, METH_VARARGS | METH_KEYWORDS,
+     "tdriz_adjoint(image, weights, pixmap, output, xmin, xmax, ymin, ymax, "
+     "scale, pixfrac, kernel, in_units, expscale, wtscale, out_x0, out_y0, "
+     "mosaic)"},
+    {"overlap_matrix", (PyCFunction)overlap_matrix,
+     METH_VARARGS | METH_KEYWORDS,
+     "overlap_matrix(pixmap, shape, xmin, xmax, ymin, ymax, scale, pixfrac, "
+     "kernel, out_x0, out_y0, mosaic)"},
+    {"tdriz_overlaps", (PyCFunction)tdriz_overlaps,
+     METH_VARARGS | METH_KEYWORDS,
+     "tdriz_overlaps(image, weights, indptr, indices, overlaps, output, "
+     "counts, context, uniqid, scale, in_units, expscale, wtscale, fillstr)"},
+    {"tdriz_batch", (PyCFunction)tdriz_batch, METH_VARARGS | METH_KEYWORDS,
+     "tdriz_batch(inputs, weights, pixmaps, output, counts, context, ctx_ids, "
+     "exptimes, scale, pixfrac, kernel, in_units, wtscale, fillstr, "
+     "nthreads, out_x0, out_y0, mosaic)"},
+    {"tdriz_stack", (PyCFunction)tdriz_stack, METH_VARARGS | METH_KEYWORDS,
+     "tdriz_stack(inputs, weights, pixmaps, output, counts, exptimes, scale, "
+     "pixfrac, kernel, in_units, wtscale, fillstr, nthreads, coadd, "
+     "coadd_counts, coadd_context, ctx_ids, out_x0, out_y0, mosaic)"},
+    {"merge", (PyCFunction)merge, METH_VARARGS | METH_KEYWORDS,
+     "merge(output, counts, context, other_output, other_counts, "
+     "other_context, ctx_offset, nthreads)"},
     {"tblot", (PyCFunction)tblot, METH_VARARGS | METH_KEYWORDS,
      "tblot(image, pixmap, output, xmin, xmax, ymin, ymax, scale, kscale, "
-     "interp, exptime, misval, sinscl)"},
+     "interp, exptime, misval, sinscl, progress, cancel, progress_rows, "
+     "pixmap_step, pixmap_affine)"},
+    {"sip_pixmap", (PyCFunction)sip_pixmap, METH_VARARGS | METH_KEYWORDS,
+     "sip_pixmap(pixmap, wcs_from, wcs_to, pixmap_step, row0, nthreads)"},
     {"test_cdrizzle", test_cdrizzle, METH_VARARGS,
      "test_cdrizzle(data, weights, pixmap, output_data, output_counts)"},
     {"invert_pixmap", invert_pixmap_wrap, METH_VARARGS,
      "invert_pixmap(pixmap, xyout, bbox)"},
     {"clip_polygon", clip_polygon_wrap, METH_VARARGS, "clip_polygon(p, q)"},
+    {"footprint_index", (PyCFunction)footprint_index,
+     METH_VARARGS | METH_KEYWORDS,
+     "footprint_index(footprints, shape, tile_shape)"},
     {NULL, NULL} /* sentinel */
 };
 #if defined(__GNUC__)
@@ -642,7 +3799,27 @@ static struct PyMethodDef cdrizzle_methods[] = {
 PyMODINIT_FUNC
 initcdrizzle(void) {
     /* Create the module and add the functions */
-    (void)Py_InitModule("cdrizzle", cdrizzle_methods);
+    PyObject *m;
+
+    m = Py_InitModule("cdrizzle", cdrizzle_methods);
+
+    gl_CancelledError = PyErr_NewException("cdrizzle.CancelledError",
+                                           PyExc_RuntimeError, NULL);
+    if (gl_CancelledError) {
+        Py_INCREF(gl_CancelledError);
+        PyModule_AddObject(m, "CancelledError", gl_CancelledError);
+    }
+
+    if (PyType_Ready(&engine_type) == 0) {
+        Py_INCREF(&engine_type);
+        PyModule_AddObject(m, "DrizzleEngine", (PyObject *)&engine_type);
+    }
+
+    if (PyType_Ready(&prepared_pixmap_type) == 0) {
+        Py_INCREF(&prepared_pixmap_type);
+        PyModule_AddObject(m, "PreparedPixmap",
+                           (PyObject *)&prepared_pixmap_type);
+    }
 
     /* Check for errors */
     if (PyErr_Occurred()) Py_FatalError("can't initialize module cdrizzle");
@@ -666,6 +3843,32 @@ PyInit_cdrizzle(void) {
     PyObject *m;
     m = PyModule_Create(&moduledef);
 
+    if (m) {
+        gl_CancelledError = PyErr_NewException("cdrizzle.CancelledError",
+                                               PyExc_RuntimeError, NULL);
+        if (gl_CancelledError) {
+            Py_INCREF(gl_CancelledError);
+            if (PyModule_AddObject(m, "CancelledError", gl_CancelledError)) {
+                Py_DECREF(gl_CancelledError);
+            }
+        }
+    }
+
+    if (m && PyType_Ready(&engine_type) == 0) {
+        Py_INCREF(&engine_type);
+        if (PyModule_AddObject(m, "DrizzleEngine", (PyObject *)&engine_type)) {
+            Py_DECREF(&engine_type);
+        }
+    }
+
+    if (m && PyType_Ready(&prepared_pixmap_type) == 0) {
+        Py_INCREF(&prepared_pixmap_type);
+        if (PyModule_AddObject(m, "PreparedPixmap",
+                               (PyObject *)&prepared_pixmap_type)) {
+            Py_DECREF(&prepared_pixmap_type);
+        }
+    }
+
     /* Check for errors */
     if (PyErr_Occurred()) Py_FatalError("can't initialize module cdrizzle");
 
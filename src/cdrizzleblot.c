@@ -268,7 +268,7 @@ interpolate_nearest_neighbor(const void *state UNUSED_PARAM,
     assert(state == NULL);
     INTERPOLATION_ASSERTS;
 
-    *value = get_pixel(data, (integer_t)(x + 0.5), (integer_t)(y + 0.5));
+    *value = get_input_value(data, (integer_t)(x + 0.5), (integer_t)(y + 0.5));
     return 0;
 }
 
@@ -304,7 +304,7 @@ interpolate_bilinear(const void *state UNUSED_PARAM, PyArrayObject *data,
         return 1;
     }
 
-    f00 = get_pixel(data, nx, ny);
+    f00 = get_input_value(data, nx, ny);
 
     if (nx == (isize[0] - 1)) {
         if (ny == (isize[1] - 1)) {
@@ -315,11 +315,11 @@ interpolate_bilinear(const void *state UNUSED_PARAM, PyArrayObject *data,
         }
         /* Interpolate along Y-direction only */
         sy = y - (float)ny;
-        *value = (1.0f - sy) * f00 + sy * get_pixel(data, nx, ny + 1);
+        *value = (1.0f - sy) * f00 + sy * get_input_value(data, nx, ny + 1);
     } else if (ny == (isize[1] - 1)) {
         /* Interpolate along X-direction only */
         sx = x - (float)nx;
-        *value = (1.0f - sx) * f00 + sx * get_pixel(data, nx + 1, ny);
+        *value = (1.0f - sx) * f00 + sx * get_input_value(data, nx + 1, ny);
     } else {
         /* Bilinear - interpolation */
         sx = x - (float)nx;
@@ -327,9 +327,9 @@ interpolate_bilinear(const void *state UNUSED_PARAM, PyArrayObject *data,
         sy = y - (float)ny;
         ty = 1.0f - sy;
 
-        *value = tx * ty * f00 + sx * ty * get_pixel(data, nx + 1, ny) +
-                 sy * tx * get_pixel(data, nx, ny + 1) +
-                 sx * sy * get_pixel(data, nx + 1, ny + 1);
+        *value = tx * ty * f00 + sx * ty * get_input_value(data, nx + 1, ny) +
+                 sy * tx * get_input_value(data, nx, ny + 1) +
+                 sx * sy * get_input_value(data, nx + 1, ny + 1);
     }
 
     return 0;
@@ -372,24 +372,27 @@ interpolate_poly3(const void *state UNUSED_PARAM, PyArrayObject *data,
         if (j >= 0 && j < isize[1]) {
             for (i = nx - 1; i <= nx + 2; ++i, ++ci) {
                 if (i < 0) {
-                    *ci = 2.0f * get_pixel(data, 0, j) - get_pixel(data, -i, j);
+                    *ci = 2.0f * get_input_value(data, 0, j) -
+                          get_input_value(data, -i, j);
                 } else if (i >= isize[0]) {
-                    *ci = 2.0f * get_pixel(data, isize[0] - 1, j) -
-                          get_pixel(data, 2 * isize[0] - 2 - i, j);
+                    *ci = 2.0f * get_input_value(data, isize[0] - 1, j) -
+                          get_input_value(data, 2 * isize[0] - 2 - i, j);
                 } else {
-                    *ci = get_pixel(data, i, j);
+                    *ci = get_input_value(data, i, j);
                 }
             }
         } else if (j == ny + 2) {
             for (i = nx - 1; i <= nx + 2; ++i, ++ci) {
                 if (i < 0) {
-                    *ci = 2.0f * get_pixel(data, 0, isize[1] - 3) -
-                          get_pixel(data, -i, isize[1] - 3);
+                    *ci = 2.0f * get_input_value(data, 0, isize[1] - 3) -
+                          get_input_value(data, -i, isize[1] - 3);
                 } else if (i >= isize[0]) {
-                    *ci = 2.0f * get_pixel(data, isize[0] - 1, isize[1] - 3) -
-                          get_pixel(data, 2 * isize[0] - 2 - i, isize[1] - 3);
+                    *ci = 2.0f * get_input_value(data, isize[0] - 1,
+                                                 isize[1] - 3) -
+                          get_input_value(data, 2 * isize[0] - 2 - i,
+                                          isize[1] - 3);
                 } else {
-                    *ci = get_pixel(data, i, isize[1] - 3);
+                    *ci = get_input_value(data, i, isize[1] - 3);
                 }
             }
         } else {
@@ -477,24 +480,27 @@ interpolate_poly5(const void *state UNUSED_PARAM, PyArrayObject *data,
         if (j >= 0 && j < isize[1]) {
             for (i = nx - 2; i <= nx + 3; ++i, ++ci) {
                 if (i < 0) {
-                    *ci = 2.0f * get_pixel(data, 0, j) - get_pixel(data, -i, j);
+                    *ci = 2.0f * get_input_value(data, 0, j) -
+                          get_input_value(data, -i, j);
                 } else if (i >= isize[0]) {
-                    *ci = 2.0f * get_pixel(data, isize[0] - 1, j) -
-                          get_pixel(data, 2 * isize[0] - 2 - i, j);
+                    *ci = 2.0f * get_input_value(data, isize[0] - 1, j) -
+                          get_input_value(data, 2 * isize[0] - 2 - i, j);
                 } else {
-                    *ci = get_pixel(data, i, j);
+                    *ci = get_input_value(data, i, j);
                 }
             }
         } else if (j == (ny + 3)) {
             for (i = nx - 2; i <= nx + 3; ++i, ++ci) {
                 if (i < 0) {
-                    *ci = 2.0f * get_pixel(data, 0, isize[1] - 4) -
-                          get_pixel(data, -i, isize[1] - 4);
+                    *ci = 2.0f * get_input_value(data, 0, isize[1] - 4) -
+                          get_input_value(data, -i, isize[1] - 4);
                 } else if (i >= isize[0]) {
-                    *ci = 2.0f * get_pixel(data, isize[0] - 1, isize[1] - 4) -
-                          get_pixel(data, 2 * isize[0] - 2 - i, isize[1] - 4);
+                    *ci = 2.0f * get_input_value(data, isize[0] - 1,
+                                                 isize[1] - 4) -
+                          get_input_value(data, 2 * isize[0] - 2 - i,
+                                          isize[1] - 4);
                 } else {
-                    *ci = get_pixel(data, i, isize[1] - 4);
+                    *ci = get_input_value(data, i, isize[1] - 4);
                 }
             }
         } else {
@@ -812,7 +818,7 @@ interpolate_lanczos(const void *state, PyArrayObject *data, const float x,
             xoff = (integer_t)(fabs((x - (float)i) / lanczos->space));
             assert(xoff >= 0 && xoff < lanczos->nlut);
 
-            sum += get_pixel(data, i, j) * lanczos->lut[xoff] * luty;
+            sum += get_input_value(data, i, j) * lanczos->lut[xoff] * luty;
         }
     }
 
@@ -912,20 +918,29 @@ doblot(struct driz_param_t *p) {
     v = 1.0;
 
     for (j = 0; j < osize[1]; ++j) {
+        if (driz_check_progress(p, j, osize[1])) goto doblot_exit_;
+
         /* Loop through the output positions and do the interpolation */
         for (i = 0; i < osize[0]; ++i) {
-            if (oob_pixel(p->pixmap, i, j)) {
-                driz_error_format_message(p->error, "OOB in pixmap[%d,%d]", i,
-                                          j);
+            if (!p->coarse_pixmap && oob_pixel(p->pixmap, i, j)) {
+                driz_error_format_message(p->error,
+                                          "OOB in pixmap[%" NPY_INTP_FMT
+                                          ",%" NPY_INTP_FMT "]",
+                                          i, j);
                 return 1;
             } else {
-                xo = get_pixmap(p->pixmap, i, j)[0];
-                yo = get_pixmap(p->pixmap, i, j)[1];
+                double x, y;
+
+                map_pixel(p, i, j, &x, &y);
+                xo = (float)x;
+                yo = (float)y;
             }
 
             if (npy_isnan(xo) || npy_isnan(yo)) {
-                driz_error_format_message(p->error, "NaN in pixmap[%d,%d]", i,
-                                          j);
+                driz_error_format_message(p->error,
+                                          "NaN in pixmap[%" NPY_INTP_FMT
+                                          ",%" NPY_INTP_FMT "]",
+                                          i, j);
                 return 1;
             }
 
@@ -942,7 +957,10 @@ doblot(struct driz_param_t *p) {
                 value = v * p->ef / scale2;
                 if (oob_pixel(p->output_data, i, j)) {
                     driz_error_format_message(
-                        p->error, "OOB in output_data[%d,%d]", i, j);
+                        p->error,
+                        "OOB in output_data[%" NPY_INTP_FMT ",%" NPY_INTP_FMT
+                        "]",
+                        i, j);
                     return 1;
                 } else {
                     set_pixel(p->output_data, i, j, value);
@@ -953,7 +971,10 @@ doblot(struct driz_param_t *p) {
                    value flag */
                 if (oob_pixel(p->output_data, i, j)) {
                     driz_error_format_message(
-                        p->error, "OOB in output_data[%d,%d]", i, j);
+                        p->error,
+                        "OOB in output_data[%" NPY_INTP_FMT ",%" NPY_INTP_FMT
+                        "]",
+                        i, j);
                     return 1;
                 } else {
                     set_pixel(p->output_data, i, j, p->misval);
@@ -11,6 +11,22 @@
 #include <math.h>
 #include <stdlib.h>
 
+/** ---------------------------------------------------------------------------
+ * Value of an input pixel in counts per second. Input images in counts are
+ * divided by the exposure time as they are read rather than scaled in place.
+ *
+ * p: structure containing options, input, and output
+ * i: x coordinate in input image
+ * j: y coordinate in input image
+ */
+
+inline_macro static float
+get_input_pixel(struct driz_param_t *p, const integer_t i, const integer_t j) {
+    float value = get_input_value(p->data, i, j);
+    if (p->in_units == unit_counts) value *= 1.0f / p->exposure_time;
+    return value;
+}
+
 /** ---------------------------------------------------------------------------
  * Update the flux and counts in the output image using a weighted average
  *
@@ -33,8 +49,10 @@ update_data(struct driz_param_t *p, const integer_t ii, const integer_t jj,
 
     if (vc == 0.0f) {
         if (oob_pixel(p->output_data, ii, jj)) {
-            driz_error_format_message(p->error, "OOB in output_data[%d,%d]", ii,
-                                      jj);
+            driz_error_format_message(p->error,
+                                      "OOB in output_data[%" NPY_INTP_FMT
+                                      ",%" NPY_INTP_FMT "]",
+                                      ii, jj);
             return 1;
         } else {
             set_pixel(p->output_data, ii, jj, d);
@@ -42,8 +60,10 @@ update_data(struct driz_param_t *p, const integer_t ii, const integer_t jj,
 
     } else {
         if (oob_pixel(p->output_data, ii, jj)) {
-            driz_error_format_message(p->error, "OOB in output_data[%d,%d]", ii,
-                                      jj);
+            driz_error_format_message(p->error,
+                                      "OOB in output_data[%" NPY_INTP_FMT
+                                      ",%" NPY_INTP_FMT "]",
+                                      ii, jj);
             return 1;
         } else {
             double value;
@@ -54,8 +74,10 @@ update_data(struct driz_param_t *p, const integer_t ii, const integer_t jj,
     }
 
     if (oob_pixel(p->output_counts, ii, jj)) {
-        driz_error_format_message(p->error, "OOB in output_counts[%d,%d]", ii,
-                                  jj);
+        driz_error_format_message(p->error,
+                                  "OOB in output_counts[%" NPY_INTP_FMT
+                                  ",%" NPY_INTP_FMT "]",
+                                  ii, jj);
         return 1;
     } else {
         set_pixel(p->output_counts, ii, jj, vc_plus_dow);
@@ -64,6 +86,154 @@ update_data(struct driz_param_t *p, const integer_t ii, const integer_t jj,
     return 0;
 }
 
+/** ---------------------------------------------------------------------------
+ * Update the flux and counts in a spectral cube using a weighted average
+ *
+ * p:   structure containing options, input, and output
+ * ii:  x coordinate in output cubes
+ * jj:  y coordinate in output cubes
+ * kk:  wavelength plane in output cubes
+ * d:   new contribution to weighted flux
+ * vc:  previous value of counts
+ * dow: new contribution to weighted counts
+ */
+
+inline_macro static void
+update_data3(struct driz_param_t *p, const integer_t ii, const integer_t jj,
+             const integer_t kk, const float d, const float vc,
+             const float dow) {
+    double vc_plus_dow;
+
+    if (dow == 0.0f) return;
+
+    vc_plus_dow = vc + dow;
+
+    if (vc == 0.0f) {
+        set_pixel3(p->output_data, ii, jj, kk, d);
+    } else {
+        set_pixel3(p->output_data, ii, jj, kk,
+                   (get_pixel3(p->output_data, ii, jj, kk) * vc + dow * d) /
+                       vc_plus_dow);
+    }
+
+    set_pixel3(p->output_counts, ii, jj, kk, vc_plus_dow);
+}
+
+/** ---------------------------------------------------------------------------
+ * Add the transpose of the contributions of an input pixel back to the input
+ * image (adjoint mode)
+ *
+ * p:   structure containing options, input, and output
+ * i:   x coordinate in input image
+ * j:   y coordinate in input image
+ * adj: sum of the output pixel values weighted by the kernel weights
+ */
+
+inline_macro static void
+update_adjoint(struct driz_param_t *p, const integer_t i, const integer_t j,
+               const double adj) {
+    double factor;
+
+    /* Transpose of the scaling of the input data in the forward drizzle */
+    factor = (float)(p->scale * p->scale);
+    if (p->in_units == unit_counts) factor *= 1.0f / p->exposure_time;
+
+    set_pixel(p->data, i, j, get_pixel(p->data, i, j) + factor * adj);
+}
+
+/** ---------------------------------------------------------------------------
+ * Allocate an empty overlap matrix for an input image with nrows pixels
+ *
+ * m:     the overlap matrix
+ * nrows: the number of pixels in the input image
+ * error: error structure set when memory cannot be allocated
+ */
+
+int
+overlap_matrix_init(struct overlap_matrix_t *m, npy_intp nrows,
+                    struct driz_error_t *error) {
+    m->nrows = nrows;
+    m->nnz = 0;
+    m->capacity = MAX(nrows, 1024);
+    m->row = -1;
+    m->indptr = (npy_intp *)malloc((nrows + 1) * sizeof(npy_intp));
+    m->indices = (npy_intp *)malloc(m->capacity * sizeof(npy_intp));
+    m->weights = (float *)malloc(m->capacity * sizeof(float));
+
+    if (m->indptr == NULL || m->indices == NULL || m->weights == NULL) {
+        overlap_matrix_free(m);
+        driz_error_set_message(error, "Out of memory");
+        return 1;
+    }
+
+    return 0;
+}
+
+/** ---------------------------------------------------------------------------
+ * Release the memory held by an overlap matrix
+ *
+ * m: the overlap matrix
+ */
+
+void
+overlap_matrix_free(struct overlap_matrix_t *m) {
+    free(m->indptr);
+    free(m->indices);
+    free(m->weights);
+    m->indptr = NULL;
+    m->indices = NULL;
+    m->weights = NULL;
+    m->nnz = m->capacity = 0;
+}
+
+/** ---------------------------------------------------------------------------
+ * Append the overlap of input pixel (i, j) with output pixel (ii, jj) to the
+ * overlap matrix. Kernels visit input pixels in row-major order, so the rows
+ * of the matrix are filled in sequence.
+ *
+ * p:     structure containing options, input, and output
+ * i:     x coordinate in input image
+ * j:     y coordinate in input image
+ * ii:    x coordinate in output images
+ * jj:    y coordinate in output images
+ * dover: kernel weight of the overlap
+ */
+
+static int
+record_overlap(struct driz_param_t *p, const integer_t i, const integer_t j,
+               const integer_t ii, const integer_t jj, const double dover) {
+    struct overlap_matrix_t *m = p->overlaps;
+    npy_intp row, capacity;
+    npy_intp *indices;
+    float *weights;
+
+    if (m->nnz == m->capacity) {
+        capacity = 2 * m->capacity;
+        indices = (npy_intp *)realloc(m->indices, capacity * sizeof(npy_intp));
+        if (indices == NULL) goto _oom;
+        m->indices = indices;
+        weights = (float *)realloc(m->weights, capacity * sizeof(float));
+        if (weights == NULL) goto _oom;
+        m->weights = weights;
+        m->capacity = capacity;
+    }
+
+    row = (npy_intp)j * PyArray_DIM(p->pixmap, 1) + i;
+    while (m->row < row) {
+        m->indptr[++m->row] = m->nnz;
+    }
+
+    m->indices[m->nnz] = (npy_intp)jj * PyArray_DIM(p->output_data, 1) + ii;
+    m->weights[m->nnz] = (float)dover;
+    ++m->nnz;
+
+    return 0;
+
+_oom:
+    driz_error_set_message(p->error, "Out of memory");
+    return 1;
+}
+
 /** ---------------------------------------------------------------------------
  * The bit value, trimmed to the appropriate range
  *
@@ -261,7 +431,8 @@ do_kernel_point(struct driz_param_t *p) {
     integer_t osize[2];
     float scale2, vc, d, dow;
     integer_t bv;
-    int xmin, xmax, ymin, ymax, n;
+    integer_t xmin, xmax, ymin, ymax;
+    int n;
 
     scale2 = p->scale * p->scale;
     bv = compute_bit_value(p->uuid);
@@ -274,6 +445,8 @@ do_kernel_point(struct driz_param_t *p) {
     /* This is the outer loop over all the lines in the input image */
     get_dimensions(p->output_data, osize);
     for (j = ymin; j <= ymax; ++j) {
+        if (driz_check_progress(p, j - ymin, ymax - ymin + 1)) return 1;
+
         /* Check the overlap with the output */
         n = get_scanline_limits(&s, j, &xmin, &xmax);
         if (n == 1) {
@@ -295,32 +468,47 @@ do_kernel_point(struct driz_param_t *p) {
         for (i = xmin; i <= xmax; ++i) {
             double ox, oy;
 
-            if (map_pixel(p->pixmap, i, j, &ox, &oy)) {
+            if (map_pixel(p, i, j, &ox, &oy)) {
                 ++p->nmiss;
 
             } else {
-                ii = fortran_round(ox);
-                jj = fortran_round(oy);
+                ii = fortran_round(ox) - p->out_x0;
+                jj = fortran_round(oy) - p->out_y0;
 
                 /* Check it is on the output image */
                 if (ii < 0 || ii >= osize[0] || jj < 0 || jj >= osize[1]) {
                     ++p->nmiss;
 
+                } else if (p->overlaps) {
+                    if (record_overlap(p, i, j, ii, jj, 1.0)) {
+                        return 1;
+                    }
+
                 } else {
                     vc = get_pixel(p->output_counts, ii, jj);
 
                     /* Allow for stretching because of scale change */
-                    d = get_pixel(p->data, i, j) * scale2;
+                    d = get_input_pixel(p, i, j) * scale2;
 
                     /* Scale the weighting mask by the scale factor.  Note that
                        we DON'T scale by the Jacobian as it hasn't been
                        calculated */
                     if (p->weights) {
-                        dow = get_pixel(p->weights, i, j) * p->weight_scale;
+                        dow = get_input_value(p->weights, i, j) *
+                              p->weight_scale;
                     } else {
                         dow = 1.0;
                     }
 
+                    if (p->adjoint) {
+                        if (dow != 0.0f) {
+                            update_adjoint(
+                                p, i, j,
+                                dow * get_pixel(p->output_data, ii, jj));
+                        }
+                        continue;
+                    }
+
                     /* If we are creating or modifying the context image,
                        we do so here. */
                     if (p->output_context && dow > 0.0) {
@@ -352,9 +540,10 @@ do_kernel_gaussian(struct driz_param_t *p) {
     integer_t osize[2];
     float vc, d, dow;
     double gaussian_efac, gaussian_es;
-    double pfo, ac, scale2, xxi, xxa, yyi, yya, w, ddx, ddy, r2, dover;
+    double pfo, ac, scale2, xxi, xxa, yyi, yya, w, ddx, ddy, r2, dover, adj;
     const double nsig = 2.5;
-    int xmin, xmax, ymin, ymax, n;
+    integer_t xmin, xmax, ymin, ymax;
+    int n;
 
     /* Added in V2.9 - make sure pfo doesn't get less than 1.2
        divided by the scale so that there are never holes in the
@@ -379,6 +568,8 @@ do_kernel_gaussian(struct driz_param_t *p) {
 
     get_dimensions(p->output_data, osize);
     for (j = ymin; j <= ymax; ++j) {
+        if (driz_check_progress(p, j - ymin, ymax - ymin + 1)) return 1;
+
         /* Check the overlap with the output */
         n = get_scanline_limits(&s, j, &xmin, &xmax);
         if (n == 1) {
@@ -400,7 +591,7 @@ do_kernel_gaussian(struct driz_param_t *p) {
         for (i = xmin; i <= xmax; ++i) {
             double ox, oy;
 
-            if (map_pixel(p->pixmap, i, j, &ox, &oy)) {
+            if (map_pixel(p, i, j, &ox, &oy)) {
                 nhit = 0;
 
             } else {
@@ -410,30 +601,31 @@ do_kernel_gaussian(struct driz_param_t *p) {
                 yyi = oy - pfo;
                 yya = oy + pfo;
 
-                nxi = MAX(fortran_round(xxi), 0);
-                nxa = MIN(fortran_round(xxa), osize[0] - 1);
-                nyi = MAX(fortran_round(yyi), 0);
-                nya = MIN(fortran_round(yya), osize[1] - 1);
+                nxi = MAX(fortran_round(xxi) - p->out_x0, 0);
+                nxa = MIN(fortran_round(xxa) - p->out_x0, osize[0] - 1);
+                nyi = MAX(fortran_round(yyi) - p->out_y0, 0);
+                nya = MIN(fortran_round(yya) - p->out_y0, osize[1] - 1);
 
                 nhit = 0;
+                adj = 0.0;
 
                 /* Allow for stretching because of scale change */
-                d = get_pixel(p->data, i, j) * scale2;
+                d = get_input_pixel(p, i, j) * scale2;
 
                 /* Scale the weighting mask by the scale factor and inversely by
                    the Jacobian to ensure conservation of weight in the output
                  */
                 if (p->weights) {
-                    w = get_pixel(p->weights, i, j) * p->weight_scale;
+                    w = get_input_value(p->weights, i, j) * p->weight_scale;
                 } else {
                     w = 1.0;
                 }
 
                 /* Loop over output pixels which could be affected */
                 for (jj = nyi; jj <= nya; ++jj) {
-                    ddy = oy - (double)jj;
+                    ddy = oy - (double)(jj + p->out_y0);
                     for (ii = nxi; ii <= nxa; ++ii) {
-                        ddx = ox - (double)ii;
+                        ddx = ox - (double)(ii + p->out_x0);
                         /* Radial distance */
                         r2 = ddx * ddx + ddy * ddy;
 
@@ -444,9 +636,23 @@ do_kernel_gaussian(struct driz_param_t *p) {
                         /* Count the hits */
                         ++nhit;
 
+                        if (p->overlaps) {
+                            if (record_overlap(p, i, j, ii, jj, dover)) {
+                                return 1;
+                            }
+                            continue;
+                        }
+
                         vc = get_pixel(p->output_counts, ii, jj);
                         dow = (float)dover * w;
 
+                        if (p->adjoint) {
+                            if (dow != 0.0f) {
+                                adj += dow * get_pixel(p->output_data, ii, jj);
+                            }
+                            continue;
+                        }
+
                         /* If we are create or modifying the context image, we
                            do so here. */
                         if (p->output_context && dow > 0.0) {
@@ -458,6 +664,8 @@ do_kernel_gaussian(struct driz_param_t *p) {
                         }
                     }
                 }
+
+                if (p->adjoint && nhit) update_adjoint(p, i, j, adj);
             }
 
             /* Count cases where the pixel is off the output image */
@@ -481,12 +689,12 @@ do_kernel_lanczos(struct driz_param_t *p) {
     integer_t bv, i, j, ii, jj, nxi, nxa, nyi, nya, nhit, ix, iy;
     integer_t osize[2];
     float scale2, vc, d, dow;
-    double pfo, xx, yy, xxi, xxa, yyi, yya, w, dx, dy, dover;
+    double pfo, xx, yy, xxi, xxa, yyi, yya, w, dx, dy, dover, adj;
     int kernel_order;
     struct lanczos_param_t lanczos;
-    const size_t nlut = 512;
-    const float del = 0.01;
-    int xmin, xmax, ymin, ymax, n;
+    float *lut = NULL;
+    integer_t xmin, xmax, ymin, ymax;
+    int n;
 
     dx = 1.0;
     dy = 1.0;
@@ -496,18 +704,27 @@ do_kernel_lanczos(struct driz_param_t *p) {
     pfo = (double)kernel_order * p->pixel_fraction / p->scale;
     bv = compute_bit_value(p->uuid);
 
-    if ((lanczos.lut = malloc(nlut * sizeof(float))) == NULL) {
-        driz_error_set_message(p->error, "Out of memory");
-        return driz_error_is_set(p->error);
-    }
+    if (p->lanczos_lut) {
+        lanczos.lut = (float *)p->lanczos_lut;
+    } else {
+        if ((lut = malloc(LANCZOS_LUT_SIZE * sizeof(float))) == NULL) {
+            driz_error_set_message(p->error, "Out of memory");
+            return driz_error_is_set(p->error);
+        }
 
-    /* Set up a look-up-table for Lanczos-style interpolation
-       kernels */
-    create_lanczos_lut(kernel_order, nlut, del, lanczos.lut);
-    lanczos.sdp = p->scale / del / p->pixel_fraction;
-    lanczos.nlut = nlut;
+        /* Set up a look-up-table for Lanczos-style interpolation
+           kernels */
+        create_lanczos_lut(kernel_order, LANCZOS_LUT_SIZE, LANCZOS_LUT_STEP,
+                           lut);
+        lanczos.lut = lut;
+    }
+    lanczos.sdp = p->scale / LANCZOS_LUT_STEP / p->pixel_fraction;
+    lanczos.nlut = LANCZOS_LUT_SIZE;
 
-    if (init_image_scanner(p, &s, &ymin, &ymax)) return 1;
+    if (init_image_scanner(p, &s, &ymin, &ymax)) {
+        free(lut);
+        return 1;
+    }
 
     p->nskip = (p->ymax - p->ymin) - (ymax - ymin);
     p->nmiss = p->nskip * (p->xmax - p->xmin);
@@ -516,6 +733,11 @@ do_kernel_lanczos(struct driz_param_t *p) {
 
     get_dimensions(p->output_data, osize);
     for (j = ymin; j <= ymax; ++j) {
+        if (driz_check_progress(p, j - ymin, ymax - ymin + 1)) {
+            free(lut);
+            return 1;
+        }
+
         /* Check the overlap with the output */
         n = get_scanline_limits(&s, j, &xmin, &xmax);
         if (n == 1) {
@@ -535,7 +757,7 @@ do_kernel_lanczos(struct driz_param_t *p) {
         }
 
         for (i = xmin; i <= xmax; ++i) {
-            if (map_pixel(p->pixmap, i, j, &xx, &yy)) {
+            if (map_pixel(p, i, j, &xx, &yy)) {
                 nhit = 0;
 
             } else {
@@ -544,21 +766,22 @@ do_kernel_lanczos(struct driz_param_t *p) {
                 yyi = yy - dy - pfo;
                 yya = yy - dy + pfo;
 
-                nxi = MAX(fortran_round(xxi), 0);
-                nxa = MIN(fortran_round(xxa), osize[0] - 1);
-                nyi = MAX(fortran_round(yyi), 0);
-                nya = MIN(fortran_round(yya), osize[1] - 1);
+                nxi = MAX(fortran_round(xxi) - p->out_x0, 0);
+                nxa = MIN(fortran_round(xxa) - p->out_x0, osize[0] - 1);
+                nyi = MAX(fortran_round(yyi) - p->out_y0, 0);
+                nya = MIN(fortran_round(yya) - p->out_y0, osize[1] - 1);
 
                 nhit = 0;
+                adj = 0.0;
 
                 /* Allow for stretching because of scale change */
-                d = get_pixel(p->data, i, j) * scale2;
+                d = get_input_pixel(p, i, j) * scale2;
 
                 /* Scale the weighting mask by the scale factor and inversely by
                    the Jacobian to ensure conservation of weight in the output
                  */
                 if (p->weights) {
-                    w = get_pixel(p->weights, i, j) * p->weight_scale;
+                    w = get_input_value(p->weights, i, j) * p->weight_scale;
                 } else {
                     w = 1.0;
                 }
@@ -567,12 +790,12 @@ do_kernel_lanczos(struct driz_param_t *p) {
                 for (jj = nyi; jj <= nya; ++jj) {
                     for (ii = nxi; ii <= nxa; ++ii) {
                         /* X and Y offsets */
-                        ix =
-                            fortran_round(fabs(xx - (double)ii) * lanczos.sdp) +
-                            1;
-                        iy =
-                            fortran_round(fabs(yy - (double)jj) * lanczos.sdp) +
-                            1;
+                        ix = fortran_round(fabs(xx - (double)(ii + p->out_x0)) *
+                                           lanczos.sdp) +
+                             1;
+                        iy = fortran_round(fabs(yy - (double)(jj + p->out_y0)) *
+                                           lanczos.sdp) +
+                             1;
 
                         /* Weight is product of Lanczos function values in X and
                          * Y */
@@ -581,9 +804,24 @@ do_kernel_lanczos(struct driz_param_t *p) {
                         /* Count the hits */
                         ++nhit;
 
+                        if (p->overlaps) {
+                            if (record_overlap(p, i, j, ii, jj, dover)) {
+                                free(lut);
+                                return 1;
+                            }
+                            continue;
+                        }
+
                         vc = get_pixel(p->output_counts, ii, jj);
                         dow = (float)(dover * w);
 
+                        if (p->adjoint) {
+                            if (dow != 0.0f) {
+                                adj += dow * get_pixel(p->output_data, ii, jj);
+                            }
+                            continue;
+                        }
+
                         /* If we are create or modifying the context image, we
                            do so here. */
                         if (p->output_context && dow > 0.0) {
@@ -591,10 +829,13 @@ do_kernel_lanczos(struct driz_param_t *p) {
                         }
 
                         if (update_data(p, ii, jj, d, vc, dow)) {
+                            free(lut);
                             return 1;
                         }
                     }
                 }
+
+                if (p->adjoint && nhit) update_adjoint(p, i, j, adj);
             }
 
             /* Count cases where the pixel is off the output image */
@@ -602,8 +843,7 @@ do_kernel_lanczos(struct driz_param_t *p) {
         }
     }
 
-    free(lanczos.lut);
-    lanczos.lut = NULL;
+    free(lut);
 
     return 0;
 }
@@ -623,8 +863,9 @@ do_kernel_turbo(struct driz_param_t *p) {
     integer_t osize[2];
     float vc, d, dow;
     double pfo, scale2, ac;
-    double xxi, xxa, yyi, yya, w, dover;
-    int xmin, xmax, ymin, ymax, n;
+    double xxi, xxa, yyi, yya, w, dover, adj;
+    integer_t xmin, xmax, ymin, ymax;
+    int n;
 
     driz_log_message("starting do_kernel_turbo");
     bv = compute_bit_value(p->uuid);
@@ -641,6 +882,8 @@ do_kernel_turbo(struct driz_param_t *p) {
 
     get_dimensions(p->output_data, osize);
     for (j = ymin; j <= ymax; ++j) {
+        if (driz_check_progress(p, j - ymin, ymax - ymin + 1)) return 1;
+
         /* Check the overlap with the output */
         n = get_scanline_limits(&s, j, &xmin, &xmax);
 
@@ -663,7 +906,7 @@ do_kernel_turbo(struct driz_param_t *p) {
         for (i = xmin; i <= xmax; ++i) {
             double ox, oy;
 
-            if (map_pixel(p->pixmap, i, j, &ox, &oy)) {
+            if (map_pixel(p, i, j, &ox, &oy)) {
                 nhit = 0;
 
             } else {
@@ -673,10 +916,10 @@ do_kernel_turbo(struct driz_param_t *p) {
                 yyi = oy - pfo;
                 yya = oy + pfo;
 
-                nxi = fortran_round(xxi);
-                nxa = fortran_round(xxa);
-                nyi = fortran_round(yyi);
-                nya = fortran_round(yya);
+                nxi = fortran_round(xxi) - p->out_x0;
+                nxa = fortran_round(xxa) - p->out_x0;
+                nyi = fortran_round(yyi) - p->out_y0;
+                nya = fortran_round(yya) - p->out_y0;
                 iis = MAX(nxi,
                           0); /* Needed to be set to 0 to avoid edge effects */
                 iie = MIN(nxa, osize[0] - 1);
@@ -685,15 +928,16 @@ do_kernel_turbo(struct driz_param_t *p) {
                 jje = MIN(nya, osize[1] - 1);
 
                 nhit = 0;
+                adj = 0.0;
 
                 /* Allow for stretching because of scale change */
-                d = get_pixel(p->data, i, j) * (float)scale2;
+                d = get_input_pixel(p, i, j) * (float)scale2;
 
                 /* Scale the weighting mask by the scale factor and inversely by
                    the Jacobian to ensure conservation of weight in the output.
                  */
                 if (p->weights) {
-                    w = get_pixel(p->weights, i, j) * p->weight_scale;
+                    w = get_input_value(p->weights, i, j) * p->weight_scale;
                 } else {
                     w = 1.0;
                 }
@@ -703,7 +947,8 @@ do_kernel_turbo(struct driz_param_t *p) {
                     for (ii = iis; ii <= iie; ++ii) {
                         /* Calculate the overlap using the simpler "aligned" box
                            routine */
-                        dover = over(ii, jj, xxi, xxa, yyi, yya);
+                        dover = over(ii + p->out_x0, jj + p->out_y0, xxi, xxa,
+                                     yyi, yya);
 
                         if (dover > 0.0) {
                             /* Correct for the pixfrac area factor */
@@ -712,9 +957,24 @@ do_kernel_turbo(struct driz_param_t *p) {
                             /* Count the hits */
                             ++nhit;
 
+                            if (p->overlaps) {
+                                if (record_overlap(p, i, j, ii, jj, dover)) {
+                                    return 1;
+                                }
+                                continue;
+                            }
+
                             vc = get_pixel(p->output_counts, ii, jj);
                             dow = (float)(dover * w);
 
+                            if (p->adjoint) {
+                                if (dow != 0.0f) {
+                                    adj += dow *
+                                           get_pixel(p->output_data, ii, jj);
+                                }
+                                continue;
+                            }
+
                             /* If we are create or modifying the context image,
                                we do so here. */
                             if (p->output_context && dow > 0.0) {
@@ -727,6 +987,8 @@ do_kernel_turbo(struct driz_param_t *p) {
                         }
                     }
                 }
+
+                if (p->adjoint && nhit) update_adjoint(p, i, j, adj);
             }
 
             /* Count cases where the pixel is off the output image */
@@ -752,11 +1014,12 @@ do_kernel_square(struct driz_param_t *p) {
     integer_t bv, i, j, ii, jj, min_ii, max_ii, min_jj, max_jj, nhit;
     integer_t osize[2];
     float scale2, vc, d, dow;
-    double dh, jaco, tem, dover, w;
+    double dh, jaco, tem, dover, w, adj;
     double xin[4], yin[4], xout[4], yout[4];
 
     struct scanner s;
-    int xmin, xmax, ymin, ymax, n;
+    integer_t xmin, xmax, ymin, ymax;
+    int n;
 
     driz_log_message("starting do_kernel_square");
     dh = 0.5 * p->pixel_fraction;
@@ -774,6 +1037,8 @@ do_kernel_square(struct driz_param_t *p) {
     /* This is the outer loop over all the lines in the input image */
     get_dimensions(p->output_data, osize);
     for (j = ymin; j <= ymax; ++j) {
+        if (driz_check_progress(p, j - ymin, ymax - ymin + 1)) return 1;
+
         /* Check the overlap with the output */
         n = get_scanline_limits(&s, j, &xmin, &xmax);
         if (n == 1) {
@@ -799,6 +1064,7 @@ do_kernel_square(struct driz_param_t *p) {
 
         for (i = xmin; i <= xmax; ++i) {
             nhit = 0;
+            adj = 0.0;
 
             xin[3] = xin[0] = (double)i - dh;
             xin[2] = xin[1] = (double)i + dh;
@@ -829,37 +1095,54 @@ do_kernel_square(struct driz_param_t *p) {
             }
 
             /* Allow for stretching because of scale change */
-            d = get_pixel(p->data, i, j) * scale2;
+            d = get_input_pixel(p, i, j) * scale2;
 
             /* Scale the weighting mask by the scale factor and inversely by
                the Jacobian to ensure conservation of weight in the output */
             if (p->weights) {
-                w = get_pixel(p->weights, i, j) * p->weight_scale;
+                w = get_input_value(p->weights, i, j) * p->weight_scale;
             } else {
                 w = 1.0;
             }
 
             /* Loop over output pixels which could be affected */
-            min_jj = MAX(fortran_round(min_doubles(yout, 4)), 0);
-            max_jj = MIN(fortran_round(max_doubles(yout, 4)), osize[1] - 1);
-            min_ii = MAX(fortran_round(min_doubles(xout, 4)), 0);
-            max_ii = MIN(fortran_round(max_doubles(xout, 4)), osize[0] - 1);
+            min_jj = MAX(fortran_round(min_doubles(yout, 4)) - p->out_y0, 0);
+            max_jj = MIN(fortran_round(max_doubles(yout, 4)) - p->out_y0,
+                         osize[1] - 1);
+            min_ii = MAX(fortran_round(min_doubles(xout, 4)) - p->out_x0, 0);
+            max_ii = MIN(fortran_round(max_doubles(xout, 4)) - p->out_x0,
+                         osize[0] - 1);
 
             for (jj = min_jj; jj <= max_jj; ++jj) {
                 for (ii = min_ii; ii <= max_ii; ++ii) {
                     /* Call compute_area to calculate overlap */
-                    dover = compute_area((double)ii, (double)jj, xout, yout);
+                    dover = compute_area((double)(ii + p->out_x0),
+                                         (double)(jj + p->out_y0), xout, yout);
 
                     if (dover > 0.0) {
-                        vc = get_pixel(p->output_counts, ii, jj);
-
                         /* Re-normalise the area overlap using the Jacobian */
                         dover /= jaco;
-                        dow = (float)(dover * w);
 
                         /* Count the hits */
                         ++nhit;
 
+                        if (p->overlaps) {
+                            if (record_overlap(p, i, j, ii, jj, dover)) {
+                                return 1;
+                            }
+                            continue;
+                        }
+
+                        vc = get_pixel(p->output_counts, ii, jj);
+                        dow = (float)(dover * w);
+
+                        if (p->adjoint) {
+                            if (dow != 0.0f) {
+                                adj += dow * get_pixel(p->output_data, ii, jj);
+                            }
+                            continue;
+                        }
+
                         /* If we are creating or modifying the context image we
                            do so here */
                         if (p->output_context && dow > 0.0) {
@@ -873,6 +1156,8 @@ do_kernel_square(struct driz_param_t *p) {
                 }
             }
 
+            if (p->adjoint && nhit) update_adjoint(p, i, j, adj);
+
         /* Count cases where the pixel is off the output image */
         _miss:
             if (nhit == 0) {
@@ -885,6 +1170,189 @@ do_kernel_square(struct driz_param_t *p) {
     return 0;
 }
 
+/** ---------------------------------------------------------------------------
+ * The square kernel for spectral cubes. The pixel map has a third component
+ * giving the (fractional) wavelength plane of the output cube. The area
+ * overlap of the input pixel with each output spaxel is computed once, as in
+ * do_kernel_square, and is then split among the wavelength planes in
+ * proportion to the overlap of the spectral extent of the input pixel with
+ * each plane. The spectral extent is the range of the spectral coordinate
+ * over the corners of the input pixel.
+ *
+ * p: structure containing options, input, and output
+ */
+
+static int
+do_kernel_square_cube(struct driz_param_t *p) {
+    integer_t bv, i, j, ii, jj, kk, min_ii, max_ii, min_jj, max_jj, min_kk,
+        max_kk, nhit, nl;
+    integer_t osize[2];
+    float scale2, vc, d, dow;
+    double dh, jaco, tem, dover, w, lmin, lmax, lwidth, fk;
+    double xin[4], yin[4], xout[4], yout[4], lout[4];
+
+    struct scanner s;
+    integer_t xmin, xmax, ymin, ymax;
+    int n;
+
+    driz_log_message("starting do_kernel_square_cube");
+    dh = 0.5 * p->pixel_fraction;
+    bv = compute_bit_value(p->uuid);
+    scale2 = p->scale * p->scale;
+
+    nl = PyArray_DIM(p->output_data, 0);
+    osize[0] = PyArray_DIM(p->output_data, 2);
+    osize[1] = PyArray_DIM(p->output_data, 1);
+
+    if (init_image_scanner(p, &s, &ymin, &ymax)) return 1;
+
+    p->nskip = (p->ymax - p->ymin) - (ymax - ymin);
+    p->nmiss = p->nskip * (p->xmax - p->xmin);
+
+    /* This is the outer loop over all the lines in the input image */
+    for (j = ymin; j <= ymax; ++j) {
+        if (driz_check_progress(p, j - ymin, ymax - ymin + 1)) return 1;
+
+        /* Check the overlap with the output */
+        n = get_scanline_limits(&s, j, &xmin, &xmax);
+        if (n == 1) {
+            // scan ended (y reached the top vertex/edge)
+            p->nskip += (ymax + 1 - j);
+            p->nmiss += (ymax + 1 - j) * (p->xmax - p->xmin);
+            break;
+        } else if (n == 2 || n == 3) {
+            // pixel centered on y is outside of scanner's limits or image [0,
+            // height - 1] OR: limits (x1, x2) are equal (line width is 0)
+            p->nmiss += (p->xmax - p->xmin);
+            ++p->nskip;
+            continue;
+        } else {
+            // limits (x1, x2) are equal (line width is 0)
+            p->nmiss += (p->xmax - p->xmin) - (xmax + 1 - xmin);
+        }
+
+        /* Set the input corner positions */
+
+        yin[1] = yin[0] = (double)j + dh;
+        yin[3] = yin[2] = (double)j - dh;
+
+        for (i = xmin; i <= xmax; ++i) {
+            nhit = 0;
+
+            xin[3] = xin[0] = (double)i - dh;
+            xin[2] = xin[1] = (double)i + dh;
+
+            for (ii = 0; ii < 4; ++ii) {
+                if (interpolate_point(p, xin[ii], yin[ii], xout + ii,
+                                      yout + ii)) {
+                    goto _miss;
+                }
+            }
+
+            /* The spectral extent is taken over the whole input pixel,
+               independently of pixfrac, so that adjacent pixels along the
+               dispersion direction tile the spectral axis */
+            if (interpolate_lambda(p, i - 0.5, j + 0.5, lout) ||
+                interpolate_lambda(p, i + 0.5, j + 0.5, lout + 1) ||
+                interpolate_lambda(p, i + 0.5, j - 0.5, lout + 2) ||
+                interpolate_lambda(p, i - 0.5, j - 0.5, lout + 3)) {
+                goto _miss;
+            }
+
+            lmin = min_doubles(lout, 4);
+            lmax = max_doubles(lout, 4);
+            lwidth = lmax - lmin;
+            min_kk = MAX(fortran_round(lmin), 0);
+            max_kk = MIN(fortran_round(lmax), nl - 1);
+            if (min_kk > max_kk) goto _miss;
+
+            /* Work out the area of the quadrilateral on the output grid.
+               Note that this expression expects the points to be in clockwise
+               order */
+
+            jaco = 0.5f * ((xout[1] - xout[3]) * (yout[0] - yout[2]) -
+                           (xout[0] - xout[2]) * (yout[1] - yout[3]));
+
+            if (jaco < 0.0) {
+                jaco *= -1.0;
+                /* Swap */
+                tem = xout[1];
+                xout[1] = xout[3];
+                xout[3] = tem;
+                tem = yout[1];
+                yout[1] = yout[3];
+                yout[3] = tem;
+            }
+
+            /* Allow for stretching because of scale change */
+            d = get_input_pixel(p, i, j) * scale2;
+
+            /* Scale the weighting mask by the scale factor and inversely by
+               the Jacobian to ensure conservation of weight in the output */
+            if (p->weights) {
+                w = get_input_value(p->weights, i, j) * p->weight_scale;
+            } else {
+                w = 1.0;
+            }
+
+            /* Loop over output spaxels which could be affected */
+            min_jj = MAX(fortran_round(min_doubles(yout, 4)) - p->out_y0, 0);
+            max_jj = MIN(fortran_round(max_doubles(yout, 4)) - p->out_y0,
+                         osize[1] - 1);
+            min_ii = MAX(fortran_round(min_doubles(xout, 4)) - p->out_x0, 0);
+            max_ii = MIN(fortran_round(max_doubles(xout, 4)) - p->out_x0,
+                         osize[0] - 1);
+
+            for (jj = min_jj; jj <= max_jj; ++jj) {
+                for (ii = min_ii; ii <= max_ii; ++ii) {
+                    /* Call compute_area to calculate overlap */
+                    dover = compute_area((double)(ii + p->out_x0),
+                                         (double)(jj + p->out_y0), xout, yout);
+
+                    if (dover <= 0.0) continue;
+
+                    /* Re-normalise the area overlap using the Jacobian */
+                    dover /= jaco;
+
+                    /* Count the hits */
+                    ++nhit;
+
+                    for (kk = min_kk; kk <= max_kk; ++kk) {
+                        /* Fraction of the spectral extent in this plane */
+                        if (lwidth > 0.0) {
+                            fk = (MIN(lmax, kk + 0.5) - MAX(lmin, kk - 0.5)) /
+                                 lwidth;
+                            if (fk <= 0.0) continue;
+                        } else {
+                            fk = 1.0;
+                        }
+
+                        vc = get_pixel3(p->output_counts, ii, jj, kk);
+                        dow = (float)(dover * fk * w);
+
+                        /* If we are creating or modifying the context image we
+                           do so here */
+                        if (p->output_context && dow > 0.0) {
+                            set_bit3(p->output_context, ii, jj, kk, bv);
+                        }
+
+                        update_data3(p, ii, jj, kk, d, vc, dow);
+                    }
+                }
+            }
+
+        /* Count cases where the pixel is off the output image */
+        _miss:
+            if (nhit == 0) {
+                ++p->nmiss;
+            }
+        }
+    }
+
+    driz_log_message("ending do_kernel_square_cube");
+    return 0;
+}
+
 /** ---------------------------------------------------------------------------
  * The user selects a kernel to use for drizzling from a function in the
  * following tables The kernels differ in how the flux inside a single pixel is
@@ -908,7 +1376,17 @@ dobox(struct driz_param_t *p) {
     driz_log_message("starting dobox");
 
     /* Set up a function pointer to handle the appropriate kernel */
-    if (p->kernel < kernel_LAST) {
+    if (PyArray_NDIM(p->output_data) == 3) {
+        /* Spectral cubes */
+        if (p->kernel != kernel_square || p->overlaps || p->adjoint) {
+            driz_error_set_message(
+                p->error, "Spectral cubes support only the square kernel");
+            return 1;
+        }
+        kernel_handler = do_kernel_square_cube;
+        kernel_handler(p);
+
+    } else if (p->kernel < kernel_LAST) {
         kernel_handler = kernel_handler_map[p->kernel];
 
         if (kernel_handler != NULL) {
@@ -916,6 +1394,14 @@ dobox(struct driz_param_t *p) {
         }
     }
 
+    /* Close the rows of input pixels past the last recorded overlap */
+    if (p->overlaps && !driz_error_is_set(p->error)) {
+        struct overlap_matrix_t *m = p->overlaps;
+        while (m->row < m->nrows) {
+            m->indptr[++m->row] = m->nnz;
+        }
+    }
+
     if (kernel_handler == NULL) {
         driz_error_set_message(p->error, "Invalid kernel type");
     }
@@ -923,3 +1409,163 @@ dobox(struct driz_param_t *p) {
     driz_log_message("ending dobox");
     return driz_error_is_set(p->error);
 }
+
+/** ---------------------------------------------------------------------------
+ * Drizzle an image using a precomputed overlap matrix. The kernel geometry is
+ * taken entirely from the matrix, so this is a single pass over its entries
+ * that replays the weighted-mean updates of the kernel that built it.
+ *
+ * p: structure containing options, input, and output
+ */
+
+int
+dobox_overlaps(struct driz_param_t *p) {
+    const struct overlap_matrix_t *m = p->overlaps;
+    npy_intp k, n, col, osize_flat;
+    integer_t i, j, ii, jj, bv;
+    integer_t isize[2], osize[2];
+    float scale2, vc, d, dow;
+    double w;
+
+    driz_log_message("starting dobox_overlaps");
+    bv = compute_bit_value(p->uuid);
+    scale2 = p->scale * p->scale;
+
+    get_dimensions(p->data, isize);
+    get_dimensions(p->output_data, osize);
+    osize_flat = (npy_intp)osize[0] * osize[1];
+
+    if (m->nrows != (npy_intp)isize[0] * isize[1]) {
+        driz_error_set_message(p->error,
+                               "Overlap matrix does not match input image");
+        return 1;
+    }
+
+    for (k = 0; k < m->nrows; ++k) {
+        if (m->indptr[k] >= m->indptr[k + 1]) continue;
+
+        i = (integer_t)(k % isize[0]);
+        j = (integer_t)(k / isize[0]);
+
+        /* Allow for stretching because of scale change */
+        d = get_input_pixel(p, i, j) * scale2;
+
+        if (p->weights) {
+            w = get_input_value(p->weights, i, j) * p->weight_scale;
+        } else {
+            w = 1.0;
+        }
+
+        for (n = m->indptr[k]; n < m->indptr[k + 1]; ++n) {
+            col = m->indices[n];
+            if (col < 0 || col >= osize_flat) {
+                driz_error_set_message(
+                    p->error, "Overlap matrix does not match output image");
+                return 1;
+            }
+            ii = (integer_t)(col % osize[0]);
+            jj = (integer_t)(col / osize[0]);
+
+            vc = get_pixel(p->output_counts, ii, jj);
+            dow = (float)(m->weights[n] * w);
+
+            /* If we are creating or modifying the context image we
+               do so here */
+            if (p->output_context && dow > 0.0) {
+                set_bit(p->output_context, ii, jj, bv);
+            }
+
+            if (update_data(p, ii, jj, d, vc, dow)) {
+                return 1;
+            }
+        }
+    }
+
+    driz_log_message("ending dobox_overlaps");
+    return driz_error_is_set(p->error);
+}
+
+/** ---------------------------------------------------------------------------
+ * Merge rows [row_start, row_end) of a partial drizzle product (images
+ * drizzled onto a separate output) into the output images. Data are combined
+ * with the same weighted mean that update_data uses for single pixels and
+ * context bit fields are OR-ed.
+ *
+ * Context bit b of the partial product (bit b % 32 of plane b / 32) is
+ * stored as bit b + ctx_offset of the output context. Bits that would be
+ * stored past the last plane of the output context are dropped.
+ *
+ * out_data:    output science image
+ * out_counts:  output weight image
+ * out_context: output context, 2D or (planes, ny, nx), may be NULL
+ * data:        science image of the partial product
+ * counts:      weight image of the partial product
+ * context:     context of the partial product, 2D or (planes, ny, nx)
+ * ctx_offset:  non-negative offset added to context bit numbers
+ * row_start:   first row to merge
+ * row_end:     one past the last row to merge
+ */
+
+static inline_macro npy_int32 *
+context_ptr(PyArrayObject *context, integer_t plane, integer_t i,
+            integer_t j) {
+    if (PyArray_NDIM(context) == 2) {
+        return (npy_int32 *)PyArray_GETPTR2(context, j, i);
+    }
+    return (npy_int32 *)PyArray_GETPTR3(context, plane, j, i);
+}
+
+void
+merge_output_rows(PyArrayObject *out_data, PyArrayObject *out_counts,
+                  PyArrayObject *out_context, PyArrayObject *data,
+                  PyArrayObject *counts, PyArrayObject *context,
+                  integer_t ctx_offset, integer_t row_start,
+                  integer_t row_end) {
+    integer_t i, j, k, kk, nx, nplanes, out_nplanes;
+    npy_uint32 v;
+    float vc, dow;
+    int shift;
+
+    nx = PyArray_DIM(out_data, 1);
+
+    for (j = row_start; j < row_end; ++j) {
+        for (i = 0; i < nx; ++i) {
+            dow = get_pixel(counts, i, j);
+            if (dow == 0.0f) continue;
+
+            vc = get_pixel(out_counts, i, j);
+            if (vc == 0.0f) {
+                set_pixel(out_data, i, j, get_pixel(data, i, j));
+            } else {
+                set_pixel(out_data, i, j,
+                          (get_pixel(out_data, i, j) * vc +
+                           dow * get_pixel(data, i, j)) /
+                              ((double)vc + dow));
+            }
+            set_pixel(out_counts, i, j, (double)vc + dow);
+        }
+    }
+
+    if (!out_context || !context) return;
+
+    nplanes = (PyArray_NDIM(context) == 2) ? 1 : PyArray_DIM(context, 0);
+    out_nplanes =
+        (PyArray_NDIM(out_context) == 2) ? 1 : PyArray_DIM(out_context, 0);
+    shift = (int)(ctx_offset % 32);
+
+    for (k = 0; k < nplanes; ++k) {
+        kk = k + ctx_offset / 32;
+        if (kk >= out_nplanes) break;
+        for (j = row_start; j < row_end; ++j) {
+            for (i = 0; i < nx; ++i) {
+                v = (npy_uint32)*context_ptr(context, k, i, j);
+                if (!v) continue;
+                *context_ptr(out_context, kk, i, j) |= (npy_int32)(v << shift);
+                if (shift && kk + 1 < out_nplanes) {
+                    *context_ptr(out_context, kk + 1, i, j) |=
+                        (npy_int32)(v >> (32 - shift));
+                }
+            }
+        }
+    }
+}
@@ -19,10 +19,44 @@ In V1.6 this was simplified to use the DRIVAL routine and also to
 include some limited multi-kernel support.
 */
 
+/**
+Sparse matrix of the overlaps between input and output pixels, stored in
+compressed sparse row (CSR) format. Row k describes the input pixel with
+flat index k = j * nx + i: entries indptr[k] to indptr[k + 1] - 1 hold the
+flat indices (jj * onx + ii) of the output pixels it contributes to and the
+kernel weights of those contributions, that is, the factors by which the
+input pixel weight is multiplied before being added to the output weight.
+
+Entries are kept in the order the kernels visit the output pixels so that
+replaying the matrix reproduces the drizzled output.
+*/
+struct overlap_matrix_t {
+    npy_intp nrows;    /* number of input pixels */
+    npy_intp nnz;      /* number of stored overlaps */
+    npy_intp capacity; /* allocated length of indices and weights */
+    npy_intp row;      /* last row whose start has been recorded */
+    npy_intp *indptr;  /* row offsets, nrows + 1 elements */
+    npy_intp *indices; /* flat indices of the output pixels */
+    float *weights;    /* kernel weights of the overlaps */
+};
+
+int overlap_matrix_init(struct overlap_matrix_t *m, npy_intp nrows,
+                        struct driz_error_t *error);
+
+void overlap_matrix_free(struct overlap_matrix_t *m);
+
 integer_t compute_bit_value(integer_t uuid);
 
 int dobox(struct driz_param_t *p);
 
+int dobox_overlaps(struct driz_param_t *p);
+
+void merge_output_rows(PyArrayObject *out_data, PyArrayObject *out_counts,
+                       PyArrayObject *out_context, PyArrayObject *data,
+                       PyArrayObject *counts, PyArrayObject *context,
+                       integer_t ctx_offset, integer_t row_start,
+                       integer_t row_end);
+
 double compute_area(double is, double js, const double x[4], const double y[4]);
 
 double boxer(double is, double js, const double x[4], const double y[4]);
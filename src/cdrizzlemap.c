@@ -1,6 +1,7 @@
 #include <assert.h>
 #include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <Python.h>
 #ifndef NPY_NO_DEPRECATED_API
@@ -30,19 +31,22 @@ static const double MAX_INV_ERR = 0.03;
  * at least one valid pixel on every edge of the bounding box.
  *
  * @param[in] PyArrayObject *pixmap - pixel map of shape (N, M, 2).
- * @param[in,out] int xmin - position of the left edge of the bounding box.
- * @param[in,out] int xmax - position of the right edge of the bounding box.
- * @param[in,out] int ymin - position of the bottom edge of the bounding box.
- * @param[in,out] int ymax - position of the top edge of the bounding box.
+ * @param[in,out] integer_t xmin - position of the left edge of the bounding
+ *                box.
+ * @param[in,out] integer_t xmax - position of the right edge of the bounding
+ *                box.
+ * @param[in,out] integer_t ymin - position of the bottom edge of the bounding
+ *                box.
+ * @param[in,out] integer_t ymax - position of the top edge of the bounding
+ *                box.
  * @return 0 if successul and 1 if there is only one or no valid pixel map
  * values.
  *
  */
 int
-shrink_image_section(PyArrayObject *pixmap, int *xmin, int *xmax, int *ymin,
-                     int *ymax) {
-    int i, j, imin, imax, jmin, jmax, i1, i2, j1, j2;
-    double *pv;
+shrink_image_section(PyArrayObject *pixmap, integer_t *xmin, integer_t *xmax,
+                     integer_t *ymin, integer_t *ymax) {
+    integer_t i, j, imin, imax, jmin, jmax, i1, i2, j1, j2;
 
     j1 = *ymin;
     j2 = *ymax;
@@ -54,8 +58,8 @@ shrink_image_section(PyArrayObject *pixmap, int *xmin, int *xmax, int *ymin,
 
     for (j = j1; j <= j2; ++j) {
         for (i = i1; i <= i2; ++i) {
-            pv = (double *)PyArray_GETPTR3(pixmap, j, i, 0);
-            if (!(npy_isnan(pv[0]) || npy_isnan(pv[1]))) {
+            if (!(npy_isnan(get_pixmap_value(pixmap, i, j, 0)) ||
+                  npy_isnan(get_pixmap_value(pixmap, i, j, 1)))) {
                 if (i < imin) {
                     imin = i;
                 }
@@ -72,8 +76,8 @@ shrink_image_section(PyArrayObject *pixmap, int *xmin, int *xmax, int *ymin,
 
     for (j = j2; j >= j1; --j) {
         for (i = i2; i >= i1; --i) {
-            pv = (double *)PyArray_GETPTR3(pixmap, j, i, 0);
-            if (!(npy_isnan(pv[0]) || npy_isnan(pv[1]))) {
+            if (!(npy_isnan(get_pixmap_value(pixmap, i, j, 0)) ||
+                  npy_isnan(get_pixmap_value(pixmap, i, j, 1)))) {
                 if (i > imax) {
                     imax = i;
                 }
@@ -93,6 +97,267 @@ shrink_image_section(PyArrayObject *pixmap, int *xmin, int *xmax, int *ymin,
     return (imin >= imax || jmin >= jmax);
 }
 
+/** ---------------------------------------------------------------------------
+ * Find the tighest bounding box around valid pixmap values of a pixel map
+ * sampled every step pixels (see shrink_image_section). The section is
+ * shrunk on the grid of nodes that covers it and then converted back to
+ * input pixels.
+ *
+ * @param[in] PyArrayObject *pixmap - pixel map of shape (N, M, 2).
+ * @param[in] integer_t step - spacing of the pixel map nodes.
+ * @param[in,out] integer_t xmin, xmax, ymin, ymax - bounding box in input
+ *                pixels.
+ * @return 0 if successul and 1 if there is only one or no valid pixel map
+ * values.
+ *
+ */
+int
+shrink_pixmap_section(PyArrayObject *pixmap, integer_t step, integer_t *xmin,
+                      integer_t *xmax, integer_t *ymin, integer_t *ymax) {
+    integer_t i1, i2, j1, j2;
+
+    if (step <= 1) {
+        return shrink_image_section(pixmap, xmin, xmax, ymin, ymax);
+    }
+
+    i1 = *xmin / step;
+    i2 = MIN((*xmax + step - 1) / step, PyArray_DIM(pixmap, 1) - 1);
+    j1 = *ymin / step;
+    j2 = MIN((*ymax + step - 1) / step, PyArray_DIM(pixmap, 0) - 1);
+
+    if (shrink_image_section(pixmap, &i1, &i2, &j1, &j2)) return 1;
+
+    *xmin = MAX(*xmin, i1 * step);
+    *xmax = MIN(*xmax, i2 * step);
+    *ymin = MAX(*ymin, j1 * step);
+    *ymax = MIN(*ymax, j2 * step);
+
+    return 0;
+}
+
+/** ---------------------------------------------------------------------------
+ * Coarse pixel maps.
+ *
+ * Geometric distortions are usually smooth on scales of tens of pixels, so
+ * that the pixel map may be sampled every few pixels. Between the nodes,
+ * the map is interpolated with Catmull-Rom (Keys, a = -0.5) bicubic
+ * convolution. Beyond the first and last nodes, the nodes are extended by
+ * quadratic extrapolation, c[-1] = 3 c[0] - 3 c[1] + c[2] (Keys, 1981),
+ * which keeps the interpolation third-order accurate up to the edges of
+ * the image.
+ */
+
+/* Catmull-Rom weights of the nodes at -1, 0, 1 and 2 for a point at t */
+static inline void
+cubic_weights(double t, double w[4]) {
+    double t2 = t * t;
+    double t3 = t2 * t;
+
+    w[0] = 0.5 * (-t3 + 2.0 * t2 - t);
+    w[1] = 0.5 * (3.0 * t3 - 5.0 * t2 + 2.0);
+    w[2] = 0.5 * (-3.0 * t3 + 4.0 * t2 + t);
+    w[3] = 0.5 * (t3 - t2);
+}
+
+/* Allocate the interpolation state of a coarse pixel map */
+struct coarse_pixmap_t *
+coarse_pixmap_new(PyArrayObject *pixmap, integer_t step,
+                  struct driz_error_t *error) {
+    struct coarse_pixmap_t *c;
+    integer_t k, nrow, nweights;
+
+    c = (struct coarse_pixmap_t *)malloc(sizeof(struct coarse_pixmap_t));
+    if (c == NULL) {
+        driz_error_set_message(error, "Out of memory");
+        return NULL;
+    }
+
+    c->step = step;
+    c->nx = PyArray_DIM(pixmap, 1);
+    c->ny = PyArray_DIM(pixmap, 0);
+    c->ncomp = MIN(PyArray_DIM(pixmap, 2), 3);
+    c->next = 0;
+    c->last = 0;
+
+    nrow = (c->nx + 2) * c->ncomp;
+    nweights = 4 * 2 * step;
+    c->rows[0] = (double *)malloc((COARSE_PIXMAP_ROWS * nrow + nweights) *
+                                  sizeof(double));
+    if (c->rows[0] == NULL) {
+        free(c);
+        driz_error_set_message(error, "Out of memory");
+        return NULL;
+    }
+    for (k = 0; k < COARSE_PIXMAP_ROWS; ++k) {
+        c->rows[k] = c->rows[0] + k * nrow;
+        c->y[k] = NPY_NAN;
+    }
+
+    /* the kernels interpolate at pixel centers and edges: precompute the
+       weights at the 2 * step half-pixel offsets from a node */
+    c->weights = c->rows[0] + COARSE_PIXMAP_ROWS * nrow;
+    for (k = 0; k < 2 * step; ++k) {
+        cubic_weights((double)k / (double)(2 * step), c->weights + 4 * k);
+    }
+
+    return c;
+}
+
+void
+coarse_pixmap_free(struct coarse_pixmap_t *c) {
+    if (c) {
+        free(c->rows[0]);
+        free(c);
+    }
+}
+
+/* Whether a pixel map sampled every step pixels covers an image of the
+   given size (x, y) with at least two nodes along each axis */
+int
+coarse_pixmap_covers(PyArrayObject *pixmap, integer_t step,
+                     const integer_t size[2]) {
+    integer_t nx = PyArray_DIM(pixmap, 1);
+    integer_t ny = PyArray_DIM(pixmap, 0);
+
+    return (step >= 1 && nx >= 2 && ny >= 2 && (nx - 1) * step >= size[0] - 1 &&
+            (ny - 1) * step >= size[1] - 1);
+}
+
+/* Node (i, j) of component k of a pixel map with nx nodes along x,
+   extrapolated for i = -1 and i = nx */
+static inline double
+coarse_node_x(PyArrayObject *pixmap, integer_t nx, integer_t i, integer_t j,
+              integer_t k) {
+    integer_t d;
+
+    if (i >= 0 && i < nx) return get_pixmap_value(pixmap, i, j, k);
+
+    /* ghost node: extrapolate from the nodes at the edge */
+    d = (i < 0) ? 1 : -1;
+    i = (i < 0) ? 0 : nx - 1;
+    if (nx < 3) {
+        return 2.0 * get_pixmap_value(pixmap, i, j, k) -
+               get_pixmap_value(pixmap, i + d, j, k);
+    }
+    return 3.0 * (get_pixmap_value(pixmap, i, j, k) -
+                  get_pixmap_value(pixmap, i + d, j, k)) +
+           get_pixmap_value(pixmap, i + 2 * d, j, k);
+}
+
+/* Node (i, j) of component k, extrapolated along both axes */
+static double
+coarse_node(PyArrayObject *pixmap, const struct coarse_pixmap_t *c,
+            integer_t i, integer_t j, integer_t k) {
+    integer_t d;
+
+    if (j >= 0 && j < c->ny) return coarse_node_x(pixmap, c->nx, i, j, k);
+
+    d = (j < 0) ? 1 : -1;
+    j = (j < 0) ? 0 : c->ny - 1;
+    if (c->ny < 3) {
+        return 2.0 * coarse_node_x(pixmap, c->nx, i, j, k) -
+               coarse_node_x(pixmap, c->nx, i, j + d, k);
+    }
+    return 3.0 * (coarse_node_x(pixmap, c->nx, i, j, k) -
+                  coarse_node_x(pixmap, c->nx, i, j + d, k)) +
+           coarse_node_x(pixmap, c->nx, i, j + 2 * d, k);
+}
+
+/* Index of the node at or below coordinate u (in nodes) such that the four
+   nodes used by the interpolation are in -1...n, and offset from it */
+static inline integer_t
+coarse_interval(double u, integer_t n, double *t) {
+    integer_t i0 = (integer_t)floor(u);
+
+    if (i0 < 0) {
+        i0 = 0;
+    } else if (i0 > n - 2) {
+        i0 = n - 2;
+    }
+    *t = u - (double)i0;
+
+    return i0;
+}
+
+/* Nodes of all columns, interpolated along y at input coordinate yin: the
+   value of component k of column i (-1...nx) is at [(i + 1) * ncomp + k] */
+static const double *
+coarse_pixmap_row(PyArrayObject *pixmap, struct coarse_pixmap_t *c,
+                  double yin) {
+    integer_t i, j0, k, m, r;
+    double t, w[4], *row;
+
+    if (c->y[c->last] == yin) return c->rows[c->last];
+    for (r = 0; r < COARSE_PIXMAP_ROWS; ++r) {
+        if (c->y[r] == yin) {
+            c->last = r;
+            return c->rows[r];
+        }
+    }
+
+    r = c->next;
+    c->next = (r + 1) % COARSE_PIXMAP_ROWS;
+    c->last = r;
+    c->y[r] = yin;
+    row = c->rows[r];
+
+    j0 = coarse_interval(yin / (double)c->step, c->ny, &t);
+    cubic_weights(t, w);
+
+    for (i = -1; i <= c->nx; ++i) {
+        for (k = 0; k < c->ncomp; ++k) {
+            row[(i + 1) * c->ncomp + k] = 0.0;
+            for (m = 0; m < 4; ++m) {
+                row[(i + 1) * c->ncomp + k] +=
+                    w[m] * coarse_node(pixmap, c, i, j0 - 1 + m, k);
+            }
+        }
+    }
+
+    return row;
+}
+
+/* Apply the affine correction of the pixel map, if any, to output (x, y) */
+static inline void
+apply_pixmap_affine(const struct driz_param_t *par, double *x, double *y) {
+    const double(*a)[3] = par->pixmap_affine;
+    double x0 = *x;
+
+    if (!a) return;
+    *x = a[0][0] * x0 + a[0][1] * *y + a[0][2];
+    *y = a[1][0] * x0 + a[1][1] * *y + a[1][2];
+}
+
+/* Interpolate all components of a coarse pixel map at input (xin, yin) */
+static void
+coarse_pixmap_value(struct driz_param_t *par, double xin, double yin,
+                    double value[3]) {
+    struct coarse_pixmap_t *c = par->coarse_pixmap;
+    const double *row = coarse_pixmap_row(par->pixmap, c, yin);
+    const double *w;
+    integer_t h, i0, k, m;
+    double t, wt[4];
+
+    h = (integer_t)(2.0 * xin);
+    if ((double)h == 2.0 * xin && h >= 0 && h < 2 * c->step * (c->nx - 1)) {
+        i0 = h / (2 * c->step);
+        w = c->weights + 4 * (h - 2 * c->step * i0);
+    } else {
+        i0 = coarse_interval(xin / (double)c->step, c->nx, &t);
+        cubic_weights(t, wt);
+        w = wt;
+    }
+
+    /* nodes i0 - 1 ... i0 + 2 start at (i0 + m) * ncomp in the row */
+    row += i0 * c->ncomp;
+    for (k = 0; k < c->ncomp; ++k) {
+        value[k] = 0.0;
+        for (m = 0; m < 4; ++m) {
+            value[k] += w[m] * row[m * c->ncomp + k];
+        }
+    }
+}
+
 /** ---------------------------------------------------------------------------
  * Map a point on the input image to the output image using
  * a mapping of the pixel centers between the two by interpolating
@@ -105,23 +370,31 @@ shrink_image_section(PyArrayObject *pixmap, int *xmin, int *xmax, int *ymin,
 int
 interpolate_point(struct driz_param_t *par, double xin, double yin,
                   double *xout, double *yout) {
-    int i0, j0, nx2, ny2;
+    integer_t i0, j0, nx2, ny2;
     npy_intp *ndim;
     double x, y, x1, y1, f00, f01, f10, f11, g00, g01, g10, g11;
-    double *p;
+    double v[3];
     PyArrayObject *pixmap;
 
+    if (par->coarse_pixmap) {
+        coarse_pixmap_value(par, xin, yin, v);
+        *xout = v[0];
+        *yout = v[1];
+        apply_pixmap_affine(par, xout, yout);
+        return (npy_isnan(*xout) || npy_isnan(*yout)) ? 1 : 0;
+    }
+
     pixmap = par->pixmap;
 
     /* Bilinear interpolation from
        https://en.wikipedia.org/wiki/Bilinear_interpolation#On_the_unit_square
     */
-    i0 = (int)xin;
-    j0 = (int)yin;
+    i0 = (integer_t)xin;
+    j0 = (integer_t)yin;
 
     ndim = PyArray_DIMS(pixmap);
-    nx2 = (int)ndim[1] - 2;
-    ny2 = (int)ndim[0] - 2;
+    nx2 = ndim[1] - 2;
+    ny2 = ndim[0] - 2;
 
     // point is outside the interpolation range. adjust limits to extrapolate.
     if (i0 < 0) {
@@ -140,35 +413,87 @@ interpolate_point(struct driz_param_t *par, double xin, double yin,
     x1 = 1.0 - x;
     y1 = 1.0 - y;
 
-    p = get_pixmap(pixmap, i0, j0);
-    f00 = p[0];
-    g00 = p[1];
+    f00 = get_pixmap_value(pixmap, i0, j0, 0);
+    g00 = get_pixmap_value(pixmap, i0, j0, 1);
 
-    p = get_pixmap(pixmap, i0 + 1, j0);
-    f10 = p[0];
-    g10 = p[1];
+    f10 = get_pixmap_value(pixmap, i0 + 1, j0, 0);
+    g10 = get_pixmap_value(pixmap, i0 + 1, j0, 1);
 
-    p = get_pixmap(pixmap, i0, j0 + 1);
-    f01 = p[0];
-    g01 = p[1];
+    f01 = get_pixmap_value(pixmap, i0, j0 + 1, 0);
+    g01 = get_pixmap_value(pixmap, i0, j0 + 1, 1);
 
-    p = get_pixmap(pixmap, i0 + 1, j0 + 1);
-    f11 = p[0];
-    g11 = p[1];
+    f11 = get_pixmap_value(pixmap, i0 + 1, j0 + 1, 0);
+    g11 = get_pixmap_value(pixmap, i0 + 1, j0 + 1, 1);
 
     *xout = f00 * x1 * y1 + f10 * x * y1 + f01 * x1 * y + f11 * x * y;
     *yout = g00 * x1 * y1 + g10 * x * y1 + g01 * x1 * y + g11 * x * y;
+    apply_pixmap_affine(par, xout, yout);
 
     if (npy_isnan(*xout) || npy_isnan(*yout)) return 1;
 
     return 0;
 }
 
+/** ---------------------------------------------------------------------------
+ * Interpolate the spectral (third) component of a pixel map of shape
+ * (ny, nx, 3) at a point on the input image. Uses the same bilinear
+ * interpolation and extrapolation rules as interpolate_point.
+ *
+ * par:  structure containing the pixel map
+ * xin:  x coordinate of the point on the input image
+ * yin:  y coordinate of the point on the input image
+ * lout: spectral coordinate (output cube plane) of the point (output)
+ */
+int
+interpolate_lambda(struct driz_param_t *par, double xin, double yin,
+                   double *lout) {
+    integer_t i0, j0, nx2, ny2;
+    npy_intp *ndim;
+    double x, y, v[3];
+    PyArrayObject *pixmap;
+
+    if (par->coarse_pixmap) {
+        coarse_pixmap_value(par, xin, yin, v);
+        *lout = v[2];
+        return npy_isnan(*lout) ? 1 : 0;
+    }
+
+    pixmap = par->pixmap;
+
+    i0 = (integer_t)xin;
+    j0 = (integer_t)yin;
+
+    ndim = PyArray_DIMS(pixmap);
+    nx2 = ndim[1] - 2;
+    ny2 = ndim[0] - 2;
+
+    if (i0 < 0) {
+        i0 = 0;
+    } else if (i0 > nx2) {
+        i0 = nx2;
+    }
+    if (j0 < 0) {
+        j0 = 0;
+    } else if (j0 > ny2) {
+        j0 = ny2;
+    }
+
+    x = xin - i0;
+    y = yin - j0;
+
+    *lout = get_pixmap_value(pixmap, i0, j0, 2) * (1.0 - x) * (1.0 - y) +
+            get_pixmap_value(pixmap, i0 + 1, j0, 2) * x * (1.0 - y) +
+            get_pixmap_value(pixmap, i0, j0 + 1, 2) * (1.0 - x) * y +
+            get_pixmap_value(pixmap, i0 + 1, j0 + 1, 2) * x * y;
+
+    return npy_isnan(*lout) ? 1 : 0;
+}
+
 /** ---------------------------------------------------------------------------
  * Map an integer pixel position from the input to the output image.
  * Fall back on interpolation if the value at the point is undefined
  *
- * pixmap: The mapping of the pixel centers from input to output image
+ * par - structure containing the pixel map
  * i - The index of the x coordinate
  * j - The index of the y coordinate
  * x - X-coordinate of the point on the output image (output)
@@ -176,10 +501,19 @@ interpolate_point(struct driz_param_t *par, double xin, double yin,
  */
 
 int
-map_pixel(PyArrayObject *pixmap, int i, int j, double *x, double *y) {
-    double *pv = (double *)PyArray_GETPTR3(pixmap, j, i, 0);
-    *x = *pv;
-    *y = *(pv + 1);
+map_pixel(struct driz_param_t *par, integer_t i, integer_t j, double *x,
+          double *y) {
+    double v[3];
+
+    if (par->coarse_pixmap) {
+        coarse_pixmap_value(par, (double)i, (double)j, v);
+        *x = v[0];
+        *y = v[1];
+    } else {
+        *x = get_pixmap_value(par->pixmap, i, j, 0);
+        *y = get_pixmap_value(par->pixmap, i, j, 1);
+    }
+    apply_pixmap_affine(par, x, y);
     return ((npy_isnan(*x) || npy_isnan(*y)) ? 1 : 0);
 }
 
@@ -190,29 +524,36 @@ map_pixel(PyArrayObject *pixmap, int i, int j, double *x, double *y) {
  * pixmap: The mapping of the pixel centers from input to output image
  * xin:   X-coordinate of a point on the input image
  * yin:   Y-coordinate of a point on the input image
- * xout:  X-coordinate of the same point on the output image (output)
- * yout:  Y-coordinate of the same point on the output image (output)
+ * xout:  X-coordinate of the same point on the output image, relative to
+ *        the output origin (output)
+ * yout:  Y-coordinate of the same point on the output image, relative to
+ *        the output origin (output)
  *
  */
 int
 map_point(struct driz_param_t *par, double xin, double yin, double *xout,
           double *yout) {
-    int i, j, status;
+    integer_t i, j;
+    int status;
 
-    i = (int)xin;
-    j = (int)yin;
+    i = (integer_t)xin;
+    j = (integer_t)yin;
 
     if ((double)i == xin && (double)j == yin) {
         if (i >= par->xmin && i <= par->xmax && j >= par->ymin &&
             j <= par->ymax) {
-            status = map_pixel(par->pixmap, i, j, xout, yout);
-            return status;
+            status = map_pixel(par, i, j, xout, yout);
         } else {
             return 1;
         }
     } else {
-        return interpolate_point(par, xin, yin, xout, yout);
+        status = interpolate_point(par, xin, yin, xout, yout);
     }
+
+    *xout -= par->out_x0;
+    *yout -= par->out_y0;
+
+    return status;
 }
 
 /** ---------------------------------------------------------------------------
@@ -243,8 +584,8 @@ eval_inversion(struct driz_param_t *par, double x, double y, double xref,
     if (interpolate_point(par, x, y, &xout, &yout)) {
         return 1;
     }
-    dx = xout - xref;
-    dy = yout - yref;
+    dx = xout - par->out_x0 - xref;
+    dy = yout - par->out_y0 - yref;
     *dist2 = dx * dx + dy * dy;  // sqrt would be slower
 
     return 0;
@@ -619,6 +960,7 @@ init_scanner(struct polygon *p, struct driz_param_t *par, struct scanner *s) {
     s->right = NULL;
     s->nleft = 0;
     s->nright = 0;
+    s->row_spans = NULL;
 
     if (p->npv < 3) {
         // not a polygon
@@ -704,6 +1046,7 @@ init_scanner(struct polygon *p, struct driz_param_t *par, struct scanner *s) {
     s->xmax = par->xmax;
     s->ymin = par->ymin;
     s->ymax = par->ymax;
+    s->row_spans = par->row_spans;
 
     return 0;
 }
@@ -721,9 +1064,9 @@ init_scanner(struct polygon *p, struct driz_param_t *par, struct scanner *s) {
  *
  * @param[in] struct scanner *s - scanner structure
  * @param[in] y - integer position of the row along the vertical direction
- * @param[out] int *x1 - horizontal position of the leftmost pixel within
+ * @param[out] integer_t *x1 - horizontal position of the leftmost pixel within
  *             the bounding polygon
- * @param[out] int *x2 - horizontal position of the rightmost pixel within
+ * @param[out] integer_t *x2 - horizontal position of the rightmost pixel within
  *             the bounding polygon
  * @return 0 no errors;
  *         1 scan ended (y reached the top vertex/edge);
@@ -733,7 +1076,8 @@ init_scanner(struct polygon *p, struct driz_param_t *par, struct scanner *s) {
  *
  */
 int
-get_scanline_limits(struct scanner *s, int y, int *x1, int *x2) {
+get_scanline_limits(struct scanner *s, integer_t y, integer_t *x1,
+                    integer_t *x2) {
     double pyb, pyt;  // pixel top and bottom limits
     double xlb, xlt, xrb, xrt, edge_ymax, xmin, xmax;
     struct edge *el_max, *er_max;
@@ -820,17 +1164,26 @@ get_scanline_limits(struct scanner *s, int y, int *x1, int *x2) {
     }
 
     if (xlt >= xrt) {
-        *x1 = (int)round(xlb);
-        *x2 = (int)round(xrb);
+        *x1 = (integer_t)round(xlb);
+        *x2 = (integer_t)round(xrb);
         if (xlb >= xrb) {
             return 3;
         }
     } else if (xlb >= xrb) {
-        *x1 = (int)round(xlt);
-        *x2 = (int)round(xrt);
+        *x1 = (integer_t)round(xlt);
+        *x2 = (integer_t)round(xrt);
     } else {
-        *x1 = (int)round((xlb > xlt) ? xlb : xlt);
-        *x2 = (int)round((xrb < xrt) ? xrb : xrt);
+        *x1 = (integer_t)round((xlb > xlt) ? xlb : xlt);
+        *x2 = (integer_t)round((xrb < xrt) ? xrb : xrt);
+    }
+
+    // skip pixels with invalid (NaN) pixel map at the ends of the row; an
+    // empty range is returned as x2 = x1 - 1 so that the kernels still
+    // count its pixels as missed (and not the row as skipped):
+    if (s->row_spans) {
+        if (*x1 < s->row_spans[y][0]) *x1 = s->row_spans[y][0];
+        if (*x2 > s->row_spans[y][1]) *x2 = s->row_spans[y][1];
+        if (*x2 < *x1) *x2 = *x1 - 1;
     }
 
     return 0;
@@ -882,6 +1235,60 @@ map_vertex_to_input(struct driz_param_t *par, struct vertex vout,
     return 0;
 }
 
+/**
+ * Compute the padding, in output pixels, of the output window used to select
+ * input pixels.
+ *
+ * Input pixels whose centers map just outside a tile of a mosaic still
+ * contribute flux to its edge pixels, and the scanner keeps only the input
+ * pixels that are entirely inside the bounding polygon. The window of a tile
+ * is therefore padded by the extent of the kernel and by the size of one
+ * input pixel (and then clipped to the mosaic) so that the tile receives the
+ * same contributions as the corresponding region of the mosaic.
+ *
+ * @param[in] struct driz_param_t - drizzle parameters (kernel is used).
+ * @param[in] struct polygon *pin - input image bounding polygon.
+ * @param[in] struct polygon *pout - pin mapped to the output frame.
+ * @return margin in output pixels.
+ *
+ */
+static double
+output_window_margin(struct driz_param_t *par, const struct polygon *pin,
+                     const struct polygon *pout) {
+    double ain = 0.0, aout = 0.0, jac, pfo;
+    int k;
+
+    // average linear magnification of the input image:
+    for (k = 0; k < pin->npv; ++k) {
+        ain += area(pin->v[k], pin->v[(k + 1) % pin->npv]);
+        aout += area(pout->v[k], pout->v[(k + 1) % pout->npv]);
+    }
+    jac = (ain == 0.0) ? 1.0 : sqrt(fabs(aout / ain));
+
+    // half-width of the kernel footprint, as used by the kernels:
+    switch (par->kernel) {
+    case kernel_square:
+        pfo = 0.5 * par->pixel_fraction * jac;
+        break;
+    case kernel_turbo:
+        pfo = 0.5 * par->pixel_fraction / par->scale;
+        break;
+    case kernel_gaussian:
+        pfo = MAX(2.5 * par->pixel_fraction / 2.3548, 1.2) / par->scale;
+        break;
+    case kernel_lanczos2:
+        pfo = 2.0 * par->pixel_fraction / par->scale;
+        break;
+    case kernel_lanczos3:
+        pfo = 3.0 * par->pixel_fraction / par->scale;
+        break;
+    default:
+        pfo = 0.0;
+    }
+
+    return 0.5 + pfo + jac + MAX_INV_ERR;
+}
+
 /**
  * Set-up image scanner.
  *
@@ -895,19 +1302,31 @@ map_vertex_to_input(struct driz_param_t *par, struct vertex vout,
  *
  * @param[in] struct driz_param_t - drizzle parameters (bounding box is used).
  * @param[out] struct scanner *s - computed from the intersection of polygons.
- * @param[out] int *ymin - minimum y of a row in input image with pixels inside
- *                 the intersection polygon
- * @param[out] int *ymax - maximum y of a row in input image with pixels inside
- *                 the intersection polygon
+ * @param[out] integer_t *ymin - minimum y of a row in input image with pixels
+ *                 inside the intersection polygon
+ * @param[out] integer_t *ymax - maximum y of a row in input image with pixels
+ *                 inside the intersection polygon
  * @return see init_scanner for return values.
  *
  */
 int
-init_image_scanner(struct driz_param_t *par, struct scanner *s, int *ymin,
-                   int *ymax) {
+init_image_scanner(struct driz_param_t *par, struct scanner *s,
+                   integer_t *ymin, integer_t *ymax) {
     struct polygon p, q, pq, inpq;
     int k, n;
     npy_intp *ndim;
+    double margin, wx0, wy0, wx1, wy1;
+
+    // reuse a scanner computed beforehand; its current edges are the first
+    // ones and must point into the copy:
+    if (par->image_scanner) {
+        *s = par->image_scanner->s;
+        if (s->left) s->left = s->left_edges;
+        if (s->right) s->right = s->right_edges;
+        *ymin = par->image_scanner->ymin;
+        *ymax = par->image_scanner->ymax;
+        return par->image_scanner->status;
+    }
 
     // define a polygon bounding the input image:
     inpq.npv = 4;
@@ -934,17 +1353,42 @@ init_image_scanner(struct driz_param_t *par, struct scanner *s, int *ymin,
     }
     p.npv = inpq.npv;
 
-    // define a polygon bounding the output image:
-    ndim = PyArray_DIMS(par->output_data);
+    // define a polygon bounding the output image (the last two axes of the
+    // output array, which may be a spectral cube):
+    ndim = PyArray_DIMS(par->output_data) + PyArray_NDIM(par->output_data) - 2;
+    wx0 = -0.5;
+    wy0 = -0.5;
+    wx1 = (double)ndim[1] - 0.5;
+    wy1 = (double)ndim[0] - 0.5;
+
+    // a tile of a mosaic is padded by the extent of the kernel so that
+    // pixels straddling its edges are not skipped, but only within the
+    // mosaic:
+    if (par->mosaic[2] > 0 && par->mosaic[3] > 0) {
+        margin = output_window_margin(par, &inpq, &p);
+        wx0 = MAX(-margin, (double)(par->mosaic[0] - par->out_x0) - 0.5);
+        wy0 = MAX(-margin, (double)(par->mosaic[1] - par->out_y0) - 0.5);
+        wx1 = MIN((double)ndim[1] - 1.0 + margin,
+                  (double)(par->mosaic[0] + par->mosaic[2] - par->out_x0) -
+                      0.5);
+        wy1 = MIN((double)ndim[0] - 1.0 + margin,
+                  (double)(par->mosaic[1] + par->mosaic[3] - par->out_y0) -
+                      0.5);
+        if (wx1 <= wx0 || wy1 <= wy0) {
+            s->overlap_valid = 0;
+            goto _setup_scanner;
+        }
+    }
+
     q.npv = 4;
-    q.v[0].x = -0.5;
-    q.v[0].y = -0.5;
-    q.v[1].x = (double)ndim[1] - 0.5;
-    q.v[1].y = -0.5;
-    q.v[2].x = (double)ndim[1] - 0.5;
-    q.v[2].y = (double)ndim[0] - 0.5;
-    q.v[3].x = -0.5;
-    q.v[3].y = (double)ndim[0] - 0.5;
+    q.v[0].x = wx0;
+    q.v[0].y = wy0;
+    q.v[1].x = wx1;
+    q.v[1].y = wy0;
+    q.v[2].x = wx1;
+    q.v[2].y = wy1;
+    q.v[3].x = wx0;
+    q.v[3].y = wy1;
 
     // compute intersection of P and Q (in the output frame):
     if (clip_polygon_to_window(&p, &q, &pq)) {
@@ -970,7 +1414,214 @@ _setup_scanner:
     // initialize polygon scanner:
     driz_error_unset(par->error);
     n = init_scanner(&inpq, par, s);
-    *ymin = MAX(0, (int)(s->min_y + 0.5 + 2.0 * MAX_INV_ERR));
-    *ymax = MIN(s->ymax, (int)(s->max_y + 2.0 * MAX_INV_ERR));
+    *ymin = MAX(0, (integer_t)(s->min_y + 0.5 + 2.0 * MAX_INV_ERR));
+    *ymax = MIN(s->ymax, (integer_t)(s->max_y + 2.0 * MAX_INV_ERR));
     return n;
 }
+
+/**
+ * Area of a polygon.
+ *
+ * @param[in] struct polygon *p - polygon (last vertex != first).
+ * @return area of the polygon; 0 for polygons with fewer than 3 vertices.
+ *
+ */
+double
+polygon_area(const struct polygon *p) {
+    double a = 0.0;
+    int k;
+
+    if (p->npv < 3) return 0.0;
+
+    for (k = 0; k < p->npv; ++k) {
+        a += area(p->v[k], p->v[(k + 1) % p->npv]);
+    }
+    return 0.5 * fabs(a);
+}
+
+/**
+ * Area of the intersection of a footprint with a tile of the output grid.
+ *
+ * Tile (ix, iy) covers output pixels ix * tx to (ix + 1) * tx - 1 along X
+ * (and similarly along Y), truncated at the edges of the output grid.
+ */
+static double
+footprint_tile_area(const struct polygon *fp,
+                    const struct footprint_index_t *idx, integer_t ix,
+                    integer_t iy) {
+    struct polygon wnd, cp;
+    double x1, y1, x2, y2;
+
+    x1 = (double)(ix * idx->tx) - 0.5;
+    y1 = (double)(iy * idx->ty) - 0.5;
+    x2 = (double)MIN((ix + 1) * idx->tx, idx->nx) - 0.5;
+    y2 = (double)MIN((iy + 1) * idx->ty, idx->ny) - 0.5;
+
+    wnd.npv = 4;
+    wnd.v[0].x = x1;
+    wnd.v[0].y = y1;
+    wnd.v[1].x = x2;
+    wnd.v[1].y = y1;
+    wnd.v[2].x = x2;
+    wnd.v[2].y = y2;
+    wnd.v[3].x = x1;
+    wnd.v[3].y = y2;
+
+    if (clip_polygon_to_window(fp, &wnd, &cp)) return 0.0;
+    return polygon_area(&cp);
+}
+
+/**
+ * Tile bounding box of a footprint.
+ *
+ * @return 0 if the footprint may overlap the output grid and 1 otherwise
+ * (including footprints with non-finite vertices).
+ */
+static int
+footprint_tile_range(const struct polygon *fp,
+                     const struct footprint_index_t *idx, integer_t *ix1,
+                     integer_t *ix2, integer_t *iy1, integer_t *iy2) {
+    double xmin, xmax, ymin, ymax;
+    int k;
+
+    xmin = xmax = fp->v[0].x;
+    ymin = ymax = fp->v[0].y;
+    for (k = 0; k < fp->npv; ++k) {
+        if (!npy_isfinite(fp->v[k].x) || !npy_isfinite(fp->v[k].y)) {
+            return 1;
+        }
+        xmin = MIN(xmin, fp->v[k].x);
+        xmax = MAX(xmax, fp->v[k].x);
+        ymin = MIN(ymin, fp->v[k].y);
+        ymax = MAX(ymax, fp->v[k].y);
+    }
+
+    if (xmax < -0.5 || ymax < -0.5 || xmin > (double)idx->nx - 0.5 ||
+        ymin > (double)idx->ny - 0.5) {
+        return 1;
+    }
+
+    *ix1 = (integer_t)floor((MAX(xmin, -0.5) + 0.5) / (double)idx->tx);
+    *ix2 = (integer_t)floor((MIN(xmax, (double)idx->nx - 0.5) + 0.5) /
+                            (double)idx->tx);
+    *iy1 = (integer_t)floor((MAX(ymin, -0.5) + 0.5) / (double)idx->ty);
+    *iy2 = (integer_t)floor((MIN(ymax, (double)idx->ny - 0.5) + 0.5) /
+                            (double)idx->ty);
+    *ix2 = MIN(*ix2, idx->ntx - 1);
+    *iy2 = MIN(*iy2, idx->nty - 1);
+    return 0;
+}
+
+/**
+ * Build the footprint index.
+ *
+ * Footprints are binned into the tiles covered by their bounding boxes and
+ * clipped to each of these tiles to find the area of the overlap. This
+ * costs O(number of footprint-tile overlaps) instead of O(footprints x
+ * tiles). Footprints are processed twice, once to count the overlaps of
+ * each tile and once to fill the index, so that no temporary storage is
+ * needed.
+ *
+ * @param[out] struct footprint_index_t *idx - index to be initialized.
+ * @param[in] const double *vertices - coordinates (x, y) of the vertices of
+ *            all footprints, npv vertices per footprint.
+ * @param[in] nfp - number of footprints.
+ * @param[in] npv - number of vertices of each footprint (3 or 4).
+ * @param[in] nx, ny - shape of the output grid.
+ * @param[in] tx, ty - shape of the tiles.
+ * @param[out] struct driz_error_t *error - error structure.
+ * @return 0 on success and 1 on error.
+ *
+ */
+int
+footprint_index_init(struct footprint_index_t *idx, const double *vertices,
+                     integer_t nfp, int npv, integer_t nx, integer_t ny,
+                     integer_t tx, integer_t ty, struct driz_error_t *error) {
+    struct polygon fp;
+    integer_t n, ix, iy, ix1, ix2, iy1, iy2, ntiles, tile, *pos = NULL;
+    double a;
+    int k, pass;
+
+    memset(idx, 0, sizeof(*idx));
+
+    if (npv < 3 || npv > IMAGE_OUTLINE_NPTS) {
+        driz_error_set_message(error, "Footprints must have 3 or 4 vertices");
+        return 1;
+    }
+    if (nx <= 0 || ny <= 0 || tx <= 0 || ty <= 0) {
+        driz_error_set_message(error,
+                               "Output and tile shapes must be positive");
+        return 1;
+    }
+
+    idx->nx = nx;
+    idx->ny = ny;
+    idx->tx = tx;
+    idx->ty = ty;
+    idx->ntx = (nx + tx - 1) / tx;
+    idx->nty = (ny + ty - 1) / ty;
+    ntiles = idx->ntx * idx->nty;
+
+    idx->indptr = (integer_t *)calloc(ntiles + 1, sizeof(integer_t));
+    pos = (integer_t *)malloc(ntiles * sizeof(integer_t));
+    if (!idx->indptr || !pos) goto _oom;
+
+    fp.npv = npv;
+    for (pass = 0; pass < 2; ++pass) {
+        if (pass == 1) {
+            for (tile = 0; tile < ntiles; ++tile) {
+                pos[tile] = idx->indptr[tile];
+                idx->indptr[tile + 1] += idx->indptr[tile];
+            }
+            idx->nnz = idx->indptr[ntiles];
+            /* at least one element so that a NULL pointer means failure */
+            idx->footprints =
+                (integer_t *)malloc(MAX(idx->nnz, 1) * sizeof(integer_t));
+            idx->areas = (double *)malloc(MAX(idx->nnz, 1) * sizeof(double));
+            if (!idx->footprints || !idx->areas) goto _oom;
+        }
+
+        for (n = 0; n < nfp; ++n) {
+            for (k = 0; k < npv; ++k) {
+                fp.v[k].x = vertices[2 * (n * npv + k)];
+                fp.v[k].y = vertices[2 * (n * npv + k) + 1];
+            }
+            if (footprint_tile_range(&fp, idx, &ix1, &ix2, &iy1, &iy2)) {
+                continue;
+            }
+            for (iy = iy1; iy <= iy2; ++iy) {
+                for (ix = ix1; ix <= ix2; ++ix) {
+                    a = footprint_tile_area(&fp, idx, ix, iy);
+                    if (a <= 0.0) continue;
+                    tile = iy * idx->ntx + ix;
+                    if (pass == 0) {
+                        /* counts are shifted by one for the prefix sum */
+                        ++idx->indptr[tile + 1];
+                    } else {
+                        idx->footprints[pos[tile]] = n;
+                        idx->areas[pos[tile]++] = a;
+                    }
+                }
+            }
+        }
+    }
+
+    free(pos);
+    return 0;
+
+_oom:
+    free(pos);
+    footprint_index_free(idx);
+    driz_error_set_message(error, "Out of memory");
+    return 1;
+}
+
+void
+footprint_index_free(struct footprint_index_t *idx) {
+    free(idx->indptr);
+    free(idx->footprints);
+    free(idx->areas);
+    idx->indptr = NULL;
+    idx->footprints = NULL;
+    idx->areas = NULL;
+}
@@ -79,13 +79,13 @@ struct scanner {
     int nright;         /**< number of right edges */
     double min_y;       /**< minimum y-coordinate of all polygon vertices */
     double max_y;       /**< maximum y-coordinate of all polygon vertices */
-    int xmin; /**< min valid pixels' x-coord in pixmap (from bounding box
+    integer_t xmin; /**< min valid pixels' x-coord in pixmap (from bounding box
                  carried over from driz_param_t) rounded to int */
-    int xmax; /**< max valid pixels' x-coord in pixmap (from bounding box
+    integer_t xmax; /**< max valid pixels' x-coord in pixmap (from bounding box
                  carried over from driz_param_t) rounded to int */
-    int ymin; /**< min valid pixels' y-coord in pixmap (from bounding box
+    integer_t ymin; /**< min valid pixels' y-coord in pixmap (from bounding box
                  carried over from driz_param_t) rounded to int */
-    int ymax; /**< max valid pixels' y-coord in pixmap (from bounding box
+    integer_t ymax; /**< max valid pixels' y-coord in pixmap (from bounding box
                  carried over from driz_param_t) rounded to int */
     // overlap_valid: 1 if polygon intersection and coord inversion worked;
     //                0 if computation of xmin, xmax, ymin, ymax has
@@ -93,18 +93,91 @@ struct scanner {
     //                  driz_param_t.
     int overlap_valid; /**< 1 if x/y min/max updated from polygon intersection
                           and 0 if carried over from driz_param_t */
+    const integer_t (*row_spans)[2]; /**< valid pixels of each row or NULL;
+                                        carried over from driz_param_t */
 };
 
+/** image scanner structure.
+ *
+ *  Result of init_image_scanner, which depends only on the pixel map, the
+ *  input section, the output grid and the kernel, saved to be reused by
+ *  later calls with the same parameters.
+ *
+ */
+struct image_scanner_t {
+    struct scanner s; /**< initialized scanner */
+    integer_t ymin;   /**< first input row to scan */
+    integer_t ymax;   /**< last input row to scan */
+    int status;       /**< return value of init_image_scanner */
+};
+
+/** footprint index structure.
+ *
+ *  Uniform grid index of polygons (footprints of input images in the output
+ *  frame) over the tiles of an output grid, in compressed sparse row
+ *  format: entries indptr[t] to indptr[t + 1] - 1 hold the numbers of the
+ *  footprints that overlap tile t = iy * ntx + ix, in increasing order, and
+ *  the areas, in output pixels, of the overlaps.
+ *
+ */
+struct footprint_index_t {
+    integer_t nx, ny;       /**< shape of the output grid */
+    integer_t tx, ty;       /**< shape of the tiles */
+    integer_t ntx, nty;     /**< number of tiles along each axis */
+    integer_t nnz;          /**< number of footprint-tile overlaps */
+    integer_t *indptr;      /**< tile offsets, ntx * nty + 1 elements */
+    integer_t *footprints;  /**< footprint numbers */
+    double *areas;          /**< areas of the overlaps */
+};
+
+/**
+ *  Coarse pixel map: pixmap[J, I] holds the output coordinates of input
+ *  pixel (I * step, J * step). The map is interpolated bicubically and, so
+ *  that interpolation along y is done once per row of the image rather than
+ *  once per pixel, the nodes interpolated along y at the last few input y
+ *  coordinates are cached.
+ *
+ */
+#define COARSE_PIXMAP_ROWS 4
+
+struct coarse_pixmap_t {
+    integer_t step;                   /**< spacing of the nodes in pixels */
+    integer_t nx, ny;                 /**< number of nodes along x and y */
+    integer_t ncomp;                  /**< number of components (2 or 3) */
+    integer_t next;                   /**< cached row to be replaced next */
+    integer_t last;                   /**< cached row used last */
+    double y[COARSE_PIXMAP_ROWS];     /**< input y of the cached rows */
+    double *rows[COARSE_PIXMAP_ROWS]; /**< (nx + 2) * ncomp values each */
+    double *weights; /**< weights at half-pixel offsets, 4 * 2 * step */
+};
+
+struct coarse_pixmap_t *coarse_pixmap_new(PyArrayObject *pixmap,
+                                          integer_t step,
+                                          struct driz_error_t *error);
+
+void coarse_pixmap_free(struct coarse_pixmap_t *c);
+
+int coarse_pixmap_covers(PyArrayObject *pixmap, integer_t step,
+                         const integer_t size[2]);
+
 int interpolate_point(struct driz_param_t *par, double xin, double yin,
                       double *xout, double *yout);
 
+int interpolate_lambda(struct driz_param_t *par, double xin, double yin,
+                       double *lout);
+
 int map_point(struct driz_param_t *par, double xin, double yin, double *xout,
               double *yout);
 
-int map_pixel(PyArrayObject *pixmap, int i, int j, double *x, double *y);
+int map_pixel(struct driz_param_t *par, integer_t i, integer_t j, double *x,
+              double *y);
+
+int shrink_image_section(PyArrayObject *pixmap, integer_t *xmin,
+                         integer_t *xmax, integer_t *ymin, integer_t *ymax);
 
-int shrink_image_section(PyArrayObject *pixmap, int *xmin, int *xmax, int *ymin,
-                         int *ymax);
+int shrink_pixmap_section(PyArrayObject *pixmap, integer_t step,
+                          integer_t *xmin, integer_t *xmax, integer_t *ymin,
+                          integer_t *ymax);
 
 int invert_pixmap(struct driz_param_t *par, double xout, double yout,
                   double *xin, double *yin);
@@ -115,9 +188,19 @@ int clip_polygon_to_window(const struct polygon *p, const struct polygon *wnd,
 int init_scanner(struct polygon *p, struct driz_param_t *par,
                  struct scanner *s);
 
-int get_scanline_limits(struct scanner *s, int y, int *x1, int *x2);
+int get_scanline_limits(struct scanner *s, integer_t y, integer_t *x1,
+                        integer_t *x2);
+
+int init_image_scanner(struct driz_param_t *par, struct scanner *s,
+                       integer_t *ymin, integer_t *ymax);
+
+double polygon_area(const struct polygon *p);
+
+int footprint_index_init(struct footprint_index_t *idx, const double *vertices,
+                         integer_t nfp, int npv, integer_t nx, integer_t ny,
+                         integer_t tx, integer_t ty,
+                         struct driz_error_t *error);
 
-int init_image_scanner(struct driz_param_t *par, struct scanner *s, int *ymin,
-                       int *ymax);
+void footprint_index_free(struct footprint_index_t *idx);
 
 #endif /* CDRIZZLEMAP_H */
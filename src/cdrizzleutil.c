@@ -3,6 +3,7 @@
 #include "cdrizzlemap.h"
 #include "cdrizzleutil.h"
 
+#include <pythread.h>
 #include <assert.h>
 #define _USE_MATH_DEFINES /* needed for MS Windows to define M_PI */
 #include <math.h>
@@ -122,15 +123,28 @@ driz_param_init(struct driz_param_t *p) {
 
     p->scale = 1.0;
 
+    /* Output origin */
+    p->out_x0 = 0;
+    p->out_y0 = 0;
+    memset(p->mosaic, 0, sizeof(p->mosaic));
+
     /* Input data */
     p->data = NULL;
     p->weights = NULL;
     p->pixmap = NULL;
+    p->coarse_pixmap = NULL;
+    p->pixmap_affine = NULL;
+    p->row_spans = NULL;
+    p->image_scanner = NULL;
 
     /* Output data */
     p->output_data = NULL;
     p->output_counts = NULL;
     p->output_context = NULL;
+    p->overlaps = NULL;
+    p->adjoint = 0;
+    p->lanczos_lut = NULL;
+    p->progress = NULL;
 
     p->nmiss = 0;
     p->nskip = 0;
@@ -231,6 +245,103 @@ bool2str(bool_t value) {
     return bool_string_table[value ? 1 : 0];
 }
 
+/*****************************************************************
+ THREADING
+*/
+struct parallel_t {
+    void (*func)(void *, int);
+    void *arg;
+    int ntasks;
+    int next;
+    PyThread_type_lock lock; /* protects next */
+};
+
+struct parallel_worker_t {
+    struct parallel_t *par;
+    PyThread_type_lock done; /* held while the worker runs */
+};
+
+static void
+run_parallel_tasks(struct parallel_t *par) {
+    int k;
+
+    for (;;) {
+        PyThread_acquire_lock(par->lock, WAIT_LOCK);
+        k = par->next++;
+        PyThread_release_lock(par->lock);
+        if (k >= par->ntasks) break;
+        par->func(par->arg, k);
+    }
+}
+
+static void
+parallel_worker(void *arg) {
+    struct parallel_worker_t *worker = (struct parallel_worker_t *)arg;
+    run_parallel_tasks(worker->par);
+    PyThread_release_lock(worker->done);
+}
+
+void
+driz_parallel(int nthreads, int ntasks, void (*func)(void *, int),
+              void *arg) {
+    struct parallel_t par;
+    struct parallel_worker_t *workers = NULL;
+    int k, nstarted = 0;
+
+    par.lock = NULL;
+    if (nthreads > ntasks) nthreads = ntasks;
+
+    if (nthreads > 1) {
+        par.lock = PyThread_allocate_lock();
+        workers = (struct parallel_worker_t *)malloc(
+            (nthreads - 1) * sizeof(struct parallel_worker_t));
+    }
+
+    if (nthreads <= 1 || par.lock == NULL || workers == NULL) {
+        if (nthreads > 1) {
+            if (par.lock) PyThread_free_lock(par.lock);
+            free(workers);
+        }
+        for (k = 0; k < ntasks; ++k) {
+            func(arg, k);
+        }
+        return;
+    }
+
+    par.func = func;
+    par.arg = arg;
+    par.ntasks = ntasks;
+    par.next = 0;
+
+    /* Start the helper threads. Should a thread fail to start, the remaining
+       tasks are simply picked up by the threads that did. */
+    for (k = 0; k < nthreads - 1; ++k) {
+        workers[k].par = &par;
+        workers[k].done = PyThread_allocate_lock();
+        if (workers[k].done == NULL) break;
+        PyThread_acquire_lock(workers[k].done, WAIT_LOCK);
+        if (PyThread_start_new_thread(parallel_worker, workers + k) ==
+            PYTHREAD_INVALID_THREAD_ID) {
+            PyThread_release_lock(workers[k].done);
+            PyThread_free_lock(workers[k].done);
+            break;
+        }
+        ++nstarted;
+    }
+
+    run_parallel_tasks(&par);
+
+    /* Wait for the helper threads to finish */
+    for (k = 0; k < nstarted; ++k) {
+        PyThread_acquire_lock(workers[k].done, WAIT_LOCK);
+        PyThread_release_lock(workers[k].done);
+        PyThread_free_lock(workers[k].done);
+    }
+
+    PyThread_free_lock(par.lock);
+    free(workers);
+}
+
 /*****************************************************************
  NUMERICAL UTILITIES
 */
@@ -260,19 +371,38 @@ create_lanczos_lut(const int kernel_order, const size_t npix, const float del,
 
 void
 put_fill(struct driz_param_t *p, const float fill_value) {
-    integer_t i, j, osize[2];
+    integer_t i, j, k, osize[2];
 
     assert(p);
+
+    if (PyArray_NDIM(p->output_data) == 3) {
+        /* Spectral cube */
+        for (k = 0; k < PyArray_DIM(p->output_data, 0); ++k) {
+            for (j = 0; j < PyArray_DIM(p->output_data, 1); ++j) {
+                for (i = 0; i < PyArray_DIM(p->output_data, 2); ++i) {
+                    if (get_pixel3(p->output_counts, i, j, k) == 0.0) {
+                        set_pixel3(p->output_data, i, j, k, fill_value);
+                    }
+                }
+            }
+        }
+        return;
+    }
+
     get_dimensions(p->output_data, osize);
     for (j = 0; j < osize[1]; ++j) {
         for (i = 0; i < osize[0]; ++i) {
             if (oob_pixel(p->output_counts, i, j)) {
                 driz_error_format_message(p->error,
-                                          "OOB in output_counts[%d,%d]", i, j);
+                                          "OOB in output_counts[%" NPY_INTP_FMT
+                                          ",%" NPY_INTP_FMT "]",
+                                          i, j);
                 return;
 
             } else if (oob_pixel(p->output_data, i, j)) {
-                driz_error_format_message(p->error, "OOB in output_data[%d,%d]",
+                driz_error_format_message(p->error,
+                                          "OOB in output_data[%" NPY_INTP_FMT
+                                          ",%" NPY_INTP_FMT "]",
                                           i, j);
                 return;
 
@@ -16,6 +16,7 @@
 #include <stdint.h>
 #endif
 #include <stdlib.h>
+#include <string.h>
 
 /*****************************************************************
  ERROR HANDLING
@@ -72,7 +73,7 @@ void driz_error_unset(struct driz_error_t *error);
 /*****************************************************************
  DATA TYPES
 */
-typedef int integer_t;
+typedef npy_intp integer_t; /* pixel indices and counters */
 #if __STDC_VERSION__ >= 199901L
 typedef int_fast8_t bool_t;
 #else
@@ -104,6 +105,25 @@ enum e_interp_t {
     interp_LAST
 };
 
+/* Progress reporting and cancellation of long kernel calls. Kernels check
+   the state once per row, with the GIL released: calls stop, with the
+   error message set and 'cancelled' set to 1, as soon as *cancel, read
+   atomically, is non-zero or callback() returns non-zero. callback() is
+   called every 'every' rows with the number of rows done and the total
+   number of rows; it is responsible for acquiring the GIL if it needs it. */
+struct driz_progress_t {
+    const npy_int32 *cancel; /* cancellation flag, or NULL */
+    int (*callback)(void *arg, integer_t done, integer_t total);
+    void *arg;       /* first argument of callback() */
+    integer_t every; /* rows between calls of callback(); 0 for automatic */
+    integer_t next;  /* rows done at the next call of callback() */
+    int cancelled;   /* set when the call was cancelled */
+};
+
+/* Lanczos drizzle kernel look-up table size and sampling */
+#define LANCZOS_LUT_SIZE 512
+#define LANCZOS_LUT_STEP 0.01f
+
 /* Lanczos values */
 struct lanczos_param_t {
     size_t nlut;
@@ -135,6 +155,17 @@ struct driz_param_t {
     integer_t ymin;
     integer_t ymax;
 
+    /* Output origin: pixel map coordinates of the first output pixel, used
+       when the output is a tile of a larger mosaic */
+    integer_t out_x0;
+    integer_t out_y0;
+
+    /* Extent (x0, y0, nx, ny), in pixel map coordinates, of the mosaic of
+       which the output is a tile, or all zeros when the output is not a
+       tile. Input pixels are then selected as when drizzling onto the whole
+       mosaic, so that tiles add up to it. */
+    integer_t mosaic[4];
+
     /* Blotting-specific parameters */
     enum e_interp_t interpolation; /* was INTERP */
     float ef;
@@ -147,11 +178,44 @@ struct driz_param_t {
     PyArrayObject *weights;
     PyArrayObject *pixmap;
 
+    /* Interpolation state of a coarse pixel map (a pixmap sampled every
+       few input pixels), or NULL when pixmap maps every input pixel */
+    struct coarse_pixmap_t *coarse_pixmap;
+
+    /* Affine transformation applied to the output coordinates read from
+       the pixel map, x' = a[0][0] x + a[0][1] y + a[0][2] (and similarly
+       for y'), or NULL */
+    const double (*pixmap_affine)[3];
+
+    /* Columns of the first and last pixels of each input row with a valid
+       (finite) pixel map, or NULL when unknown (see PreparedPixmap) */
+    const integer_t (*row_spans)[2];
+
+    /* Image scanner computed beforehand for the same pixel map, input
+       section and output grid, or NULL to compute it in the kernels */
+    const struct image_scanner_t *image_scanner;
+
     /* Output images */
     PyArrayObject *output_data;
     PyArrayObject *output_counts;  /* was: COU */
     PyArrayObject *output_context; /* was: CONTIM */
 
+    /* Sparse overlap matrix: when set, the kernels record the overlaps
+       between input and output pixels instead of drizzling the data */
+    struct overlap_matrix_t *overlaps;
+
+    /* Adjoint mode: the kernels gather output_data back onto the input grid,
+       adding to data the transpose of the weighted flux they would deposit */
+    bool_t adjoint;
+
+    /* Lanczos kernel look-up table (LANCZOS_LUT_SIZE values spaced by
+       LANCZOS_LUT_STEP) computed in advance, or NULL to let the kernel
+       compute it */
+    const float *lanczos_lut;
+
+    /* Progress reporting and cancellation, or NULL */
+    struct driz_progress_t *progress;
+
     /* Other output */
     integer_t nmiss;
     integer_t nskip;
@@ -242,6 +306,74 @@ driz_log_idem(void *ptr) {
 
 /* New numpy based accessors */
 
+/* Input arrays may be in non-native byte order, e.g., big-endian FITS data
+   memory-mapped on a little-endian machine. Their values are swapped when
+   they are fetched rather than making byteswapped copies of whole arrays. */
+
+static inline_macro float
+load_float(const void *ptr, int swapped) {
+    npy_uint32 u;
+    float value;
+
+    if (!swapped) return *(const float *)ptr;
+
+    memcpy(&u, ptr, sizeof(u));
+    u = (u >> 24) | ((u >> 8) & 0x0000ff00u) | ((u << 8) & 0x00ff0000u) |
+        (u << 24);
+    memcpy(&value, &u, sizeof(value));
+    return value;
+}
+
+static inline_macro double
+load_double(const void *ptr, int swapped) {
+    npy_uint64 u;
+    double value;
+
+    if (!swapped) return *(const double *)ptr;
+
+    memcpy(&u, ptr, sizeof(u));
+    u = (u >> 56) | ((u >> 40) & 0x000000000000ff00ull) |
+        ((u >> 24) & 0x0000000000ff0000ull) |
+        ((u >> 8) & 0x00000000ff000000ull) |
+        ((u << 8) & 0x000000ff00000000ull) |
+        ((u << 24) & 0x0000ff0000000000ull) |
+        ((u << 40) & 0x00ff000000000000ull) | (u << 56);
+    memcpy(&value, &u, sizeof(value));
+    return value;
+}
+
+static inline_macro npy_uint16
+load_uint16(const void *ptr, int swapped) {
+    npy_uint16 u;
+
+    memcpy(&u, ptr, sizeof(u));
+    return swapped ? (npy_uint16)((u >> 8) | (u << 8)) : u;
+}
+
+/* Input images (data and weights) may also be float64, int16 or uint16:
+   their values are converted to float when they are fetched. Arrays of any
+   other type are converted to float32 arrays by the Python interface. */
+
+static inline_macro int
+is_input_type(int type) {
+    return type == NPY_FLOAT || type == NPY_DOUBLE || type == NPY_INT16 ||
+           type == NPY_UINT16;
+}
+
+static inline_macro float
+load_input(const void *ptr, int type, int swapped) {
+    switch (type) {
+        case NPY_DOUBLE:
+            return (float)load_double(ptr, swapped);
+        case NPY_INT16:
+            return (float)(npy_int16)load_uint16(ptr, swapped);
+        case NPY_UINT16:
+            return (float)load_uint16(ptr, swapped);
+        default:
+            return load_float(ptr, swapped);
+    }
+}
+
 static inline_macro void
 get_dimensions(PyArrayObject *image, integer_t size[2]) {
     npy_intp *ndim = PyArray_DIMS(image);
@@ -258,15 +390,30 @@ get_pixmap(PyArrayObject *pixmap, integer_t xpix, integer_t ypix) {
     return (double *)PyArray_GETPTR3(pixmap, ypix, xpix, 0);
 }
 
+/* Component k of the pixel map at (xpix, ypix), in any byte order. Pixel
+   maps may be stored in single precision; values are widened to double. */
+static inline_macro double
+get_pixmap_value(PyArrayObject *pixmap, integer_t xpix, integer_t ypix,
+                 integer_t k) {
+    const void *ptr = PyArray_GETPTR3(pixmap, ypix, xpix, k);
+
+    if (PyArray_TYPE(pixmap) == NPY_FLOAT) {
+        return (double)load_float(ptr, PyArray_ISBYTESWAPPED(pixmap));
+    }
+    return load_double(ptr, PyArray_ISBYTESWAPPED(pixmap));
+}
+
 #if defined(LOGGING) && defined(CHECK_OOB)
 
 static inline_macro int
 oob_pixel(PyArrayObject *image, integer_t xpix, integer_t ypix) {
-    char buffer[64];
+    char buffer[128];
     npy_intp *ndim = PyArray_DIMS(image);
     if ((xpix < 0 || xpix >= ndim[1]) || (ypix < 0 || ypix >= ndim[0])) {
-        sprintf(buffer, "Point [%d,%d] is outside of [%d, %d]", xpix, ypix,
-                (int)ndim[1], (int)ndim[0]);
+        sprintf(buffer,
+                "Point [%" NPY_INTP_FMT ",%" NPY_INTP_FMT
+                "] is outside of [%" NPY_INTP_FMT ", %" NPY_INTP_FMT "]",
+                xpix, ypix, ndim[1], ndim[0]);
         driz_log_message(buffer);
         return 1;
     }
@@ -285,11 +432,19 @@ get_pixel(PyArrayObject *image, integer_t xpix, integer_t ypix) {
     return *(float *)PyArray_GETPTR2(image, ypix, xpix);
 }
 
+/* Pixel of an input image (data or weights), of any input type and in any
+   byte order */
+static inline_macro float
+get_input_value(PyArrayObject *image, integer_t xpix, integer_t ypix) {
+    return load_input(PyArray_GETPTR2(image, ypix, xpix), PyArray_TYPE(image),
+                      PyArray_ISBYTESWAPPED(image));
+}
+
+/* Pixel of an input image at the flat (C order) index pos */
 static inline_macro float
 get_pixel_at_pos(PyArrayObject *image, integer_t pos) {
-    float *imptr;
-    imptr = (float *)PyArray_DATA(image);
-    return imptr[pos];
+    integer_t nx = PyArray_DIM(image, 1);
+    return get_input_value(image, pos % nx, pos / nx);
 }
 
 static inline_macro void
@@ -298,24 +453,45 @@ set_pixel(PyArrayObject *image, integer_t xpix, integer_t ypix, double value) {
     return;
 }
 
+static inline_macro float
+get_pixel3(PyArrayObject *cube, integer_t xpix, integer_t ypix,
+           integer_t zpix) {
+    return *(float *)PyArray_GETPTR3(cube, zpix, ypix, xpix);
+}
+
+static inline_macro void
+set_pixel3(PyArrayObject *cube, integer_t xpix, integer_t ypix, integer_t zpix,
+           double value) {
+    *(float *)PyArray_GETPTR3(cube, zpix, ypix, xpix) = value;
+    return;
+}
+
 static inline_macro int
 get_bit(PyArrayObject *image, integer_t xpix, integer_t ypix,
         integer_t bitval) {
-    integer_t value;
-    value = *(integer_t *)PyArray_GETPTR2(image, ypix, xpix) & bitval;
+    npy_int32 value;
+    value =
+        *(npy_int32 *)PyArray_GETPTR2(image, ypix, xpix) & (npy_int32)bitval;
     return value ? 1 : 0;
 }
 
 static inline_macro void
 set_bit(PyArrayObject *image, integer_t xpix, integer_t ypix,
         integer_t bitval) {
-    *(integer_t *)PyArray_GETPTR2(image, ypix, xpix) |= bitval;
+    *(npy_int32 *)PyArray_GETPTR2(image, ypix, xpix) |= (npy_int32)bitval;
+    return;
+}
+
+static inline_macro void
+set_bit3(PyArrayObject *cube, integer_t xpix, integer_t ypix, integer_t zpix,
+         integer_t bitval) {
+    *(npy_int32 *)PyArray_GETPTR3(cube, zpix, ypix, xpix) |= (npy_int32)bitval;
     return;
 }
 
 static inline_macro void
 unset_bit(PyArrayObject *image, integer_t xpix, integer_t ypix) {
-    *(integer_t *)PyArray_GETPTR2(image, ypix, xpix) = 0;
+    *(npy_int32 *)PyArray_GETPTR2(image, ypix, xpix) = 0;
     return;
 }
 
@@ -339,6 +515,24 @@ const char *interp_enum2str(enum e_interp_t value);
 
 const char *bool2str(bool_t value);
 
+/*****************************************************************
+ THREADING
+*/
+/**
+Run func(arg, k) for every task k = 0, ..., ntasks - 1 on up to nthreads
+threads, the calling thread included. Tasks are claimed in increasing order
+as threads become free. Threads are started with the Python thread API, so
+no extra libraries are needed; callers should release the GIL around this
+call, and tasks must not call into Python.
+
+@param nthreads the maximum number of threads to use (values < 1 mean 1)
+@param ntasks the number of tasks
+@param func the task function
+@param arg the argument passed to every task
+*/
+void driz_parallel(int nthreads, int ntasks, void (*func)(void *, int),
+                   void *arg);
+
 /*****************************************************************
  NUMERICAL UTILITIES
 */
@@ -444,4 +638,38 @@ rad3(const double x, const double y, const double *co,
     *yo = f * y;
 }
 
+/**
+Report progress and check for cancellation at the start of a row of a
+kernel loop.
+
+@param p The drizzle parameters
+
+@param done The number of rows done
+
+@param total The total number of rows
+
+@return 1 if the call has been cancelled (the error message is then set)
+and 0 otherwise
+*/
+static inline_macro int
+driz_check_progress(struct driz_param_t *p, integer_t done,
+                    integer_t total) {
+    struct driz_progress_t *pr = p->progress;
+
+    if (!pr) return 0;
+
+    if (pr->cancel && driz_atomic_load_relaxed(pr->cancel)) {
+        pr->cancelled = 1;
+    } else if (pr->callback && done >= pr->next) {
+        if (pr->every <= 0) pr->every = MAX(1, total / 100);
+        pr->next = done + pr->every;
+        pr->cancelled = pr->callback(pr->arg, done, total) != 0;
+    }
+
+    if (pr->cancelled) {
+        driz_error_set_message(p->error, "Drizzle operation cancelled");
+    }
+    return pr->cancelled;
+}
+
 #endif /* CDRIZZLEUTIL_H */
@@ -0,0 +1,236 @@
+#include <math.h>
+#include <string.h>
+#include <Python.h>
+#ifndef NPY_NO_DEPRECATED_API
+#define NPY_NO_DEPRECATED_API NPY_1_10_API_VERSION
+#endif
+#include <numpy/npy_math.h>
+#include <numpy/arrayobject.h>
+
+#include "driz_portability.h"
+#include "cdrizzleutil.h"
+#include "cdrizzlewcs.h"
+
+static const double D2R = 0.017453292519943295;
+static const double R2D = 57.295779513082323;
+
+/* Convergence tolerance (pixels) and iteration limit of the inversion of
+   the SIP polynomials. */
+static const double SIP_INV_TOL = 1.0e-11;
+static const int SIP_INV_MAXITER = 30;
+
+/* Celestial unit vector of native spherical coordinates (phi, theta) of a
+   projection with reference point (alpha_p, delta_p) and native longitude
+   of the celestial pole phi_p (Calabretta & Greisen 2002, eq. 2). */
+static void
+native_to_celestial(double phi, double theta, double alpha_p, double delta_p,
+                    double phi_p, double c[3]) {
+    double dphi, alpha, delta;
+
+    dphi = (phi - phi_p) * D2R;
+    theta *= D2R;
+    delta_p *= D2R;
+    alpha = alpha_p * D2R +
+            atan2(-cos(theta) * sin(dphi),
+                  sin(theta) * cos(delta_p) -
+                      cos(theta) * sin(delta_p) * cos(dphi));
+    delta = asin(sin(theta) * sin(delta_p) +
+                 cos(theta) * cos(delta_p) * cos(dphi));
+    c[0] = cos(delta) * cos(alpha);
+    c[1] = cos(delta) * sin(alpha);
+    c[2] = sin(delta);
+}
+
+int
+sip_wcs_init(struct sip_wcs_t *wcs, double crval1, double crval2,
+             double lonpole, struct driz_error_t *error) {
+    double det, c[3];
+    int i;
+
+    det = wcs->cd[0][0] * wcs->cd[1][1] - wcs->cd[0][1] * wcs->cd[1][0];
+    if (det == 0.0 || !isfinite(det)) {
+        driz_error_set_message(error, "WCS CD matrix is singular");
+        return 1;
+    }
+    wcs->icd[0][0] = wcs->cd[1][1] / det;
+    wcs->icd[0][1] = -wcs->cd[0][1] / det;
+    wcs->icd[1][0] = -wcs->cd[1][0] / det;
+    wcs->icd[1][1] = wcs->cd[0][0] / det;
+
+    /* Columns of the rotation: celestial images of the native x, y and z
+       (pole) axes. */
+    native_to_celestial(0.0, 0.0, crval1, crval2, lonpole, c);
+    for (i = 0; i < 3; ++i) wcs->rot[i][0] = c[i];
+    native_to_celestial(90.0, 0.0, crval1, crval2, lonpole, c);
+    for (i = 0; i < 3; ++i) wcs->rot[i][1] = c[i];
+    native_to_celestial(0.0, 90.0, crval1, crval2, lonpole, c);
+    for (i = 0; i < 3; ++i) wcs->rot[i][2] = c[i];
+
+    return 0;
+}
+
+/* Value of a SIP polynomial sum_{p+q<=order} coef[p][q] u^p v^q and,
+   optionally, its partial derivatives. */
+static double
+sip_poly(const double coef[SIP_MAX_ORDER + 1][SIP_MAX_ORDER + 1], int order,
+         double u, double v, double *du, double *dv) {
+    double upow[SIP_MAX_ORDER + 1], vpow[SIP_MAX_ORDER + 1];
+    double f = 0.0, fu = 0.0, fv = 0.0;
+    int p, q;
+
+    upow[0] = vpow[0] = 1.0;
+    for (p = 1; p <= order; ++p) {
+        upow[p] = upow[p - 1] * u;
+        vpow[p] = vpow[p - 1] * v;
+    }
+
+    for (p = 0; p <= order; ++p) {
+        for (q = 0; q <= order - p; ++q) {
+            if (coef[p][q] == 0.0) continue;
+            f += coef[p][q] * upow[p] * vpow[q];
+            if (du) {
+                if (p) fu += p * coef[p][q] * upow[p - 1] * vpow[q];
+                if (q) fv += q * coef[p][q] * upow[p] * vpow[q - 1];
+            }
+        }
+    }
+
+    if (du) {
+        *du = fu;
+        *dv = fv;
+    }
+    return f;
+}
+
+/* Celestial unit vector of pixel (x, y). */
+static void
+pixel_to_vector(const struct sip_wcs_t *wcs, double x, double y,
+                double c[3]) {
+    double u, v, up, vp, xi, eta, n[3], norm;
+    int i;
+
+    u = x + 1.0 - wcs->crpix[0];
+    v = y + 1.0 - wcs->crpix[1];
+    if (wcs->a_order) {
+        up = u + sip_poly(wcs->a, wcs->a_order, u, v, NULL, NULL);
+        vp = v + sip_poly(wcs->b, wcs->a_order, u, v, NULL, NULL);
+    } else {
+        up = u;
+        vp = v;
+    }
+
+    /* Intermediate world coordinates (radians) and their gnomonic
+       deprojection: x = R sin(phi), y = -R cos(phi), R = cot(theta). */
+    xi = (wcs->cd[0][0] * up + wcs->cd[0][1] * vp) * D2R;
+    eta = (wcs->cd[1][0] * up + wcs->cd[1][1] * vp) * D2R;
+    norm = 1.0 / sqrt(1.0 + xi * xi + eta * eta);
+    n[0] = -eta * norm;
+    n[1] = xi * norm;
+    n[2] = norm;
+
+    for (i = 0; i < 3; ++i) {
+        c[i] = wcs->rot[i][0] * n[0] + wcs->rot[i][1] * n[1] +
+               wcs->rot[i][2] * n[2];
+    }
+}
+
+/* Solve u + A(u, v) = up, v + B(u, v) = vp by Newton iterations starting
+   from the inverse (AP, BP) polynomials, when available. */
+static int
+invert_sip(const struct sip_wcs_t *wcs, double up, double vp, double *u,
+           double *v) {
+    double f, g, fu, fv, gu, gv, det, du, dv;
+    int it;
+
+    *u = up;
+    *v = vp;
+    if (wcs->ap_order) {
+        *u += sip_poly(wcs->ap, wcs->ap_order, up, vp, NULL, NULL);
+        *v += sip_poly(wcs->bp, wcs->ap_order, up, vp, NULL, NULL);
+    }
+
+    for (it = 0; it < SIP_INV_MAXITER; ++it) {
+        f = *u + sip_poly(wcs->a, wcs->a_order, *u, *v, &fu, &fv) - up;
+        g = *v + sip_poly(wcs->b, wcs->a_order, *u, *v, &gu, &gv) - vp;
+        fu += 1.0;
+        gv += 1.0;
+        det = fu * gv - fv * gu;
+        if (det == 0.0) break;
+        du = (gv * f - fv * g) / det;
+        dv = (fu * g - gu * f) / det;
+        *u -= du;
+        *v -= dv;
+        if (fabs(du) < SIP_INV_TOL && fabs(dv) < SIP_INV_TOL) return 0;
+        if (!isfinite(*u) || !isfinite(*v)) break;
+    }
+
+    return 1;
+}
+
+int
+sip_wcs_map(const struct sip_wcs_t *wcs_from, const struct sip_wcs_t *wcs_to,
+            double x, double y, double *xout, double *yout) {
+    double c[3], n[3], xi, eta, up, vp, u, v;
+    int i;
+
+    pixel_to_vector(wcs_from, x, y, c);
+
+    /* Native vector of the target projection: rot is orthogonal. */
+    for (i = 0; i < 3; ++i) {
+        n[i] = wcs_to->rot[0][i] * c[0] + wcs_to->rot[1][i] * c[1] +
+               wcs_to->rot[2][i] * c[2];
+    }
+    if (!(n[2] > 0.0)) goto _fail;
+
+    xi = R2D * n[1] / n[2];
+    eta = -R2D * n[0] / n[2];
+    up = wcs_to->icd[0][0] * xi + wcs_to->icd[0][1] * eta;
+    vp = wcs_to->icd[1][0] * xi + wcs_to->icd[1][1] * eta;
+
+    if (wcs_to->a_order) {
+        if (invert_sip(wcs_to, up, vp, &u, &v)) goto _fail;
+    } else {
+        u = up;
+        v = vp;
+    }
+
+    *xout = u + wcs_to->crpix[0] - 1.0;
+    *yout = v + wcs_to->crpix[1] - 1.0;
+    return 0;
+
+_fail:
+    *xout = *yout = NPY_NAN;
+    return 1;
+}
+
+void
+sip_pixmap_rows(const struct sip_wcs_t *wcs_from,
+                const struct sip_wcs_t *wcs_to, PyArrayObject *pixmap,
+                integer_t step, integer_t row0, integer_t row_start,
+                integer_t row_end) {
+    integer_t i, j, nx;
+    double xo, yo;
+    char *ptr;
+    npy_intp *strides;
+    int is_float;
+
+    nx = PyArray_DIM(pixmap, 1);
+    strides = PyArray_STRIDES(pixmap);
+    is_float = PyArray_TYPE(pixmap) == NPY_FLOAT;
+
+    for (j = row_start; j < row_end; ++j) {
+        for (i = 0; i < nx; ++i) {
+            sip_wcs_map(wcs_from, wcs_to, (double)(i * step),
+                        (double)((row0 + j) * step), &xo, &yo);
+            ptr = (char *)PyArray_DATA(pixmap) + j * strides[0] +
+                  i * strides[1];
+            if (is_float) {
+                *(float *)ptr = (float)xo;
+                *(float *)(ptr + strides[2]) = (float)yo;
+            } else {
+                *(double *)ptr = xo;
+                *(double *)(ptr + strides[2]) = yo;
+            }
+        }
+    }
+}
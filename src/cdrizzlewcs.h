@@ -0,0 +1,60 @@
+#ifndef CDRIZZLEWCS_H
+#define CDRIZZLEWCS_H
+
+#include "cdrizzleutil.h"
+
+/**
+Native evaluation of pixel maps between two celestial WCS that use the
+gnomonic (TAN) projection with a linear (CD matrix) transformation and,
+optionally, SIP distortion polynomials: the common case of HST and JWST
+images and of resampled (output) images.
+
+Pixel coordinates are zero-based, like in the rest of drizzle; CRPIX and
+SIP polynomials follow the (one-based) FITS conventions.
+*/
+
+#define SIP_MAX_ORDER 9
+
+struct sip_wcs_t {
+    double crpix[2];   /* reference pixel (FITS, one-based) */
+    double cd[2][2];   /* linear transformation, degrees per pixel */
+    double icd[2][2];  /* inverse of cd */
+    double rot[3][3];  /* rotation of native to celestial unit vectors */
+    int a_order;       /* order of the A and B polynomials, 0 if none */
+    int ap_order;      /* order of the AP and BP polynomials, 0 if none */
+    double a[SIP_MAX_ORDER + 1][SIP_MAX_ORDER + 1]; /* a[p][q]: u^p v^q */
+    double b[SIP_MAX_ORDER + 1][SIP_MAX_ORDER + 1];
+    double ap[SIP_MAX_ORDER + 1][SIP_MAX_ORDER + 1];
+    double bp[SIP_MAX_ORDER + 1][SIP_MAX_ORDER + 1];
+};
+
+/**
+Set up the rotation matrix and inverse CD matrix of a WCS from its
+reference coordinates and native longitude of the celestial pole (degrees).
+
+@return Non-zero if the CD matrix is singular.
+*/
+int sip_wcs_init(struct sip_wcs_t *wcs, double crval1, double crval2,
+                 double lonpole, struct driz_error_t *error);
+
+/**
+Map pixel (x, y) of one WCS to pixel coordinates of another through the
+celestial sphere.
+
+@return Non-zero (and NaN coordinates) if the point cannot be projected
+onto the tangent plane of wcs_to or the SIP inversion does not converge.
+*/
+int sip_wcs_map(const struct sip_wcs_t *wcs_from,
+                const struct sip_wcs_t *wcs_to, double x, double y,
+                double *xout, double *yout);
+
+/**
+Compute rows [row_start, row_end) of the pixel map of wcs_from to wcs_to.
+Row j of pixmap maps input pixels (i * step, (row0 + j) * step).
+*/
+void sip_pixmap_rows(const struct sip_wcs_t *wcs_from,
+                     const struct sip_wcs_t *wcs_to, PyArrayObject *pixmap,
+                     integer_t step, integer_t row0, integer_t row_start,
+                     integer_t row_end);
+
+#endif /* CDRIZZLEWCS_H */
@@ -8,3 +8,14 @@
 #endif
 
 #define private
+
+/*
+ * Relaxed atomic load of a 32-bit flag written by another thread: GCC and
+ * Clang builtins, or a volatile read of the aligned flag elsewhere (MSVC
+ * compiles it to a single load).
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define driz_atomic_load_relaxed(ptr) __atomic_load_n((ptr), __ATOMIC_RELAXED)
+#else
+#define driz_atomic_load_relaxed(ptr) (*(const volatile int32_t *)(ptr))
+#endif
@@ -313,7 +313,7 @@ FCT_BGN_FN(utest_cdrizzle) {
         FCT_TEARDOWN_END();
 
         FCT_TEST_BGN(utest_shrink_bbox) {
-            int xmin, xmax, ymin, ymax;
+            integer_t xmin, xmax, ymin, ymax;
             struct driz_param_t *p; /* parameter structure */
 
             p = setup_parameters();
@@ -499,7 +499,8 @@ FCT_BGN_FN(utest_cdrizzle) {
 
         FCT_TEST_BGN(utest_check_line_overlap_01) {
             struct scanner s;
-            int ymin, ymax, shift, status;
+            integer_t ymin, ymax;
+            int shift, status;
 
             /* Test for complete overlap */
 
@@ -527,7 +528,8 @@ FCT_BGN_FN(utest_cdrizzle) {
 
         FCT_TEST_BGN(utest_check_line_overlap_02) {
             struct scanner s;
-            int ymin, ymax, shift, status;
+            integer_t ymin, ymax;
+            int shift, status;
 
             /* Test for half overlap */
 
@@ -555,7 +557,8 @@ FCT_BGN_FN(utest_cdrizzle) {
 
         FCT_TEST_BGN(utest_check_line_overlap_03) {
             struct scanner s;
-            int ymin, ymax, shift, status;
+            integer_t ymin, ymax;
+            int shift, status;
 
             /* Test for negative half overlap */
 
@@ -583,7 +586,8 @@ FCT_BGN_FN(utest_cdrizzle) {
 
         FCT_TEST_BGN(utest_check_image_overlap_02) {
             struct scanner s;
-            int ymin, ymax, shift;
+            integer_t ymin, ymax;
+            int shift;
 
             /* Test for half overlap */
 
@@ -605,7 +609,8 @@ FCT_BGN_FN(utest_cdrizzle) {
 
         FCT_TEST_BGN(utest_check_image_overlap_03) {
             struct scanner s;
-            int ymin, ymax, shift;
+            integer_t ymin, ymax;
+            int shift;
 
             /* Test for negative half overlap */
 